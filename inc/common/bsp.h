@@ -26,6 +26,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "system/hunk.h"
 #include "format/bsp.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #ifndef MIPLEVELS
 #define MIPLEVELS 4
 #endif
@@ -37,6 +41,34 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define VIS_FAST_LONGS(bsp) \
     (((bsp)->visrowsize + sizeof(uint_fast32_t) - 1) / sizeof(uint_fast32_t))
 
+// Vis rows can be scanned 64 clusters at a time. Rows are visrowsize bytes
+// long and not aligned, so words are assembled from little endian halves.
+
+// returns 64 bits of the row starting at byte offset ofs,
+// bit N of the word is cluster ofs * 8 + N
+static inline uint64_t BSP_LoadVisWord(const byte *row, int ofs, int rowsize)
+{
+    byte        buf[8] = { 0 };
+    uint32_t    lo, hi;
+
+    memcpy(buf, row + ofs, rowsize - ofs < 8 ? rowsize - ofs : 8);
+    memcpy(&lo, buf, 4);
+    memcpy(&hi, buf + 4, 4);
+    return LittleLong(lo) | (uint64_t)LittleLong(hi) << 32;
+}
+
+// returns the index of the lowest set bit, word must not be zero
+static inline int BSP_FirstVisBit(uint64_t word)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (int)index;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
 typedef struct mtexinfo_s {  // used internally due to name len probs //ZOID
     csurface_t          c;
     char                name[MAX_TEXNAME];
@@ -285,6 +317,7 @@ typedef struct bsp_s {
 
 	char            *pvs_matrix;
 	char            *pvs2_matrix;
+	char            *phs_matrix;
 	qboolean        pvs_patched;
 
 	// WARNING: the 'name' string is actually longer than this, and the bsp_t structure is allocated larger than sizeof(bsp_t) in BSP_Load
@@ -309,6 +342,10 @@ void BSP_TransformedLightPoint(lightpoint_t *point, vec3_t start, vec3_t end,
 #endif
 
 byte *BSP_ClusterVis(bsp_t *bsp, byte *mask, int cluster, int vis);
+byte *BSP_DecompressVis(bsp_t *bsp, byte *mask, int cluster, int vis);
+const byte *BSP_GetVisRow(bsp_t *bsp, int cluster, int vis);
+int BSP_VisNextCluster(bsp_t *bsp, const byte *row, int cluster);
+qboolean BSP_VisIntersects(bsp_t *bsp, const byte *a, const byte *b);
 mleaf_t *BSP_PointLeaf(mnode_t *node, vec3_t p);
 mmodel_t *BSP_InlineModel(bsp_t *bsp, const char *name);
 
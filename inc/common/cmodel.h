@@ -83,7 +83,7 @@ qboolean    CM_AreasConnected(cm_t *cm, int area1, int area2);
 int         CM_WriteAreaBits(cm_t *cm, byte *buffer, int area);
 int         CM_WritePortalBits(cm_t *cm, byte *buffer);
 void        CM_SetPortalStates(cm_t *cm, byte *buffer, int bytes);
-qboolean    CM_HeadnodeVisible(mnode_t *headnode, byte *visbits);
+qboolean    CM_HeadnodeVisible(mnode_t *headnode, const byte *visbits);
 
 void        CM_WritePortalState(cm_t *cm, qhandle_t f);
 void        CM_ReadPortalState(cm_t *cm, qhandle_t f);
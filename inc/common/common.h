@@ -135,9 +135,7 @@ void        Com_AddConfigFile(const char *name, unsigned flags);
 
 extern cvar_t  *z_perturb;
 
-#ifdef _DEBUG
 extern cvar_t   *developer;
-#endif
 extern cvar_t   *dedicated;
 #if USE_CLIENT
 extern cvar_t   *host_speeds;
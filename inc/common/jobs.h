@@ -0,0 +1,43 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef JOBS_H
+#define JOBS_H
+
+//
+// jobs.h -- worker thread pool for data-parallel loops
+//
+// Job functions run on worker threads and must not call Com_Error,
+// print to console or touch the filesystem. Zone allocations are safe.
+//
+
+#define MAX_JOB_THREADS     16
+
+typedef void (*jobfunc_t)(void *arg, int index);
+
+void    Job_Init(void);
+void    Job_Shutdown(void);
+
+// number of threads that execute jobs, including the calling thread
+int     Job_NumThreads(void);
+
+// calls func(arg, i) for each i in [0, count) and waits for completion.
+// must be called from the main thread. nested calls run serially.
+void    Job_ParallelFor(jobfunc_t func, void *arg, int count);
+
+#endif // JOBS_H
@@ -0,0 +1,46 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef CPU_H
+#define CPU_H
+
+#define CPU_SSE2    (1 << 0)
+#define CPU_AVX2    (1 << 1)
+
+#if (defined __i386__) || (defined __x86_64__) || (defined _M_IX86) || (defined _M_X64)
+
+#define USE_X86_SIMD    1
+
+// returns CPU_* bits supported by both CPU and OS
+unsigned X86_CPUFeatures(void);
+
+#ifdef __GNUC__
+#define X86_TARGET(x)   __attribute__((target(x)))
+#else
+#define X86_TARGET(x)
+#endif
+
+#else
+
+#define USE_X86_SIMD    0
+
+#define X86_CPUFeatures()   0
+
+#endif
+
+#endif // CPU_H
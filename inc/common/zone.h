@@ -45,6 +45,7 @@ typedef enum {
 } memtag_t;
 
 void    Z_Init(void);
+void    Z_InitCvars(void);
 void    Z_Free(void *ptr);
 void    *Z_Realloc(void *ptr, size_t size);
 void    *Z_TagMalloc(size_t size, memtag_t tag) q_malloc;
@@ -0,0 +1,56 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef BC_H
+#define BC_H
+
+//
+// bc.h -- block compressed texture formats
+//
+// Shared between the renderer and the offline texture baker, so this
+// module must not depend on anything but shared.h.
+//
+
+typedef enum {
+    BC_NONE,    // uncompressed RGBA
+    BC_1,       // RGB + 1-bit alpha, 8 bytes per block
+    BC_3,       // RGBA, 16 bytes per block
+    BC_4,       // R, 8 bytes per block
+    BC_5,       // RG, 16 bytes per block
+    BC_7,       // RGBA, 16 bytes per block
+    BC_MAX
+} bcformat_t;
+
+const char  *BC_FormatName(bcformat_t fmt);
+size_t      BC_BlockSize(bcformat_t fmt);
+
+// size of a single level and of a whole mip chain, uncompressed RGBA
+// sizes are returned for BC_NONE
+size_t      BC_LevelSize(bcformat_t fmt, int width, int height);
+size_t      BC_ChainSize(bcformat_t fmt, int width, int height, int levels);
+
+// encodes RGBA image into blocks, partial edge blocks are padded
+// by replicating the last row and column. BC_7 output uses mode 6.
+void        BC_Encode(bcformat_t fmt, byte *out, const byte *in, int width, int height);
+
+// decodes blocks into RGBA image. returns qfalse if some of the blocks
+// use BC7 modes this decoder doesn't support (only mode 6 is), these
+// are left black and the result must not be analyzed.
+qboolean    BC_Decode(bcformat_t fmt, byte *out, const byte *in, int width, int height);
+
+#endif // BC_H
@@ -30,6 +30,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/zone.h"
 #include "common/error.h"
 #include "refresh/refresh.h"
+#include "refresh/bc.h"
 
 #define R_Malloc(size)      Z_TagMalloc(size, TAG_RENDERER)
 #define R_Mallocz(size)     Z_TagMallocz(size, TAG_RENDERER)
@@ -62,11 +63,13 @@ typedef enum {
     IM_TGA,
     IM_JPG,
     IM_PNG,
+    IM_DDS,
     IM_MAX
 } imageformat_t;
 
 typedef struct image_s {
-    list_t          entry;
+    unsigned        hash; // full name hash
+    int             live_index; // position in the list of registered images
     char            name[MAX_QPATH]; // game path
     int             baselen; // without extension
     imagetype_t     type;
@@ -77,6 +80,8 @@ typedef struct image_s {
 	char            filepath[MAX_QPATH]; // actual path loaded, with correct format extension
 	int             is_srgb;
 	uint64_t        last_modified;
+    bcformat_t      bc_format; // BC_NONE if pixels are uncompressed RGBA
+    int             bc_levels; // mip levels stored in compressed pixels
 #if REF_GL
     unsigned        texnum; // gl texture binding
     float           sl, sh, tl, th;
@@ -109,10 +114,15 @@ void IMG_ReloadAll();
 image_t *IMG_Find(const char *name, imagetype_t type, imageflags_t flags);
 void IMG_FreeUnused(void);
 void IMG_FreeAll(void);
+void IMG_FreeImage(image_t *image);
 void IMG_Init(void);
 void IMG_Shutdown(void);
 void IMG_GetPalette(void);
 
+// batched registration, pending images are decoded in parallel
+void IMG_Request(const char *name, imagetype_t type, imageflags_t flags);
+void IMG_LoadRequested(void);
+
 image_t *IMG_ForHandle(qhandle_t h);
 
 void IMG_ResampleTexture(const byte *in, int inwidth, int inheight,
@@ -122,6 +132,8 @@ void IMG_MipMap(byte *out, byte *in, int width, int height);
 // these are implemented in src/refresh/[gl,sw]/images.c
 extern void (*IMG_Unload)(image_t *image);
 extern void (*IMG_Load)(image_t *image, byte *pic);
+// NULL if renderer can't upload block compressed textures
+extern qboolean (*IMG_SupportsCompressed)(void);
 extern byte* (*IMG_ReadPixels)(int *width, int *height, int *rowbytes);
 
 #endif // IMAGES_H
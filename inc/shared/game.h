@@ -25,7 +25,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // game.h -- game dll information visible to server
 //
 
-#define GAME_API_VERSION    3
+#define GAME_API_VERSION    4
+
+// version 3 modules predate LevelAlloc/LevelFree and never touch them,
+// import table is otherwise the same
+#define GAME_API_VERSION_OLD    3
 
 // edict->svflags
 
@@ -182,6 +186,11 @@ typedef struct {
     void (*AddCommandString)(const char *text);
 
     void (*DebugGraph)(float value, int color);
+
+    // level scoped bump allocator, returns zeroed memory. blocks can't be
+    // freed individually, LevelFree releases all of them at once.
+    void *(*LevelAlloc)(size_t size);
+    void (*LevelFree)(void);
 } game_import_t;
 
 //
@@ -24,11 +24,19 @@ typedef struct {
     size_t  maxsize;
     size_t  cursize;
     size_t  mapped;
+    size_t  pagesize;
+    unsigned    faults;     // page faults taken between begin and end
+    unsigned    msec;       // time spent between begin and end
 } memhunk_t;
 
+void    Hunk_Init(void);
 void    Hunk_Begin(memhunk_t *hunk, size_t maxsize);
 void    *Hunk_Alloc(memhunk_t *hunk, size_t size);
 void    Hunk_End(memhunk_t *hunk);
 void    Hunk_Free(memhunk_t *hunk);
 
+// commits pages for the expected amount of data up front, should be
+// called right after Hunk_Begin. no-op unless sys_hugepages is enabled.
+void    Hunk_Prefault(memhunk_t *hunk, size_t size);
+
 #endif // HUNK_H
@@ -0,0 +1,58 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef THREADS_H
+#define THREADS_H
+
+//
+// threads.h -- minimal portable threading primitives
+//
+
+typedef struct qthread_s    qthread_t;
+typedef struct qmutex_s     qmutex_t;
+typedef struct qcond_s      qcond_t;
+
+typedef void (*threadfunc_t)(void *arg);
+
+qthread_t   *Sys_CreateThread(threadfunc_t func, void *arg);
+void        Sys_JoinThread(qthread_t *thread);
+
+qmutex_t    *Sys_CreateMutex(void);
+void        Sys_DestroyMutex(qmutex_t *mutex);
+void        Sys_LockMutex(qmutex_t *mutex);
+void        Sys_UnlockMutex(qmutex_t *mutex);
+
+qcond_t     *Sys_CreateCond(void);
+void        Sys_DestroyCond(qcond_t *cond);
+void        Sys_WaitCond(qcond_t *cond, qmutex_t *mutex);
+void        Sys_SignalCond(qcond_t *cond);
+void        Sys_BroadcastCond(qcond_t *cond);
+
+int         Sys_NumProcessors(void);
+
+// returns the new value
+#ifdef _MSC_VER
+#include <intrin.h>
+#define Sys_AtomicAdd(p, v) \
+    (_InterlockedExchangeAdd((volatile long *)(p), (v)) + (v))
+#else
+#define Sys_AtomicAdd(p, v) \
+    __sync_add_and_fetch((p), (v))
+#endif
+
+#endif // THREADS_H
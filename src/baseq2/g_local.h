@@ -568,7 +568,7 @@ typedef enum {
     F_SHORT,
     F_INT,
     F_FLOAT,
-    F_LSTRING,          // string on disk, pointer in memory, TAG_LEVEL
+    F_LSTRING,          // string on disk, pointer in memory, LevelAlloc
     F_GSTRING,          // string on disk, pointer in memory, TAG_GAME
     F_ZSTRING,          // string on disk, string in memory
     F_VECTOR,
@@ -99,6 +99,7 @@ void ShutdownGame(void)
     gi.dprintf("==== ShutdownGame ====\n");
 
     gi.FreeTags(TAG_LEVEL);
+    gi.LevelFree();
     gi.FreeTags(TAG_GAME);
 }
 
@@ -631,7 +631,7 @@ static char *read_string(FILE *f)
         gi.error("%s: bad length", __func__);
     }
 
-    s = gi.TagMalloc(len + 1, TAG_LEVEL);
+    s = gi.LevelAlloc(len + 1);
     read_data(s, len, f);
     s[len] = 0;
 
@@ -919,6 +919,7 @@ void ReadLevel(const char *filename)
     // free any dynamic memory allocated by loading the level
     // base state
     gi.FreeTags(TAG_LEVEL);
+    gi.LevelFree();
 
     f = fopen(filename, "rb");
     if (!f)
@@ -990,7 +991,6 @@ void ReadLevel(const char *filename)
             ent->message = gi.TagMalloc(CLOCK_MESSAGE_SIZE, TAG_LEVEL);
             if (msg) {
                 Q_strlcpy(ent->message, msg, CLOCK_MESSAGE_SIZE);
-                gi.TagFree(msg);
             }
         }
     }
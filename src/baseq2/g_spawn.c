@@ -382,7 +382,7 @@ static char *ED_NewString(const char *string)
 
     l = strlen(string) + 1;
 
-    newb = gi.TagMalloc(l, TAG_LEVEL);
+    newb = gi.LevelAlloc(l);
 
     new_p = newb;
 
@@ -584,6 +584,7 @@ void SpawnEntities(const char *mapname, const char *entities, const char *spawnp
     SaveClientData();
 
     gi.FreeTags(TAG_LEVEL);
+    gi.LevelFree();
 
     memset(&level, 0, sizeof(level));
     memset(g_edicts, 0, game.maxentities * sizeof(g_edicts[0]));
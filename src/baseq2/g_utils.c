@@ -363,7 +363,7 @@ char *G_CopyString(char *in)
 {
     char    *out;
 
-    out = gi.TagMalloc(strlen(in) + 1, TAG_LEVEL);
+    out = gi.LevelAlloc(strlen(in) + 1);
     strcpy(out, in);
     return out;
 }
@@ -107,6 +107,14 @@ typedef struct centity_s {
 
 extern centity_t    cl_entities[MAX_EDICTS];
 
+// solid entity prepared for collision, with conservative world bounds
+typedef struct {
+    vec3_t      mins, maxs;
+    centity_t   *ent;
+    mnode_t     *headnode;      // NULL for bounding boxes
+    qboolean    rotated;        // trace box rotates with the entity
+} csolid_t;
+
 #define MAX_CLIENTWEAPONMODELS        20        // PGM -- upped from 16 to fit the chainfist vwep
 
 typedef struct clientinfo_s {
@@ -195,10 +203,27 @@ typedef struct client_state_s {
     vec3_t      predicted_velocity;
     vec3_t      prediction_error;
 
+    // prediction results cached per command, replay starts from the last
+    // cached command as long as the server agrees with our prediction
+    pmove_state_t   predicted_states[CMD_BACKUP];
+    vec3_t          predicted_viewangles[CMD_BACKUP];
+    unsigned        predicted_base;     // acknowledged command the cache starts from
+    unsigned        predicted_top;      // last command with cached result
+    unsigned        predicted_solids;   // checksum of solid entities cache was built against
+    struct {
+        int     cached;     // commands taken from cache
+        int     run;        // commands run through Pmove
+        int     traces;     // traces made by Pmove
+    } predicted_stats;      // for debug overlay
+
     // rebuilt each valid frame
     centity_t       *solidEntities[MAX_PACKET_ENTITIES];
     int             numSolidEntities;
 
+    // solid entities sorted by mins[0] for sweep and prune
+    csolid_t        solids[MAX_PACKET_ENTITIES];
+    int             numSolids;
+
     entity_state_t  baselines[MAX_EDICTS];
 
     entity_state_t  entityStates[MAX_PARSE_ENTITIES];
@@ -768,6 +793,7 @@ void CL_InitTEnts(void);
 void CL_PredictAngles(void);
 void CL_PredictMovement(void);
 void CL_CheckPredictionError(void);
+void CL_BuildSolidList(void);
 
 
 //
@@ -778,8 +804,6 @@ void CL_CheckPredictionError(void);
 #define INSTANT_PARTICLE    -10000.0
 
 typedef struct cparticle_s {
-    struct cparticle_s    *next;
-
     float   time;
 
     vec3_t  org;
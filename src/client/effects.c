@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // cl_fx.c -- entity effects parsing and management
 
 #include "client.h"
+#include "common/x86/cpu.h"
 
 static void CL_LogoutEffect(vec3_t org, int type);
 
@@ -825,46 +826,60 @@ PARTICLE MANAGEMENT
 ==============================================================
 */
 
-static cparticle_t  *active_particles, *free_particles;
-
-static cparticle_t  particles[MAX_PARTICLES];
-static const int    cl_numparticles = MAX_PARTICLES;
+// Live particles are kept as structure of arrays, so that integration
+// runs over contiguous floats. Effects fill cparticle_t records returned
+// by CL_AllocParticle, which are moved into the pool by CL_AddParticles.
+// Pool size is bound by renderer limit, vkpt indexes particle quads
+// with 16-bit indices.
+typedef struct {
+    int     count;
+    float   time[MAX_PARTICLES];
+    float   org[3][MAX_PARTICLES];
+    float   vel[3][MAX_PARTICLES];
+    float   accel[3][MAX_PARTICLES];
+    float   alpha[MAX_PARTICLES];
+    float   alphavel[MAX_PARTICLES];
+    int     color[MAX_PARTICLES];
+    color_t rgba[MAX_PARTICLES];
+    float   brightness[MAX_PARTICLES];
+
+    // computed each frame
+    float   pos[3][MAX_PARTICLES];
+    float   fade[MAX_PARTICLES];
+} cparticles_t;
+
+static cparticles_t cl_particles;
+
+static cparticle_t  cl_newparticles[MAX_PARTICLES];
+static int          cl_numnewparticles;
 
 extern uint32_t d_8to24table[256];
 
 cvar_t* cvar_pt_particle_emissive = NULL;
 static cvar_t* cl_particle_num_factor = NULL;
 
+static void CL_InitParticles(void);
+
 void FX_Init(void)
 {
     cvar_pt_particle_emissive = Cvar_Get("pt_particle_emissive", "10.0", 0);
 	cl_particle_num_factor = Cvar_Get("cl_particle_num_factor", "1", 0);
+
+    CL_InitParticles();
 }
 
 static void CL_ClearParticles(void)
 {
-    int     i;
-
-    free_particles = &particles[0];
-    active_particles = NULL;
-
-    for (i = 0; i < cl_numparticles; i++)
-        particles[i].next = &particles[i + 1];
-    particles[cl_numparticles - 1].next = NULL;
+    cl_particles.count = 0;
+    cl_numnewparticles = 0;
 }
 
 cparticle_t *CL_AllocParticle(void)
 {
-    cparticle_t *p;
-
-    if (!free_particles)
+    if (cl_particles.count + cl_numnewparticles >= MAX_PARTICLES)
         return NULL;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
 
-    return p;
+    return &cl_newparticles[cl_numnewparticles++];
 }
 
 /*
@@ -1981,6 +1996,150 @@ void CL_TeleportParticles(vec3_t org)
 extern int          r_numparticles;
 extern particle_t   r_particles[MAX_PARTICLES];
 
+/*
+==============================================================
+
+PARTICLE INTEGRATION
+
+==============================================================
+*/
+
+typedef void (*integratefunc_t)(cparticles_t *p, int start, int end, float now);
+
+static void integrate_c(cparticles_t *p, int start, int end, float now)
+{
+    float   time, time2;
+    int     i, j;
+
+    for (i = start; i < end; i++) {
+        time = (now - p->time[i]) * 0.001f;
+        time2 = time * time;
+
+        for (j = 0; j < 3; j++)
+            p->pos[j][i] = p->org[j][i] + p->vel[j][i] * time + p->accel[j][i] * time2;
+
+        if (p->alphavel[i] != INSTANT_PARTICLE)
+            p->fade[i] = p->alpha[i] + time * p->alphavel[i];
+        else
+            p->fade[i] = p->alpha[i];
+    }
+}
+
+#if USE_X86_SIMD
+
+#include <emmintrin.h>
+
+X86_TARGET("sse2")
+static void integrate_sse2(cparticles_t *p, int start, int end, float now)
+{
+    __m128  vnow = _mm_set1_ps(now);
+    __m128  scale = _mm_set1_ps(0.001f);
+    __m128  instant = _mm_set1_ps(INSTANT_PARTICLE);
+    __m128  time, time2, pos, alphavel, alpha, fade, mask;
+    int     i, j;
+
+    for (i = start; i + 4 <= end; i += 4) {
+        time = _mm_mul_ps(_mm_sub_ps(vnow, _mm_loadu_ps(&p->time[i])), scale);
+        time2 = _mm_mul_ps(time, time);
+
+        for (j = 0; j < 3; j++) {
+            pos = _mm_add_ps(_mm_loadu_ps(&p->org[j][i]),
+                             _mm_mul_ps(_mm_loadu_ps(&p->vel[j][i]), time));
+            pos = _mm_add_ps(pos, _mm_mul_ps(_mm_loadu_ps(&p->accel[j][i]), time2));
+            _mm_storeu_ps(&p->pos[j][i], pos);
+        }
+
+        alpha = _mm_loadu_ps(&p->alpha[i]);
+        alphavel = _mm_loadu_ps(&p->alphavel[i]);
+        fade = _mm_add_ps(alpha, _mm_mul_ps(time, alphavel));
+        mask = _mm_cmpeq_ps(alphavel, instant);
+        fade = _mm_or_ps(_mm_and_ps(mask, alpha), _mm_andnot_ps(mask, fade));
+        _mm_storeu_ps(&p->fade[i], fade);
+    }
+
+    integrate_c(p, i, end, now);
+}
+
+#endif // USE_X86_SIMD
+
+static const struct {
+    const char      *name;
+    unsigned        cpu;
+    integratefunc_t integrate;
+} particle_kernels[] = {
+#if USE_X86_SIMD
+    { "sse2", CPU_SSE2, integrate_sse2 },
+#endif
+    { "c", 0, integrate_c }
+};
+
+static integratefunc_t integrate_particles = integrate_c;
+
+static void CL_InitParticles(void)
+{
+    unsigned features = X86_CPUFeatures();
+    int i;
+
+    for (i = 0; i < q_countof(particle_kernels); i++) {
+        if ((particle_kernels[i].cpu & features) == particle_kernels[i].cpu) {
+            break;
+        }
+    }
+
+    integrate_particles = particle_kernels[i].integrate;
+    Com_DPrintf("Using %s particle kernels\n", particle_kernels[i].name);
+}
+
+// moves particles spawned since last frame into the pool
+static void CL_CommitParticles(void)
+{
+    cparticles_t    *p = &cl_particles;
+    cparticle_t     *src;
+    int             i, j, n;
+
+    for (i = 0, src = cl_newparticles; i < cl_numnewparticles; i++, src++) {
+        n = p->count++;
+        p->time[n] = src->time;
+        for (j = 0; j < 3; j++) {
+            p->org[j][n] = src->org[j];
+            p->vel[j][n] = src->vel[j];
+            p->accel[j][n] = src->accel[j];
+        }
+        p->alpha[n] = src->alpha;
+        p->alphavel[n] = src->alphavel;
+        p->color[n] = src->color;
+        p->rgba[n] = src->rgba;
+        p->brightness[n] = src->brightness;
+    }
+
+    cl_numnewparticles = 0;
+}
+
+// removes particle by moving the last one into its place
+static void CL_RemoveParticle(int i)
+{
+    cparticles_t    *p = &cl_particles;
+    int             j, n;
+
+    n = --p->count;
+    if (i == n)
+        return;
+
+    p->time[i] = p->time[n];
+    for (j = 0; j < 3; j++) {
+        p->org[j][i] = p->org[j][n];
+        p->vel[j][i] = p->vel[j][n];
+        p->accel[j][i] = p->accel[j][n];
+        p->pos[j][i] = p->pos[j][n];
+    }
+    p->alpha[i] = p->alpha[n];
+    p->alphavel[i] = p->alphavel[n];
+    p->color[i] = p->color[n];
+    p->rgba[i] = p->rgba[n];
+    p->brightness[i] = p->brightness[n];
+    p->fade[i] = p->fade[n];
+}
+
 /*
 ===============
 CL_AddParticles
@@ -1988,73 +2147,54 @@ CL_AddParticles
 */
 void CL_AddParticles(void)
 {
-    cparticle_t     *p, *next;
+    cparticles_t    *p = &cl_particles;
     float           alpha;
-    float           time = 0, time2;
-    int             color;
-    cparticle_t     *active, *tail;
+    int             i;
     particle_t      *part;
 
-    active = NULL;
-    tail = NULL;
+    CL_CommitParticles();
 
-    for (p = active_particles; p; p = next) {
-        next = p->next;
+    integrate_particles(p, 0, p->count, cl.time);
 
-        if (p->alphavel != INSTANT_PARTICLE) {
-            time = (cl.time - p->time) * 0.001;
-            alpha = p->alpha + time * p->alphavel;
-            if (alpha <= 0) {
-                // faded out
-                p->next = free_particles;
-                free_particles = p;
-                continue;
-            }
-        } else {
-            alpha = p->alpha;
+    for (i = 0; i < p->count; ) {
+        alpha = p->fade[i];
+        if (alpha <= 0) {
+            // faded out, the last particle takes this slot
+            CL_RemoveParticle(i);
+            continue;
         }
 
-        if (r_numparticles >= MAX_PARTICLES)
-            break;
-        part = &r_particles[r_numparticles++];
-
-        p->next = NULL;
-        if (!tail)
-            active = tail = p;
-        else {
-            tail->next = p;
-            tail = p;
-        }
+        if (r_numparticles < MAX_PARTICLES) {
+            part = &r_particles[r_numparticles++];
 
-        if (alpha > 1.0)
-            alpha = 1;
-        color = p->color;
+            if (alpha > 1.0)
+                alpha = 1;
 
-        time2 = time * time;
+            part->origin[0] = p->pos[0][i];
+            part->origin[1] = p->pos[1][i];
+            part->origin[2] = p->pos[2][i];
 
-        part->origin[0] = p->org[0] + p->vel[0] * time + p->accel[0] * time2;
-        part->origin[1] = p->org[1] + p->vel[1] * time + p->accel[1] * time2;
-        part->origin[2] = p->org[2] + p->vel[2] * time + p->accel[2] * time2;
+            if (p->color[i] == -1) {
+                part->rgba.u8[0] = p->rgba[i].u8[0];
+                part->rgba.u8[1] = p->rgba[i].u8[1];
+                part->rgba.u8[2] = p->rgba[i].u8[2];
+                part->rgba.u8[3] = p->rgba[i].u8[3] * alpha;
+            }
 
-        if (color == -1) {
-            part->rgba.u8[0] = p->rgba.u8[0];
-            part->rgba.u8[1] = p->rgba.u8[1];
-            part->rgba.u8[2] = p->rgba.u8[2];
-            part->rgba.u8[3] = p->rgba.u8[3] * alpha;
+            part->color = p->color[i];
+            part->brightness = p->brightness[i];
+            part->alpha = alpha;
+            part->radius = 0.f;
         }
 
-        part->color = color;
-		part->brightness = p->brightness;
-		part->alpha = alpha;
-		part->radius = 0.f;
-
-        if (p->alphavel == INSTANT_PARTICLE) {
-            p->alphavel = 0.0;
-            p->alpha = 0.0;
+        // instant particles are drawn once
+        if (p->alphavel[i] == INSTANT_PARTICLE) {
+            p->alphavel[i] = 0.0;
+            p->alpha[i] = 0.0;
         }
+
+        i++;
     }
-	
-    active_particles = active;
 }
 
 
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // cl_ents.c -- entity parsing and management
 
 #include "client.h"
+#include "common/jobs.h"
 #include "refresh/models.h"
 
 extern qhandle_t cl_mod_powerscreen;
@@ -394,6 +395,8 @@ void CL_DeltaFrame(void)
         entity_event(state->number);
     }
 
+    CL_BuildSolidList();
+
     if (cls.demo.recording && !cls.demo.paused && !cls.demo.seeking && CL_FRAMESYNC) {
         CL_EmitDemoFrame();
     }
@@ -502,53 +505,61 @@ static int adjust_shell_fx(int renderfx)
 	return renderfx;
 }
 
+// interpolated entity state, computed in parallel before
+// the entities are added to the scene in frame order
+typedef struct {
+    unsigned    effects;
+    unsigned    renderfx;
+    int         frame;
+    vec3_t      origin;
+    vec3_t      oldorigin;
+    vec3_t      angles;
+} lerp_entity_t;
+
+static lerp_entity_t    cl_lerp_entities[MAX_PACKET_ENTITIES];
+
+// entities per job, interpolation alone is too cheap to go finer
+#define LERP_ENTITIES_CHUNK     64
+
 /*
 ===============
-CL_AddPacketEntities
+CL_LerpEntities
 
+Interpolates a chunk of the frame's entities. Runs on job threads,
+so this must not print, spawn effects or touch anything but its own
+centity_t and lerp_entity_t.
 ===============
 */
-static void CL_AddPacketEntities(void)
+static void CL_LerpEntities(void *arg, int index)
 {
-    entity_t            ent;
-    entity_state_t      *s1;
-    float               autorotate;
-    int                 i;
+    int                 first = index * LERP_ENTITIES_CHUNK;
+    int                 last = min(first + LERP_ENTITIES_CHUNK, cl.frame.numEntities);
+    int                 autoanim = *(int *)arg;
     int                 pnum;
+    entity_state_t      *s1;
     centity_t           *cent;
-    int                 autoanim;
-    clientinfo_t        *ci;
+    lerp_entity_t       *lerp;
     unsigned int        effects, renderfx;
 
-    // bonus items rotate at a fixed rate
-    autorotate = anglemod(cl.time * 0.1f);
-
-    // brush models can auto animate their frames
-    autoanim = 2 * cl.time / 1000;
-
-    memset(&ent, 0, sizeof(ent));
-
-    for (pnum = 0; pnum < cl.frame.numEntities; pnum++) {
-        i = (cl.frame.firstEntity + pnum) & PARSE_ENTITIES_MASK;
-        s1 = &cl.entityStates[i];
-
+    for (pnum = first; pnum < last; pnum++) {
+        s1 = &cl.entityStates[(cl.frame.firstEntity + pnum) & PARSE_ENTITIES_MASK];
         cent = &cl_entities[s1->number];
-        ent.id = cent->id + RESERVED_ENTITIY_COUNT;
+        lerp = &cl_lerp_entities[pnum];
 
         effects = s1->effects;
         renderfx = s1->renderfx;
 
         // set frame
         if (effects & EF_ANIM01)
-            ent.frame = autoanim & 1;
+            lerp->frame = autoanim & 1;
         else if (effects & EF_ANIM23)
-            ent.frame = 2 + (autoanim & 1);
+            lerp->frame = 2 + (autoanim & 1);
         else if (effects & EF_ANIM_ALL)
-            ent.frame = autoanim;
+            lerp->frame = autoanim;
         else if (effects & EF_ANIM_ALLFAST)
-            ent.frame = cl.time / 100;
+            lerp->frame = cl.time / 100;
         else
-            ent.frame = s1->frame;
+            lerp->frame = s1->frame;
 
         // quad and pent can do different things on client
         if (effects & EF_PENT) {
@@ -579,34 +590,97 @@ static void CL_AddPacketEntities(void)
         if (cl_noglow->integer)
             renderfx &= ~RF_GLOW;
 
-        ent.oldframe = cent->prev.frame;
-        ent.backlerp = 1.0 - cl.lerpfrac;
+        lerp->effects = effects;
+        lerp->renderfx = renderfx;
 
         if (renderfx & RF_FRAMELERP) {
             // step origin discretely, because the frames
             // do the animation properly
-            VectorCopy(cent->current.origin, ent.origin);
-            VectorCopy(cent->current.old_origin, ent.oldorigin);  // FIXME
+            VectorCopy(cent->current.origin, lerp->origin);
+            VectorCopy(cent->current.old_origin, lerp->oldorigin);  // FIXME
         } else if (renderfx & RF_BEAM) {
             // interpolate start and end points for beams
             LerpVector(cent->prev.origin, cent->current.origin,
-                       cl.lerpfrac, ent.origin);
+                       cl.lerpfrac, lerp->origin);
             LerpVector(cent->prev.old_origin, cent->current.old_origin,
-                       cl.lerpfrac, ent.oldorigin);
+                       cl.lerpfrac, lerp->oldorigin);
+        } else if (s1->number == cl.frame.clientNum + 1) {
+            // use predicted origin
+            VectorCopy(cl.playerEntityOrigin, lerp->origin);
+            VectorCopy(cl.playerEntityOrigin, lerp->oldorigin);
         } else {
-            if (s1->number == cl.frame.clientNum + 1) {
-                // use predicted origin
-                VectorCopy(cl.playerEntityOrigin, ent.origin);
-                VectorCopy(cl.playerEntityOrigin, ent.oldorigin);
-            } else {
-                // interpolate origin
-                LerpVector(cent->prev.origin, cent->current.origin,
-                           cl.lerpfrac, ent.origin);
-                VectorCopy(ent.origin, ent.oldorigin);
+            // interpolate origin
+            LerpVector(cent->prev.origin, cent->current.origin,
+                       cl.lerpfrac, lerp->origin);
+            VectorCopy(lerp->origin, lerp->oldorigin);
+        }
+
+        // interpolate angles, special cases are handled by the caller
+        if (s1->number == cl.frame.clientNum + 1) {
+            VectorCopy(cl.playerEntityAngles, lerp->angles);      // use predicted angles
+        } else {
+            LerpAngles(cent->prev.angles, cent->current.angles,
+                       cl.lerpfrac, lerp->angles);
+
+            // mimic original ref_gl "leaning" bug (uuugly!)
+            if (s1->modelindex == 255 && cl_rollhack->integer) {
+                lerp->angles[ROLL] = -lerp->angles[ROLL];
             }
+        }
+    }
+}
+
+/*
+===============
+CL_AddPacketEntities
+
+===============
+*/
+static void CL_AddPacketEntities(void)
+{
+    entity_t            ent;
+    entity_state_t      *s1;
+    float               autorotate;
+    int                 i;
+    int                 pnum;
+    centity_t           *cent;
+    int                 autoanim;
+    clientinfo_t        *ci;
+    unsigned int        effects, renderfx;
+    lerp_entity_t       *lerp;
+
+    // bonus items rotate at a fixed rate
+    autorotate = anglemod(cl.time * 0.1f);
+
+    // brush models can auto animate their frames
+    autoanim = 2 * cl.time / 1000;
+
+    Job_ParallelFor(CL_LerpEntities, &autoanim,
+                    (cl.frame.numEntities + LERP_ENTITIES_CHUNK - 1) / LERP_ENTITIES_CHUNK);
+
+    memset(&ent, 0, sizeof(ent));
+
+    for (pnum = 0; pnum < cl.frame.numEntities; pnum++) {
+        i = (cl.frame.firstEntity + pnum) & PARSE_ENTITIES_MASK;
+        s1 = &cl.entityStates[i];
+
+        cent = &cl_entities[s1->number];
+        ent.id = cent->id + RESERVED_ENTITIY_COUNT;
+
+        lerp = &cl_lerp_entities[pnum];
+        effects = lerp->effects;
+        renderfx = lerp->renderfx;
+        ent.frame = lerp->frame;
+
+        ent.oldframe = cent->prev.frame;
+        ent.backlerp = 1.0 - cl.lerpfrac;
+
+        VectorCopy(lerp->origin, ent.origin);
+        VectorCopy(lerp->oldorigin, ent.oldorigin);
 
 #if USE_FPS
-            // run alias model animation
+        // run alias model animation
+        if (!(renderfx & (RF_FRAMELERP | RF_BEAM))) {
             if (cent->prev_frame != s1->frame) {
                 int delta = cl.time - cent->anim_start;
                 float frac;
@@ -630,8 +704,8 @@ static void CL_AddPacketEntities(void)
                 ent.oldframe = cent->prev_frame;
                 ent.backlerp = 1.0 - frac;
             }
-#endif
         }
+#endif
 
         if ((effects & EF_GIB) && !cl_gibs->integer) {
             goto skip;
@@ -699,16 +773,8 @@ static void CL_AddPacketEntities(void)
             AngleVectors(ent.angles, forward, NULL, NULL);
             VectorMA(ent.origin, 64, forward, start);
             V_AddLight(start, 100, 1, 0, 0);
-        } else if (s1->number == cl.frame.clientNum + 1) {
-            VectorCopy(cl.playerEntityAngles, ent.angles);      // use predicted angles
-        } else { // interpolate angles
-            LerpAngles(cent->prev.angles, cent->current.angles,
-                       cl.lerpfrac, ent.angles);
-
-            // mimic original ref_gl "leaning" bug (uuugly!)
-            if (s1->modelindex == 255 && cl_rollhack->integer) {
-                ent.angles[ROLL] = -ent.angles[ROLL];
-            }
+        } else {
+            VectorCopy(lerp->angles, ent.angles);
         }
 
         int base_entity_flags = 0;
@@ -71,41 +71,132 @@ void CL_CheckPredictionError(void)
     VectorScale(delta, 0.125f, cl.prediction_error);
 }
 
+static int CL_SolidCompare(const void *p1, const void *p2)
+{
+    const csolid_t *s1 = p1, *s2 = p2;
+
+    if (s1->mins[0] < s2->mins[0])
+        return -1;
+    if (s1->mins[0] > s2->mins[0])
+        return 1;
+    return 0;
+}
+
 /*
 ====================
-CL_ClipMoveToEntities
+CL_BuildSolidList
 
+Computes world space bounds of solid entities and sorts them along X
+axis, so that traces only need to test entities they can touch.
 ====================
 */
-static void CL_ClipMoveToEntities(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, trace_t *tr)
+void CL_BuildSolidList(void)
 {
     int         i;
-    trace_t     trace;
-    mnode_t     *headnode;
     centity_t   *ent;
     mmodel_t    *cmodel;
+    csolid_t    *solid;
+    vec_t       radius;
+
+    cl.numSolids = 0;
 
     for (i = 0; i < cl.numSolidEntities; i++) {
         ent = cl.solidEntities[i];
+        solid = &cl.solids[cl.numSolids];
 
         if (ent->current.solid == PACKED_BSP) {
             // special value for bmodel
             cmodel = cl.model_clip[ent->current.modelindex];
             if (!cmodel)
                 continue;
-            headnode = cmodel->headnode;
+            solid->headnode = cmodel->headnode;
+            solid->rotated = ent->current.angles[0] || ent->current.angles[1] || ent->current.angles[2];
+            if (solid->rotated) {
+                radius = RadiusFromBounds(cmodel->mins, cmodel->maxs);
+                VectorSet(solid->mins, -radius, -radius, -radius);
+                VectorSet(solid->maxs, radius, radius, radius);
+            } else {
+                VectorCopy(cmodel->mins, solid->mins);
+                VectorCopy(cmodel->maxs, solid->maxs);
+            }
         } else {
-            headnode = CM_HeadnodeForBox(ent->mins, ent->maxs);
+            solid->headnode = NULL;
+            solid->rotated = qfalse;
+            VectorCopy(ent->mins, solid->mins);
+            VectorCopy(ent->maxs, solid->maxs);
+        }
+
+        // leave some space for epsilons
+        VectorAdd(solid->mins, ent->current.origin, solid->mins);
+        VectorAdd(solid->maxs, ent->current.origin, solid->maxs);
+        solid->mins[0] -= 1; solid->mins[1] -= 1; solid->mins[2] -= 1;
+        solid->maxs[0] += 1; solid->maxs[1] += 1; solid->maxs[2] += 1;
+        solid->ent = ent;
+        cl.numSolids++;
+    }
+
+    qsort(cl.solids, cl.numSolids, sizeof(cl.solids[0]), CL_SolidCompare);
+}
+
+static inline qboolean CL_SolidOverlaps(const csolid_t *solid, const vec3_t mins, const vec3_t maxs)
+{
+    return solid->maxs[0] >= mins[0]
+        && solid->mins[1] <= maxs[1] && solid->maxs[1] >= mins[1]
+        && solid->mins[2] <= maxs[2] && solid->maxs[2] >= mins[2];
+}
+
+/*
+====================
+CL_ClipMoveToEntities
+
+====================
+*/
+static void CL_ClipMoveToEntities(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, trace_t *tr)
+{
+    int         i, j;
+    trace_t     trace;
+    mnode_t     *headnode;
+    csolid_t    *solid;
+    vec3_t      boxmins, boxmaxs;   // swept box bounds
+    vec3_t      radmins, radmaxs;   // same for the box rotated any way
+    vec_t       radius;
+
+    radius = RadiusFromBounds(mins, maxs);
+    for (j = 0; j < 3; j++) {
+        boxmins[j] = min(start[j], end[j]) + mins[j];
+        boxmaxs[j] = max(start[j], end[j]) + maxs[j];
+        radmins[j] = min(start[j], end[j]) - radius;
+        radmaxs[j] = max(start[j], end[j]) + radius;
+    }
+
+    for (i = 0, solid = cl.solids; i < cl.numSolids; i++, solid++) {
+        // list is sorted, rest are out of reach. radius bounds
+        // always enclose axial ones.
+        if (solid->mins[0] > radmaxs[0])
+            break;
+
+        if (solid->rotated) {
+            if (!CL_SolidOverlaps(solid, radmins, radmaxs))
+                continue;
+        } else {
+            if (solid->mins[0] > boxmaxs[0])
+                continue;
+            if (!CL_SolidOverlaps(solid, boxmins, boxmaxs))
+                continue;
         }
 
         if (tr->allsolid)
             return;
 
+        headnode = solid->headnode;
+        if (!headnode)
+            headnode = CM_HeadnodeForBox(solid->ent->mins, solid->ent->maxs);
+
         CM_TransformedBoxTrace(&trace, start, end,
                                mins, maxs, headnode,  MASK_PLAYERSOLID,
-                               ent->current.origin, ent->current.angles);
+                               solid->ent->current.origin, solid->ent->current.angles);
 
-        CM_ClipEntity(tr, &trace, (struct edict_s *)ent);
+        CM_ClipEntity(tr, &trace, (struct edict_s *)solid->ent);
     }
 }
 
@@ -119,6 +210,8 @@ static trace_t q_gameabi CL_Trace(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t
 {
     trace_t    t;
 
+    cl.predicted_stats.traces++;
+
     // check against world
     CM_BoxTrace(&t, start, end, mins, maxs, cl.bsp->nodes, MASK_PLAYERSOLID);
     if (t.fraction < 1.0)
@@ -133,31 +226,64 @@ static trace_t q_gameabi CL_Trace(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t
 static int CL_PointContents(vec3_t point)
 {
     int         i;
-    centity_t   *ent;
-    mmodel_t    *cmodel;
+    csolid_t    *solid;
     int         contents;
 
     contents = CM_PointContents(point, cl.bsp->nodes);
 
-    for (i = 0; i < cl.numSolidEntities; i++) {
-        ent = cl.solidEntities[i];
+    for (i = 0, solid = cl.solids; i < cl.numSolids; i++, solid++) {
+        if (solid->mins[0] > point[0])
+            break;  // list is sorted, rest are out of reach
 
-        if (ent->current.solid != PACKED_BSP) // special value for bmodel
+        if (!solid->headnode) // only bmodels have contents
             continue;
 
-        cmodel = cl.model_clip[ent->current.modelindex];
-        if (!cmodel)
+        if (!CL_SolidOverlaps(solid, point, point))
             continue;
 
         contents |= CM_TransformedPointContents(
-                        point, cmodel->headnode,
-                        ent->current.origin,
-                        ent->current.angles);
+                        point, solid->headnode,
+                        solid->ent->current.origin,
+                        solid->ent->current.angles);
     }
 
     return contents;
 }
 
+// anything Pmove may collide with besides the world
+static unsigned CL_SolidsChecksum(void)
+{
+    unsigned    hash = 2166136261u;
+    centity_t   *ent;
+    int         i, j;
+
+#define HASH(x) (hash = (hash ^ (unsigned)(x)) * 16777619)
+    for (i = 0; i < cl.numSolidEntities; i++) {
+        ent = cl.solidEntities[i];
+        HASH(ent->current.number);
+        HASH(ent->current.solid);
+        HASH(ent->current.modelindex);
+        for (j = 0; j < 3; j++) {
+            HASH((int)(ent->current.origin[j] * 8));
+            HASH((int)(ent->current.angles[j] * 8));
+        }
+    }
+#undef HASH
+
+    return hash;
+}
+
+static qboolean CL_PmoveStatesEqual(const pmove_state_t *a, const pmove_state_t *b)
+{
+    return a->pm_type == b->pm_type
+        && VectorCompare(a->origin, b->origin)
+        && VectorCompare(a->velocity, b->velocity)
+        && a->pm_flags == b->pm_flags
+        && a->pm_time == b->pm_time
+        && a->gravity == b->gravity
+        && VectorCompare(a->delta_angles, b->delta_angles);
+}
+
 /*
 =================
 CL_PredictMovement
@@ -174,7 +300,8 @@ void CL_PredictAngles(void)
 
 void CL_PredictMovement(void)
 {
-    unsigned    ack, current, frame;
+    unsigned    ack, current, frame, solids;
+    pmove_state_t   base;
     pmove_t     pm;
     int         step, oldz;
 
@@ -210,27 +337,51 @@ void CL_PredictMovement(void)
         return;
     }
 
+    base = cl.frame.ps.pmove;
+#if USE_SMOOTH_DELTA_ANGLES
+    VectorCopy(cl.delta_angles, base.delta_angles);
+#endif
+
+    // cached results stay valid if server state matches what we have
+    // predicted for the acknowledged command and nothing solid moved
+    solids = CL_SolidsChecksum();
+    if (ack < cl.predicted_base || ack > cl.predicted_top || cl.predicted_top > current ||
+        solids != cl.predicted_solids ||
+        !CL_PmoveStatesEqual(&base, &cl.predicted_states[ack & CMD_MASK])) {
+        cl.predicted_states[ack & CMD_MASK] = base;
+        cl.predicted_top = ack;
+    }
+    cl.predicted_base = ack;
+    cl.predicted_solids = solids;
+
+    cl.predicted_stats.cached = cl.predicted_top - ack;
+    cl.predicted_stats.run = current - cl.predicted_top;
+    cl.predicted_stats.traces = 0;
+
     X86_PUSH_FPCW;
     X86_SINGLE_FPCW;
 
-    // copy current state to pmove
+    // copy last cached state to pmove
     memset(&pm, 0, sizeof(pm));
     pm.trace = CL_Trace;
     pm.pointcontents = CL_PointContents;
 
-    pm.s = cl.frame.ps.pmove;
-#if USE_SMOOTH_DELTA_ANGLES
-    VectorCopy(cl.delta_angles, pm.s.delta_angles);
-#endif
+    pm.s = cl.predicted_states[cl.predicted_top & CMD_MASK];
+    VectorCopy(cl.predicted_viewangles[cl.predicted_top & CMD_MASK], pm.viewangles);
 
-    // run frames
-    while (++ack <= current) {
+    // run frames not yet cached
+    while (++cl.predicted_top <= current) {
+        ack = cl.predicted_top;
         pm.cmd = cl.cmds[ack & CMD_MASK];
         Pmove(&pm, &cl.pmp);
 
+        cl.predicted_states[ack & CMD_MASK] = pm.s;
+        VectorCopy(pm.viewangles, cl.predicted_viewangles[ack & CMD_MASK]);
+
         // save for debug checking
         VectorCopy(pm.s.origin, cl.predicted_origins[ack & CMD_MASK]);
     }
+    cl.predicted_top = current;
 
     // run pending cmd
     if (cl.cmd.msec) {
@@ -240,6 +391,7 @@ void CL_PredictMovement(void)
         pm.cmd.upmove = cl.localmove[2];
         Pmove(&pm, &cl.pmp);
         frame = current;
+        cl.predicted_stats.run++;
 
         // save for debug checking
         VectorCopy(pm.s.origin, cl.predicted_origins[(current + 1) & CMD_MASK]);
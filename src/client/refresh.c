@@ -429,6 +429,7 @@ qboolean(*R_InterceptKey)(unsigned key, qboolean down) = NULL;
 
 void(*IMG_Unload)(image_t *image) = NULL;
 void(*IMG_Load)(image_t *image, byte *pic) = NULL;
+qboolean(*IMG_SupportsCompressed)(void) = NULL;
 byte* (*IMG_ReadPixels)(int *width, int *height, int *rowbytes) = NULL;
 
 qerror_t(*MOD_LoadMD2)(model_t *model, const void *rawdata, size_t length) = NULL;
@@ -1075,6 +1075,17 @@ static void SCR_DrawDebugPmove(void)
             x += CHAR_WIDTH;
         }
     }
+
+    if (scr_showpmove->integer > 1) {
+        char buffer[MAX_QPATH];
+
+        Q_snprintf(buffer, sizeof(buffer), "cached %d run %d traces %d",
+                   cl.predicted_stats.cached, cl.predicted_stats.run,
+                   cl.predicted_stats.traces);
+        x = CHAR_WIDTH;
+        y += CHAR_HEIGHT;
+        R_DrawString(x, y, 0, MAX_STRING_CHARS, buffer, scr.font_pic);
+    }
 }
 
 #endif
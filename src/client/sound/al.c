@@ -33,7 +33,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 int active_buffers = 0;
 qboolean streamPlaying = qfalse;
-static ALuint s_srcnums[MAX_CHANNELS];
+static ALuint s_srcnums[MAX_VOICES];
+static ALuint s_freesrcs[MAX_VOICES];   // sources not bound to channels
+static int s_numfreesrcs;
 static ALuint streamSource = 0;
 static int s_framecount;
 
@@ -43,7 +45,7 @@ void AL_SoundInfo(void)
     Com_Printf("AL_RENDERER: %s\n", qalGetString(AL_RENDERER));
     Com_Printf("AL_VERSION: %s\n", qalGetString(AL_VERSION));
     Com_Printf("AL_EXTENSIONS: %s\n", qalGetString(AL_EXTENSIONS));
-    Com_Printf("Number of sources: %d\n", s_numchannels);
+    Com_Printf("Number of sources: %d\n", s_numvoices);
 }
 
 /*
@@ -152,11 +154,12 @@ qboolean AL_Init(void)
 	}
 	else
 	{
-		for (i = 0; i < MAX_CHANNELS; i++) {
+		for (i = 0; i < MAX_VOICES; i++) {
 			qalGenSources(1, &s_srcnums[i]);
 			if (qalGetError() != AL_NO_ERROR) {
 				break;
 			}
+			s_freesrcs[i] = s_srcnums[i];
 		}
 	}
 
@@ -167,7 +170,8 @@ qboolean AL_Init(void)
         goto fail1;
     }
 
-    s_numchannels = i;
+    s_numchannels = MAX_CHANNELS;
+    s_numvoices = s_numfreesrcs = i;
 	AL_InitStreamSource();
 
     Com_Printf("OpenAL initialized.\n");
@@ -188,10 +192,11 @@ void AL_Shutdown(void)
 
 	qalDeleteSources(1, &streamSource);
 
-    if (s_numchannels) {
+    if (s_numvoices) {
         // delete source names
-        qalDeleteSources(s_numchannels, s_srcnums);
+        qalDeleteSources(s_numvoices, s_srcnums);
         memset(s_srcnums, 0, sizeof(s_srcnums));
+        s_numvoices = s_numfreesrcs = 0;
         s_numchannels = 0;
     }
 
@@ -268,6 +273,19 @@ static void AL_Spatialize(channel_t *ch)
     qalSource3f(ch->srcnum, AL_POSITION, AL_UnpackVector(origin));
 }
 
+// stops the source and returns it to the pool, channel becomes virtual
+static void AL_ReleaseSource(channel_t *ch)
+{
+    if (!ch->srcnum)
+        return;
+
+    qalSourceStop(ch->srcnum);
+    qalSourcei(ch->srcnum, AL_BUFFER, AL_NONE);
+    s_freesrcs[s_numfreesrcs++] = ch->srcnum;
+    ch->srcnum = 0;
+    ch->audible = qfalse;
+}
+
 void AL_StopChannel(channel_t *ch)
 {
 #ifdef _DEBUG
@@ -276,8 +294,7 @@ void AL_StopChannel(channel_t *ch)
 #endif
 
     // stop it
-    qalSourceStop(ch->srcnum);
-    qalSourcei(ch->srcnum, AL_BUFFER, AL_NONE);
+    AL_ReleaseSource(ch);
     memset(ch, 0, sizeof(*ch));
 }
 
@@ -290,7 +307,14 @@ void AL_PlayChannel(channel_t *ch)
         Com_Printf("%s: %s\n", __func__, ch->sfx->name);
 #endif
 
-    ch->srcnum = s_srcnums[ch - channels];
+    // out of sources, stay virtual until rescheduled
+    if (!s_numfreesrcs) {
+        ch->audible = qfalse;
+        return;
+    }
+
+    ch->srcnum = s_freesrcs[--s_numfreesrcs];
+    ch->audible = qtrue;
     qalGetError();
     qalSourcei(ch->srcnum, AL_BUFFER, sc->bufnum);
     if (ch->autosound /*|| sc->loopstart >= 0*/) {
@@ -312,6 +336,24 @@ void AL_PlayChannel(channel_t *ch)
     }
 }
 
+// binds a source to the channel that was virtual, continuing
+// from where the sound would be by now
+static void AL_ResumeChannel(channel_t *ch)
+{
+    sfxcache_t *sc = ch->sfx->cache;
+    int offset;
+
+    if (ch->autosound)
+        offset = paintedtime % sc->length;
+    else
+        offset = paintedtime - (ch->end - sc->length);
+
+    AL_PlayChannel(ch);
+
+    if (ch->srcnum && offset > 0)
+        qalSourcef(ch->srcnum, AL_SEC_OFFSET, offset * 0.001f);
+}
+
 static void AL_IssuePlaysounds(void)
 {
     playsound_t *ps;
@@ -426,7 +468,7 @@ static void AL_AddLoopSounds(void)
         AL_PlayChannel(ch);
 
         // attempt to synchronize with existing sounds of the same type
-        if (ch2) {
+        if (ch2 && ch2->srcnum && ch->srcnum) {
             ALint offset;
 
             qalGetSourcei(ch2->srcnum, AL_SAMPLE_OFFSET, &offset);
@@ -467,7 +509,7 @@ void AL_Update(void)
                 AL_StopChannel(ch);
                 continue;
             }
-        } else {
+        } else if (ch->srcnum) {
             ALenum state;
 
             qalGetError();
@@ -476,6 +518,10 @@ void AL_Update(void)
                 AL_StopChannel(ch);
                 continue;
             }
+        } else if (paintedtime >= ch->end) {
+            // virtual channel played to the end
+            AL_StopChannel(ch);
+            continue;
         }
 
 #ifdef _DEBUG
@@ -485,7 +531,8 @@ void AL_Update(void)
         }
 #endif
 
-        AL_Spatialize(ch);         // respatialize channel
+        if (ch->srcnum)
+            AL_Spatialize(ch);     // respatialize channel
     }
 
     s_framecount++;
@@ -495,6 +542,21 @@ void AL_Update(void)
 
 	AL_StreamUpdate();
     AL_IssuePlaysounds();
+
+    // hand sources over to the most audible channels
+    S_ScheduleVoices();
+
+    ch = channels;
+    for (i = 0; i < s_numchannels; i++, ch++) {
+        if (ch->srcnum && !ch->audible)
+            AL_ReleaseSource(ch);
+    }
+
+    ch = channels;
+    for (i = 0; i < s_numchannels; i++, ch++) {
+        if (ch->sfx && ch->audible && !ch->srcnum)
+            AL_ResumeChannel(ch);
+    }
 }
 
 /*
@@ -18,6 +18,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // snd_dma.c -- main control for any streaming sound output device
 
 #include "sound.h"
+#include "system/system.h"
+#include "system/threads.h"
+
+// how often the mixer thread wakes up to paint
+#define MIXER_MSEC  5
 
 dma_t       dma;
 
@@ -27,6 +32,13 @@ cvar_t      *s_testsound;
 static cvar_t       *s_direct;
 #endif
 static cvar_t       *s_mixahead;
+static cvar_t       *s_mixthread;
+
+static struct {
+    qthread_t   *thread;
+    qmutex_t    *lock;      // protects channels, playsounds and paint state
+    qboolean    shutdown;
+} mixer;
 
 static snddmaAPI_t snddma;
 
@@ -48,6 +60,7 @@ qboolean DMA_Init(void)
     s_khz = Cvar_Get("s_khz", "44", CVAR_ARCHIVE | CVAR_SOUND);
     s_mixahead = Cvar_Get("s_mixahead", "0.1", CVAR_ARCHIVE);
     s_testsound = Cvar_Get("s_testsound", "0", 0);
+    s_mixthread = Cvar_Get("s_mixthread", "1", CVAR_SOUND);
 
 #if USE_DSOUND
     s_direct = Cvar_Get("s_direct", "1", CVAR_SOUND);
@@ -67,9 +80,10 @@ qboolean DMA_Init(void)
         }
     }
 
-    S_InitScaletable();
+    S_InitMixer();
 
     s_numchannels = MAX_CHANNELS;
+    s_numvoices = MAX_VOICES;
 
     Com_Printf("sound sampling rate: %i\n", dma.speed);
 
@@ -78,8 +92,10 @@ qboolean DMA_Init(void)
 
 void DMA_Shutdown(void)
 {
+    DMA_StopMixer();
     snddma.Shutdown();
     s_numchannels = 0;
+    s_numvoices = 0;
 }
 
 void DMA_Activate(void)
@@ -90,19 +106,19 @@ void DMA_Activate(void)
     }
 }
 
-int DMA_DriftBeginofs(float timeofs)
+int DMA_DriftBeginofs(int servertime, float timeofs)
 {
     static int  s_beginofs;
     int         start;
 
     // drift s_beginofs
-    start = cl.servertime * 0.001 * dma.speed + s_beginofs;
+    start = servertime * 0.001 * dma.speed + s_beginofs;
     if (start < paintedtime) {
         start = paintedtime;
-        s_beginofs = start - (cl.servertime * 0.001 * dma.speed);
+        s_beginofs = start - (servertime * 0.001 * dma.speed);
     } else if (start > paintedtime + 0.3 * dma.speed) {
         start = paintedtime + 0.1 * dma.speed;
-        s_beginofs = start - (cl.servertime * 0.001 * dma.speed);
+        s_beginofs = start - (servertime * 0.001 * dma.speed);
     } else {
         s_beginofs -= 10;
     }
@@ -139,7 +155,7 @@ static int DMA_GetTime(void)
             // time to chop things off to avoid 32 bit limits
             buffers = 0;
             paintedtime = fullsamples;
-            S_StopAllSounds();
+            S_ResetSounds();
         }
     }
     oldsamplepos = dma.samplepos;
@@ -162,7 +178,8 @@ void DMA_Update(void)
 
 // check to make sure that we haven't overshot
     if (paintedtime < soundtime) {
-        Com_DPrintf("S_Update_ : overflow\n");
+        if (!mixer.thread)
+            Com_DPrintf("S_Update_ : overflow\n");
         paintedtime = soundtime;
     }
 
@@ -182,4 +199,76 @@ void DMA_Update(void)
     snddma.Submit();
 }
 
+/*
+===============================================================================
+
+MIXER THREAD
+
+Paints channels independently of the client frame rate, so low frame
+rates don't cause underruns. Sounds are started through the lock free
+play queue, everything else that touches channels takes the mixer lock.
 
+===============================================================================
+*/
+
+static void DMA_MixerThread(void *arg)
+{
+    while (1) {
+        Sys_LockMutex(mixer.lock);
+        if (mixer.shutdown) {
+            Sys_UnlockMutex(mixer.lock);
+            break;
+        }
+        S_RunPlayQueue();
+        DMA_Update();
+        Sys_UnlockMutex(mixer.lock);
+
+        Sys_Sleep(MIXER_MSEC);
+    }
+}
+
+void DMA_StartMixer(void)
+{
+    if (mixer.thread || !s_mixthread->integer)
+        return;
+
+    mixer.lock = Sys_CreateMutex();
+    mixer.shutdown = qfalse;
+    mixer.thread = Sys_CreateThread(DMA_MixerThread, NULL);
+    if (!mixer.thread) {
+        Com_WPrintf("Couldn't create mixer thread, mixing from main loop\n");
+        Sys_DestroyMutex(mixer.lock);
+        mixer.lock = NULL;
+    }
+}
+
+void DMA_StopMixer(void)
+{
+    if (!mixer.thread)
+        return;
+
+    Sys_LockMutex(mixer.lock);
+    mixer.shutdown = qtrue;
+    Sys_UnlockMutex(mixer.lock);
+
+    Sys_JoinThread(mixer.thread);
+    Sys_DestroyMutex(mixer.lock);
+    memset(&mixer, 0, sizeof(mixer));
+}
+
+qboolean DMA_MixerRunning(void)
+{
+    return mixer.thread != NULL;
+}
+
+void DMA_LockMixer(void)
+{
+    if (mixer.thread)
+        Sys_LockMutex(mixer.lock);
+}
+
+void DMA_UnlockMixer(void)
+{
+    if (mixer.thread)
+        Sys_UnlockMutex(mixer.lock);
+}
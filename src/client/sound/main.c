@@ -19,6 +19,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "sound.h"
 #include "client/sound/vorbis.h"
+#include "system/threads.h"
+#if USE_TESTS
+#include "system/system.h"
+#endif
 
 // =======================================================================
 // Internal sound data & structures
@@ -28,6 +32,7 @@ int         s_registration_sequence;
 
 channel_t   channels[MAX_CHANNELS];
 int         s_numchannels;
+int         s_numvoices;
 
 sndstarted_t s_started;
 qboolean    s_active;
@@ -55,6 +60,16 @@ playsound_t s_playsounds[MAX_PLAYSOUNDS];
 playsound_t s_freeplays;
 playsound_t s_pendingplays;
 
+#if USE_SNDDMA
+// sounds started by the client and not yet seen by the mixer. single
+// producer and single consumer, so starting a sound never waits for
+// the mixer thread. size must be a power of two.
+#define     PLAYQUEUE_SIZE  MAX_PLAYSOUNDS
+static playsound_t          s_playqueue[PLAYQUEUE_SIZE];
+static volatile unsigned    s_playqueue_head;   // advanced by client
+static volatile unsigned    s_playqueue_tail;   // advanced by mixer
+#endif
+
 cvar_t      *s_volume;
 cvar_t      *s_ambient;
 #ifdef _DEBUG
@@ -123,10 +138,18 @@ static void S_SoundList_f(void)
     Com_Printf("Total resident: %i\n", total);
 }
 
+#if USE_SNDDMA && USE_TESTS
+static void S_LoopTest_f(void);
+#endif
+
 static const cmdreg_t c_sound[] = {
     { "stopsound", S_StopAllSounds },
     { "soundlist", S_SoundList_f },
     { "soundinfo", S_SoundInfo_f },
+#if USE_SNDDMA && USE_TESTS
+    { "mixtest", S_MixTest_f },
+    { "looptest", S_LoopTest_f },
+#endif
 
     { NULL }
 };
@@ -195,7 +218,12 @@ void S_Init(void)
     paintedtime = 0;
 
     s_registration_sequence = 1;
-    
+
+#if USE_SNDDMA
+    if (s_started == SS_DMA)
+        DMA_StartMixer();
+#endif
+
 	OGG_Init();
 	OGG_InitTrackList();
 	OGG_RecoverState();
@@ -557,11 +585,7 @@ void S_EndRegistration(void)
     }
 
     // load everything in
-    for (i = 0, sfx = known_sfx; i < num_sfx; i++, sfx++) {
-        if (!sfx->name[0])
-            continue;
-        S_LoadSound(sfx);
-    }
+    S_LoadSounds(known_sfx, num_sfx);
 
     s_registering = qfalse;
 }
@@ -569,18 +593,69 @@ void S_EndRegistration(void)
 
 //=============================================================================
 
+// audibility weights, view entity sounds are never dropped for
+// monsters and ambient loops yield to one-shot effects
+#define PRIORITY_LOCAL      4.0f
+#define PRIORITY_LOOP       0.5f
+
+/*
+=================
+S_Audibility
+
+Estimates how loud the channel is heard, weighted by priority.
+May be called from the mixer thread, so DMA uses spatialized volumes.
+=================
+*/
+static float S_Audibility(const channel_t *ch)
+{
+    vec3_t      origin;
+    vec_t       dist;
+    float       scale;
+
+    if (!ch->sfx)
+        return 0;
+
+    if (ch->entnum == -1 || ch->entnum == listener_entnum)
+        return ch->master_vol * PRIORITY_LOCAL;
+
+#if USE_SNDDMA
+    if (s_started == SS_DMA) {
+        scale = max(ch->leftvol, ch->rightvol) * (1.0f / 255);
+    } else
+#endif
+    {
+        if (ch->fixed_origin) {
+            VectorCopy(ch->origin, origin);
+        } else {
+            CL_GetEntitySoundOrigin(ch->entnum, origin);
+        }
+
+        dist = Distance(origin, listener_origin) - SOUND_FULLVOLUME;
+        if (dist < 0)
+            dist = 0;
+        scale = ch->master_vol * (1.0f - dist * ch->dist_mult);
+        if (scale < 0)
+            scale = 0;
+    }
+
+    if (ch->autosound)
+        scale *= PRIORITY_LOOP;
+
+    return scale;
+}
+
 /*
 =================
 S_PickChannel
 
-picks a channel based on priorities, empty slots, number of channels
+picks a channel based on priorities, empty slots and audibility
 =================
 */
 channel_t *S_PickChannel(int entnum, int entchannel)
 {
     int         ch_idx;
     int         first_to_die;
-    int         life_left;
+    float       score, best;
     channel_t   *ch;
 
     if (entchannel < 0)
@@ -588,7 +663,7 @@ channel_t *S_PickChannel(int entnum, int entchannel)
 
 // Check for replacement sound, or find the best one to replace
     first_to_die = -1;
-    life_left = 0x7fffffff;
+    best = 0;
     for (ch_idx = 0; ch_idx < s_numchannels; ch_idx++) {
         ch = &channels[ch_idx];
         // channel 0 never overrides unless out of channels
@@ -601,12 +676,23 @@ channel_t *S_PickChannel(int entnum, int entchannel)
             break;
         }
 
+        if (!ch->sfx) {
+            // take the first free slot unless overriding
+            if (best >= 0) {
+                best = -1;
+                first_to_die = ch_idx;
+            }
+            continue;
+        }
+
         // don't let monster sounds override player sounds
-        if (ch->entnum == listener_entnum && entnum != listener_entnum && ch->sfx)
+        if (ch->entnum == listener_entnum && entnum != listener_entnum)
             continue;
 
-        if (ch->end - paintedtime < life_left) {
-            life_left = ch->end - paintedtime;
+        // steal the least audible voice
+        score = S_Audibility(ch);
+        if (first_to_die == -1 || score < best) {
+            best = score;
             first_to_die = ch_idx;
         }
     }
@@ -624,6 +710,52 @@ channel_t *S_PickChannel(int entnum, int entchannel)
     return ch;
 }
 
+/*
+=================
+S_ScheduleVoices
+
+Marks up to s_numvoices most audible channels for mixing. The rest
+become virtual: they keep their playback position, but are not heard
+until they win a voice back.
+=================
+*/
+void S_ScheduleVoices(void)
+{
+    float       score[MAX_CHANNELS];
+    int         order[MAX_CHANNELS];
+    int         i, j, best, count;
+    channel_t   *ch;
+
+    count = 0;
+    ch = channels;
+    for (i = 0; i < s_numchannels; i++, ch++) {
+        ch->audible = qfalse;
+        if (!ch->sfx)
+            continue;
+        score[i] = S_Audibility(ch);
+        if (score[i] > 0)
+            order[count++] = i;
+    }
+
+    // partial selection sort, only the top voices need ordering
+    if (count > s_numvoices) {
+        for (i = 0; i < s_numvoices; i++) {
+            best = i;
+            for (j = i + 1; j < count; j++) {
+                if (score[order[j]] > score[order[best]])
+                    best = j;
+            }
+            j = order[i];
+            order[i] = order[best];
+            order[best] = j;
+        }
+        count = s_numvoices;
+    }
+
+    for (i = 0; i < count; i++)
+        channels[order[i]].audible = qtrue;
+}
+
 #if USE_SNDDMA
 
 /*
@@ -762,7 +894,7 @@ void S_IssuePlaysound(playsound_t *ps)
     sfxcache_t  *sc;
 
 #ifdef _DEBUG
-    if (s_show->integer)
+    if (s_show->integer && !DMA_MixerRunning())
         Com_Printf("Issue %i\n", ps->begin);
 #endif
     // pick a channel to play on
@@ -790,6 +922,9 @@ void S_IssuePlaysound(playsound_t *ps)
     ch->sfx = ps->sfx;
     VectorCopy(ps->origin, ch->origin);
     ch->fixed_origin = ps->fixed_origin;
+    ch->audible = qtrue;    // until rescheduled
+    ch->pos = 0;
+    ch->end = paintedtime + sc->length;
 
 #if USE_OPENAL
     if (s_started == SS_OAL)
@@ -797,17 +932,101 @@ void S_IssuePlaysound(playsound_t *ps)
 #endif
 
 #if USE_SNDDMA
-    if (s_started == SS_DMA)
-        S_Spatialize(ch);
+    // may run on mixer thread, use volumes computed by S_StartSound
+    if (s_started == SS_DMA) {
+        ch->leftvol = ps->leftvol;
+        ch->rightvol = ps->rightvol;
+    }
 #endif
 
-    ch->pos = 0;
-    ch->end = paintedtime + sc->length;
-
     // free the playsound
     S_FreePlaysound(ps);
 }
 
+// sorts playsound into the pending sound list
+static void S_LinkPlaysound(playsound_t *ps)
+{
+    playsound_t *sort;
+
+    for (sort = s_pendingplays.next; sort != &s_pendingplays && sort->begin < ps->begin; sort = sort->next)
+        ;
+
+    ps->next = sort;
+    ps->prev = sort->prev;
+
+    ps->next->prev = ps;
+    ps->prev->next = ps;
+}
+
+#if USE_SNDDMA
+
+/*
+=================
+S_QueuePlaysound
+
+Spatializes the sound with current listener and entity positions,
+then passes it to the mixer.
+=================
+*/
+static void S_QueuePlaysound(playsound_t *ps)
+{
+    channel_t   ch;
+    unsigned    head = s_playqueue_head;
+
+    if (head - Sys_AtomicAdd(&s_playqueue_tail, 0) >= PLAYQUEUE_SIZE)
+        return;     // mixer is behind, drop the sound
+
+    memset(&ch, 0, sizeof(ch));
+    if (ps->attenuation == ATTN_STATIC)
+        ch.dist_mult = ps->attenuation * 0.001;
+    else
+        ch.dist_mult = ps->attenuation * 0.0005;
+    ch.master_vol = ps->volume;
+    ch.entnum = ps->entnum;
+    ch.fixed_origin = ps->fixed_origin;
+    VectorCopy(ps->origin, ch.origin);
+    S_Spatialize(&ch);
+
+    ps->leftvol = ch.leftvol;
+    ps->rightvol = ch.rightvol;
+
+    s_playqueue[head & (PLAYQUEUE_SIZE - 1)] = *ps;
+
+    // publish the entry
+    Sys_AtomicAdd(&s_playqueue_head, 1);
+}
+
+/*
+=================
+S_RunPlayQueue
+
+Moves queued sounds into the pending sound list. Called by the mixer.
+=================
+*/
+void S_RunPlayQueue(void)
+{
+    unsigned    head = Sys_AtomicAdd(&s_playqueue_head, 0);
+    unsigned    tail = s_playqueue_tail;
+    playsound_t *ps, *queued;
+
+    for (; tail != head; tail++) {
+        queued = &s_playqueue[tail & (PLAYQUEUE_SIZE - 1)];
+
+        ps = S_AllocPlaysound();
+        if (!ps)
+            continue;
+
+        *ps = *queued;
+        ps->begin = DMA_DriftBeginofs(queued->servertime, queued->timeofs);
+        S_LinkPlaysound(ps);
+    }
+
+    // release the entries
+    Sys_AtomicAdd(&s_playqueue_tail, head - s_playqueue_tail);
+}
+
+#endif
+
 // =======================================================================
 // Start a sound effect
 // =======================================================================
@@ -824,14 +1043,21 @@ Entchannel 0 will never override a playing sound
 void S_StartSound(const vec3_t origin, int entnum, int entchannel, qhandle_t hSfx, float vol, float attenuation, float timeofs)
 {
     sfxcache_t  *sc;
-    playsound_t *ps, *sort;
+    playsound_t *ps;
     sfx_t       *sfx;
+#if USE_SNDDMA
+    playsound_t queued;
+#endif
 
     if (!s_started)
         return;
     if (!s_active)
         return;
 
+    // checked here since channels may be picked on mixer thread
+    if (entchannel < 0)
+        Com_Error(ERR_DROP, "S_StartSound: entchannel < 0");
+
     if (!(sfx = S_SfxForHandle(hSfx))) {
         return;
     }
@@ -847,10 +1073,19 @@ void S_StartSound(const vec3_t origin, int entnum, int entchannel, qhandle_t hSf
     if (!sc)
         return;     // couldn't load the sound's data
 
-    // make the playsound_t
-    ps = S_AllocPlaysound();
-    if (!ps)
-        return;
+#if USE_SNDDMA
+    if (s_started == SS_DMA) {
+        // copied into play queue
+        memset(&queued, 0, sizeof(queued));
+        ps = &queued;
+    } else
+#endif
+    {
+        // make the playsound_t
+        ps = S_AllocPlaysound();
+        if (!ps)
+            return;
+    }
 
     if (origin) {
         VectorCopy(origin, ps->origin);
@@ -871,19 +1106,16 @@ void S_StartSound(const vec3_t origin, int entnum, int entchannel, qhandle_t hSf
 #endif
 
 #if USE_SNDDMA
-    if (s_started == SS_DMA)
-        ps->begin = DMA_DriftBeginofs(timeofs);
+    if (s_started == SS_DMA) {
+        ps->servertime = cl.servertime;
+        ps->timeofs = timeofs;
+        S_QueuePlaysound(ps);
+        return;
+    }
 #endif
 
     // sort into the pending sound list
-    for (sort = s_pendingplays.next; sort != &s_pendingplays && sort->begin < ps->begin; sort = sort->next)
-        ;
-
-    ps->next = sort;
-    ps->prev = sort->prev;
-
-    ps->next->prev = ps;
-    ps->prev->next = ps;
+    S_LinkPlaysound(ps);
 }
 
 void S_ParseStartSound(void)
@@ -926,16 +1158,15 @@ void S_StartLocalSound_(const char *sound)
 
 /*
 ==================
-S_StopAllSounds
+S_ResetSounds
+
+Stops all sounds, must be called with mixer locked.
 ==================
 */
-void S_StopAllSounds(void)
+void S_ResetSounds(void)
 {
     int     i;
 
-    if (!s_started)
-        return;
-
     // clear all the playsounds
     memset(s_playsounds, 0, sizeof(s_playsounds));
     s_freeplays.next = s_freeplays.prev = &s_freeplays;
@@ -958,10 +1189,30 @@ void S_StopAllSounds(void)
         DMA_ClearBuffer();
 #endif
 
+#if USE_SNDDMA
+    // drop sounds not yet seen by the mixer
+    s_playqueue_tail = s_playqueue_head;
+#endif
+
     // clear all the channels
     memset(channels, 0, sizeof(channels));
 }
 
+/*
+==================
+S_StopAllSounds
+==================
+*/
+void S_StopAllSounds(void)
+{
+    if (!s_started)
+        return;
+
+    DMA_LockMixer();
+    S_ResetSounds();
+    DMA_UnlockMixer();
+}
+
 // =======================================================================
 // Update sound buffer
 // =======================================================================
@@ -987,6 +1238,51 @@ void S_BuildSoundList(int *sounds)
 
 #if USE_SNDDMA
 
+// distance at which looping sounds are attenuated completely
+#define LOOP_CULL_DIST  (SOUND_FULLVOLUME + 1.0f / SOUND_LOOPATTENUATE)
+
+/*
+=================
+S_SpatializeLoops
+
+Batched version of S_SpatializeOrigin for looping sounds at full master
+volume. Written without branches on the inner loop so the compiler can
+vectorize it.
+=================
+*/
+static void S_SpatializeLoops(int count, const vec_t *x, const vec_t *y, const vec_t *z,
+                              int *left_vol, int *right_vol)
+{
+    vec_t   dx, dy, dz, dist, dot, scale, lscale, rscale;
+    vec_t   center = 0.5f, sep = s_swapstereo->integer ? -0.5f : 0.5f;
+    int     i;
+
+    if (dma.channels == 1) {
+        // no stereo separation
+        center = 1.0f;
+        sep = 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        dx = x[i] - listener_origin[0];
+        dy = y[i] - listener_origin[1];
+        dz = z[i] - listener_origin[2];
+
+        dist = sqrtf(dx * dx + dy * dy + dz * dz);
+        dot = listener_right[0] * dx + listener_right[1] * dy + listener_right[2] * dz;
+        dot = dist > 0 ? dot / dist : 0;
+
+        scale = dist - SOUND_FULLVOLUME;
+        scale = 1.0f - (scale > 0 ? scale : 0) * SOUND_LOOPATTENUATE;
+
+        rscale = 255.0f * scale * (center + sep * dot);
+        lscale = 255.0f * scale * (center - sep * dot);
+
+        right_vol[i] = rscale > 0 ? (int)rscale : 0;
+        left_vol[i] = lscale > 0 ? (int)lscale : 0;
+    }
+}
+
 /*
 ==================
 S_AddLoopSounds
@@ -998,15 +1294,18 @@ as the entities are sent to the client
 */
 static void S_AddLoopSounds(void)
 {
-    int         i, j;
+    static vec_t    x[MAX_EDICTS], y[MAX_EDICTS], z[MAX_EDICTS];
+    static int      left[MAX_EDICTS], right[MAX_EDICTS], index[MAX_EDICTS];
+    int         i, count, numloops;
     int         sounds[MAX_EDICTS];
-    int         left, right, left_total, right_total;
+    int         loops[MAX_SOUNDS];
+    int         left_total[MAX_SOUNDS], right_total[MAX_SOUNDS];
     channel_t   *ch;
     sfx_t       *sfx;
     sfxcache_t  *sc;
-    int         num;
+    int         num, snd;
     entity_state_t  *ent;
-    vec3_t      origin;
+    vec3_t      origin, delta;
 
     if (cls.state != ca_active || !s_active || sv_paused->integer || !s_ambient->integer) {
         return;
@@ -1014,53 +1313,65 @@ static void S_AddLoopSounds(void)
 
     S_BuildSoundList(sounds);
 
+    // group emitters by sound in a single pass. sounds are listed in
+    // order of first appearance, so channels are picked in the same
+    // order as if each group was collected separately.
+    memset(left_total, -1, sizeof(left_total));
+    count = numloops = 0;
     for (i = 0; i < cl.frame.numEntities; i++) {
-        if (!sounds[i])
+        snd = sounds[i];
+        if (!snd)
             continue;
 
-        sfx = S_SfxForHandle(cl.sound_precache[sounds[i]]);
-        if (!sfx)
-            continue;       // bad sound effect
-        sc = sfx->cache;
-        if (!sc)
-            continue;
+        if (left_total[snd] == -1) {
+            left_total[snd] = right_total[snd] = 0;
+            loops[numloops++] = snd;
+        }
 
         num = (cl.frame.firstEntity + i) & PARSE_ENTITIES_MASK;
         ent = &cl.entityStates[num];
 
-        // find the total contribution of all sounds of this type
+        // skip emitters out of hearing range early
         CL_GetEntitySoundOrigin(ent->number, origin);
-        S_SpatializeOrigin(origin, 1.0, SOUND_LOOPATTENUATE,
-                           &left_total, &right_total);
-        for (j = i + 1; j < cl.frame.numEntities; j++) {
-            if (sounds[j] != sounds[i])
-                continue;
-            sounds[j] = 0;  // don't check this again later
-
-            num = (cl.frame.firstEntity + j) & PARSE_ENTITIES_MASK;
-            ent = &cl.entityStates[num];
-
-            CL_GetEntitySoundOrigin(ent->number, origin);
-            S_SpatializeOrigin(origin, 1.0, SOUND_LOOPATTENUATE,
-                               &left, &right);
-            left_total += left;
-            right_total += right;
-        }
+        VectorSubtract(origin, listener_origin, delta);
+        if (DotProduct(delta, delta) >= LOOP_CULL_DIST * LOOP_CULL_DIST)
+            continue;
+
+        x[count] = origin[0];
+        y[count] = origin[1];
+        z[count] = origin[2];
+        index[count] = snd;
+        count++;
+    }
 
-        if (left_total == 0 && right_total == 0)
+    // find the total contribution of all sounds of each type
+    S_SpatializeLoops(count, x, y, z, left, right);
+
+    for (i = 0; i < count; i++) {
+        left_total[index[i]] += left[i];
+        right_total[index[i]] += right[i];
+    }
+
+    for (i = 0; i < numloops; i++) {
+        snd = loops[i];
+
+        if (left_total[snd] == 0 && right_total[snd] == 0)
             continue;       // not audible
 
+        sfx = S_SfxForHandle(cl.sound_precache[snd]);
+        if (!sfx)
+            continue;       // bad sound effect
+        sc = sfx->cache;
+        if (!sc)
+            continue;
+
         // allocate a channel
         ch = S_PickChannel(0, 0);
         if (!ch)
             return;
 
-        if (left_total > 255)
-            left_total = 255;
-        if (right_total > 255)
-            right_total = 255;
-        ch->leftvol = left_total;
-        ch->rightvol = right_total;
+        ch->leftvol = min(left_total[snd], 255);
+        ch->rightvol = min(right_total[snd], 255);
         ch->autosound = qtrue;  // remove next frame
         ch->sfx = sfx;
         ch->pos = paintedtime % sc->length;
@@ -1068,6 +1379,56 @@ static void S_AddLoopSounds(void)
     }
 }
 
+#if USE_TESTS
+
+/*
+==================
+S_LoopTest_f
+
+Times loop sound aggregation on the current frame.
+==================
+*/
+static void S_LoopTest_f(void)
+{
+    unsigned    start, msec;
+    int         i, j, passes, emitters;
+    channel_t   *ch;
+
+    if (s_started != SS_DMA || cls.state != ca_active) {
+        Com_Printf("Must be in a level with DMA sound engine\n");
+        return;
+    }
+
+    passes = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 1000;
+    clamp(passes, 1, 100000);
+
+    for (i = emitters = 0; i < cl.frame.numEntities; i++) {
+        entity_state_t *ent = &cl.entityStates[(cl.frame.firstEntity + i) & PARSE_ENTITIES_MASK];
+        if (ent->sound)
+            emitters++;
+    }
+
+    DMA_LockMixer();
+
+    start = Sys_Milliseconds();
+    for (i = 0; i < passes; i++) {
+        // autosounds are regenerated fresh each pass
+        for (j = 0, ch = channels; j < s_numchannels; j++, ch++) {
+            if (ch->autosound)
+                memset(ch, 0, sizeof(*ch));
+        }
+        S_AddLoopSounds();
+    }
+    msec = Sys_Milliseconds() - start;
+
+    DMA_UnlockMixer();
+
+    Com_Printf("%d looping emitters, %d passes: %u msec, %.2f usec per pass\n",
+               emitters, passes, msec, msec * 1000.0f / passes);
+}
+
+#endif
+
 #endif
 
 /*
@@ -1101,6 +1462,8 @@ void S_Update(void)
         return;
     }
 
+    DMA_LockMixer();
+
     // set listener entity number
     // other parameters should be already set up by CL_CalcViewValues
     if (cl.clientNum == -1 || cl.frame.clientNum == CLIENTNUM_NONE) {
@@ -1133,16 +1496,13 @@ void S_Update(void)
             continue;
         }
         S_Spatialize(ch);         // respatialize channel
-        if (!ch->leftvol && !ch->rightvol) {
-            memset(ch, 0, sizeof(*ch));
-            continue;
-        }
     }
 
     // add loopsounds
     S_AddLoopSounds();
 
-    OGG_Stream();
+    // pick voices to mix, inaudible ones keep running virtually
+    S_ScheduleVoices();
 
 #ifdef _DEBUG
     //
@@ -1163,8 +1523,16 @@ void S_Update(void)
     }
 #endif
 
-// mix some sound
-    DMA_Update();
+    DMA_UnlockMixer();
+
+    // raw samples take the mixer lock
+    OGG_Stream();
+
+// mix some sound, unless mixer thread does it
+    if (!DMA_MixerRunning()) {
+        S_RunPlayQueue();
+        DMA_Update();
+    }
 #endif
 }
 
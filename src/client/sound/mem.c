@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // snd_mem.c: sound caching
 
 #include "sound.h"
+#include "common/jobs.h"
 
 wavinfo_t s_info;
 
@@ -25,9 +26,11 @@ wavinfo_t s_info;
 /*
 ================
 ResampleSfx
+
+May be called from job threads, so errors are only recorded in sfx.
 ================
 */
-static sfxcache_t *ResampleSfx(sfx_t *sfx)
+static sfxcache_t *ResampleSfx(sfx_t *sfx, const wavinfo_t *info)
 {
     int         outcount;
     int         srcsample;
@@ -36,33 +39,32 @@ static sfxcache_t *ResampleSfx(sfx_t *sfx)
     int         samplefrac, fracstep;
     sfxcache_t  *sc;
 
-    stepscale = (float)s_info.rate / dma.speed;      // this is usually 0.5, 1, or 2
+    stepscale = (float)info->rate / dma.speed;      // this is usually 0.5, 1, or 2
 
-    outcount = s_info.samples / stepscale;
+    outcount = info->samples / stepscale;
     if (!outcount) {
-        Com_DPrintf("%s resampled to zero length\n", s_info.name);
         sfx->error = Q_ERR_TOO_FEW;
         return NULL;
     }
 
-    sc = sfx->cache = S_Malloc(outcount * s_info.width + sizeof(sfxcache_t) - 1);
+    sc = sfx->cache = S_Malloc(outcount * info->width + sizeof(sfxcache_t) - 1);
 
     sc->length = outcount;
-    sc->loopstart = s_info.loopstart == -1 ? -1 : s_info.loopstart / stepscale;
-    sc->width = s_info.width;
+    sc->loopstart = info->loopstart == -1 ? -1 : info->loopstart / stepscale;
+    sc->width = info->width;
 
 // resample / decimate to the current source rate
 //Com_Printf("%s: %f, %d\n",sfx->name,stepscale,sc->width);
     if (stepscale == 1) {
 // fast special case
         if (sc->width == 1) {
-            memcpy(sc->data, s_info.data, outcount);
+            memcpy(sc->data, info->data, outcount);
         } else {
 #if __BYTE_ORDER == __LITTLE_ENDIAN
-            memcpy(sc->data, s_info.data, outcount << 1);
+            memcpy(sc->data, info->data, outcount << 1);
 #else
             for (i = 0; i < outcount; i++) {
-                ((uint16_t *)sc->data)[i] = LittleShort(((uint16_t *)s_info.data)[i]);
+                ((uint16_t *)sc->data)[i] = LittleShort(((uint16_t *)info->data)[i]);
             }
 #endif
         }
@@ -74,13 +76,13 @@ static sfxcache_t *ResampleSfx(sfx_t *sfx)
             for (i = 0; i < outcount; i++) {
                 srcsample = samplefrac >> 8;
                 samplefrac += fracstep;
-                sc->data[i] = s_info.data[srcsample];
+                sc->data[i] = info->data[srcsample];
             }
         } else {
             for (i = 0; i < outcount; i++) {
                 srcsample = samplefrac >> 8;
                 samplefrac += fracstep;
-                ((uint16_t *)sc->data)[i] = LittleShort(((uint16_t *)s_info.data)[srcsample]);
+                ((uint16_t *)sc->data)[i] = LittleShort(((uint16_t *)info->data)[srcsample]);
             }
         }
     }
@@ -280,31 +282,14 @@ static qboolean GetWavinfo(void)
     return qtrue;
 }
 
-/*
-==============
-S_LoadSound
-==============
-*/
-sfxcache_t *S_LoadSound(sfx_t *s)
+// loads and parses WAV file into s_info, returns file data
+// that must be freed by caller
+static byte *S_LoadWav(sfx_t *s)
 {
     byte        *data;
-    sfxcache_t  *sc;
     ssize_t     len;
     char        *name;
 
-    if (s->name[0] == '*')
-        return NULL;
-
-// see if still in memory
-    sc = s->cache;
-    if (sc)
-        return sc;
-
-// don't retry after error
-    if (s->error)
-        return NULL;
-
-// load it in
     if (s->truename)
         name = s->truename;
     else
@@ -323,21 +308,132 @@ sfxcache_t *S_LoadSound(sfx_t *s)
     iff_end = data + len;
     if (!GetWavinfo()) {
         s->error = Q_ERR_INVALID_FORMAT;
-        goto fail;
+        FS_FreeFile(data);
+        return NULL;
     }
 
+    return data;
+}
+
+/*
+==============
+S_LoadSound
+==============
+*/
+sfxcache_t *S_LoadSound(sfx_t *s)
+{
+    byte        *data;
+    sfxcache_t  *sc;
+
+    if (s->name[0] == '*')
+        return NULL;
+
+// see if still in memory
+    sc = s->cache;
+    if (sc)
+        return sc;
+
+// don't retry after error
+    if (s->error)
+        return NULL;
+
+// load it in
+    data = S_LoadWav(s);
+    if (!data)
+        return NULL;
+
 #if USE_OPENAL
     if (s_started == SS_OAL)
         sc = AL_UploadSfx(s);
 #endif
 
 #if USE_SNDDMA
-    if (s_started == SS_DMA)
-        sc = ResampleSfx(s);
+    if (s_started == SS_DMA) {
+        sc = ResampleSfx(s, &s_info);
+        if (!sc)
+            Com_DPrintf("%s resampled to zero length\n", s_info.name);
+    }
 #endif
 
-fail:
     FS_FreeFile(data);
     return sc;
 }
 
+#if USE_SNDDMA
+
+#define MAX_SOUND_REQUESTS  64
+
+typedef struct {
+    sfx_t       *sfx;
+    byte        *rawdata;
+    wavinfo_t   info;
+} soundreq_t;
+
+static void resample_request(void *arg, int index)
+{
+    soundreq_t *req = (soundreq_t *)arg + index;
+
+    ResampleSfx(req->sfx, &req->info);
+}
+
+static void load_requests(soundreq_t *reqs, int count)
+{
+    soundreq_t  *req;
+    int         i;
+
+    Job_ParallelFor(resample_request, reqs, count);
+
+    for (i = 0, req = reqs; i < count; i++, req++) {
+        if (!req->sfx->cache)
+            Com_DPrintf("%s resampled to zero length\n", req->info.name);
+        FS_FreeFile(req->rawdata);
+    }
+}
+
+#endif
+
+/*
+==============
+S_LoadSounds
+
+Loads all sounds in the given array. With software mixing, files are
+read and parsed here and resampled in batches on the job threads.
+==============
+*/
+void S_LoadSounds(sfx_t *list, int count)
+{
+#if USE_SNDDMA
+    soundreq_t  reqs[MAX_SOUND_REQUESTS];
+    int         numreqs;
+    sfx_t       *s;
+    byte        *data;
+    int         i;
+
+    if (s_started == SS_DMA) {
+        numreqs = 0;
+        for (i = 0, s = list; i < count; i++, s++) {
+            if (!s->name[0] || s->name[0] == '*')
+                continue;
+            if (s->cache || s->error)
+                continue;
+            data = S_LoadWav(s);
+            if (!data)
+                continue;
+            reqs[numreqs].sfx = s;
+            reqs[numreqs].rawdata = data;
+            reqs[numreqs].info = s_info;
+            if (++numreqs == MAX_SOUND_REQUESTS) {
+                load_requests(reqs, numreqs);
+                numreqs = 0;
+            }
+        }
+        load_requests(reqs, numreqs);
+        return;
+    }
+#endif
+
+    for (; count > 0; count--, list++) {
+        if (list->name[0])
+            S_LoadSound(list);
+    }
+}
@@ -18,6 +18,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // snd_mix.c -- portable code to mix sounds for snd_dma.c
 
 #include "sound.h"
+#include "common/x86/cpu.h"
+#if USE_TESTS
+#include "system/system.h"
+#endif
 
 #define    PAINTBUFFER_SIZE    2048
 
@@ -27,7 +31,57 @@ static int snd_vol;
 samplepair_t s_rawsamples[S_MAX_RAW_SAMPLES];
 int          s_rawend = 0;
 
-static void WriteLinearBlast(int16_t *out, samplepair_t *samp, int count)
+/*
+===============================================================================
+
+MIXING KERNELS
+
+Channel volumes passed to paint kernels are 0-255. SIMD kernels produce
+output identical to the scalar versions: products are computed exactly
+in 32 bits by splitting the scale into two halves that fit into 16 bits.
+
+===============================================================================
+*/
+
+typedef void (*paint8func_t)(samplepair_t *, const uint8_t *, int, int, int);
+typedef void (*paint16func_t)(samplepair_t *, const int16_t *, int, int, int);
+typedef void (*clipfunc_t)(int16_t *, const samplepair_t *, int);
+
+static void paint8_c(samplepair_t *samp, const uint8_t *sfx, int count, int leftvol, int rightvol)
+{
+    int data;
+    int *lscale, *rscale;
+    int i;
+
+    lscale = snd_scaletable[leftvol >> 3];
+    rscale = snd_scaletable[rightvol >> 3];
+
+    for (i = 0; i < count; i++, samp++) {
+        data = *sfx++;
+        samp->left += lscale[data];
+        samp->right += rscale[data];
+    }
+}
+
+static void paint16_c(samplepair_t *samp, const int16_t *sfx, int count, int leftvol, int rightvol)
+{
+    int data;
+    int left, right;
+    int i;
+
+    leftvol *= snd_vol;
+    rightvol *= snd_vol;
+
+    for (i = 0; i < count; i++, samp++) {
+        data = *sfx++;
+        left = (data * leftvol) >> 8;
+        right = (data * rightvol) >> 8;
+        samp->left += left;
+        samp->right += right;
+    }
+}
+
+static void clip_c(int16_t *out, const samplepair_t *samp, int count)
 {
     int i, val;
 
@@ -40,6 +94,108 @@ static void WriteLinearBlast(int16_t *out, samplepair_t *samp, int count)
     }
 }
 
+#if USE_X86_SIMD
+
+#include <emmintrin.h>
+
+// multiplies each sample by left and right scales, producing interleaved
+// samplepairs. scales must be in 0-65535 range.
+#define MADD_COEFS(l, r) \
+    _mm_setr_epi16((l) >> 1, (l) - ((l) >> 1), (r) >> 1, (r) - ((r) >> 1), \
+                   (l) >> 1, (l) - ((l) >> 1), (r) >> 1, (r) - ((r) >> 1))
+
+// adds 8 scaled samples in d to 8 samplepairs at p
+#define PAINT8_SSE2(p, d, coefs, shift) do { \
+    __m128i *o = (__m128i *)(p); \
+    __m128i lo = _mm_unpacklo_epi16(d, d); \
+    __m128i hi = _mm_unpackhi_epi16(d, d); \
+    __m128i s0 = _mm_madd_epi16(_mm_unpacklo_epi32(lo, lo), coefs); \
+    __m128i s1 = _mm_madd_epi16(_mm_unpackhi_epi32(lo, lo), coefs); \
+    __m128i s2 = _mm_madd_epi16(_mm_unpacklo_epi32(hi, hi), coefs); \
+    __m128i s3 = _mm_madd_epi16(_mm_unpackhi_epi32(hi, hi), coefs); \
+    _mm_storeu_si128(o + 0, _mm_add_epi32(_mm_loadu_si128(o + 0), _mm_srai_epi32(s0, shift))); \
+    _mm_storeu_si128(o + 1, _mm_add_epi32(_mm_loadu_si128(o + 1), _mm_srai_epi32(s1, shift))); \
+    _mm_storeu_si128(o + 2, _mm_add_epi32(_mm_loadu_si128(o + 2), _mm_srai_epi32(s2, shift))); \
+    _mm_storeu_si128(o + 3, _mm_add_epi32(_mm_loadu_si128(o + 3), _mm_srai_epi32(s3, shift))); \
+} while (0)
+
+X86_TARGET("sse2")
+static void paint8_sse2(samplepair_t *samp, const uint8_t *sfx, int count, int leftvol, int rightvol)
+{
+    // same as snd_scaletable entries
+    int lscale = (leftvol >> 3) * 8 * snd_vol;
+    int rscale = (rightvol >> 3) * 8 * snd_vol;
+    __m128i coefs = MADD_COEFS(lscale, rscale);
+    __m128i bias = _mm_set1_epi16(128);
+    __m128i zero = _mm_setzero_si128();
+    __m128i d;
+    int i;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        d = _mm_loadl_epi64((const __m128i *)(sfx + i));
+        d = _mm_sub_epi16(_mm_unpacklo_epi8(d, zero), bias);
+        PAINT8_SSE2(samp + i, d, coefs, 0);
+    }
+
+    paint8_c(samp + i, sfx + i, count - i, leftvol, rightvol);
+}
+
+X86_TARGET("sse2")
+static void paint16_sse2(samplepair_t *samp, const int16_t *sfx, int count, int leftvol, int rightvol)
+{
+    __m128i coefs = MADD_COEFS(leftvol * snd_vol, rightvol * snd_vol);
+    __m128i d;
+    int i;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        d = _mm_loadu_si128((const __m128i *)(sfx + i));
+        PAINT8_SSE2(samp + i, d, coefs, 8);
+    }
+
+    paint16_c(samp + i, sfx + i, count - i, leftvol, rightvol);
+}
+
+X86_TARGET("sse2")
+static void clip_sse2(int16_t *out, const samplepair_t *samp, int count)
+{
+    __m128i a, b;
+    int i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(samp + i + 0)), 8);
+        b = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(samp + i + 2)), 8);
+        _mm_storeu_si128((__m128i *)(out + i * 2), _mm_packs_epi32(a, b));
+    }
+
+    clip_c(out + i * 2, samp + i, count - i);
+}
+
+#endif // USE_X86_SIMD
+
+static const struct {
+    const char      *name;
+    unsigned        cpu;
+    paint8func_t    paint8;
+    paint16func_t   paint16;
+    clipfunc_t      clip;
+} mix_kernels[] = {
+#if USE_X86_SIMD
+    { "sse2", CPU_SSE2, paint8_sse2, paint16_sse2, clip_sse2 },
+#endif
+    { "c", 0, paint8_c, paint16_c, clip_c }
+};
+
+// selected by S_InitMixer
+static int mix_kernel = q_countof(mix_kernels) - 1;
+
+/*
+===============================================================================
+
+PAINT BUFFER TRANSFER
+
+===============================================================================
+*/
+
 static void TransferStereo16(samplepair_t *samp, int endtime)
 {
     int lpos;
@@ -58,7 +214,7 @@ static void TransferStereo16(samplepair_t *samp, int endtime)
             count = endtime - ltime;
 
         // write a linear blast of samples
-        WriteLinearBlast(out, samp, count);
+        mix_kernels[mix_kernel].clip(out, samp, count);
 
         samp += count;
         ltime += count;
@@ -130,48 +286,26 @@ CHANNEL MIXING
 
 static void Paint8(channel_t *ch, sfxcache_t *sc, int count, samplepair_t *samp)
 {
-    int data;
-    int *lscale, *rscale;
-    uint8_t *sfx;
-    int i;
-
     if (ch->leftvol > 255)
         ch->leftvol = 255;
     if (ch->rightvol > 255)
         ch->rightvol = 255;
 
-    lscale = snd_scaletable[ch->leftvol >> 3];
-    rscale = snd_scaletable[ch->rightvol >> 3];
-    sfx = (uint8_t *)sc->data + ch->pos;
-
-    for (i = 0; i < count; i++, samp++) {
-        data = *sfx++;
-        samp->left += lscale[data];
-        samp->right += rscale[data];
-    }
+    mix_kernels[mix_kernel].paint8(samp, (uint8_t *)sc->data + ch->pos,
+                                   count, ch->leftvol, ch->rightvol);
 
     ch->pos += count;
 }
 
 static void Paint16(channel_t *ch, sfxcache_t *sc, int count, samplepair_t *samp)
 {
-    int data;
-    int left, right;
-    int leftvol, rightvol;
-    int16_t *sfx;
-    int i;
-
-    leftvol = ch->leftvol * snd_vol;
-    rightvol = ch->rightvol * snd_vol;
-    sfx = (int16_t *)sc->data + ch->pos;
+    if (ch->leftvol > 255)
+        ch->leftvol = 255;
+    if (ch->rightvol > 255)
+        ch->rightvol = 255;
 
-    for (i = 0; i < count; i++, samp++) {
-        data = *sfx++;
-        left = (data * leftvol) >> 8;
-        right = (data * rightvol) >> 8;
-        samp->left += left;
-        samp->right += right;
-    }
+    mix_kernels[mix_kernel].paint16(samp, (int16_t *)sc->data + ch->pos,
+                                    count, ch->leftvol, ch->rightvol);
 
     ch->pos += count;
 }
@@ -216,7 +350,7 @@ void S_PaintChannels(int endtime)
             ltime = paintedtime;
 
             while (ltime < end) {
-                if (!ch->sfx || (!ch->leftvol && !ch->rightvol))
+                if (!ch->sfx)
                     break;
 
                 // max painting is to the end of the buffer
@@ -232,7 +366,9 @@ void S_PaintChannels(int endtime)
 
                 if (count > 0 && ch->sfx) {
                     samplepair_t *samp = &paintbuffer[ltime - paintedtime];
-                    if (sc->width == 1)
+                    if (!ch->audible || (!ch->leftvol && !ch->rightvol))
+                        ch->pos += count;   // virtual voice
+                    else if (sc->width == 1)
                         Paint8(ch, sc, count, samp);
                     else
                         Paint16(ch, sc, count, samp);
@@ -294,6 +430,107 @@ void S_InitScaletable(void)
     s_volume->modified = qfalse;
 }
 
+void S_InitMixer(void)
+{
+    unsigned features = X86_CPUFeatures();
+    int i;
+
+    for (i = 0; i < q_countof(mix_kernels); i++) {
+        if ((mix_kernels[i].cpu & features) == mix_kernels[i].cpu) {
+            break;
+        }
+    }
+
+    mix_kernel = i;
+    Com_DPrintf("Using %s mixing kernels\n", mix_kernels[i].name);
+
+    S_InitScaletable();
+}
+
+#if USE_TESTS
+
+#define MIXTEST_CHANNELS    32
+#define MIXTEST_LENGTH      (PAINTBUFFER_SIZE * 4)
+
+/*
+=================
+S_MixTest_f
+
+Mixes synthetic sounds with all kernels supported by this CPU without
+touching the sound device, reports channels of PAINTBUFFER_SIZE samples
+mixed per millisecond and checks output against the scalar kernels.
+=================
+*/
+void S_MixTest_f(void)
+{
+    unsigned    features = X86_CPUFeatures();
+    static samplepair_t paintbuffer[PAINTBUFFER_SIZE], reference[PAINTBUFFER_SIZE];
+    static int16_t out[PAINTBUFFER_SIZE * 2], outref[PAINTBUFFER_SIZE * 2];
+    uint8_t     *data8;
+    int16_t     *data16;
+    unsigned    start, msec[2];
+    int         i, j, k, width, passes, pos, errors;
+
+    passes = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 1000;
+    clamp(passes, 1, 100000);
+
+    S_InitScaletable();
+
+    data8 = S_Malloc(MIXTEST_LENGTH);
+    data16 = S_Malloc(MIXTEST_LENGTH * sizeof(data16[0]));
+    for (i = 0; i < MIXTEST_LENGTH; i++) {
+        data16[i] = rand() ^ (rand() << 8);
+        data8[i] = data16[i];
+    }
+
+    errors = 0;
+    for (j = q_countof(mix_kernels) - 1; j >= 0; j--) {
+        if ((mix_kernels[j].cpu & features) != mix_kernels[j].cpu) {
+            continue;
+        }
+
+        for (width = 1; width <= 2; width++) {
+            start = Sys_Milliseconds();
+            for (i = 0; i < passes; i++) {
+                memset(paintbuffer, 0, sizeof(paintbuffer));
+                for (k = 0; k < MIXTEST_CHANNELS; k++) {
+                    // odd offsets and lengths exercise unaligned heads and tails
+                    pos = (k * 331) % (MIXTEST_LENGTH - PAINTBUFFER_SIZE);
+                    if (width == 1)
+                        mix_kernels[j].paint8(paintbuffer + (k & 3), data8 + pos,
+                                              PAINTBUFFER_SIZE - 3 - k, k * 8, 255 - k * 8);
+                    else
+                        mix_kernels[j].paint16(paintbuffer + (k & 3), data16 + pos,
+                                               PAINTBUFFER_SIZE - 3 - k, k * 8, 255 - k * 8);
+                }
+                mix_kernels[j].clip(out, paintbuffer, PAINTBUFFER_SIZE);
+            }
+            msec[width - 1] = Sys_Milliseconds() - start;
+
+            // scalar kernel runs first and provides the reference output
+            if (j == q_countof(mix_kernels) - 1) {
+                memcpy(reference, paintbuffer, sizeof(reference));
+                memcpy(outref, out, sizeof(outref));
+            } else if (memcmp(reference, paintbuffer, sizeof(reference)) || memcmp(outref, out, sizeof(outref))) {
+                Com_Printf("%s: %d-bit mix mismatch\n", mix_kernels[j].name, width * 8);
+                errors++;
+            }
+        }
+
+        Com_Printf("%-4s: %.1f 8-bit, %.1f 16-bit channels/msec%s\n", mix_kernels[j].name,
+                   (float)passes * MIXTEST_CHANNELS / max(msec[0], 1),
+                   (float)passes * MIXTEST_CHANNELS / max(msec[1], 1),
+                   j == mix_kernel ? " (selected)" : "");
+    }
+
+    Com_Printf("%d errors\n", errors);
+
+    Z_Free(data16);
+    Z_Free(data8);
+}
+
+#endif // USE_TESTS
+
 /*
  * Cinematic streaming and voice over network.
  * This could be used for chat over network, but
@@ -311,6 +548,8 @@ S_RawSamples(int samples, int rate, int width,
 	  return;
   }
 
+  DMA_LockMixer();
+
   if (s_rawend < paintedtime)
     s_rawend = paintedtime;
 
@@ -395,6 +634,24 @@ S_RawSamples(int samples, int rate, int width,
       s_rawsamples[dst].right = (((byte *)data)[src] - 128) * intVolume;
     }
   }
+
+  DMA_UnlockMixer();
+}
+
+/*
+ * Returns true if the raw sample buffer is not filled
+ * ahead of the mixer far enough.
+ */
+qboolean
+S_NeedRawSamples(void)
+{
+  qboolean need;
+
+  DMA_LockMixer();
+  need = paintedtime + S_MAX_RAW_SAMPLES - 2048 > s_rawend;
+  DMA_UnlockMixer();
+
+  return need;
 }
 
 void S_UnqueueRawSamples()
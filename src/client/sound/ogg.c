@@ -39,6 +39,7 @@
 #include "shared/shared.h"
 #include "sound.h"
 #include "client/sound/vorbis.h"
+#include "system/threads.h"
 
 #define STB_VORBIS_NO_PUSHDATA_API
 #include "stb_vorbis.c"
@@ -71,6 +72,30 @@ struct {
 	int numsamples;
 } ogg_saved_state;
 
+/* Size of the decoded sample ring in shorts. About 1.5 seconds of
+   44.1 kHz stereo music, must be a power of two. */
+#define OGG_RING_SIZE 0x20000
+
+/* Read size for both the decoder thread and the client frame. */
+#define OGG_CHUNK_SIZE 4096
+
+/* Background decoder state. The decoder thread keeps the ring filled
+   from the attached file, so OGG_Stream only copies decoded samples
+   out and track changes don't stall the client frame. */
+static struct {
+	qthread_t *thread;
+	qmutex_t *lock;
+	qcond_t *wake;      /* signalled on new work or shutdown */
+	qcond_t *idle;      /* signalled when the decoder leaves stb_vorbis */
+	stb_vorbis *file;   /* attached file, NULL when detached */
+	qboolean busy;      /* decoder is reading from the file */
+	qboolean eof;       /* end of attached file reached */
+	qboolean shutdown;
+	unsigned head;      /* write position, head - tail is the fill level */
+	unsigned tail;      /* read position */
+	short ring[OGG_RING_SIZE];
+} ogg_dec;
+
 // --------
 
 /*
@@ -229,15 +254,154 @@ OGG_InitTrackList(void)
 // --------
 
 /*
- * Play a portion of the currently opened file.
+ * Decoder thread. Decodes the attached file into the ring
+ * until it is full or the end of file is reached.
  */
-void
-static OGG_Read(void)
+static void
+OGG_DecodeThread(void *arg)
+{
+	short samples[OGG_CHUNK_SIZE];
+
+	Sys_LockMutex(ogg_dec.lock);
+
+	while (!ogg_dec.shutdown)
+	{
+		stb_vorbis *file = ogg_dec.file;
+
+		if (!file || ogg_dec.eof || ogg_dec.head - ogg_dec.tail > OGG_RING_SIZE - OGG_CHUNK_SIZE)
+		{
+			Sys_WaitCond(ogg_dec.wake, ogg_dec.lock);
+			continue;
+		}
+
+		ogg_dec.busy = qtrue;
+		Sys_UnlockMutex(ogg_dec.lock);
+
+		int count = stb_vorbis_get_samples_short_interleaved(file, file->channels, samples,
+			OGG_CHUNK_SIZE / file->channels) * file->channels;
+
+		Sys_LockMutex(ogg_dec.lock);
+		ogg_dec.busy = qfalse;
+
+		/* File may have been detached meanwhile, drop the samples then. */
+		if (ogg_dec.file == file)
+		{
+			if (count <= 0)
+			{
+				ogg_dec.eof = qtrue;
+			}
+
+			for (int i = 0; i < count; i++)
+			{
+				ogg_dec.ring[ogg_dec.head++ & (OGG_RING_SIZE - 1)] = samples[i];
+			}
+		}
+
+		Sys_BroadcastCond(ogg_dec.idle);
+	}
+
+	Sys_UnlockMutex(ogg_dec.lock);
+}
+
+/*
+ * Stop decoding ahead from the current file and drop decoded
+ * samples. The file may be seeked or closed after this.
+ */
+static void
+OGG_Detach(void)
+{
+	if (!ogg_dec.thread)
+	{
+		return;
+	}
+
+	Sys_LockMutex(ogg_dec.lock);
+
+	ogg_dec.file = NULL;
+
+	while (ogg_dec.busy)
+	{
+		Sys_WaitCond(ogg_dec.idle, ogg_dec.lock);
+	}
+
+	ogg_dec.head = ogg_dec.tail = 0;
+	ogg_dec.eof = qfalse;
+
+	Sys_UnlockMutex(ogg_dec.lock);
+}
+
+/*
+ * Start decoding ahead from the current file.
+ */
+static void
+OGG_Attach(void)
+{
+	if (!ogg_dec.thread)
+	{
+		return;
+	}
+
+	Sys_LockMutex(ogg_dec.lock);
+
+	ogg_dec.file = ogg_file;
+	ogg_dec.head = ogg_dec.tail = 0;
+	ogg_dec.eof = qfalse;
+
+	Sys_SignalCond(ogg_dec.wake);
+	Sys_UnlockMutex(ogg_dec.lock);
+}
+
+/*
+ * Fetch decoded samples from the ring, or decode them directly if
+ * there is no decoder thread. Returns the number of sample frames,
+ * 0 if the decoder is behind and -1 at end of file.
+ */
+static int
+OGG_Fetch(short *samples)
 {
-	short samples[4096] = {0};
+	int channels = ogg_file->channels;
+
+	if (!ogg_dec.thread)
+	{
+		int read_samples = stb_vorbis_get_samples_short_interleaved(ogg_file, channels, samples,
+			OGG_CHUNK_SIZE / channels);
 
-	int read_samples = stb_vorbis_get_samples_short_interleaved(ogg_file, ogg_file->channels, samples,
-		sizeof(samples) / ogg_file->channels);
+		return read_samples > 0 ? read_samples : -1;
+	}
+
+	Sys_LockMutex(ogg_dec.lock);
+
+	/* The ring is always filled with whole sample frames. */
+	int count = min(ogg_dec.head - ogg_dec.tail, OGG_CHUNK_SIZE / channels * channels);
+
+	for (int i = 0; i < count; i++)
+	{
+		samples[i] = ogg_dec.ring[ogg_dec.tail++ & (OGG_RING_SIZE - 1)];
+	}
+
+	qboolean eof = ogg_dec.eof && ogg_dec.head == ogg_dec.tail;
+
+	Sys_SignalCond(ogg_dec.wake);
+	Sys_UnlockMutex(ogg_dec.lock);
+
+	if (count)
+	{
+		return count / channels;
+	}
+
+	return eof ? -1 : 0;
+}
+
+/*
+ * Play a portion of the currently opened file. Returns
+ * qfalse if no decoded samples are available right now.
+ */
+static qboolean
+OGG_Read(void)
+{
+	short samples[OGG_CHUNK_SIZE];
+
+	int read_samples = OGG_Fetch(samples);
 
 	if (read_samples > 0)
 	{
@@ -246,13 +410,14 @@ static OGG_Read(void)
 		S_RawSamples(read_samples, ogg_file->sample_rate, ogg_file->channels, ogg_file->channels,
 			(byte *)samples, S_GetLinearVolume(ogg_volume->value));
 	}
-	else
+	else if (read_samples < 0)
 	{
 		// We cannot call OGG_Stop() here. It flushes the OpenAL sample
 		// queue, thus about 12 seconds of music are lost. Instead we
 		// just set the OGG state to stop and open a new file. The new
 		// files content is added to the sample queue after the remaining
 		// samples from the old file.
+		OGG_Detach();
 		stb_vorbis_close(ogg_file);
 		ogg_status = STOP;
 		ogg_numbufs = 0;
@@ -260,6 +425,8 @@ static OGG_Read(void)
 
 		OGG_PlayTrack(ogg_curfile);
 	}
+
+	return read_samples != 0;
 }
 
 /*
@@ -291,9 +458,12 @@ OGG_Stream(void)
 
 			/* active_buffers are all active OpenAL buffers,
 			   buffering normal sfx _and_ ogg/vorbis samples. */
-			while (active_buffers <= ogg_numbufs)
+			while (ogg_status == PLAY && active_buffers <= ogg_numbufs)
 			{
-				OGG_Read();
+				if (!OGG_Read())
+				{
+					break;
+				}
 			}
 		}
 		else /* using SDL */
@@ -305,9 +475,12 @@ OGG_Stream(void)
 				   were played since the last call to this function.
 				   This keeps the buffer at all times at an "optimal"
 				   fill level. */
-				while (paintedtime + S_MAX_RAW_SAMPLES - 2048 > s_rawend)
+				while (ogg_status == PLAY && S_NeedRawSamples())
 				{
-					OGG_Read();
+					if (!OGG_Read())
+					{
+						break;
+					}
 				}
 			}
 		}
@@ -427,6 +600,8 @@ OGG_PlayTrack(int trackNo)
 		ogg_status = PLAY;
 	else
 		ogg_status = PAUSE;
+
+	OGG_Attach();
 }
 
 // ----
@@ -459,12 +634,12 @@ OGG_Info(void)
 	{
 		case PLAY:
 			Com_Printf("State: Playing file %d (%s) at %i samples.\n",
-			           ogg_curfile, ogg_tracks[ogg_curfile], stb_vorbis_get_sample_offset(ogg_file));
+			           ogg_curfile, ogg_tracks[ogg_curfile], ogg_numsamples);
 			break;
 
 		case PAUSE:
 			Com_Printf("State: Paused file %d (%s) at %i samples.\n",
-			           ogg_curfile, ogg_tracks[ogg_curfile], stb_vorbis_get_sample_offset(ogg_file));
+			           ogg_curfile, ogg_tracks[ogg_curfile], ogg_numsamples);
 			break;
 
 		case STOP:
@@ -499,6 +674,7 @@ OGG_Stop(void)
 	}
 #endif
 
+	OGG_Detach();
 	stb_vorbis_close(ogg_file);
 	ogg_status = STOP;
 	ogg_numbufs = 0;
@@ -628,8 +804,14 @@ OGG_RecoverState(void)
 	Cvar_SetValue(ogg_shuffle, 0, FROM_CODE);
 
 	OGG_PlayTrack(ogg_saved_state.curfile);
-	stb_vorbis_seek_frame(ogg_file, ogg_saved_state.numsamples);
-	ogg_numsamples = ogg_saved_state.numsamples;
+
+	if (ogg_status != STOP)
+	{
+		OGG_Detach();
+		stb_vorbis_seek_frame(ogg_file, ogg_saved_state.numsamples);
+		OGG_Attach();
+		ogg_numsamples = ogg_saved_state.numsamples;
+	}
 
 	Cvar_SetValue(ogg_shuffle, shuffle_state, FROM_CODE);
 }
@@ -666,6 +848,17 @@ OGG_Init(void)
 	ogg_numsamples = 0;
 	ogg_status = STOP;
 
+	// Decoder thread, falls back to decoding from OGG_Stream
+	ogg_dec.lock = Sys_CreateMutex();
+	ogg_dec.wake = Sys_CreateCond();
+	ogg_dec.idle = Sys_CreateCond();
+	ogg_dec.thread = Sys_CreateThread(OGG_DecodeThread, NULL);
+
+	if (!ogg_dec.thread)
+	{
+		Com_DPrintf("OGG_Init: couldn't create decoder thread\n");
+	}
+
 	ogg_started = qtrue;
 }
 
@@ -683,6 +876,21 @@ OGG_Shutdown(void)
 	// Music must be stopped.
 	OGG_Stop();
 
+	if (ogg_dec.thread)
+	{
+		Sys_LockMutex(ogg_dec.lock);
+		ogg_dec.shutdown = qtrue;
+		Sys_SignalCond(ogg_dec.wake);
+		Sys_UnlockMutex(ogg_dec.lock);
+
+		Sys_JoinThread(ogg_dec.thread);
+	}
+
+	Sys_DestroyCond(ogg_dec.idle);
+	Sys_DestroyCond(ogg_dec.wake);
+	Sys_DestroyMutex(ogg_dec.lock);
+	memset(&ogg_dec, 0, sizeof(ogg_dec));
+
 	// Free file lsit.
 	for(int i=0; i<MAX_NUM_OGGTRACKS; ++i)
 	{
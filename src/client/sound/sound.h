@@ -62,6 +62,12 @@ typedef struct playsound_s {
     qboolean    fixed_origin;   // use origin field instead of entnum's origin
     vec3_t      origin;
     unsigned    begin;          // begin on this sample
+#if USE_SNDDMA
+    int         servertime;     // for computing begin when issued from play queue
+    float       timeofs;
+    int         leftvol;        // spatialized when started
+    int         rightvol;
+#endif
 } playsound_t;
 
 // !!! if this is changed, the asm code must change !!!
@@ -79,6 +85,7 @@ typedef struct channel_s {
     float       master_vol;     // 0.0-1.0 master volume
     qboolean    fixed_origin;   // use origin instead of fetching entnum's origin
     qboolean    autosound;      // from an entity->sound, cleared each frame
+    qboolean    audible;        // mixed for real, virtual voices only advance
 #if USE_OPENAL
     int         autoframe;
     int         srcnum;
@@ -107,9 +114,18 @@ void DMA_SoundInfo(void);
 qboolean DMA_Init(void);
 void DMA_Shutdown(void);
 void DMA_Activate(void);
-int DMA_DriftBeginofs(float timeofs);
+int DMA_DriftBeginofs(int servertime, float timeofs);
 void DMA_ClearBuffer(void);
 void DMA_Update(void);
+void DMA_StartMixer(void);
+void DMA_StopMixer(void);
+qboolean DMA_MixerRunning(void);
+void DMA_LockMixer(void);
+void DMA_UnlockMixer(void);
+#else
+#define DMA_MixerRunning()  qfalse
+#define DMA_LockMixer()     (void)0
+#define DMA_UnlockMixer()   (void)0
 #endif
 
 #if USE_OPENAL
@@ -138,9 +154,12 @@ extern int active_buffers;
 
 extern qboolean s_active;
 
-#define MAX_CHANNELS            32
+// logical voices, only s_numvoices most audible ones are mixed
+#define MAX_CHANNELS            128
+#define MAX_VOICES              32
 extern  channel_t   channels[MAX_CHANNELS];
 extern  int         s_numchannels;
+extern  int         s_numvoices;
 
 extern  int         paintedtime;
 extern  playsound_t s_pendingplays;
@@ -170,11 +189,20 @@ extern cvar_t   *s_show;
 
 sfx_t *S_SfxForHandle(qhandle_t hSfx);
 sfxcache_t *S_LoadSound(sfx_t *s);
+void S_LoadSounds(sfx_t *list, int count);
 channel_t *S_PickChannel(int entnum, int entchannel);
+void S_ScheduleVoices(void);
 void S_IssuePlaysound(playsound_t *ps);
 void S_BuildSoundList(int *sounds);
+void S_ResetSounds(void);
 #if USE_SNDDMA
+void S_RunPlayQueue(void);
 void S_InitScaletable(void);
+void S_InitMixer(void);
 void S_PaintChannels(int endtime);
+qboolean S_NeedRawSamples(void);
+#if USE_TESTS
+void S_MixTest_f(void);
+#endif
 #endif
 
@@ -26,16 +26,22 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/cmd.h"
 #include "common/common.h"
 #include "common/files.h"
+#include "common/jobs.h"
 #include "common/bsp.h"
 #include "common/math.h"
 #include "common/utils.h"
 #include "common/mdfour.h"
 #include "system/hunk.h"
+#include "system/system.h"
 
 extern mtexinfo_t nulltexinfo;
 
 static cvar_t *map_visibility_patch;
 
+// shared rows returned by BSP_GetVisRow when there is nothing to look up
+static byte vis_all[VIS_MAX_BYTES];
+static byte vis_none[VIS_MAX_BYTES];
+
 /*
 ===============================================================================
 
@@ -44,14 +50,15 @@ static cvar_t *map_visibility_patch;
 ===============================================================================
 */
 
-#define ALLOC(size) \
-    Hunk_Alloc(&bsp->hunk, size)
-
+// Lump storage and counts are set up by BSP_Load before the loaders run,
+// so that loaders only depend on each other's sizes and base pointers and
+// can parse the lumps on job threads in any order.
 #define LOAD(func) \
-    static qerror_t BSP_Load##func(bsp_t *bsp, void *base, size_t count)
+    static qerror_t BSP_Load##func(bsp_t *bsp, void *base, size_t count, const char **error)
 
+// job threads can't print, BSP_Load prints the message after all lumps are parsed
 #define DEBUG(msg) \
-    Com_DPrintf("%s: %s\n", __func__, msg)
+    (*error = msg)
 
 LOAD(Visibility)
 {
@@ -67,8 +74,6 @@ LOAD(Visibility)
         return Q_ERR_TOO_FEW;
     }
 
-    bsp->numvisibility = count;
-    bsp->vis = ALLOC(count);
     memcpy(bsp->vis, base, count);
 
     numclusters = LittleLong(bsp->vis->numclusters);
@@ -110,9 +115,6 @@ LOAD(Texinfo)
     mtexinfo_t  *step;
 #endif
 
-    bsp->numtexinfo = count;
-    bsp->texinfo = ALLOC(sizeof(*out) * count);
-
     in = base;
     out = bsp->texinfo;
     for (i = 0; i < count; i++, in++, out++) {
@@ -169,9 +171,6 @@ LOAD(Planes)
     cplane_t    *out;
     int         i, j;
 
-    bsp->numplanes = count;
-    bsp->planes = ALLOC(sizeof(*out) * count);
-
     in = base;
     out = bsp->planes;
     for (i = 0; i < count; i++, in++, out++) {
@@ -193,9 +192,6 @@ LOAD(BrushSides)
     int         i;
     uint16_t    planenum, texinfo;
 
-    bsp->numbrushsides = count;
-    bsp->brushsides = ALLOC(sizeof(*out) * count);
-
     in = base;
     out = bsp->brushsides;
     for (i = 0; i < count; i++, in++, out++) {
@@ -227,9 +223,6 @@ LOAD(Brushes)
     int         i;
     uint32_t    firstside, numsides, lastside;
 
-    bsp->numbrushes = count;
-    bsp->brushes = ALLOC(sizeof(*out) * count);
-
     in = base;
     out = bsp->brushes;
     for (i = 0; i < count; i++, out++, in++) {
@@ -256,9 +249,6 @@ LOAD(LeafBrushes)
     int         i;
     uint16_t    brushnum;
 
-    bsp->numleafbrushes = count;
-    bsp->leafbrushes = ALLOC(sizeof(*out) * count);
-
     in = base;
     out = bsp->leafbrushes;
     for (i = 0; i < count; i++, in++, out++) {
@@ -281,9 +271,6 @@ LOAD(Lightmap)
         return Q_ERR_SUCCESS;
     }
 
-    bsp->numlightmapbytes = count;
-    bsp->lightmap = ALLOC(count);
-
     memcpy(bsp->lightmap, base, count);
 
     return Q_ERR_SUCCESS;
@@ -295,9 +282,6 @@ LOAD(Vertices)
     mvertex_t   *out;
     int         i, j;
 
-    bsp->numvertices = count;
-    bsp->vertices = ALLOC(sizeof(*out) * count);
-
     in = base;
     out = bsp->vertices;
     for (i = 0; i < count; i++, out++, in++) {
@@ -316,9 +300,6 @@ LOAD(Edges)
     int         i, j;
     uint16_t    vertnum;
 
-    bsp->numedges = count;
-    bsp->edges = ALLOC(sizeof(*out) * count);
-
     in = base;
     out = bsp->edges;
     for (i = 0; i < count; i++, out++, in++) {
@@ -342,9 +323,6 @@ LOAD(SurfEdges)
     int         i, vert;
     int32_t     index;
 
-    bsp->numsurfedges = count;
-    bsp->surfedges = ALLOC(sizeof(*out) * count);
-
     in = base;
     out = bsp->surfedges;
     for (i = 0; i < count; i++, out++, in++) {
@@ -377,9 +355,6 @@ LOAD(Faces)
     uint16_t    planenum, texinfo, side;
     uint32_t    lightofs;
 
-    bsp->numfaces = count;
-    bsp->faces = ALLOC(sizeof(*out) * count);
-
     in = base;
     out = bsp->faces;
     for (i = 0; i < count; i++, in++, out++) {
@@ -448,9 +423,6 @@ LOAD(LeafFaces)
     int         i;
     uint16_t    facenum;
 
-    bsp->numleaffaces = count;
-    bsp->leaffaces = ALLOC(sizeof(*out) * count);
-
     in = base;
     out = bsp->leaffaces;
     for (i = 0; i < count; i++, in++, out++) {
@@ -483,9 +455,6 @@ LOAD(Leafs)
         return Q_ERR_TOO_FEW;
     }
 
-    bsp->numleafs = count;
-    bsp->leafs = ALLOC(sizeof(*out) * count);
-
     in = base;
     out = bsp->leafs;
     for (i = 0; i < count; i++, in++, out++) {
@@ -568,9 +537,6 @@ LOAD(Nodes)
         return Q_ERR_TOO_FEW;
     }
 
-    bsp->numnodes = count;
-    bsp->nodes = ALLOC(sizeof(*out) * count);
-
     in = base;
     out = bsp->nodes;
     for (i = 0; i < count; i++, out++, in++) {
@@ -638,9 +604,6 @@ LOAD(Submodels)
         return Q_ERR_TOO_FEW;
     }
 
-    bsp->models = ALLOC(sizeof(*out) * count);
-    bsp->nummodels = count;
-
     in = base;
     out = bsp->models;
     for (i = 0; i < count; i++, in++, out++) {
@@ -687,21 +650,33 @@ LOAD(Submodels)
     return Q_ERR_SUCCESS;
 }
 
-// These are validated after all the areas are loaded
+// also calculates the last portal number used
+// by CM code to allocate portalopen[] array
 LOAD(AreaPortals)
 {
     dareaportal_t   *in;
     mareaportal_t   *out;
     int         i;
 
-    bsp->numareaportals = count;
-    bsp->areaportals = ALLOC(sizeof(*out) * count);
+    bsp->lastareaportal = 0;
 
     in = base;
     out = bsp->areaportals;
     for (i = 0; i < count; i++, in++, out++) {
         out->portalnum = LittleLong(in->portalnum);
         out->otherarea = LittleLong(in->otherarea);
+
+        if (out->portalnum >= MAX_MAP_AREAPORTALS) {
+            DEBUG("bad portalnum");
+            return Q_ERR_TOO_MANY;
+        }
+        if (out->portalnum > bsp->lastareaportal) {
+            bsp->lastareaportal = out->portalnum;
+        }
+        if (out->otherarea >= bsp->numareas) {
+            DEBUG("bad otherarea");
+            return Q_ERR_BAD_INDEX;
+        }
     }
 
     return Q_ERR_SUCCESS;
@@ -714,9 +689,6 @@ LOAD(Areas)
     int         i;
     uint32_t    numareaportals, firstareaportal, lastareaportal;
 
-    bsp->numareas = count;
-    bsp->areas = ALLOC(sizeof(*out) * count);
-
     in = base;
     out = bsp->areas;
     for (i = 0; i < count; i++, in++, out++) {
@@ -737,8 +709,6 @@ LOAD(Areas)
 
 LOAD(EntString)
 {
-    bsp->numentitychars = count;
-    bsp->entitystring = ALLOC(count + 1);
     memcpy(bsp->entitystring, base, count);
     bsp->entitystring[count] = 0;
 
@@ -753,45 +723,130 @@ LOAD(EntString)
 ===============================================================================
 */
 
+#undef DEBUG
+
+#define DEBUG(msg) \
+    Com_DPrintf("%s: %s\n", __func__, msg)
+
 typedef struct {
-    qerror_t (*load)(bsp_t *, void *, size_t);
+    qerror_t (*load)(bsp_t *, void *, size_t, const char **);
+    const char *name;
     unsigned lump;
     size_t disksize;
     size_t memsize;
     size_t maxcount;
+    size_t dataofs;     // bsp_t member the lump is loaded into
+    size_t countofs;    // bsp_t member holding the number of elements
 } lump_info_t;
 
-#define L(func, lump, disk_t, mem_t) \
-    { BSP_Load##func, LUMP_##lump, sizeof(disk_t), sizeof(mem_t), MAX_MAP_##lump }
+#define L(func, lump, disk_t, mem_t, data, count) \
+    { BSP_Load##func, #func, LUMP_##lump, sizeof(disk_t), sizeof(mem_t), MAX_MAP_##lump, \
+      q_offsetof(bsp_t, data), q_offsetof(bsp_t, count) }
 
+// visibility goes first, it is loaded ahead of the other lumps
 static const lump_info_t bsp_lumps[] = {
-    L(Visibility,   VISIBILITY,     byte,           byte),
-    L(Texinfo,      TEXINFO,        dtexinfo_t,     mtexinfo_t),
-    L(Planes,       PLANES,         dplane_t,       cplane_t),
-    L(BrushSides,   BRUSHSIDES,     dbrushside_t,   mbrushside_t),
-    L(Brushes,      BRUSHES,        dbrush_t,       mbrush_t),
-    L(LeafBrushes,  LEAFBRUSHES,    uint16_t,       mbrush_t *),
-    L(AreaPortals,  AREAPORTALS,    dareaportal_t,  mareaportal_t),
-    L(Areas,        AREAS,          darea_t,        marea_t),
+    L(Visibility,   VISIBILITY,     byte,           byte,           vis,            numvisibility),
+    L(Texinfo,      TEXINFO,        dtexinfo_t,     mtexinfo_t,     texinfo,        numtexinfo),
+    L(Planes,       PLANES,         dplane_t,       cplane_t,       planes,         numplanes),
+    L(BrushSides,   BRUSHSIDES,     dbrushside_t,   mbrushside_t,   brushsides,     numbrushsides),
+    L(Brushes,      BRUSHES,        dbrush_t,       mbrush_t,       brushes,        numbrushes),
+    L(LeafBrushes,  LEAFBRUSHES,    uint16_t,       mbrush_t *,     leafbrushes,    numleafbrushes),
+    L(AreaPortals,  AREAPORTALS,    dareaportal_t,  mareaportal_t,  areaportals,    numareaportals),
+    L(Areas,        AREAS,          darea_t,        marea_t,        areas,          numareas),
 #if USE_REF
-    L(Lightmap,     LIGHTING,       byte,           byte),
-    L(Vertices,     VERTEXES,       dvertex_t,      mvertex_t),
-    L(Edges,        EDGES,          dedge_t,        medge_t),
-    L(SurfEdges,    SURFEDGES,      uint32_t,       msurfedge_t),
-    L(Faces,        FACES,          dface_t,        mface_t),
-    L(LeafFaces,    LEAFFACES,      uint16_t,       mface_t *),
+    L(Lightmap,     LIGHTING,       byte,           byte,           lightmap,       numlightmapbytes),
+    L(Vertices,     VERTEXES,       dvertex_t,      mvertex_t,      vertices,       numvertices),
+    L(Edges,        EDGES,          dedge_t,        medge_t,        edges,          numedges),
+    L(SurfEdges,    SURFEDGES,      uint32_t,       msurfedge_t,    surfedges,      numsurfedges),
+    L(Faces,        FACES,          dface_t,        mface_t,        faces,          numfaces),
+    L(LeafFaces,    LEAFFACES,      uint16_t,       mface_t *,      leaffaces,      numleaffaces),
 #endif
-    L(Leafs,        LEAFS,          dleaf_t,        mleaf_t),
-    L(Nodes,        NODES,          dnode_t,        mnode_t),
-    L(Submodels,    MODELS,         dmodel_t,       mmodel_t),
-    L(EntString,    ENTSTRING,      char,           char),
+    L(Leafs,        LEAFS,          dleaf_t,        mleaf_t,        leafs,          numleafs),
+    L(Nodes,        NODES,          dnode_t,        mnode_t,        nodes,          numnodes),
+    L(Submodels,    MODELS,         dmodel_t,       mmodel_t,       models,         nummodels),
+    L(EntString,    ENTSTRING,      char,           char,           entitystring,   numentitychars),
     { NULL }
 };
 
 #undef L
 
+#define NUM_BSP_LUMPS   (q_countof(bsp_lumps) - 1)
+
+// Sets the lump count and reserves hunk memory for it. Empty visibility and
+// lightmap lumps are left NULL, the entity string gets a terminator.
+static void BSP_AllocLump(bsp_t *bsp, const lump_info_t *info, size_t count)
+{
+    size_t size = count * info->memsize;
+
+    *(int *)((byte *)bsp + info->countofs) = count;
+
+    if (!count && (info->lump == LUMP_VISIBILITY || info->lump == LUMP_LIGHTING)) {
+        return;
+    }
+    if (info->lump == LUMP_ENTSTRING) {
+        size++;
+    }
+
+    *(void **)((byte *)bsp + info->dataofs) = Hunk_Alloc(&bsp->hunk, size);
+}
+
+typedef struct {
+    bsp_t       *bsp;
+    byte        *buf;
+    size_t      filelen;
+    byte        *lumpdata[HEADER_LUMPS];
+    size_t      lumpcount[HEADER_LUMPS];
+    qerror_t    ret[NUM_BSP_LUMPS];
+    const char  *error[NUM_BSP_LUMPS];
+} lump_job_t;
+
+static void BSP_ParseLump(lump_job_t *job, int index)
+{
+    const lump_info_t *info = &bsp_lumps[index];
+
+    job->error[index] = NULL;
+    job->ret[index] = info->load(job->bsp, job->lumpdata[info->lump],
+                                 job->lumpcount[info->lump], &job->error[index]);
+}
+
+// job function, index 0 is taken by the visibility lump that is parsed before
+// the others, so the job with that index calculates the file checksum instead
+static void BSP_ParseLumpJob(void *arg, int index)
+{
+    lump_job_t *job = arg;
+
+    if (index == 0) {
+        job->bsp->checksum = LittleLong(Com_BlockChecksum(job->buf, job->filelen));
+        return;
+    }
+
+    BSP_ParseLump(job, index);
+}
+
+static qerror_t BSP_ParseResult(lump_job_t *job, int index)
+{
+    if (job->ret[index] && job->error[index]) {
+        Com_DPrintf("BSP_Load%s: %s\n", bsp_lumps[index].name, job->error[index]);
+    }
+
+    return job->ret[index];
+}
+
 static list_t   bsp_cache;
 
+// memory taken by the decompressed vis matrices
+static size_t BSP_VisMatrixSize(bsp_t *bsp)
+{
+    size_t size = 0;
+
+    if (bsp->vis) {
+        size = (size_t)bsp->visrowsize * bsp->vis->numclusters;
+        size *= !!bsp->pvs_matrix + !!bsp->pvs2_matrix + !!bsp->phs_matrix;
+    }
+
+    return size;
+}
+
 static void BSP_List_f(void)
 {
     bsp_t *bsp;
@@ -806,9 +861,11 @@ static void BSP_List_f(void)
     bytes = 0;
 
     LIST_FOR_EACH(bsp_t, bsp, &bsp_cache, entry) {
+        size_t size = bsp->hunk.mapped + BSP_VisMatrixSize(bsp);
+
         Com_Printf("%8"PRIz" : %s (%d refs)\n",
-                   bsp->hunk.mapped, bsp->name, bsp->refcount);
-        bytes += bsp->hunk.mapped;
+                   size, bsp->name, bsp->refcount);
+        bytes += size;
     }
     Com_Printf("Total resident: %"PRIz"\n", bytes);
 }
@@ -904,31 +961,6 @@ static qerror_t BSP_ValidateTree(bsp_t *bsp)
     return Q_ERR_SUCCESS;
 }
 
-// also calculates the last portal number used
-// by CM code to allocate portalopen[] array
-static qerror_t BSP_ValidateAreaPortals(bsp_t *bsp)
-{
-    mareaportal_t   *p;
-    int             i;
-
-    bsp->lastareaportal = 0;
-    for (i = 0, p = bsp->areaportals; i < bsp->numareaportals; i++, p++) {
-        if (p->portalnum >= MAX_MAP_AREAPORTALS) {
-            DEBUG("bad portalnum");
-            return Q_ERR_TOO_MANY;
-        }
-        if (p->portalnum > bsp->lastareaportal) {
-            bsp->lastareaportal = p->portalnum;
-        }
-        if (p->otherarea >= bsp->numareas) {
-            DEBUG("bad otherarea");
-            return Q_ERR_BAD_INDEX;
-        }
-    }
-
-    return Q_ERR_SUCCESS;
-}
-
 void BSP_Free(bsp_t *bsp)
 {
     if (!bsp) {
@@ -938,12 +970,10 @@ void BSP_Free(bsp_t *bsp)
         Com_Error(ERR_FATAL, "%s: negative refcount", __func__);
     }
     if (--bsp->refcount == 0) {
-		if (bsp->pvs2_matrix)
-		{
-			// free the PVS2 matrix separately - it's not part of the hunk
-			Z_Free(bsp->pvs2_matrix);
-			bsp->pvs2_matrix = NULL;
-		}
+		// free the vis matrices separately - they're not part of the hunk
+		Z_Free(bsp->pvs_matrix);
+		Z_Free(bsp->pvs2_matrix);
+		Z_Free(bsp->phs_matrix);
 
         Hunk_Free(&bsp->hunk);
         List_Remove(&bsp->entry);
@@ -951,24 +981,33 @@ void BSP_Free(bsp_t *bsp)
     }
 }
 
-static void BSP_BuildPvsMatrix(bsp_t *bsp)
+typedef struct {
+	bsp_t *bsp;
+	char *matrix;
+	int vis;
+} vis_matrix_job_t;
+
+static void BSP_BuildVisRowJob(void *arg, int cluster)
 {
-	if (!bsp->vis)
-		return;
+	vis_matrix_job_t *job = arg;
+
+	BSP_DecompressVis(job->bsp, (byte*)job->matrix + job->bsp->visrowsize * cluster, cluster, job->vis);
+}
 
+// Decompresses the PVS or PHS rows of all clusters, in parallel on the job threads
+static char* BSP_BuildVisMatrix(bsp_t *bsp, int vis)
+{
 	// a typical map with 2K clusters will take half a megabyte of memory for the matrix
 	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
 
-	// allocate the matrix but don't set it in the BSP structure yet: 
-	// we want BSP_CluterVis to use the old PVS data here, and not the new empty matrix
-	char* pvs_matrix = Z_Mallocz(matrix_size);
-	
-	for (int cluster = 0; cluster < bsp->vis->numclusters; cluster++)
-	{
-		BSP_ClusterVis(bsp, pvs_matrix + bsp->visrowsize * cluster, cluster, DVIS_PVS);
-	}
+	vis_matrix_job_t job;
+	job.bsp = bsp;
+	job.matrix = Z_Mallocz(matrix_size);
+	job.vis = vis;
+
+	Job_ParallelFor(BSP_BuildVisRowJob, &job, bsp->vis->numclusters);
 
-	bsp->pvs_matrix = pvs_matrix;
+	return job.matrix;
 }
 
 char* BSP_GetPvs(bsp_t *bsp, int cluster)
@@ -1015,7 +1054,8 @@ static qboolean BSP_GetPatchedPVSFileName(const char* map_path, char pvs_path[MA
 	return qtrue;
 }
 
-// Loads the first- and second-order PVS matrices from a file called `maps/pvs/<mapname>.bin`
+// Loads the first- and second-order PVS matrices and the PHS matrix from a file called `maps/pvs/<mapname>.bin`.
+// Files written before the PHS matrix was added only have the PVS matrices.
 static qboolean BSP_LoadPatchedPVS(bsp_t *bsp)
 {
 	char pvs_path[MAX_QPATH];
@@ -1031,7 +1071,7 @@ static qboolean BSP_LoadPatchedPVS(bsp_t *bsp)
 		return qfalse;
 
 	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
-	if (filelen != matrix_size * 2)
+	if (filelen != matrix_size * 2 && filelen != matrix_size * 3)
 	{
 		FS_FreeFile(filebuf);
 		return qfalse;
@@ -1043,11 +1083,17 @@ static qboolean BSP_LoadPatchedPVS(bsp_t *bsp)
 	bsp->pvs2_matrix = Z_Malloc(matrix_size);
 	memcpy(bsp->pvs2_matrix, filebuf + matrix_size, matrix_size);
 
+	if (filelen == matrix_size * 3)
+	{
+		bsp->phs_matrix = Z_Malloc(matrix_size);
+		memcpy(bsp->phs_matrix, filebuf + matrix_size * 2, matrix_size);
+	}
+
 	FS_FreeFile(filebuf);
 	return qtrue;
 }
 
-// Saves the first- and second-order PVS matrices to a file called `maps/pvs/<mapname>.bin`
+// Saves the first- and second-order PVS matrices and the PHS matrix to a file called `maps/pvs/<mapname>.bin`
 qboolean BSP_SavePatchedPVS(bsp_t *bsp)
 {
 	char pvs_path[MAX_QPATH];
@@ -1061,13 +1107,17 @@ qboolean BSP_SavePatchedPVS(bsp_t *bsp)
 	if (!bsp->pvs2_matrix)
 		return qfalse;
 
+	if (!bsp->phs_matrix)
+		return qfalse;
+
 	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
-	unsigned char* filebuf = Z_Malloc(matrix_size * 2);
+	unsigned char* filebuf = Z_Malloc(matrix_size * 3);
 
 	memcpy(filebuf, bsp->pvs_matrix, matrix_size);
 	memcpy(filebuf + matrix_size, bsp->pvs2_matrix, matrix_size);
+	memcpy(filebuf + matrix_size * 2, bsp->phs_matrix, matrix_size);
 
-	qerror_t err = FS_WriteFile(pvs_path, filebuf, matrix_size * 2);
+	qerror_t err = FS_WriteFile(pvs_path, filebuf, matrix_size * 3);
 
 	Z_Free(filebuf);
 
@@ -1092,9 +1142,10 @@ qerror_t BSP_Load(const char *name, bsp_t **bsp_p)
     const lump_info_t *info;
     size_t          filelen, ofs, len, end, count;
     qerror_t        ret;
-    byte            *lumpdata[HEADER_LUMPS];
-    size_t          lumpcount[HEADER_LUMPS];
+    lump_job_t      job;
     size_t          memsize;
+    unsigned        start;
+    int             i;
 
     if (!name || !bsp_p)
         Com_Error(ERR_FATAL, "%s: NULL", __func__);
@@ -1111,6 +1162,8 @@ qerror_t BSP_Load(const char *name, bsp_t **bsp_p)
         return Q_ERR_SUCCESS;
     }
 
+    start = Sys_Milliseconds();
+
     //
     // load the file
     //
@@ -1150,8 +1203,8 @@ qerror_t BSP_Load(const char *name, bsp_t **bsp_p)
             goto fail2;
         }
 
-        lumpdata[info->lump] = buf + ofs;
-        lumpcount[info->lump] = count;
+        job.lumpdata[info->lump] = buf + ofs;
+        job.lumpcount[info->lump] = count;
 
         memsize += count * info->memsize;
     }
@@ -1164,23 +1217,36 @@ qerror_t BSP_Load(const char *name, bsp_t **bsp_p)
 
     // add an extra page for cacheline alignment overhead
     Hunk_Begin(&bsp->hunk, memsize + 4096);
+    Hunk_Prefault(&bsp->hunk, memsize + 4096);
 
-    // calculate the checksum
-    bsp->checksum = LittleLong(Com_BlockChecksum(buf, filelen));
-
-    // load all lumps
+    // reserve memory for all lumps in one go
     for (info = bsp_lumps; info->load; info++) {
-        ret = info->load(bsp, lumpdata[info->lump], lumpcount[info->lump]);
-        if (ret) {
-            goto fail1;
-        }
+        BSP_AllocLump(bsp, info, job.lumpcount[info->lump]);
     }
 
-    ret = BSP_ValidateAreaPortals(bsp);
+    job.bsp = bsp;
+    job.buf = buf;
+    job.filelen = filelen;
+
+    // leafs validate their clusters against the visibility header,
+    // so parse that first
+    BSP_ParseLump(&job, 0);
+    ret = BSP_ParseResult(&job, 0);
     if (ret) {
         goto fail1;
     }
 
+    // parse the rest of the lumps and calculate the checksum in parallel
+    Job_ParallelFor(BSP_ParseLumpJob, &job, NUM_BSP_LUMPS);
+
+    // report the first failure in lump order
+    for (i = 1; i < NUM_BSP_LUMPS; i++) {
+        ret = BSP_ParseResult(&job, i);
+        if (ret) {
+            goto fail1;
+        }
+    }
+
     ret = BSP_ValidateTree(bsp);
     if (ret) {
         goto fail1;
@@ -1191,16 +1257,27 @@ qerror_t BSP_Load(const char *name, bsp_t **bsp_p)
 		if (dedicated->integer)
 			Com_WPrintf("WARNING: Pathced PVS file for %s unavailable. Some entities may disappear.\n"
 				"Load the map with the RTX renderer once to generate the patched PVS file.\n", bsp->name);
-		else
-			BSP_BuildPvsMatrix(bsp);
+
+		if (bsp->vis)
+			bsp->pvs_matrix = BSP_BuildVisMatrix(bsp, DVIS_PVS);
 	}
 	else
 	{
 		bsp->pvs_patched = qtrue;
 	}
 
+	// the PHS matrix is missing from older patched PVS files
+	if (bsp->vis && !bsp->phs_matrix)
+		bsp->phs_matrix = BSP_BuildVisMatrix(bsp, DVIS_PHS);
+
     Hunk_End(&bsp->hunk);
 
+    if (developer->integer) {
+        Com_Printf("%s: %"PRIz" bytes file, %"PRIz" bytes hunk, %"PRIz" bytes vis, "
+                   "%u page faults, %u msec\n", bsp->name, filelen, bsp->hunk.mapped,
+                   BSP_VisMatrixSize(bsp), bsp->hunk.faults, Sys_Milliseconds() - start);
+    }
+
     List_Append(&bsp_cache, &bsp->entry);
 
     FS_FreeFile(buf);
@@ -1338,9 +1415,6 @@ void BSP_TransformedLightPoint(lightpoint_t *point, vec3_t start, vec3_t end,
 
 byte *BSP_ClusterVis(bsp_t *bsp, byte *mask, int cluster, int vis)
 {
-    byte    *in, *out, *in_end, *out_end;
-    int     c;
-
     if (!bsp || !bsp->vis) {
         return memset(mask, 0xff, VIS_MAX_BYTES);
     }
@@ -1371,6 +1445,41 @@ byte *BSP_ClusterVis(bsp_t *bsp, byte *mask, int cluster, int vis)
 		return mask;
 	}
 
+	if (vis == DVIS_PHS && bsp->phs_matrix)
+	{
+		memcpy(mask, bsp->phs_matrix + bsp->visrowsize * cluster, bsp->visrowsize);
+		return mask;
+	}
+
+    return BSP_DecompressVis(bsp, mask, cluster, vis);
+}
+
+/*
+=============
+BSP_DecompressVis
+
+Decompresses the PVS or PHS row of the cluster from the BSP file, ignoring
+any vis matrices. Used to build the matrices and to check them.
+=============
+*/
+byte *BSP_DecompressVis(bsp_t *bsp, byte *mask, int cluster, int vis)
+{
+    byte    *in, *out, *in_end, *out_end;
+    int     c;
+
+    if (!bsp || !bsp->vis) {
+        return memset(mask, 0xff, VIS_MAX_BYTES);
+    }
+    if (cluster == -1) {
+        return memset(mask, 0, bsp->visrowsize);
+    }
+    if (cluster < 0 || cluster >= bsp->vis->numclusters) {
+        Com_Error(ERR_DROP, "%s: bad cluster", __func__);
+    }
+    if (vis == DVIS_PVS2) {
+        vis = DVIS_PVS;
+    }
+
     // decompress vis
     in_end = (byte *)bsp->vis + bsp->numvisibility;
     in = (byte *)bsp->vis + bsp->vis->bitofs[cluster][vis];
@@ -1436,6 +1545,114 @@ overrun:
     return mask;
 }
 
+/*
+=============
+BSP_GetVisRow
+
+Returns the decompressed PVS, PVS2 or PHS row of the cluster without copying
+it. The row stays valid until the BSP is freed, and cluster -1 or a map
+without visibility info give shared rows of no or all clusters, the same
+way BSP_ClusterVis fills the mask for them.
+=============
+*/
+const byte *BSP_GetVisRow(bsp_t *bsp, int cluster, int vis)
+{
+    char *matrix;
+
+    if (!bsp || !bsp->vis) {
+        return vis_all;
+    }
+    if (cluster == -1) {
+        return vis_none;
+    }
+    if (cluster < 0 || cluster >= bsp->vis->numclusters) {
+        Com_Error(ERR_DROP, "%s: bad cluster", __func__);
+    }
+
+    switch (vis) {
+    case DVIS_PVS2:
+        matrix = bsp->pvs2_matrix ? bsp->pvs2_matrix : bsp->pvs_matrix;
+        break;
+    case DVIS_PHS:
+        matrix = bsp->phs_matrix;
+        break;
+    default:
+        matrix = bsp->pvs_matrix;
+        break;
+    }
+
+    if (!matrix) {
+        Com_Error(ERR_DROP, "%s: vis matrix not loaded", __func__);
+    }
+
+    return (byte *)matrix + bsp->visrowsize * cluster;
+}
+
+/*
+=============
+BSP_VisNextCluster
+
+Returns the first cluster after the given one that is set in the row, or -1
+when there are no more. Pass -1 to start from the beginning. Rows are
+scanned 64 clusters at a time, so walking a sparse PVS costs about one
+load per 64 clusters instead of one bit test per cluster.
+=============
+*/
+int BSP_VisNextCluster(bsp_t *bsp, const byte *row, int cluster)
+{
+    int numclusters, rowsize, ofs;
+    uint64_t word;
+
+    if (!bsp || !bsp->vis) {
+        return -1;
+    }
+
+    numclusters = bsp->vis->numclusters;
+    rowsize = bsp->visrowsize;
+
+    cluster++;
+    if (cluster < 0) {
+        cluster = 0;
+    }
+
+    while (cluster < numclusters) {
+        ofs = cluster >> 3;
+        word = BSP_LoadVisWord(row, ofs, rowsize) >> (cluster & 7);
+        if (word) {
+            cluster += BSP_FirstVisBit(word);
+            return cluster < numclusters ? cluster : -1;
+        }
+        cluster = (ofs + 8) << 3;
+    }
+
+    return -1;
+}
+
+/*
+=============
+BSP_VisIntersects
+
+Returns true if any cluster is set in both rows.
+=============
+*/
+qboolean BSP_VisIntersects(bsp_t *bsp, const byte *a, const byte *b)
+{
+    int rowsize, ofs;
+
+    if (!bsp || !bsp->vis) {
+        return qtrue;
+    }
+
+    rowsize = bsp->visrowsize;
+    for (ofs = 0; ofs < rowsize; ofs += 8) {
+        if (BSP_LoadVisWord(a, ofs, rowsize) & BSP_LoadVisWord(b, ofs, rowsize)) {
+            return qtrue;
+        }
+    }
+
+    return qfalse;
+}
+
 mleaf_t *BSP_PointLeaf(mnode_t *node, vec3_t p)
 {
     float d;
@@ -1478,6 +1695,8 @@ void BSP_Init(void)
 {
     map_visibility_patch = Cvar_Get("map_visibility_patch", "1", 0);
 
+    memset(vis_all, 0xff, sizeof(vis_all));
+
     Cmd_AddCommand("bsplist", BSP_List_f);
 
     List_Init(&bsp_cache);
@@ -1013,7 +1013,7 @@ Returns qtrue if any leaf under headnode has a cluster that
 is potentially visible
 =============
 */
-qboolean CM_HeadnodeVisible(mnode_t *node, byte *visbits)
+qboolean CM_HeadnodeVisible(mnode_t *node, const byte *visbits)
 {
     mleaf_t *leaf;
     int     cluster;
@@ -1044,11 +1044,10 @@ so we can't use a single PVS point
 */
 byte *CM_FatPVS(cm_t *cm, byte *mask, const vec3_t org, int vis)
 {
-    byte    temp[VIS_MAX_BYTES];
     mleaf_t *leafs[64];
     int     clusters[64];
-    int     i, j, count, longs;
-    uint_fast32_t *src, *dst;
+    int     i, j, count, rowsize;
+    const byte *src;
     vec3_t  mins, maxs;
 
     if (!cm->cache) {   // map not loaded
@@ -1066,14 +1065,14 @@ byte *CM_FatPVS(cm_t *cm, byte *mask, const vec3_t org, int vis)
     count = CM_BoxLeafs(cm, mins, maxs, leafs, 64, NULL);
     if (count < 1)
         Com_Error(ERR_DROP, "CM_FatPVS: leaf count < 1");
-    longs = VIS_FAST_LONGS(cm->cache);
+    rowsize = cm->cache->visrowsize;
 
     // convert leafs to clusters
     for (i = 0; i < count; i++) {
         clusters[i] = leafs[i]->cluster;
     }
 
-    BSP_ClusterVis(cm->cache, mask, clusters[0], vis);
+    memcpy(mask, BSP_GetVisRow(cm->cache, clusters[0], vis), rowsize);
 
     // or in all the other leaf bits
     for (i = 1; i < count; i++) {
@@ -1082,10 +1081,11 @@ byte *CM_FatPVS(cm_t *cm, byte *mask, const vec3_t org, int vis)
                 goto nextleaf; // already have the cluster we want
             }
         }
-        src = (uint_fast32_t *)BSP_ClusterVis(cm->cache, temp, clusters[i], vis);
-        dst = (uint_fast32_t *)mask;
-        for (j = 0; j < longs; j++) {
-            *dst++ |= *src++;
+        // rows come straight from the vis matrix, which is not padded
+        // to whole longs, so stick to bytes and let the compiler widen
+        src = BSP_GetVisRow(cm->cache, clusters[i], vis);
+        for (j = 0; j < rowsize; j++) {
+            mask[j] |= src[j];
         }
 
 nextleaf:;
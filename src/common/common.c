@@ -32,6 +32,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/field.h"
 #include "common/fifo.h"
 #include "common/files.h"
+#include "common/jobs.h"
 #include "common/math.h"
 #include "common/mdfour.h"
 #include "common/msg.h"
@@ -624,6 +625,7 @@ void Com_Quit(const char *reason, error_type_t type)
     NET_Shutdown();
     logfile_close();
     FS_Shutdown();
+    Job_Shutdown();
 
     Sys_Quit();
     // doesn't get there
@@ -919,6 +921,7 @@ void Qcommon_Init(int argc, char **argv)
     // init commands and vars
     //
     z_perturb = Cvar_Get("z_perturb", "0", 0);
+    Z_InitCvars();
 #if USE_CLIENT
     host_speeds = Cvar_Get("host_speeds", "0", 0);
 #endif
@@ -987,6 +990,8 @@ void Qcommon_Init(int argc, char **argv)
 
     Sys_Init();
 
+    Job_Init();
+
     Sys_RunConsole();
 
     FS_Init();
@@ -0,0 +1,183 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// jobs.c -- worker thread pool
+//
+
+#include "shared/shared.h"
+#include "common/cmd.h"
+#include "common/common.h"
+#include "common/cvar.h"
+#include "common/jobs.h"
+#include "system/threads.h"
+
+static cvar_t   *com_jobthreads;
+
+static struct {
+    qmutex_t        *lock;
+    qcond_t         *wake;      // signalled when a new batch is posted
+    qcond_t         *done;      // signalled when the last worker finishes
+    qthread_t       *threads[MAX_JOB_THREADS];
+    int             numthreads;
+    qboolean        shutdown;
+    qboolean        active;     // batch in progress, nested calls run serially
+
+    // current batch
+    unsigned        batch;
+    jobfunc_t       func;
+    void            *arg;
+    int             count;
+    volatile int    next;
+    int             busy;
+} jobs;
+
+static void run_batch(void)
+{
+    int i;
+
+    while ((i = Sys_AtomicAdd(&jobs.next, 1) - 1) < jobs.count)
+        jobs.func(jobs.arg, i);
+}
+
+static void job_thread(void *arg)
+{
+    unsigned batch = 0;
+
+    while (1) {
+        Sys_LockMutex(jobs.lock);
+        while (jobs.batch == batch && !jobs.shutdown)
+            Sys_WaitCond(jobs.wake, jobs.lock);
+        if (jobs.shutdown) {
+            Sys_UnlockMutex(jobs.lock);
+            break;
+        }
+        batch = jobs.batch;
+        Sys_UnlockMutex(jobs.lock);
+
+        run_batch();
+
+        Sys_LockMutex(jobs.lock);
+        if (--jobs.busy == 0)
+            Sys_SignalCond(jobs.done);
+        Sys_UnlockMutex(jobs.lock);
+    }
+}
+
+/*
+=================
+Job_ParallelFor
+=================
+*/
+void Job_ParallelFor(jobfunc_t func, void *arg, int count)
+{
+    int i;
+
+    if (count <= 0)
+        return;
+
+    if (!jobs.numthreads || jobs.active || count == 1) {
+        for (i = 0; i < count; i++)
+            func(arg, i);
+        return;
+    }
+
+    Sys_LockMutex(jobs.lock);
+    jobs.active = qtrue;
+    jobs.func = func;
+    jobs.arg = arg;
+    jobs.count = count;
+    jobs.next = 0;
+    jobs.busy = jobs.numthreads;
+    jobs.batch++;
+    Sys_BroadcastCond(jobs.wake);
+    Sys_UnlockMutex(jobs.lock);
+
+    // calling thread takes part in the work
+    run_batch();
+
+    Sys_LockMutex(jobs.lock);
+    while (jobs.busy)
+        Sys_WaitCond(jobs.done, jobs.lock);
+    jobs.active = qfalse;
+    Sys_UnlockMutex(jobs.lock);
+}
+
+int Job_NumThreads(void)
+{
+    return jobs.numthreads + 1;
+}
+
+static void Job_Info_f(void)
+{
+    Com_Printf("%d worker thread%s, %d processor%s\n",
+               jobs.numthreads, jobs.numthreads == 1 ? "" : "s",
+               Sys_NumProcessors(), Sys_NumProcessors() == 1 ? "" : "s");
+}
+
+void Job_Init(void)
+{
+    int i, count;
+
+    com_jobthreads = Cvar_Get("com_jobthreads", "-1", CVAR_NOSET);
+
+    Cmd_AddCommand("jobinfo", Job_Info_f);
+
+    count = com_jobthreads->integer;
+    if (count < 0)
+        count = Sys_NumProcessors() - 1;
+    clamp(count, 0, MAX_JOB_THREADS);
+
+    if (!count)
+        return;
+
+    jobs.lock = Sys_CreateMutex();
+    jobs.wake = Sys_CreateCond();
+    jobs.done = Sys_CreateCond();
+
+    for (i = 0; i < count; i++) {
+        jobs.threads[i] = Sys_CreateThread(job_thread, NULL);
+        if (!jobs.threads[i])
+            break;
+        jobs.numthreads++;
+    }
+
+    Com_DPrintf("%s: %d worker threads\n", __func__, jobs.numthreads);
+}
+
+void Job_Shutdown(void)
+{
+    int i;
+
+    if (!jobs.lock)
+        return;
+
+    Sys_LockMutex(jobs.lock);
+    jobs.shutdown = qtrue;
+    Sys_BroadcastCond(jobs.wake);
+    Sys_UnlockMutex(jobs.lock);
+
+    for (i = 0; i < jobs.numthreads; i++)
+        Sys_JoinThread(jobs.threads[i]);
+
+    Sys_DestroyCond(jobs.done);
+    Sys_DestroyCond(jobs.wake);
+    Sys_DestroyMutex(jobs.lock);
+
+    memset(&jobs, 0, sizeof(jobs));
+}
@@ -23,6 +23,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/files.h"
 #include "common/tests.h"
 #include "refresh/refresh.h"
+#if USE_REF
+#include "refresh/models.h"
+#endif
 #include "system/system.h"
 
 // test error shutdown procedures
@@ -116,6 +119,94 @@ static void Com_PrintJunk_f(void)
     Com_Printf("\n");
 }
 
+// checks the bitset queries against plain bit tests on every cluster, and
+// the vis matrices, which may come from maps/pvs/*.bin, against the rows
+// decompressed from the map
+static int BSP_TestVis(bsp_t *bsp)
+{
+    static const int vistypes[] = { DVIS_PVS, DVIS_PVS2, DVIS_PHS };
+    byte mask[VIS_MAX_BYTES];
+    const byte *row, *next, *pvs;
+    int i, cluster, expected, found, numclusters, errors;
+    qboolean any;
+
+    if (!bsp->vis) {
+        return 0;
+    }
+
+    numclusters = bsp->vis->numclusters;
+    errors = 0;
+
+    for (i = 0; i < q_countof(vistypes); i++) {
+        for (cluster = 0; cluster < numclusters; cluster++) {
+            row = BSP_GetVisRow(bsp, cluster, vistypes[i]);
+
+            // walk the row both ways
+            found = -1;
+            for (expected = 0; expected <= numclusters; expected++) {
+                if (expected < numclusters && !Q_IsBitSet(row, expected)) {
+                    continue;
+                }
+                found = BSP_VisNextCluster(bsp, row, found);
+                if (found != (expected < numclusters ? expected : -1)) {
+                    Com_EPrintf("%s: vis %d cluster %d: next cluster %d, expected %d\n",
+                                bsp->name, vistypes[i], cluster, found, expected);
+                    errors++;
+                    break;
+                }
+            }
+
+            // intersect with the next cluster's row
+            next = BSP_GetVisRow(bsp, (cluster + 1) % numclusters, vistypes[i]);
+            any = qfalse;
+            for (expected = 0; expected < numclusters; expected++) {
+                if (Q_IsBitSet(row, expected) && Q_IsBitSet(next, expected)) {
+                    any = qtrue;
+                    break;
+                }
+            }
+            if (BSP_VisIntersects(bsp, row, next) != any) {
+                Com_EPrintf("%s: vis %d cluster %d: intersection mismatch\n",
+                            bsp->name, vistypes[i], cluster);
+                errors++;
+            }
+
+            // PHS and unpatched PVS rows are plain decompression, patched
+            // PVS and PVS2 rows only add clusters to it
+            BSP_DecompressVis(bsp, mask, cluster, vistypes[i]);
+            for (expected = 0; expected < numclusters; expected++) {
+                if (Q_IsBitSet(mask, expected) && !Q_IsBitSet(row, expected)) {
+                    break;
+                }
+                if (!Q_IsBitSet(mask, expected) && Q_IsBitSet(row, expected) &&
+                    (vistypes[i] == DVIS_PHS || (vistypes[i] == DVIS_PVS && !bsp->pvs_patched))) {
+                    break;
+                }
+            }
+            if (expected < numclusters) {
+                Com_EPrintf("%s: vis %d cluster %d: matrix differs from decompression at cluster %d\n",
+                            bsp->name, vistypes[i], cluster, expected);
+                errors++;
+            }
+
+            // PVS2 contains the PVS
+            if (vistypes[i] == DVIS_PVS2) {
+                pvs = BSP_GetVisRow(bsp, cluster, DVIS_PVS);
+                for (expected = 0; expected < numclusters; expected++) {
+                    if (Q_IsBitSet(pvs, expected) && !Q_IsBitSet(row, expected)) {
+                        Com_EPrintf("%s: cluster %d: PVS2 misses PVS cluster %d\n",
+                                    bsp->name, cluster, expected);
+                        errors++;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    return errors;
+}
+
 static void BSP_Test_f(void)
 {
     void **list;
@@ -143,7 +234,11 @@ static void BSP_Test_f(void)
             continue;
         }
 
-        Com_DPrintf("%s: success\n", name);
+        if (BSP_TestVis(bsp)) {
+            errors++;
+        } else {
+            Com_DPrintf("%s: success\n", name);
+        }
         BSP_Free(bsp);
     }
 
@@ -498,6 +593,8 @@ static void Com_TestModels_f(void)
     void **list;
     int i, count, errors;
     unsigned start, end;
+    size_t bytes, maxbytes;
+    const char *maxname;
 
     list = FS_ListFiles("models", ".md2", FS_SEARCH_SAVEPATH, &count);
     if (!list) {
@@ -508,11 +605,30 @@ static void Com_TestModels_f(void)
     start = Sys_Milliseconds();
 
     errors = 0;
+    bytes = maxbytes = 0;
+    maxname = NULL;
     for (i = 0; i < count; i++) {
-        if (!R_RegisterModel(list[i])) {
+        qhandle_t handle = R_RegisterModel(list[i]);
+        model_t *model;
+
+        if (!handle) {
             errors++;
             continue;
         }
+
+        model = MOD_ForHandle(handle);
+        if (!model) {
+            continue;
+        }
+
+        if (developer->integer) {
+            Com_Printf("%8"PRIz" : %s\n", model->hunk.mapped, model->name);
+        }
+        bytes += model->hunk.mapped;
+        if (model->hunk.mapped > maxbytes) {
+            maxbytes = model->hunk.mapped;
+            maxname = model->name;
+        }
     }
 
     end = Sys_Milliseconds();
@@ -520,6 +636,12 @@ static void Com_TestModels_f(void)
     Com_Printf("%d msec, %d failures, %d models tested\n",
                end - start, errors, count);
 
+    if (count > errors) {
+        Com_Printf("%"PRIz" KB resident, %"PRIz" KB per model, largest %s (%"PRIz" KB)\n",
+                   bytes / 1024, bytes / 1024 / (count - errors),
+                   maxname ? maxname : "none", maxbytes / 1024);
+    }
+
     FS_FreeList(list);
 }
 #endif
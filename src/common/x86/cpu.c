@@ -0,0 +1,82 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "shared/shared.h"
+#include "common/x86/cpu.h"
+
+#if USE_X86_SIMD
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void get_cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4])
+{
+#ifdef _MSC_VER
+    __cpuidex((int *)regs, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t get_xcr0(void)
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+
+    __asm__ __volatile__("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+unsigned X86_CPUFeatures(void)
+{
+    static qboolean initialized;
+    static unsigned features;
+    unsigned regs[4], maxleaf;
+
+    if (initialized)
+        return features;
+
+    initialized = qtrue;
+
+    get_cpuid(0, 0, regs);
+    maxleaf = regs[0];
+    if (maxleaf < 1)
+        return features;
+
+    get_cpuid(1, 0, regs);
+    if (regs[3] & (1 << 26))
+        features |= CPU_SSE2;
+
+    // AVX state must be enabled by the OS
+    if ((regs[2] & (1 << 27)) && (regs[2] & (1 << 28)) &&
+        (get_xcr0() & 6) == 6 && maxleaf >= 7) {
+        get_cpuid(7, 0, regs);
+        if (regs[1] & (1 << 5))
+            features |= CPU_AVX2;
+    }
+
+    return features;
+}
+
+#endif
@@ -18,7 +18,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "shared/shared.h"
 #include "common/common.h"
+#include "common/cvar.h"
 #include "common/zone.h"
+#include "system/threads.h"
 
 #define Z_MAGIC     0x1d0d
 #define Z_TAIL      0x5b7b
@@ -26,27 +28,105 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define Z_TAIL_F(z) \
     *(uint16_t *)((byte *)(z) + (z)->size - sizeof(uint16_t))
 
-#define Z_FOR_EACH(z) \
-    for ((z) = z_chain.next; (z) != &z_chain; (z) = (z)->next)
+#define Z_FOR_EACH(z, zone) \
+    for ((z) = (zone)->chain.next; (z) != &(zone)->chain; (z) = (z)->next)
 
-#define Z_FOR_EACH_SAFE(z, n) \
-    for ((z) = z_chain.next; (z) != &z_chain; (z) = (n))
+#define Z_FOR_EACH_SAFE(z, n, zone) \
+    for ((z) = (zone)->chain.next; (z) != &(zone)->chain; (z) = (n))
+
+// block origin, values below Z_NUM_CLASSES are slab size classes
+#define Z_POOL_HEAP     0xfd
+#define Z_POOL_ARENA    0xfe
+#define Z_POOL_STATIC   0xff
 
 typedef struct zhead_s {
+    uint32_t    tag;            // for group free, game tags are offset by TAG_MAX
     uint16_t    magic;
-    uint16_t    tag;            // for group free
+    uint8_t     pool;           // where the block came from
+    uint8_t     guard;          // tail guard present
     size_t      size;
 #ifdef _DEBUG
     void        *addr;
     time_t      time;
 #endif
-    struct zhead_s  *prev, *next;
+    struct zhead_s  *prev, *next;   // arena blocks only use next on free lists
 } zhead_t;
 
 // number of overhead bytes
 #define Z_EXTRA (sizeof(zhead_t) + sizeof(uint16_t))
 
-static zhead_t      z_chain;
+// blocks are rounded up to this
+#define Z_ALIGN     16
+
+/*
+Small blocks come from slabs of fixed size classes. Freed slab blocks go
+to per class free lists and are reused by any tag.
+*/
+#define Z_SLAB_SIZE     0x10000
+#define Z_NUM_CLASSES   9
+#define Z_SLAB_MAX      1024
+
+static const uint16_t z_classes[Z_NUM_CLASSES] = {
+    64, 96, 128, 192, 256, 384, 512, 768, 1024
+};
+
+typedef struct {
+    zhead_t     *free;          // linked through next
+    byte        *cursor;        // uncarved part of the current slab
+    byte        *limit;
+} zclass_t;
+
+static zclass_t     z_slabs[Z_NUM_CLASSES];
+static size_t       z_slab_reserved;    // bytes in all slabs
+static size_t       z_slab_inuse;       // bytes in live slab blocks
+
+/*
+Small game tag blocks are carved from per zone arenas in slab size classes,
+Z_FreeTags releases all chunks at once. Blocks freed one at a time go to per
+zone free lists and are reused by the same tag. Chunks start small and grow,
+so that rarely used tags don't hold much memory.
+*/
+#define Z_CHUNK_MIN     0x10000
+#define Z_CHUNK_MAX     0x100000
+
+typedef struct zchunk_s {
+    struct zchunk_s *next;
+    size_t          size;       // including this header
+    size_t          used;
+} zchunk_t;
+
+#define Z_CHUNK_HEAD    ((sizeof(zchunk_t) + Z_ALIGN - 1) & ~(Z_ALIGN - 1))
+
+typedef struct zone_s {
+    unsigned        tag;
+    zhead_t         chain;      // heap and slab blocks
+    zchunk_t        *chunks;    // arena blocks, newest chunk first
+    zhead_t         *free[Z_NUM_CLASSES];   // freed arena blocks
+    size_t          count;
+    size_t          bytes;
+    struct zone_s   *next;
+} zone_t;
+
+static zone_t       z_zones[TAG_MAX];
+static zone_t       *z_gamezones;   // allocated on demand
+
+// guards zones and slabs, allocations may come from job threads
+static qmutex_t     *z_lock;
+
+#define Z_LOCK()    Sys_LockMutex(z_lock)
+#define Z_UNLOCK()  Sys_UnlockMutex(z_lock)
+
+// tail guards are written and checked if enabled when block was allocated
+static cvar_t       *z_guard;
+
+#ifdef _DEBUG
+#define Z_GUARD_DEFAULT "1"
+#else
+#define Z_GUARD_DEFAULT "0"
+#endif
+
+#define Z_GUARDS_ENABLED() \
+    (z_guard ? !!z_guard->integer : atoi(Z_GUARD_DEFAULT))
 
 typedef struct {
     zhead_t     z;
@@ -56,7 +136,7 @@ typedef struct {
 
 static const zstatic_t z_static[] = {
 #define Z_STATIC(x) \
-    { { Z_MAGIC, TAG_STATIC, q_offsetof(zstatic_t, tail) + sizeof(uint16_t) }, x, Z_TAIL }
+    { { TAG_STATIC, Z_MAGIC, Z_POOL_STATIC, 1, q_offsetof(zstatic_t, tail) + sizeof(uint16_t) }, x, Z_TAIL }
 
     Z_STATIC("0"),
     Z_STATIC("1"),
@@ -73,13 +153,6 @@ static const zstatic_t z_static[] = {
 #undef Z_STATIC
 };
 
-typedef struct {
-    size_t count;
-    size_t bytes;
-} zstats_t;
-
-static zstats_t z_stats[TAG_MAX];
-
 static const char z_tagnames[TAG_MAX][8] = {
     "game",
     "static",
@@ -100,7 +173,7 @@ static inline void Z_Validate(zhead_t *z, const char *func)
     if (z->magic != Z_MAGIC) {
         Com_Error(ERR_FATAL, "%s: bad magic", func);
     }
-    if (Z_TAIL_F(z) != Z_TAIL) {
+    if (z->guard && Z_TAIL_F(z) != Z_TAIL) {
         Com_Error(ERR_FATAL, "%s: bad tail", func);
     }
     if (z->tag == TAG_FREE) {
@@ -108,27 +181,120 @@ static inline void Z_Validate(zhead_t *z, const char *func)
     }
 }
 
-void Z_Check(void)
+// returns zone for the tag, or NULL if it has never been used.
+// must be called with z_lock held.
+static zone_t *Z_FindZone(unsigned tag)
+{
+    zone_t *zone;
+
+    if (tag < TAG_MAX) {
+        return &z_zones[tag];
+    }
+
+    for (zone = z_gamezones; zone; zone = zone->next) {
+        if (zone->tag == tag) {
+            return zone;
+        }
+    }
+
+    return NULL;
+}
+
+// must be called with z_lock held
+static zone_t *Z_ZoneForTag(unsigned tag)
+{
+    zone_t *zone = Z_FindZone(tag);
+
+    if (!zone) {
+        zone = calloc(1, sizeof(*zone));
+        if (!zone) {
+            return NULL;
+        }
+        zone->tag = tag;
+        zone->chain.next = zone->chain.prev = &zone->chain;
+        zone->next = z_gamezones;
+        z_gamezones = zone;
+    }
+
+    return zone;
+}
+
+static const char *Z_ZoneName(const zone_t *zone)
 {
+    static char buffer[16];
+
+    if (zone->tag < TAG_MAX) {
+        return z_tagnames[zone->tag];
+    }
+
+    Q_snprintf(buffer, sizeof(buffer), "game %u", zone->tag - TAG_MAX);
+    return buffer;
+}
+
+// calls func for each block in zone arena, including freed ones
+static void Z_ForEachArenaBlock(zone_t *zone, void (*func)(zhead_t *, void *), void *arg)
+{
+    zchunk_t *chunk;
+    size_t ofs;
     zhead_t *z;
 
-    Z_FOR_EACH(z) {
-        Z_Validate(z, __func__);
+    for (chunk = zone->chunks; chunk; chunk = chunk->next) {
+        for (ofs = Z_CHUNK_HEAD; ofs < chunk->used; ofs += z->size) {
+            z = (zhead_t *)((byte *)chunk + ofs);
+            func(z, arg);
+        }
     }
 }
 
-void Z_LeakTest(memtag_t tag)
+static void Z_ValidateArenaBlock(zhead_t *z, void *arg)
+{
+    if (z->tag != TAG_FREE) {
+        Z_Validate(z, arg);
+    }
+}
+
+// must be called with z_lock held
+static void Z_CheckZone(zone_t *zone, const char *func)
 {
     zhead_t *z;
+
+    Z_FOR_EACH(z, zone) {
+        Z_Validate(z, func);
+    }
+
+    Z_ForEachArenaBlock(zone, Z_ValidateArenaBlock, (void *)func);
+}
+
+void Z_Check(void)
+{
+    zone_t *zone;
+    int i;
+
+    Z_LOCK();
+    for (i = 0; i < TAG_MAX; i++) {
+        Z_CheckZone(&z_zones[i], __func__);
+    }
+    for (zone = z_gamezones; zone; zone = zone->next) {
+        Z_CheckZone(zone, __func__);
+    }
+    Z_UNLOCK();
+}
+
+void Z_LeakTest(memtag_t tag)
+{
+    zone_t *zone;
     size_t numLeaks = 0, numBytes = 0;
 
-    Z_FOR_EACH(z) {
-        Z_Validate(z, __func__);
-        if (z->tag == tag) {
-            numLeaks++;
-            numBytes += z->size;
+    Z_LOCK();
+    zone = Z_FindZone(tag);
+    if (zone) {
+        if (Z_GUARDS_ENABLED()) {
+            Z_CheckZone(zone, __func__);
         }
+        numLeaks = zone->count;
+        numBytes = zone->bytes;
     }
+    Z_UNLOCK();
 
     if (numLeaks) {
         Com_WPrintf("************* Z_LeakTest *************\n"
@@ -139,6 +305,140 @@ void Z_LeakTest(memtag_t tag)
     }
 }
 
+static int Z_ClassForSize(size_t size)
+{
+    int i;
+
+    for (i = 0; i < Z_NUM_CLASSES; i++) {
+        if (size <= z_classes[i]) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// must be called with z_lock held
+static zhead_t *Z_SlabAlloc(int cls)
+{
+    zclass_t *c = &z_slabs[cls];
+    size_t size = z_classes[cls];
+    zhead_t *z;
+
+    if (c->free) {
+        z = c->free;
+        c->free = z->next;
+    } else {
+        if (c->cursor + size > c->limit) {
+            // slabs are never released, previous tail is lost
+            c->cursor = malloc(Z_SLAB_SIZE);
+            if (!c->cursor) {
+                c->limit = NULL;
+                return NULL;
+            }
+            c->limit = c->cursor + Z_SLAB_SIZE;
+            z_slab_reserved += Z_SLAB_SIZE;
+        }
+        z = (zhead_t *)c->cursor;
+        c->cursor += size;
+    }
+
+    z_slab_inuse += size;
+    return z;
+}
+
+// must be called with z_lock held
+static void Z_SlabFree(zhead_t *z)
+{
+    zclass_t *c = &z_slabs[z->pool];
+
+    z_slab_inuse -= z->size;
+    z->next = c->free;
+    c->free = z;
+}
+
+// must be called with z_lock held
+static zhead_t *Z_ArenaAlloc(zone_t *zone, int cls)
+{
+    zchunk_t *chunk = zone->chunks;
+    size_t size = z_classes[cls];
+    zhead_t *z;
+
+    if (zone->free[cls]) {
+        z = zone->free[cls];
+        zone->free[cls] = z->next;
+        return z;
+    }
+
+    if (!chunk || chunk->used + size > chunk->size) {
+        size_t chunksize = chunk ? min(chunk->size * 2, Z_CHUNK_MAX) : Z_CHUNK_MIN;
+
+        chunk = malloc(chunksize);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->size = chunksize;
+        chunk->used = Z_CHUNK_HEAD;
+        chunk->next = zone->chunks;
+        zone->chunks = chunk;
+    }
+
+    z = (zhead_t *)((byte *)chunk + chunk->used);
+    chunk->used += size;
+    return z;
+}
+
+// releases all arena blocks at once.
+// must be called with z_lock held.
+static void Z_ArenaReset(zone_t *zone)
+{
+    zchunk_t *chunk, *next;
+
+    for (chunk = zone->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+
+    zone->chunks = NULL;
+    memset(zone->free, 0, sizeof(zone->free));
+}
+
+// returns zone the block belonged to.
+// must be called with z_lock held.
+static zone_t *Z_Unlink(zhead_t *z)
+{
+    zone_t *zone = Z_FindZone(z->tag);
+
+    zone->count--;
+    zone->bytes -= z->size;
+
+    if (z->pool != Z_POOL_STATIC) {
+        if (z->pool != Z_POOL_ARENA) {
+            z->prev->next = z->next;
+            z->next->prev = z->prev;
+        }
+        z->magic = 0xdead;
+        z->tag = TAG_FREE;
+    }
+
+    return zone;
+}
+
+// must be called with z_lock held, after Z_Unlink
+static void Z_Release(zone_t *zone, zhead_t *z)
+{
+    if (z->pool == Z_POOL_HEAP) {
+        free(z);
+    } else if (z->pool == Z_POOL_ARENA) {
+        int cls = Z_ClassForSize(z->size);
+
+        z->next = zone->free[cls];
+        zone->free[cls] = z;
+    } else if (z->pool < Z_NUM_CLASSES) {
+        Z_SlabFree(z);
+    }
+}
+
 /*
 ========================
 Z_Free
@@ -147,7 +447,6 @@ Z_Free
 void Z_Free(void *ptr)
 {
     zhead_t *z;
-    zstats_t *s;
 
     if (!ptr) {
         return;
@@ -157,17 +456,9 @@ void Z_Free(void *ptr)
 
     Z_Validate(z, __func__);
 
-    s = &z_stats[z->tag < TAG_MAX ? z->tag : TAG_FREE];
-    s->count--;
-    s->bytes -= z->size;
-
-    if (z->tag != TAG_STATIC) {
-        z->prev->next = z->next;
-        z->next->prev = z->prev;
-        z->magic = 0xdead;
-        z->tag = TAG_FREE;
-        free(z);
-    }
+    Z_LOCK();
+    Z_Release(Z_Unlink(z), z);
+    Z_UNLOCK();
 }
 
 /*
@@ -178,7 +469,8 @@ Z_Realloc
 void *Z_Realloc(void *ptr, size_t size)
 {
     zhead_t *z;
-    zstats_t *s;
+    zone_t *zone;
+    void *copy;
 
     if (!ptr) {
         return Z_Malloc(size);
@@ -193,20 +485,34 @@ void *Z_Realloc(void *ptr, size_t size)
 
     Z_Validate(z, __func__);
 
-    if (z->tag == TAG_STATIC) {
+    if (z->pool == Z_POOL_STATIC) {
         Com_Error(ERR_FATAL, "%s: couldn't realloc static memory", __func__);
     }
 
-    s = &z_stats[z->tag < TAG_MAX ? z->tag : TAG_FREE];
-    s->bytes -= z->size;
-
-    if (size > SIZE_MAX - Z_EXTRA - 3) {
+    if (size > SIZE_MAX - Z_EXTRA - Z_ALIGN) {
         Com_Error(ERR_FATAL, "%s: bad size", __func__);
     }
 
-    size = (size + Z_EXTRA + 3) & ~3;
+    // slab and arena blocks are moved to a new block unless it still fits
+    if (z->pool != Z_POOL_HEAP) {
+        if (size <= z->size - Z_EXTRA) {
+            return ptr;
+        }
+        copy = Z_TagMalloc(size, z->tag);
+        memcpy(copy, ptr, z->size - Z_EXTRA);
+        Z_Free(ptr);
+        return copy;
+    }
+
+    size = (size + Z_EXTRA + Z_ALIGN - 1) & ~(Z_ALIGN - 1);
+
+    // neighbours are relinked after realloc, keep the chain locked meanwhile
+    Z_LOCK();
+    zone = Z_FindZone(z->tag);
+    zone->bytes -= z->size;
     z = realloc(z, size);
     if (!z) {
+        Z_UNLOCK();
         Com_Error(ERR_FATAL, "%s: couldn't realloc %"PRIz" bytes", __func__, size);
     }
 
@@ -214,13 +520,49 @@ void *Z_Realloc(void *ptr, size_t size)
     z->prev->next = z;
     z->next->prev = z;
 
-    s->bytes += size;
+    if (z->guard) {
+        Z_TAIL_F(z) = Z_TAIL;
+    }
 
-    Z_TAIL_F(z) = Z_TAIL;
+    zone->bytes += size;
+    Z_UNLOCK();
 
     return z + 1;
 }
 
+typedef struct {
+    size_t  bytes, count;
+    size_t  arena_reserved, arena_used, arena_freed;
+} zusage_t;
+
+static void Z_CountArenaBlock(zhead_t *z, void *arg)
+{
+    zusage_t *u = arg;
+
+    if (z->tag == TAG_FREE) {
+        u->arena_freed += z->size;
+    }
+}
+
+// must be called with z_lock held
+static void Z_ZoneStats(zone_t *zone, zusage_t *u)
+{
+    zchunk_t *chunk;
+
+    if (zone->count) {
+        Com_Printf("%9"PRIz" %6"PRIz" %s\n", zone->bytes, zone->count, Z_ZoneName(zone));
+        u->bytes += zone->bytes;
+        u->count += zone->count;
+    }
+
+    for (chunk = zone->chunks; chunk; chunk = chunk->next) {
+        u->arena_reserved += chunk->size;
+        u->arena_used += chunk->used - Z_CHUNK_HEAD;
+    }
+
+    Z_ForEachArenaBlock(zone, Z_CountArenaBlock, u);
+}
+
 /*
 ========================
 Z_Stats_f
@@ -228,25 +570,41 @@ Z_Stats_f
 */
 void Z_Stats_f(void)
 {
-    size_t bytes = 0, count = 0;
-    zstats_t *s;
+    zusage_t u;
+    size_t slab_free = 0;
+    zhead_t *z;
+    zone_t *zone;
     int i;
 
+    memset(&u, 0, sizeof(u));
+
     Com_Printf("    bytes blocks name\n"
                "--------- ------ -------\n");
 
-    for (i = 0, s = z_stats; i < TAG_MAX; i++, s++) {
-        if (!s->count) {
-            continue;
+    Z_LOCK();
+    for (i = 0; i < TAG_MAX; i++) {
+        Z_ZoneStats(&z_zones[i], &u);
+    }
+    for (zone = z_gamezones; zone; zone = zone->next) {
+        Z_ZoneStats(zone, &u);
+    }
+
+    for (i = 0; i < Z_NUM_CLASSES; i++) {
+        for (z = z_slabs[i].free; z; z = z->next) {
+            slab_free += z_classes[i];
         }
-        Com_Printf("%9"PRIz" %6"PRIz" %s\n", s->bytes, s->count, z_tagnames[i]);
-        bytes += s->bytes;
-        count += s->count;
     }
+    Z_UNLOCK();
 
     Com_Printf("--------- ------ -------\n"
                "%9"PRIz" %6"PRIz" total\n",
-               bytes, count);
+               u.bytes, u.count);
+
+    // reserved memory not in live blocks is lost to fragmentation
+    Com_Printf("slabs:  %9"PRIz" reserved, %9"PRIz" in use, %9"PRIz" on free lists\n",
+               z_slab_reserved, z_slab_inuse, slab_free);
+    Com_Printf("arenas: %9"PRIz" reserved, %9"PRIz" used, %9"PRIz" on free lists\n",
+               u.arena_reserved, u.arena_used, u.arena_freed);
 }
 
 /*
@@ -257,14 +615,29 @@ Z_FreeTags
 void Z_FreeTags(memtag_t tag)
 {
     zhead_t *z, *n;
+    zone_t *zone;
 
-    Z_FOR_EACH_SAFE(z, n) {
+    Z_LOCK();
+    zone = Z_FindZone(tag);
+    if (!zone || tag == TAG_STATIC) {
+        Z_UNLOCK();
+        return;
+    }
+
+    Z_FOR_EACH_SAFE(z, n, zone) {
         Z_Validate(z, __func__);
         n = z->next;
-        if (z->tag == tag) {
-            Z_Free(z + 1);
-        }
+        z->magic = 0xdead;
+        z->tag = TAG_FREE;
+        Z_Release(zone, z);
     }
+    zone->chain.next = zone->chain.prev = &zone->chain;
+
+    Z_ArenaReset(zone);
+
+    zone->count = 0;
+    zone->bytes = 0;
+    Z_UNLOCK();
 }
 
 /*
@@ -275,7 +648,8 @@ Z_TagMalloc
 void *Z_TagMalloc(size_t size, memtag_t tag)
 {
     zhead_t *z;
-    zstats_t *s;
+    zone_t *zone;
+    int pool;
 
     if (!size) {
         return NULL;
@@ -285,17 +659,48 @@ void *Z_TagMalloc(size_t size, memtag_t tag)
         Com_Error(ERR_FATAL, "%s: bad tag", __func__);
     }
 
-    if (size > SIZE_MAX - Z_EXTRA - 3) {
+    if (size > SIZE_MAX - Z_EXTRA - Z_ALIGN) {
         Com_Error(ERR_FATAL, "%s: bad size", __func__);
     }
 
-    size = (size + Z_EXTRA + 3) & ~3;
-    z = malloc(size);
+    size = (size + Z_EXTRA + Z_ALIGN - 1) & ~(Z_ALIGN - 1);
+
+    Z_LOCK();
+    zone = Z_ZoneForTag(tag);
+    if (!zone) {
+        z = NULL;
+    } else if (tag >= TAG_MAX && size <= Z_SLAB_MAX) {
+        int cls = Z_ClassForSize(size);
+
+        pool = Z_POOL_ARENA;
+        size = z_classes[cls];
+        z = Z_ArenaAlloc(zone, cls);
+    } else if (size <= Z_SLAB_MAX) {
+        pool = Z_ClassForSize(size);
+        size = z_classes[pool];
+        z = Z_SlabAlloc(pool);
+    } else {
+        pool = Z_POOL_HEAP;
+        z = malloc(size);
+    }
+
     if (!z) {
+        Z_UNLOCK();
         Com_Error(ERR_FATAL, "%s: couldn't allocate %"PRIz" bytes", __func__, size);
     }
+
+    if (pool != Z_POOL_ARENA) {
+        z->next = zone->chain.next;
+        z->prev = &zone->chain;
+        zone->chain.next->prev = z;
+        zone->chain.next = z;
+    }
+
+    // header must be valid before unlocking, arena walks rely on it
     z->magic = Z_MAGIC;
     z->tag = tag;
+    z->pool = pool;
+    z->guard = Z_GUARDS_ENABLED();
     z->size = size;
 
 #ifdef _DEBUG
@@ -309,21 +714,18 @@ void *Z_TagMalloc(size_t size, memtag_t tag)
     z->time = time(NULL);
 #endif
 
-    z->next = z_chain.next;
-    z->prev = &z_chain;
-    z_chain.next->prev = z;
-    z_chain.next = z;
+    if (z->guard) {
+        Z_TAIL_F(z) = Z_TAIL;
+    }
+
+    zone->count++;
+    zone->bytes += size;
+    Z_UNLOCK();
 
     if (z_perturb && z_perturb->integer) {
         memset(z + 1, z_perturb->integer, size - Z_EXTRA);
     }
 
-    Z_TAIL_F(z) = Z_TAIL;
-
-    s = &z_stats[tag < TAG_MAX ? tag : TAG_FREE];
-    s->count++;
-    s->bytes += size;
-
     return z + 1;
 }
 
@@ -391,7 +793,25 @@ Z_Init
 */
 void Z_Init(void)
 {
-    z_chain.next = z_chain.prev = &z_chain;
+    int i;
+
+    for (i = 0; i < TAG_MAX; i++) {
+        z_zones[i].tag = i;
+        z_zones[i].chain.next = z_zones[i].chain.prev = &z_zones[i].chain;
+    }
+    z_lock = Sys_CreateMutex();
+}
+
+/*
+========================
+Z_InitCvars
+
+Called once cvar system is up.
+========================
+*/
+void Z_InitCvars(void)
+{
+    z_guard = Cvar_Get("z_guard", Z_GUARD_DEFAULT, 0);
 }
 
 /*
@@ -420,7 +840,6 @@ char *Z_CvarCopyString(const char *in)
 {
     size_t len;
     zstatic_t *z;
-    zstats_t *s;
     int i;
 
     if (!in) {
@@ -438,9 +857,10 @@ char *Z_CvarCopyString(const char *in)
 
     // return static storage
     z = (zstatic_t *)&z_static[i];
-    s = &z_stats[TAG_STATIC];
-    s->count++;
-    s->bytes += z->z.size;
+    Z_LOCK();
+    z_zones[TAG_STATIC].count++;
+    z_zones[TAG_STATIC].bytes += z->z.size;
+    Z_UNLOCK();
     return z->data;
 }
 
@@ -0,0 +1,595 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// bc.c -- block compression encoder and decoder
+//
+// The encoders use a simple principal axis range fit, which is fast and
+// good enough for baking. They are not meant to compete with dedicated
+// texture compression tools, any DDS file produced by those is accepted
+// by the loader as well.
+//
+
+#include "shared/shared.h"
+#include "refresh/bc.h"
+
+static const struct {
+    char    name[4];
+    size_t  blocksize;
+} bc_formats[BC_MAX] = {
+    { "RGB", 0 },
+    { "BC1", 8 },
+    { "BC3", 16 },
+    { "BC4", 8 },
+    { "BC5", 16 },
+    { "BC7", 16 }
+};
+
+const char *BC_FormatName(bcformat_t fmt)
+{
+    return fmt < BC_MAX ? bc_formats[fmt].name : "???";
+}
+
+size_t BC_BlockSize(bcformat_t fmt)
+{
+    return fmt < BC_MAX ? bc_formats[fmt].blocksize : 0;
+}
+
+size_t BC_LevelSize(bcformat_t fmt, int width, int height)
+{
+    if (fmt == BC_NONE)
+        return (size_t)width * height * 4;
+
+    return (size_t)((width + 3) >> 2) * ((height + 3) >> 2) * BC_BlockSize(fmt);
+}
+
+size_t BC_ChainSize(bcformat_t fmt, int width, int height, int levels)
+{
+    size_t size = 0;
+
+    while (levels-- > 0) {
+        size += BC_LevelSize(fmt, width, height);
+        width = max(width >> 1, 1);
+        height = max(height >> 1, 1);
+    }
+
+    return size;
+}
+
+/*
+=================================================================
+
+ENCODER
+
+=================================================================
+*/
+
+// finds principal axis of the given points using power iteration
+static void principal_axis(const byte *pixels, int channels, float *mean, float *axis)
+{
+    float   cov[4][4] = { { 0 } };
+    float   v[4], d;
+    int     i, j, k;
+
+    for (j = 0; j < channels; j++) {
+        mean[j] = 0;
+        for (i = 0; i < 16; i++)
+            mean[j] += pixels[i * 4 + j];
+        mean[j] /= 16;
+    }
+
+    for (i = 0; i < 16; i++) {
+        for (j = 0; j < channels; j++)
+            v[j] = pixels[i * 4 + j] - mean[j];
+        for (j = 0; j < channels; j++)
+            for (k = j; k < channels; k++)
+                cov[j][k] += v[j] * v[k];
+    }
+
+    for (j = 0; j < channels; j++) {
+        for (k = 0; k < j; k++)
+            cov[j][k] = cov[k][j];
+        axis[j] = 1;
+    }
+
+    for (i = 0; i < 8; i++) {
+        d = 0;
+        for (j = 0; j < channels; j++) {
+            v[j] = 0;
+            for (k = 0; k < channels; k++)
+                v[j] += cov[j][k] * axis[k];
+            d = max(d, fabsf(v[j]));
+        }
+        if (d < 1e-6f)
+            break;
+        for (j = 0; j < channels; j++)
+            axis[j] = v[j] / d;
+    }
+}
+
+// picks the two pixels at the extremes of principal axis
+static void range_fit(const byte *pixels, int channels, const byte *mask,
+                      int *lo, int *hi)
+{
+    float   mean[4], axis[4], t, tmin, tmax;
+    int     i, j;
+
+    principal_axis(pixels, channels, mean, axis);
+
+    *lo = *hi = -1;
+    tmin = tmax = 0;
+    for (i = 0; i < 16; i++) {
+        if (mask && !mask[i])
+            continue;
+        for (j = 0, t = 0; j < channels; j++)
+            t += (pixels[i * 4 + j] - mean[j]) * axis[j];
+        if (*lo < 0 || t < tmin) {
+            tmin = t;
+            *lo = i;
+        }
+        if (*hi < 0 || t > tmax) {
+            tmax = t;
+            *hi = i;
+        }
+    }
+}
+
+static int color_dist(const byte *a, const byte *b, int channels)
+{
+    int i, d, dist = 0;
+
+    for (i = 0; i < channels; i++) {
+        d = a[i] - b[i];
+        dist += d * d;
+    }
+
+    return dist;
+}
+
+static int best_index(const byte *pixel, const byte *palette, int count, int channels)
+{
+    int i, d, best = 0, bestdist = INT_MAX;
+
+    for (i = 0; i < count; i++) {
+        d = color_dist(pixel, palette + i * 4, channels);
+        if (d < bestdist) {
+            bestdist = d;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+static unsigned pack_565(const byte *c)
+{
+    return ((c[0] * 31 + 127) / 255) << 11 |
+           ((c[1] * 63 + 127) / 255) << 5 |
+           ((c[2] * 31 + 127) / 255);
+}
+
+static void unpack_565(byte *c, unsigned v)
+{
+    unsigned r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+
+    c[0] = (r << 3) | (r >> 2);
+    c[1] = (g << 2) | (g >> 4);
+    c[2] = (b << 3) | (b >> 2);
+    c[3] = 255;
+}
+
+static void color_palette(byte *palette, unsigned c0, unsigned c1, qboolean four)
+{
+    int i;
+
+    unpack_565(palette + 0, c0);
+    unpack_565(palette + 4, c1);
+
+    for (i = 0; i < 3; i++) {
+        if (four) {
+            palette[ 8 + i] = (2 * palette[i] + palette[4 + i]) / 3;
+            palette[12 + i] = (palette[i] + 2 * palette[4 + i]) / 3;
+        } else {
+            palette[ 8 + i] = (palette[i] + palette[4 + i]) / 2;
+            palette[12 + i] = 0;
+        }
+    }
+
+    palette[11] = 255;
+    palette[15] = four ? 255 : 0;
+}
+
+static void write_le16(byte *p, unsigned v)
+{
+    p[0] = v & 255;
+    p[1] = v >> 8;
+}
+
+static void write_le32(byte *p, uint32_t v)
+{
+    p[0] = v & 255;
+    p[1] = (v >> 8) & 255;
+    p[2] = (v >> 16) & 255;
+    p[3] = v >> 24;
+}
+
+// BC1 color block. pixels with alpha below 128 are made transparent
+// unless this is the color part of BC3 block, which is always opaque.
+static void encode_color_block(byte *block, const byte *pixels, qboolean opaque)
+{
+    byte        mask[16], palette[16];
+    unsigned    c0, c1, tmp;
+    uint32_t    indices;
+    int         i, lo, hi, count;
+
+    count = 0;
+    for (i = 0; i < 16; i++) {
+        mask[i] = opaque || pixels[i * 4 + 3] >= 128;
+        count += mask[i];
+    }
+
+    if (!count) {
+        write_le16(block + 0, 0);
+        write_le16(block + 2, 0);
+        write_le32(block + 4, 0xffffffff);
+        return;
+    }
+
+    range_fit(pixels, 3, mask, &lo, &hi);
+    c0 = pack_565(pixels + hi * 4);
+    c1 = pack_565(pixels + lo * 4);
+
+    if (count == 16) {
+        // 4 color mode requires c0 > c1
+        if (c0 < c1) {
+            tmp = c0; c0 = c1; c1 = tmp;
+        }
+        color_palette(palette, c0, c1, qtrue);
+    } else {
+        // 3 color mode with transparency requires c0 <= c1
+        if (c0 > c1) {
+            tmp = c0; c0 = c1; c1 = tmp;
+        }
+        color_palette(palette, c0, c1, qfalse);
+    }
+
+    indices = 0;
+    if (c0 != c1) {
+        for (i = 0; i < 16; i++) {
+            if (mask[i])
+                indices |= best_index(pixels + i * 4, palette, count == 16 ? 4 : 3, 3) << (i * 2);
+            else
+                indices |= 3 << (i * 2);
+        }
+    } else if (count < 16) {
+        for (i = 0; i < 16; i++)
+            if (!mask[i])
+                indices |= 3 << (i * 2);
+    }
+
+    write_le16(block + 0, c0);
+    write_le16(block + 2, c1);
+    write_le32(block + 4, indices);
+}
+
+// BC4 block for the given channel, always uses 8 value mode
+static void encode_alpha_block(byte *block, const byte *pixels, int channel)
+{
+    byte        palette[8 * 4];
+    uint64_t    indices;
+    int         i, lo, hi, v;
+
+    lo = hi = pixels[channel];
+    for (i = 1; i < 16; i++) {
+        v = pixels[i * 4 + channel];
+        lo = min(lo, v);
+        hi = max(hi, v);
+    }
+
+    block[0] = hi;
+    block[1] = lo;
+
+    palette[0] = hi;
+    palette[4] = lo;
+    for (i = 1; i < 7; i++)
+        palette[(i + 1) * 4] = ((7 - i) * hi + i * lo) / 7;
+
+    indices = 0;
+    if (hi != lo)
+        for (i = 0; i < 16; i++)
+            indices |= (uint64_t)best_index(pixels + i * 4 + channel, palette, 8, 1) << (i * 3);
+
+    for (i = 0; i < 6; i++)
+        block[2 + i] = (indices >> (i * 8)) & 255;
+}
+
+static const int bc7_weights4[16] = {
+    0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+};
+
+// quantizes endpoint to 7 bits per channel plus shared p-bit
+static void quantize_endpoint(const byte *color, byte *q, int *pbit)
+{
+    int     i, p, v, err, besterr = INT_MAX;
+    byte    tmp[4];
+
+    for (p = 0; p < 2; p++) {
+        err = 0;
+        for (i = 0; i < 4; i++) {
+            v = (color[i] - p + 1) >> 1;
+            clamp(v, 0, 127);
+            tmp[i] = v;
+            v = (v << 1 | p) - color[i];
+            err += v * v;
+        }
+        if (err < besterr) {
+            besterr = err;
+            memcpy(q, tmp, 4);
+            *pbit = p;
+        }
+    }
+}
+
+static void put_bits(byte *block, int *pos, unsigned value, int bits)
+{
+    int i;
+
+    for (i = 0; i < bits; i++, (*pos)++)
+        if (value & (1 << i))
+            block[*pos >> 3] |= 1 << (*pos & 7);
+}
+
+// BC7 mode 6: single subset RGBA with 7.7.7.7.1 endpoints and 4 bit indices
+static void encode_bc7_block(byte *block, const byte *pixels)
+{
+    byte    q[2][4], palette[16 * 4], e0[4], e1[4], tmp;
+    int     p[2], idx[16], i, j, lo, hi, pos;
+
+    range_fit(pixels, 4, NULL, &lo, &hi);
+    quantize_endpoint(pixels + lo * 4, q[0], &p[0]);
+    quantize_endpoint(pixels + hi * 4, q[1], &p[1]);
+
+    for (j = 0; j < 4; j++) {
+        e0[j] = q[0][j] << 1 | p[0];
+        e1[j] = q[1][j] << 1 | p[1];
+    }
+
+    for (i = 0; i < 16; i++)
+        for (j = 0; j < 4; j++)
+            palette[i * 4 + j] = ((64 - bc7_weights4[i]) * e0[j] + bc7_weights4[i] * e1[j] + 32) >> 6;
+
+    for (i = 0; i < 16; i++)
+        idx[i] = best_index(pixels + i * 4, palette, 16, 4);
+
+    // anchor index has implicit zero MSB
+    if (idx[0] & 8) {
+        for (j = 0; j < 4; j++) {
+            tmp = q[0][j]; q[0][j] = q[1][j]; q[1][j] = tmp;
+        }
+        j = p[0]; p[0] = p[1]; p[1] = j;
+        for (i = 0; i < 16; i++)
+            idx[i] = 15 - idx[i];
+    }
+
+    memset(block, 0, 16);
+    pos = 0;
+    put_bits(block, &pos, 1 << 6, 7);
+    for (j = 0; j < 4; j++) {
+        put_bits(block, &pos, q[0][j], 7);
+        put_bits(block, &pos, q[1][j], 7);
+    }
+    put_bits(block, &pos, p[0], 1);
+    put_bits(block, &pos, p[1], 1);
+    put_bits(block, &pos, idx[0], 3);
+    for (i = 1; i < 16; i++)
+        put_bits(block, &pos, idx[i], 4);
+}
+
+static void encode_block(bcformat_t fmt, byte *block, const byte *pixels)
+{
+    switch (fmt) {
+    case BC_1:
+        encode_color_block(block, pixels, qfalse);
+        break;
+    case BC_3:
+        encode_alpha_block(block, pixels, 3);
+        encode_color_block(block + 8, pixels, qtrue);
+        break;
+    case BC_4:
+        encode_alpha_block(block, pixels, 0);
+        break;
+    case BC_5:
+        encode_alpha_block(block, pixels, 0);
+        encode_alpha_block(block + 8, pixels, 1);
+        break;
+    case BC_7:
+        encode_bc7_block(block, pixels);
+        break;
+    default:
+        break;
+    }
+}
+
+void BC_Encode(bcformat_t fmt, byte *out, const byte *in, int width, int height)
+{
+    byte    pixels[16 * 4];
+    size_t  blocksize = BC_BlockSize(fmt);
+    int     x, y, i, j, sx, sy;
+
+    for (y = 0; y < height; y += 4) {
+        for (x = 0; x < width; x += 4) {
+            for (i = 0; i < 4; i++) {
+                sy = min(y + i, height - 1);
+                for (j = 0; j < 4; j++) {
+                    sx = min(x + j, width - 1);
+                    memcpy(pixels + (i * 4 + j) * 4, in + (sy * width + sx) * 4, 4);
+                }
+            }
+            encode_block(fmt, out, pixels);
+            out += blocksize;
+        }
+    }
+}
+
+/*
+=================================================================
+
+DECODER
+
+=================================================================
+*/
+
+static void decode_color_block(byte *pixels, const byte *block, qboolean four)
+{
+    byte        palette[16];
+    unsigned    c0, c1;
+    uint32_t    indices;
+    int         i;
+
+    c0 = block[0] | block[1] << 8;
+    c1 = block[2] | block[3] << 8;
+    indices = block[4] | block[5] << 8 | block[6] << 16 | (uint32_t)block[7] << 24;
+
+    color_palette(palette, c0, c1, four || c0 > c1);
+
+    for (i = 0; i < 16; i++)
+        memcpy(pixels + i * 4, palette + ((indices >> (i * 2)) & 3) * 4, 4);
+}
+
+static void decode_alpha_block(byte *pixels, const byte *block, int channel)
+{
+    byte        palette[8];
+    uint64_t    indices;
+    int         i, a0, a1;
+
+    a0 = palette[0] = block[0];
+    a1 = palette[1] = block[1];
+
+    if (a0 > a1) {
+        for (i = 1; i < 7; i++)
+            palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+    } else {
+        for (i = 1; i < 5; i++)
+            palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    indices = 0;
+    for (i = 0; i < 6; i++)
+        indices |= (uint64_t)block[2 + i] << (i * 8);
+
+    for (i = 0; i < 16; i++)
+        pixels[i * 4 + channel] = palette[(indices >> (i * 3)) & 7];
+}
+
+static unsigned get_bits(const byte *block, int *pos, int bits)
+{
+    unsigned v = 0;
+    int i;
+
+    for (i = 0; i < bits; i++, (*pos)++)
+        if (block[*pos >> 3] & (1 << (*pos & 7)))
+            v |= 1 << i;
+
+    return v;
+}
+
+static qboolean decode_bc7_block(byte *pixels, const byte *block)
+{
+    byte    e0[4], e1[4];
+    int     i, j, w, pos;
+
+    if ((block[0] & 0x7f) != 0x40) {
+        memset(pixels, 0, 16 * 4);
+        return qfalse;
+    }
+
+    pos = 7;
+    for (j = 0; j < 4; j++) {
+        e0[j] = get_bits(block, &pos, 7) << 1;
+        e1[j] = get_bits(block, &pos, 7) << 1;
+    }
+    i = get_bits(block, &pos, 1);
+    j = get_bits(block, &pos, 1);
+    e0[0] |= i; e0[1] |= i; e0[2] |= i; e0[3] |= i;
+    e1[0] |= j; e1[1] |= j; e1[2] |= j; e1[3] |= j;
+
+    for (i = 0; i < 16; i++) {
+        w = bc7_weights4[get_bits(block, &pos, i ? 4 : 3)];
+        for (j = 0; j < 4; j++)
+            pixels[i * 4 + j] = ((64 - w) * e0[j] + w * e1[j] + 32) >> 6;
+    }
+
+    return qtrue;
+}
+
+static qboolean decode_block(bcformat_t fmt, byte *pixels, const byte *block)
+{
+    int i;
+
+    switch (fmt) {
+    case BC_1:
+        decode_color_block(pixels, block, qfalse);
+        break;
+    case BC_3:
+        decode_color_block(pixels, block + 8, qtrue);
+        decode_alpha_block(pixels, block, 3);
+        break;
+    case BC_4:
+    case BC_5:
+        for (i = 0; i < 16; i++) {
+            pixels[i * 4 + 1] = 0;
+            pixels[i * 4 + 2] = 0;
+            pixels[i * 4 + 3] = 255;
+        }
+        decode_alpha_block(pixels, block, 0);
+        if (fmt == BC_5)
+            decode_alpha_block(pixels, block + 8, 1);
+        break;
+    case BC_7:
+        return decode_bc7_block(pixels, block);
+    default:
+        memset(pixels, 0, 16 * 4);
+        return qfalse;
+    }
+
+    return qtrue;
+}
+
+qboolean BC_Decode(bcformat_t fmt, byte *out, const byte *in, int width, int height)
+{
+    byte        pixels[16 * 4];
+    size_t      blocksize = BC_BlockSize(fmt);
+    qboolean    ret = qtrue;
+    int         x, y, i, w, h;
+
+    for (y = 0; y < height; y += 4) {
+        h = min(height - y, 4);
+        for (x = 0; x < width; x += 4) {
+            w = min(width - x, 4);
+            if (!decode_block(fmt, pixels, in))
+                ret = qfalse;
+            for (i = 0; i < h; i++)
+                memcpy(out + ((y + i) * width + x) * 4, pixels + i * 16, w * 4);
+            in += blocksize;
+        }
+    }
+
+    return ret;
+}
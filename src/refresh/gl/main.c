@@ -1123,8 +1123,8 @@ R_EndRegistration
 */
 void R_EndRegistration_GL(void)
 {
-    IMG_FreeUnused();
     MOD_FreeUnused();
+    IMG_FreeUnused();
     Scrap_Upload();
     gl_static.registering = qfalse;
 }
@@ -1173,6 +1173,7 @@ void R_RegisterFunctionsGL()
 	R_InterceptKey = R_InterceptKey_GL;
 	IMG_Load = IMG_Load_GL;
 	IMG_Unload = IMG_Unload_GL;
+	IMG_SupportsCompressed = NULL;
 	IMG_ReadPixels = IMG_ReadPixels_GL;
 	MOD_LoadMD2 = MOD_LoadMD2_GL;
 	MOD_LoadMD3 = MOD_LoadMD3_GL;
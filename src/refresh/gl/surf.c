@@ -914,7 +914,20 @@ void GL_LoadWorld(const char *name)
     // calculate world size for far clip plane and sky box
     set_world_size();
 
-    // register all texinfo
+    // register all texinfo, decoding images in parallel
+    for (i = 0, info = bsp->texinfo; i < bsp->numtexinfo; i++, info++) {
+        if (info->c.flags & SURF_WARP)
+            flags = IF_TURBULENT;
+        else
+            flags = IF_NONE;
+
+        Q_concat(buffer, sizeof(buffer), "textures/", info->name, ".wal", NULL);
+        FS_NormalizePath(buffer, buffer);
+        IMG_Request(buffer, IT_WALL, flags);
+    }
+
+    IMG_LoadRequested();
+
     for (i = 0, info = bsp->texinfo; i < bsp->numtexinfo; i++, info++) {
         if (info->c.flags & SURF_WARP)
             flags = IF_TURBULENT;
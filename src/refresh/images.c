@@ -26,7 +26,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/common.h"
 #include "common/cvar.h"
 #include "common/files.h"
+#include "common/jobs.h"
+#include "common/x86/cpu.h"
 #include "refresh/images.h"
+#include "system/system.h"
+#include "format/dds.h"
 #include "format/pcx.h"
 #include "format/wal.h"
 #include "stb_image.h"
@@ -333,6 +337,132 @@ IMG_LOAD(WAL)
 /*
 =================================================================
 
+DDS LOADING
+
+Only 2D block compressed textures are supported. Pixel data holds
+all mip levels stored in the file and is uploaded as is.
+
+=================================================================
+*/
+
+static bcformat_t dds_format(const DDS_HEADER *dds, const DDS_HEADER_DXT10 *dxt10)
+{
+    if (!(LittleLong(dds->ddspf.flags) & DDS_FOURCC))
+        return BC_NONE;
+
+    switch (LittleLong(dds->ddspf.fourCC)) {
+    case MAKEFOURCC('D', 'X', 'T', '1'):
+        return BC_1;
+    case MAKEFOURCC('D', 'X', 'T', '5'):
+        return BC_3;
+    case MAKEFOURCC('A', 'T', 'I', '1'):
+    case MAKEFOURCC('B', 'C', '4', 'U'):
+        return BC_4;
+    case MAKEFOURCC('A', 'T', 'I', '2'):
+    case MAKEFOURCC('B', 'C', '5', 'U'):
+        return BC_5;
+    case MAKEFOURCC('D', 'X', '1', '0'):
+        break;
+    default:
+        return BC_NONE;
+    }
+
+    if (LittleLong(dxt10->resourceDimension) != DDS_DIMENSION_TEXTURE2D ||
+        LittleLong(dxt10->arraySize) > 1 ||
+        (LittleLong(dxt10->miscFlag) & DDS_RESOURCE_MISC_TEXTURECUBE))
+        return BC_NONE;
+
+    switch (LittleLong(dxt10->dxgiFormat)) {
+    case DXGI_FORMAT_BC1_TYPELESS:
+    case DXGI_FORMAT_BC1_UNORM:
+    case DXGI_FORMAT_BC1_UNORM_SRGB:
+        return BC_1;
+    case DXGI_FORMAT_BC3_TYPELESS:
+    case DXGI_FORMAT_BC3_UNORM:
+    case DXGI_FORMAT_BC3_UNORM_SRGB:
+        return BC_3;
+    case DXGI_FORMAT_BC4_TYPELESS:
+    case DXGI_FORMAT_BC4_UNORM:
+        return BC_4;
+    case DXGI_FORMAT_BC5_TYPELESS:
+    case DXGI_FORMAT_BC5_UNORM:
+        return BC_5;
+    case DXGI_FORMAT_BC7_TYPELESS:
+    case DXGI_FORMAT_BC7_UNORM:
+    case DXGI_FORMAT_BC7_UNORM_SRGB:
+        return BC_7;
+    default:
+        return BC_NONE;
+    }
+}
+
+IMG_LOAD(DDS)
+{
+    const DDS_HEADER        *dds = (const DDS_HEADER *)rawdata;
+    const DDS_HEADER_DXT10  *dxt10 = (const DDS_HEADER_DXT10 *)(dds + 1);
+    size_t      offset, size;
+    bcformat_t  fmt;
+    int         w, h, levels, maxlevels;
+
+    if (rawlen < sizeof(*dds)) {
+        return Q_ERR_FILE_TOO_SMALL;
+    }
+
+    if (LittleLong(dds->magic) != DDS_MAGIC ||
+        LittleLong(dds->size) != sizeof(*dds) - 4) {
+        return Q_ERR_UNKNOWN_FORMAT;
+    }
+
+    offset = sizeof(*dds);
+    if (LittleLong(dds->ddspf.fourCC) == MAKEFOURCC('D', 'X', '1', '0')) {
+        offset += sizeof(*dxt10);
+        if (rawlen < offset) {
+            return Q_ERR_FILE_TOO_SMALL;
+        }
+    }
+
+    fmt = dds_format(dds, dxt10);
+    if (fmt == BC_NONE) {
+        return Q_ERR_INVALID_FORMAT;
+    }
+
+    w = LittleLong(dds->width);
+    h = LittleLong(dds->height);
+    if (w < 1 || h < 1 || w > 8192 || h > 8192) {
+        return Q_ERR_INVALID_FORMAT;
+    }
+
+    for (maxlevels = 1; (w | h) >> maxlevels; maxlevels++)
+        ;
+
+    levels = 1;
+    if (LittleLong(dds->flags) & DDS_HEADER_FLAGS_MIPMAP) {
+        levels = LittleLong(dds->mipMapCount);
+        clamp(levels, 1, maxlevels);
+    }
+
+    size = BC_ChainSize(fmt, w, h, levels);
+    if (size > rawlen - offset) {
+        return Q_ERR_BAD_EXTENT;
+    }
+
+    *pic = IMG_AllocPixels(size);
+    memcpy(*pic, rawdata + offset, size);
+
+    image->upload_width = image->width = w;
+    image->upload_height = image->height = h;
+    image->bc_format = fmt;
+    image->bc_levels = levels;
+
+    if (fmt == BC_4 || fmt == BC_5)
+        image->flags |= IF_OPAQUE;
+
+    return Q_ERR_SUCCESS;
+}
+
+/*
+=================================================================
+
 STB_IMAGE LOADING
 
 =================================================================
@@ -574,19 +704,10 @@ IMAGE PROCESSING
 =========================================================
 */
 
-void IMG_ResampleTexture(const byte *in, int inwidth, int inheight,
-                         byte *out, int outwidth, int outheight)
+static void resample_steps(unsigned *p1, unsigned *p2, int inwidth, int outwidth)
 {
-    int i, j;
-    const byte  *inrow1, *inrow2;
     unsigned    frac, fracstep;
-    unsigned    p1[MAX_TEXTURE_SIZE], p2[MAX_TEXTURE_SIZE];
-    const byte  *pix1, *pix2, *pix3, *pix4;
-    float       heightScale;
-
-    if (outwidth > MAX_TEXTURE_SIZE) {
-        Com_Error(ERR_FATAL, "%s: outwidth > %d", __func__, MAX_TEXTURE_SIZE);
-    }
+    int         i;
 
     fracstep = inwidth * 0x10000 / outwidth;
 
@@ -600,42 +721,255 @@ void IMG_ResampleTexture(const byte *in, int inwidth, int inheight,
         p2[i] = 4 * (frac >> 16);
         frac += fracstep;
     }
+}
+
+static void resample_row_c(const byte *inrow1, const byte *inrow2,
+                           const unsigned *p1, const unsigned *p2,
+                           byte *out, int start, int outwidth)
+{
+    const byte  *pix1, *pix2, *pix3, *pix4;
+    int         j;
+
+    for (j = start, out += j * 4; j < outwidth; j++) {
+        pix1 = inrow1 + p1[j];
+        pix2 = inrow1 + p2[j];
+        pix3 = inrow2 + p1[j];
+        pix4 = inrow2 + p2[j];
+        out[0] = (pix1[0] + pix2[0] + pix3[0] + pix4[0]) >> 2;
+        out[1] = (pix1[1] + pix2[1] + pix3[1] + pix4[1]) >> 2;
+        out[2] = (pix1[2] + pix2[2] + pix3[2] + pix4[2]) >> 2;
+        out[3] = (pix1[3] + pix2[3] + pix3[3] + pix4[3]) >> 2;
+        out += 4;
+    }
+}
+
+// averages 2x2 blocks of the given row pair, starting at input pixel x
+static void mipmap_row_c(byte *out, const byte *in, int x, int width)
+{
+    int         j;
+
+    width <<= 2;
+    for (j = x * 4, out += x * 2, in += x * 4; j < width; j += 8, out += 4, in += 8) {
+        out[0] = (in[0] + in[4] + in[width + 0] + in[width + 4]) >> 2;
+        out[1] = (in[1] + in[5] + in[width + 1] + in[width + 5]) >> 2;
+        out[2] = (in[2] + in[6] + in[width + 2] + in[width + 6]) >> 2;
+        out[3] = (in[3] + in[7] + in[width + 3] + in[width + 7]) >> 2;
+    }
+}
+
+static void resample_texture_c(const unsigned *p1, const unsigned *p2,
+                               const byte *inrow1, const byte *inrow2,
+                               byte *out, int outwidth)
+{
+    resample_row_c(inrow1, inrow2, p1, p2, out, 0, outwidth);
+}
+
+static void mipmap_c(byte *out, const byte *in, int width)
+{
+    mipmap_row_c(out, in, 0, width);
+}
+
+#if USE_X86_SIMD
+
+/*
+SIMD kernels produce output identical to the scalar versions above:
+all channel sums are computed exactly in 16-bit lanes before the shift.
+*/
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+X86_TARGET("sse2")
+static void resample_texture_sse2(const unsigned *p1, const unsigned *p2,
+                                  const byte *inrow1, const byte *inrow2,
+                                  byte *out, int outwidth)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int j;
+
+#define LOAD4(row, p) \
+    _mm_setr_epi32(*(const int *)(row + p[j + 0]), *(const int *)(row + p[j + 1]), \
+                   *(const int *)(row + p[j + 2]), *(const int *)(row + p[j + 3]))
+
+    for (j = 0; j + 4 <= outwidth; j += 4) {
+        __m128i a = LOAD4(inrow1, p1);
+        __m128i b = LOAD4(inrow1, p2);
+        __m128i c = LOAD4(inrow2, p1);
+        __m128i d = LOAD4(inrow2, p2);
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+                                   _mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero)));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+                                   _mm_add_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero)));
+        lo = _mm_srli_epi16(lo, 2);
+        hi = _mm_srli_epi16(hi, 2);
+        _mm_storeu_si128((__m128i *)(out + j * 4), _mm_packus_epi16(lo, hi));
+    }
+
+#undef LOAD4
+
+    resample_row_c(inrow1, inrow2, p1, p2, out, j, outwidth);
+}
+
+X86_TARGET("sse2")
+static void mipmap_sse2(byte *out, const byte *in, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const byte *in2 = in + width * 4;
+    int x;
+
+    // 4 input pixels per row produce 2 output pixels
+    for (x = 0; x + 4 <= width; x += 4) {
+        __m128i r0 = _mm_loadu_si128((const __m128i *)(in + x * 4));
+        __m128i r1 = _mm_loadu_si128((const __m128i *)(in2 + x * 4));
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(r0, zero), _mm_unpacklo_epi8(r1, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(r0, zero), _mm_unpackhi_epi8(r1, zero));
+        lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+        lo = _mm_srli_epi16(_mm_unpacklo_epi64(lo, hi), 2);
+        _mm_storel_epi64((__m128i *)(out + x * 2), _mm_packus_epi16(lo, lo));
+    }
+
+    mipmap_row_c(out, in, x, width);
+}
+
+X86_TARGET("avx2")
+static void resample_texture_avx2(const unsigned *p1, const unsigned *p2,
+                                  const byte *inrow1, const byte *inrow2,
+                                  byte *out, int outwidth)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    int j;
+
+    for (j = 0; j + 8 <= outwidth; j += 8) {
+        __m256i o1 = _mm256_loadu_si256((const __m256i *)(p1 + j));
+        __m256i o2 = _mm256_loadu_si256((const __m256i *)(p2 + j));
+        __m256i a = _mm256_i32gather_epi32((const int *)inrow1, o1, 1);
+        __m256i b = _mm256_i32gather_epi32((const int *)inrow1, o2, 1);
+        __m256i c = _mm256_i32gather_epi32((const int *)inrow2, o1, 1);
+        __m256i d = _mm256_i32gather_epi32((const int *)inrow2, o2, 1);
+        __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero)),
+                                      _mm256_add_epi16(_mm256_unpacklo_epi8(c, zero), _mm256_unpacklo_epi8(d, zero)));
+        __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero)),
+                                      _mm256_add_epi16(_mm256_unpackhi_epi8(c, zero), _mm256_unpackhi_epi8(d, zero)));
+        lo = _mm256_srli_epi16(lo, 2);
+        hi = _mm256_srli_epi16(hi, 2);
+        // unpack and pack both work within 128-bit lanes, so order is preserved
+        _mm256_storeu_si256((__m256i *)(out + j * 4), _mm256_packus_epi16(lo, hi));
+    }
+
+    resample_row_c(inrow1, inrow2, p1, p2, out, j, outwidth);
+}
+
+X86_TARGET("avx2")
+static void mipmap_avx2(byte *out, const byte *in, int width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const byte *in2 = in + width * 4;
+    int x;
+
+    // 8 input pixels per row produce 4 output pixels
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m256i r0 = _mm256_loadu_si256((const __m256i *)(in + x * 4));
+        __m256i r1 = _mm256_loadu_si256((const __m256i *)(in2 + x * 4));
+        __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(r0, zero), _mm256_unpacklo_epi8(r1, zero));
+        __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(r0, zero), _mm256_unpackhi_epi8(r1, zero));
+        lo = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+        hi = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+        lo = _mm256_srli_epi16(_mm256_unpacklo_epi64(lo, hi), 2);
+        lo = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, lo), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i *)(out + x * 2), _mm256_castsi256_si128(lo));
+    }
+
+    mipmap_row_c(out, in, x, width);
+}
+
+#endif // USE_X86_SIMD
+
+typedef void (*resamplefunc_t)(const unsigned *, const unsigned *,
+                               const byte *, const byte *, byte *, int);
+typedef void (*mipmapfunc_t)(byte *, const byte *, int);
+
+static const struct {
+    const char      *name;
+    unsigned        cpu;
+    resamplefunc_t  resample;
+    mipmapfunc_t    mipmap;
+} img_kernels[] = {
+#if USE_X86_SIMD
+    { "avx2", CPU_AVX2, resample_texture_avx2, mipmap_avx2 },
+    { "sse2", CPU_SSE2, resample_texture_sse2, mipmap_sse2 },
+#endif
+    { "c", 0, resample_texture_c, mipmap_c }
+};
+
+// selected by IMG_Init
+static int img_kernel = q_countof(img_kernels) - 1;
+
+static void select_kernels(void)
+{
+    unsigned features = X86_CPUFeatures();
+    int i;
+
+    for (i = 0; i < q_countof(img_kernels); i++) {
+        if ((img_kernels[i].cpu & features) == img_kernels[i].cpu) {
+            break;
+        }
+    }
+
+    img_kernel = i;
+    Com_DPrintf("Using %s image processing kernels\n", img_kernels[i].name);
+}
+
+static void resample_texture(resamplefunc_t func,
+                             const byte *in, int inwidth, int inheight,
+                             byte *out, int outwidth, int outheight)
+{
+    int i;
+    const byte  *inrow1, *inrow2;
+    unsigned    p1[MAX_TEXTURE_SIZE], p2[MAX_TEXTURE_SIZE];
+    float       heightScale;
+
+    if (outwidth > MAX_TEXTURE_SIZE) {
+        Com_Error(ERR_FATAL, "%s: outwidth > %d", __func__, MAX_TEXTURE_SIZE);
+    }
+
+    resample_steps(p1, p2, inwidth, outwidth);
 
     heightScale = (float)inheight / outheight;
     inwidth <<= 2;
     for (i = 0; i < outheight; i++) {
         inrow1 = in + inwidth * (int)((i + 0.25f) * heightScale);
         inrow2 = in + inwidth * (int)((i + 0.75f) * heightScale);
-        for (j = 0; j < outwidth; j++) {
-            pix1 = inrow1 + p1[j];
-            pix2 = inrow1 + p2[j];
-            pix3 = inrow2 + p1[j];
-            pix4 = inrow2 + p2[j];
-            out[0] = (pix1[0] + pix2[0] + pix3[0] + pix4[0]) >> 2;
-            out[1] = (pix1[1] + pix2[1] + pix3[1] + pix4[1]) >> 2;
-            out[2] = (pix1[2] + pix2[2] + pix3[2] + pix4[2]) >> 2;
-            out[3] = (pix1[3] + pix2[3] + pix3[3] + pix4[3]) >> 2;
-            out += 4;
-        }
+        func(p1, p2, inrow1, inrow2, out, outwidth);
+        out += outwidth * 4;
     }
 }
 
-void IMG_MipMap(byte *out, byte *in, int width, int height)
+static void mipmap(mipmapfunc_t func, byte *out, byte *in, int width, int height)
 {
-    int     i, j;
+    int     i, n;
+
+    // output pixels per row, odd widths are rounded up like before
+    n = (width + 1) >> 1;
 
-    width <<= 2;
     height >>= 1;
-    for (i = 0; i < height; i++, in += width) {
-        for (j = 0; j < width; j += 8, out += 4, in += 8) {
-            out[0] = (in[0] + in[4] + in[width + 0] + in[width + 4]) >> 2;
-            out[1] = (in[1] + in[5] + in[width + 1] + in[width + 5]) >> 2;
-            out[2] = (in[2] + in[6] + in[width + 2] + in[width + 6]) >> 2;
-            out[3] = (in[3] + in[7] + in[width + 3] + in[width + 7]) >> 2;
-        }
+    for (i = 0; i < height; i++, in += n * 8 + width * 4, out += n * 4) {
+        func(out, in, width);
     }
 }
 
+void IMG_ResampleTexture(const byte *in, int inwidth, int inheight,
+                         byte *out, int outwidth, int outheight)
+{
+    resample_texture(img_kernels[img_kernel].resample,
+                     in, inwidth, inheight, out, outwidth, outheight);
+}
+
+void IMG_MipMap(byte *out, byte *in, int width, int height)
+{
+    mipmap(img_kernels[img_kernel].mipmap, out, in, width, height);
+}
+
 /*
 =========================================================
 
@@ -644,9 +978,28 @@ IMAGE MANAGER
 =========================================================
 */
 
-#define RIMAGES_HASH    256
+// open addressing hash table of image slots, keyed by full name hash.
+// must be a power of two and at least twice MAX_RIMAGES to keep probe
+// sequences short. index 0 marks an empty entry, R_NOTEXTURE is never hashed.
+#define RIMAGES_HASH    (MAX_RIMAGES * 2)
 
-static list_t   r_imageHash[RIMAGES_HASH];
+typedef struct {
+    unsigned    hash;
+    int         index;
+} imagehash_t;
+
+static imagehash_t  r_imageHash[RIMAGES_HASH];
+
+// free image_t slots below r_numImages
+static int      r_freeImages[MAX_RIMAGES];
+static int      r_numFreeImages;
+
+// slots of all registered images. the first r_numTouched entries were
+// touched on r_touchSequence, so IMG_FreeUnused only visits the rest.
+static int      r_liveImages[MAX_RIMAGES];
+static int      r_numLiveImages;
+static int      r_numTouched;
+static int      r_touchSequence;
 
 image_t     r_images[MAX_RIMAGES];
 int         r_numImages;
@@ -661,7 +1014,8 @@ static const struct {
     { "wal", IMG_LoadWAL },
     { "tga", IMG_LoadSTB },
     { "jpg", IMG_LoadSTB },
-    { "png", IMG_LoadSTB }
+    { "png", IMG_LoadSTB },
+    { "dds", IMG_LoadDDS }
 };
 
 static imageformat_t    img_search[IM_MAX];
@@ -670,6 +1024,42 @@ static int              img_total;
 static cvar_t   *r_override_textures;
 static cvar_t   *r_texture_formats;
 
+// pending image for batched registration, decoded by IMG_LoadRequested
+typedef struct {
+    image_t         *image;
+    char            name[MAX_QPATH];    // as requested
+    size_t          len;
+    imageformat_t   orig;               // format of requested extension
+    imageformat_t   fmt;                // format of the file found
+    byte            *rawdata;
+    ssize_t         rawlen;
+    byte            *pic;
+    qerror_t        ret;
+} imagereq_t;
+
+#define MAX_IMAGE_REQUESTS  256
+
+static imagereq_t   img_requests[MAX_IMAGE_REQUESTS];
+static int          img_numrequests;
+
+// texture memory saved by block compression, including mip levels
+static size_t compressed_savings(const image_t *image)
+{
+    int w = image->upload_width;
+    int h = image->upload_height;
+    int levels;
+
+    if (image->bc_format == BC_NONE) {
+        return 0;
+    }
+
+    for (levels = 1; (w | h) >> levels; levels++)
+        ;
+
+    return BC_ChainSize(BC_NONE, w, h, levels) -
+           BC_ChainSize(image->bc_format, w, h, image->bc_levels);
+}
+
 /*
 ===============
 IMG_List_f
@@ -680,6 +1070,8 @@ static void IMG_List_f(void)
 	int        i;
 	image_t    *image;
 	int        texels, count;
+	size_t     saved, total_saved;
+	char       buffer[16];
 
 	if (Cmd_Argc() > 1) {
 
@@ -698,14 +1090,16 @@ static void IMG_List_f(void)
 				continue;
 
 			char fmt[MAX_QPATH];
-			sprintf(fmt, "%%-%ds, %%-%ds, (%% 5d %% 5d), sRGB:%%d\n", MAX_QPATH, MAX_QPATH);
+			sprintf(fmt, "%%-%ds, %%-%ds, (%% 5d %% 5d), sRGB:%%d, %%s, saved:%%zu\n", MAX_QPATH, MAX_QPATH);
 
 			FS_FPrintf(f, fmt, 
 				image->name, 
 				image->filepath, 
 				image->width, 
 				image->height,
-				image->is_srgb);
+				image->is_srgb,
+				BC_FormatName(image->bc_format),
+				compressed_savings(image));
 		}
 		FS_FCloseFile(f);
 
@@ -718,47 +1112,156 @@ static void IMG_List_f(void)
 
 		Com_Printf("------------------\n");
 		texels = count = 0;
+		total_saved = 0;
 
 		for (i = 1, image = r_images + 1; i < r_numImages; i++, image++) {
 			if (!image->registration_sequence)
 				continue;
 
-			Com_Printf("%c%c%c%c %4i %4i %s: %s\n",
+			saved = compressed_savings(image);
+			if (saved)
+				Com_FormatSize(buffer, sizeof(buffer), saved);
+
+			Com_Printf("%c%c%c%c %4i %4i %s: %s%s%s%s\n",
 				types[image->type > IT_MAX ? IT_MAX : image->type],
 				(image->flags & IF_TRANSPARENT) ? 'T' : ' ',
 				(image->flags & IF_SCRAP) ? 'S' : ' ',
 				(image->flags & IF_PERMANENT) ? '*' : ' ',
 				image->upload_width,
 				image->upload_height,
+				image->bc_format ? BC_FormatName(image->bc_format) :
 				(image->flags & IF_PALETTED) ? "PAL" : "RGB",
-				image->name);
+				image->name,
+				saved ? " (" : "", saved ? buffer : "", saved ? " saved)" : "");
 
 			texels += image->upload_width * image->upload_height;
+			total_saved += saved;
 			count++;
 		}
 		Com_Printf("Total images: %d (out of %d slots)\n", count, r_numImages);
 		Com_Printf("Total texels: %d (not counting mipmaps)\n", texels);
+		if (total_saved) {
+			Com_FormatSize(buffer, sizeof(buffer), total_saved);
+			Com_Printf("Memory saved by compression: %s\n", buffer);
+		}
 	}
 }
 
 static image_t *alloc_image(void)
 {
-    int i;
-    image_t *image;
+    if (r_numFreeImages)
+        return &r_images[r_freeImages[--r_numFreeImages]];
 
-    // find a free image_t slot
-    for (i = 1, image = r_images + 1; i < r_numImages; i++, image++) {
-        if (!image->registration_sequence)
-            break;
-    }
+    if (r_numImages == MAX_RIMAGES)
+        return NULL;
+
+    return &r_images[r_numImages++];
+}
 
-    if (i == r_numImages) {
-        if (r_numImages == MAX_RIMAGES)
-            return NULL;
-        r_numImages++;
+// returns slot of unregistered image back to the free list
+static void free_image_slot(image_t *image)
+{
+    memset(image, 0, sizeof(*image));
+    r_freeImages[r_numFreeImages++] = image - r_images;
+}
+
+static void swap_live_images(int a, int b)
+{
+    int tmp = r_liveImages[a];
+
+    r_liveImages[a] = r_liveImages[b];
+    r_liveImages[b] = tmp;
+    r_images[r_liveImages[a]].live_index = a;
+    r_images[r_liveImages[b]].live_index = b;
+}
+
+// new registration sequence makes all images stale
+static void update_touched(void)
+{
+    if (r_touchSequence != registration_sequence) {
+        r_touchSequence = registration_sequence;
+        r_numTouched = 0;
     }
+}
+
+// marks image as used on this registration sequence
+static void touch_image(image_t *image)
+{
+    update_touched();
 
-    return image;
+    image->registration_sequence = registration_sequence;
+
+    if (image->live_index >= r_numTouched)
+        swap_live_images(image->live_index, r_numTouched++);
+}
+
+// moves image out of the touched part of live list
+static void untouch_image(image_t *image)
+{
+    update_touched();
+
+    if (image->live_index < r_numTouched)
+        swap_live_images(image->live_index, --r_numTouched);
+}
+
+// makes image visible to lookups
+static void insert_image(image_t *image, unsigned hash)
+{
+    unsigned i;
+
+    for (i = hash & (RIMAGES_HASH - 1); r_imageHash[i].index; i = (i + 1) & (RIMAGES_HASH - 1))
+        ;
+
+    r_imageHash[i].hash = hash;
+    r_imageHash[i].index = image - r_images;
+
+    image->hash = hash;
+    image->live_index = r_numLiveImages;
+    r_liveImages[r_numLiveImages++] = image - r_images;
+
+    touch_image(image);
+}
+
+// removes image from the hash table and live list, doesn't free the slot
+static void remove_image(image_t *image)
+{
+    unsigned i, j, k;
+    int index = image - r_images;
+
+    for (i = image->hash & (RIMAGES_HASH - 1); r_imageHash[i].index != index; i = (i + 1) & (RIMAGES_HASH - 1))
+        ;
+
+    // shift back following entries of the probe sequence
+    // instead of leaving a tombstone
+    for (j = i; ; ) {
+        r_imageHash[i].index = 0;
+        do {
+            j = (j + 1) & (RIMAGES_HASH - 1);
+            if (!r_imageHash[j].index)
+                goto unlink;
+            k = r_imageHash[j].hash & (RIMAGES_HASH - 1);
+        } while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+        r_imageHash[i] = r_imageHash[j];
+        i = j;
+    }
+
+unlink:
+    untouch_image(image);
+    swap_live_images(image->live_index, --r_numLiveImages);
+}
+
+/*
+===============
+IMG_FreeImage
+
+Unloads registered image and frees its slot.
+===============
+*/
+void IMG_FreeImage(image_t *image)
+{
+    remove_image(image);
+    IMG_Unload(image);
+    free_image_slot(image);
 }
 
 // finds the given image of the given type.
@@ -767,9 +1270,13 @@ static image_t *lookup_image(const char *name,
                              imagetype_t type, unsigned hash, size_t baselen)
 {
     image_t *image;
+    unsigned i;
 
-    // look for it
-    LIST_FOR_EACH(image_t, image, &r_imageHash[hash], entry) {
+    for (i = hash & (RIMAGES_HASH - 1); r_imageHash[i].index; i = (i + 1) & (RIMAGES_HASH - 1)) {
+        if (r_imageHash[i].hash != hash) {
+            continue;
+        }
+        image = &r_images[r_imageHash[i].index];
         if (image->type != type) {
             continue;
         }
@@ -784,22 +1291,46 @@ static image_t *lookup_image(const char *name,
     return NULL;
 }
 
-static int _try_image_format(imageformat_t fmt, image_t *image, byte **pic)
+// if req is not NULL, decompression is deferred and raw file
+// data is kept in the request instead
+static int _try_image_format(imageformat_t fmt, image_t *image, byte **pic,
+                             imagereq_t *req)
 {
     byte        *data;
     ssize_t     len;
     qerror_t    ret;
 
+    // compressed textures are only used for world and model surfaces,
+    // other image types may need their pixels on the CPU side
+    if (fmt == IM_DDS) {
+        if (!IMG_SupportsCompressed || !IMG_SupportsCompressed()) {
+            return Q_ERR_NOENT;
+        }
+        if (image->type != IT_WALL && image->type != IT_SKIN) {
+            return Q_ERR_NOENT;
+        }
+    }
+
+    image->bc_format = BC_NONE;
+    image->bc_levels = 1;
+
     // load the file
     len = FS_LoadFile(image->name, (void **)&data);
     if (!data) {
         return len;
     }
 
-    // decompress the image
-    ret = img_loaders[fmt].load(data, len, image, pic);
+    if (req) {
+        req->rawdata = data;
+        req->rawlen = len;
+        req->fmt = fmt;
+        ret = Q_ERR_SUCCESS;
+    } else {
+        // decompress the image
+        ret = img_loaders[fmt].load(data, len, image, pic);
 
-    FS_FreeFile(data);
+        FS_FreeFile(data);
+    }
 
     image->filepath[0] = 0;
     if (ret >= 0) {
@@ -811,16 +1342,18 @@ static int _try_image_format(imageformat_t fmt, image_t *image, byte **pic)
     return ret < 0 ? ret : fmt;
 }
 
-static int try_image_format(imageformat_t fmt, image_t *image, byte **pic)
+static int try_image_format(imageformat_t fmt, image_t *image, byte **pic,
+                            imagereq_t *req)
 {
     // replace the extension
     memcpy(image->name + image->baselen + 1, img_loaders[fmt].ext, 4);
-    return _try_image_format(fmt, image, pic);
+    return _try_image_format(fmt, image, pic, req);
 }
 
 
 // tries to load the image with a different extension
-static int try_other_formats(imageformat_t orig, image_t *image, byte **pic)
+static int try_other_formats(imageformat_t orig, image_t *image, byte **pic,
+                             imagereq_t *req)
 {
     imageformat_t   fmt;
     qerror_t        ret;
@@ -833,7 +1366,7 @@ static int try_other_formats(imageformat_t orig, image_t *image, byte **pic)
             continue;   // don't retry twice
         }
 
-        ret = try_image_format(fmt, image, pic);
+        ret = try_image_format(fmt, image, pic, req);
         if (ret != Q_ERR_NOENT) {
             return ret; // found something
         }
@@ -845,7 +1378,7 @@ static int try_other_formats(imageformat_t orig, image_t *image, byte **pic)
         return Q_ERR_NOENT; // don't retry twice
     }
 
-    return try_image_format(fmt, image, pic);
+    return try_image_format(fmt, image, pic, req);
 }
 
 static void get_image_dimensions(imageformat_t fmt, image_t *image)
@@ -906,6 +1439,7 @@ static void r_texture_formats_changed(cvar_t *self)
             case 't': case 'T': i = IM_TGA; break;
             case 'j': case 'J': i = IM_JPG; break;
             case 'p': case 'P': i = IM_PNG; break;
+            case 'd': case 'D': i = IM_DDS; break;
             default: continue;
         }
 
@@ -924,7 +1458,7 @@ static void r_texture_formats_changed(cvar_t *self)
 }
 
 qerror_t
-load_img(const char *name, image_t *image)
+load_img(const char *name, imagetype_t type, image_t *image)
 {
     byte            *pic;
     imageformat_t   fmt;
@@ -942,7 +1476,7 @@ load_img(const char *name, image_t *image)
 
     memcpy(image->name, name, len + 1);
     image->baselen = len - 4;
-    image->type = 0;
+    image->type = type;
     image->flags = 0;
     image->registration_sequence = 1;
 
@@ -957,10 +1491,10 @@ load_img(const char *name, image_t *image)
     pic = NULL;
 
 	// first try with original extension
-	ret = _try_image_format(fmt, image, &pic);
+	ret = _try_image_format(fmt, image, &pic, NULL);
 	if (ret == Q_ERR_NOENT) {
 		// retry with remaining extensions
-		ret = try_other_formats(fmt, image, &pic);
+		ret = try_other_formats(fmt, image, &pic, NULL);
     }
 
     // if we are replacing 8-bit texture with a higher resolution 32-bit
@@ -987,43 +1521,15 @@ load_img(const char *name, image_t *image)
     return Q_ERR_SUCCESS;
 }
 
-// finds or loads the given image, adding it to the hash table.
-static qerror_t find_or_load_image(const char *name, size_t len,
-                                   imagetype_t type, imageflags_t flags,
-                                   image_t **image_p)
+// loads the pic for the given image slot, trying texture overrides first.
+// if req is not NULL, only the file is read and decompression is deferred.
+static qerror_t load_image_data(const char *name, size_t len, image_t *image,
+                                imagetype_t type, imageflags_t flags,
+                                byte **pic, imagereq_t *req)
 {
-    image_t         *image;
-    byte            *pic;
-    unsigned        hash;
     imageformat_t   fmt;
     qerror_t        ret;
 
-    *image_p = NULL;
-
-    // must have an extension and at least 1 char of base name
-    if (len <= 4) {
-        return Q_ERR_NAMETOOSHORT;
-    }
-    if (name[len - 4] != '.') {
-        return Q_ERR_INVALID_PATH;
-    }
-
-    hash = FS_HashPathLen(name, len - 4, RIMAGES_HASH);
-
-    // look for it
-    if ((image = lookup_image(name, type, hash, len - 4)) != NULL) {
-        image->flags |= flags & IF_PERMANENT;
-        image->registration_sequence = registration_sequence;
-        *image_p = image;
-        return Q_ERR_SUCCESS;
-    }
-
-    // allocate image slot
-    image = alloc_image();
-    if (!image) {
-        return Q_ERR_OUT_OF_SLOTS;
-    }
-
 	int override_textures = !!r_override_textures->integer;
 	if (!vid_rtx->integer && (type != IT_PIC))
 		override_textures = 0;
@@ -1060,11 +1566,11 @@ static qerror_t find_or_load_image(const char *name, size_t len,
 		}
 
 		// load the pic from disk
-		pic = NULL;
+		*pic = NULL;
 
 		if (fmt == IM_MAX) {
 			// unknown extension, but give it a chance to load anyway
-			ret = try_other_formats(IM_MAX, image, &pic);
+			ret = try_other_formats(IM_MAX, image, pic, req);
 			if (ret == Q_ERR_NOENT) {
 				// not found, change error to invalid path
 				ret = Q_ERR_INVALID_PATH;
@@ -1072,14 +1578,14 @@ static qerror_t find_or_load_image(const char *name, size_t len,
 		}
 		else if (override_textures) {
 			// forcibly replace the extension
-			ret = try_other_formats(IM_MAX, image, &pic);
+			ret = try_other_formats(IM_MAX, image, pic, req);
 		}
 		else {
 			// first try with original extension
-			ret = _try_image_format(fmt, image, &pic);
+			ret = _try_image_format(fmt, image, pic, req);
 			if (ret == Q_ERR_NOENT) {
 				// retry with remaining extensions
-				ret = try_other_formats(fmt, image, &pic);
+				ret = try_other_formats(fmt, image, pic, req);
 			}
 		}
 
@@ -1093,9 +1599,13 @@ static qerror_t find_or_load_image(const char *name, size_t len,
 			image->baselen = len - 4;
 		}
 
+		if (req) {
+			// image dimensions are recovered after decompression
+			req->orig = fmt;
+		}
 		// if we are replacing 8-bit texture with a higher resolution 32-bit
 		// texture, we need to recover original image dimensions
-		if (fmt <= IM_WAL && ret > IM_WAL) {
+		else if (fmt <= IM_WAL && ret > IM_WAL) {
 			get_image_dimensions(fmt, image);
 		}
 
@@ -1103,12 +1613,52 @@ static qerror_t find_or_load_image(const char *name, size_t len,
 			break;
 	}
 
+    return ret;
+}
+
+// finds or loads the given image, adding it to the hash table.
+static qerror_t find_or_load_image(const char *name, size_t len,
+                                   imagetype_t type, imageflags_t flags,
+                                   image_t **image_p)
+{
+    image_t         *image;
+    byte            *pic;
+    unsigned        hash;
+    qerror_t        ret;
+
+    *image_p = NULL;
+
+    // must have an extension and at least 1 char of base name
+    if (len <= 4) {
+        return Q_ERR_NAMETOOSHORT;
+    }
+    if (name[len - 4] != '.') {
+        return Q_ERR_INVALID_PATH;
+    }
+
+    hash = FS_HashPathLen(name, len - 4, 0);
+
+    // look for it
+    if ((image = lookup_image(name, type, hash, len - 4)) != NULL) {
+        image->flags |= flags & IF_PERMANENT;
+        touch_image(image);
+        *image_p = image;
+        return Q_ERR_SUCCESS;
+    }
+
+    // allocate image slot
+    image = alloc_image();
+    if (!image) {
+        return Q_ERR_OUT_OF_SLOTS;
+    }
+
+    ret = load_image_data(name, len, image, type, flags, &pic, NULL);
     if (ret < 0) {
-        memset(image, 0, sizeof(*image));
+        free_image_slot(image);
         return ret;
     }
 
-    List_Append(&r_imageHash[hash], &image->entry);
+    insert_image(image, hash);
 
 	image->is_srgb = !!(flags & IF_SRGB);
 
@@ -1148,6 +1698,150 @@ image_t *IMG_Find(const char *name, imagetype_t type, imageflags_t flags)
     return R_NOTEXTURE;
 }
 
+/*
+=========================================================
+
+BATCHED REGISTRATION
+
+Images are requested first, which reads their files on the main
+thread, then decompressed in parallel on job threads and finally
+handed over to the renderer in request order.
+
+=========================================================
+*/
+
+static void decode_image_request(void *arg, int index)
+{
+    imagereq_t *req = (imagereq_t *)arg + index;
+
+    req->pic = NULL;
+    req->ret = img_loaders[req->fmt].load(req->rawdata, req->rawlen,
+                                          req->image, &req->pic);
+}
+
+/*
+===============
+IMG_LoadRequested
+
+Decodes all pending image requests and uploads them.
+===============
+*/
+void IMG_LoadRequested(void)
+{
+    imagereq_t  *req;
+    image_t     *image;
+    qerror_t    ret;
+    int         i;
+
+    if (!img_numrequests) {
+        return;
+    }
+
+    Job_ParallelFor(decode_image_request, img_requests, img_numrequests);
+
+    for (i = 0, req = img_requests; i < img_numrequests; i++, req++) {
+        image = req->image;
+
+        FS_FreeFile(req->rawdata);
+
+        if (req->ret < 0) {
+            imagetype_t type = image->type;
+            imageflags_t flags = image->flags;
+
+            // drop the pending slot and retry synchronously,
+            // texture overrides may fall back to the original image
+            remove_image(image);
+            free_image_slot(image);
+
+            ret = find_or_load_image(req->name, req->len, type, flags, &image);
+            if (!image && ret != Q_ERR_NOENT) {
+                Com_EPrintf("Couldn't load %s: %s\n", req->name, Q_ErrorString(ret));
+            }
+            continue;
+        }
+
+        // if we are replacing 8-bit texture with a higher resolution 32-bit
+        // texture, we need to recover original image dimensions
+        if (req->orig <= IM_WAL && req->fmt > IM_WAL) {
+            get_image_dimensions(req->orig, image);
+        }
+
+        // upload the image
+        IMG_Load(image, req->pic);
+    }
+
+    img_numrequests = 0;
+}
+
+/*
+===============
+IMG_Request
+
+Queues the given image for loading by IMG_LoadRequested. Pending
+images must not be looked up with IMG_Find until then.
+===============
+*/
+void IMG_Request(const char *name, imagetype_t type, imageflags_t flags)
+{
+    image_t     *image;
+    imagereq_t  *req;
+    byte        *pic;
+    unsigned    hash;
+    size_t      len;
+    qerror_t    ret;
+
+    len = strlen(name);
+    if (len >= MAX_QPATH) {
+        Com_Error(ERR_FATAL, "%s: oversize name", __func__);
+    }
+
+    // must have an extension and at least 1 char of base name
+    if (len <= 4 || name[len - 4] != '.') {
+        return;
+    }
+
+    hash = FS_HashPathLen(name, len - 4, 0);
+
+    // already loaded or requested
+    if ((image = lookup_image(name, type, hash, len - 4)) != NULL) {
+        image->flags |= flags & IF_PERMANENT;
+        touch_image(image);
+        return;
+    }
+
+    if (img_numrequests == MAX_IMAGE_REQUESTS) {
+        IMG_LoadRequested();
+    }
+
+    image = alloc_image();
+    if (!image) {
+        Com_EPrintf("Couldn't load %s: %s\n", name, Q_ErrorString(Q_ERR_OUT_OF_SLOTS));
+        return;
+    }
+
+    req = &img_requests[img_numrequests];
+    memset(req, 0, sizeof(*req));
+
+    ret = load_image_data(name, len, image, type, flags, &pic, req);
+    if (ret < 0) {
+        free_image_slot(image);
+        if (ret != Q_ERR_NOENT) {
+            Com_EPrintf("Couldn't load %s: %s\n", name, Q_ErrorString(ret));
+        }
+        return;
+    }
+
+    // visible to lookups from now on, so duplicate requests are merged
+    insert_image(image, hash);
+
+    image->is_srgb = !!(flags & IF_SRGB);
+
+    memcpy(req->name, name, len + 1);
+    req->len = len;
+    req->image = image;
+    img_numrequests++;
+}
+
 /*
 ===============
 IMG_ForHandle
@@ -1231,12 +1925,12 @@ qhandle_t R_RegisterRawImage(const char *name, int width, int height, byte* pic,
     unsigned        hash;
 
     int len = strlen(name);
-    hash = FS_HashPathLen(name, len, RIMAGES_HASH);
+    hash = FS_HashPathLen(name, len, 0);
 
     // look for it
     if ((image = lookup_image(name, type, hash, len)) != NULL) {
         image->flags |= flags & IF_PERMANENT;
-        image->registration_sequence = registration_sequence;
+        touch_image(image);
         return image - r_images;
     }
 
@@ -1257,7 +1951,7 @@ qhandle_t R_RegisterRawImage(const char *name, int width, int height, byte* pic,
     image->upload_width = width;
     image->upload_height = height;
 
-    List_Append(&r_imageHash[hash], &image->entry);
+    insert_image(image, hash);
 
     image->is_srgb = !!(flags & IF_SRGB);
 
@@ -1277,6 +1971,7 @@ void R_UnregisterImage(qhandle_t handle)
     if (image->registration_sequence)
     {
         image->registration_sequence = -1;
+        untouch_image(image);
         IMG_FreeUnused();
     }
 }
@@ -1312,26 +2007,31 @@ void IMG_FreeUnused(void)
     image_t *image;
     int i, count = 0;
 
-    for (i = 1, image = r_images + 1; i < r_numImages; i++, image++) {
-        if (image->registration_sequence == registration_sequence) {
+    update_touched();
+
 #if USE_REF == REF_SOFT
-            // TODO: account for MIPSIZE, TEX_BYTES
-            Com_PageInMemory(image->pixels[0], image->upload_width * image->upload_height * 4);
+    for (i = 0; i < r_numTouched; i++) {
+        image = &r_images[r_liveImages[i]];
+        // TODO: account for MIPSIZE, TEX_BYTES
+        Com_PageInMemory(image->pixels[0], image->upload_width * image->upload_height * 4);
+    }
 #endif
+
+    // only images not touched through lookups are checked here,
+    // some of them may have been marked used directly
+    for (i = r_numTouched; i < r_numLiveImages; ) {
+        image = &r_images[r_liveImages[i]];
+        if (image->registration_sequence == registration_sequence) {
+            swap_live_images(i++, r_numTouched++);
             continue;        // used this sequence
         }
-        if (!image->registration_sequence)
-            continue;        // free image_t slot
-        if (image->flags & (IF_PERMANENT | IF_SCRAP))
+        if (image->flags & (IF_PERMANENT | IF_SCRAP)) {
+            i++;
             continue;        // don't free pics
+        }
 
-        // delete it from hash table
-        List_Remove(&image->entry);
-
-        // free it
-        IMG_Unload(image);
-
-        memset(image, 0, sizeof(*image));
+        // last live image is moved into this position
+        IMG_FreeImage(image);
         count++;
     }
 
@@ -1342,26 +2042,23 @@ void IMG_FreeUnused(void)
 
 void IMG_FreeAll(void)
 {
-    image_t *image;
-    int i, count = 0;
-
-    for (i = 1, image = r_images + 1; i < r_numImages; i++, image++) {
-        if (!image->registration_sequence)
-            continue;        // free image_t slot
-        // free it
-        IMG_Unload(image);
+    int i;
 
-        memset(image, 0, sizeof(*image));
-        count++;
+    for (i = 0; i < r_numLiveImages; i++) {
+        IMG_Unload(&r_images[r_liveImages[i]]);
     }
 
-    if (count) {
-        Com_DPrintf("%s: %i images freed\n", __func__, count);
+    if (r_numLiveImages) {
+        Com_DPrintf("%s: %i images freed\n", __func__, r_numLiveImages);
     }
 
-    for (i = 0; i < RIMAGES_HASH; i++) {
-        List_Init(&r_imageHash[i]);
+    if (r_numImages > 1) {
+        memset(r_images + 1, 0, sizeof(r_images[0]) * (r_numImages - 1));
     }
+    memset(r_imageHash, 0, sizeof(r_imageHash));
+    r_numFreeImages = 0;
+    r_numLiveImages = 0;
+    r_numTouched = 0;
 
     // &r_images[0] == R_NOTEXTURE
     r_numImages = 1;
@@ -1407,26 +2104,140 @@ fail:
     Com_Error(ERR_FATAL, "Couldn't load %s: %s", R_COLORMAP_PCX, Q_ErrorString(ret));
 }
 
+#if USE_TESTS
+
+/*
+===============
+IMG_TestKernels_f
+
+Times all image processing kernels supported by this CPU on the stock
+wall textures and checks their output against the scalar kernels.
+===============
+*/
+static void IMG_TestKernels_f(void)
+{
+    unsigned    features = X86_CPUFeatures();
+    unsigned    msec[q_countof(img_kernels)][2];
+    image_t     image;
+    void        **list;
+    byte        *data, *pic, *out, *ref;
+    ssize_t     len;
+    unsigned    start;
+    int         i, j, k, count, passes, numtested, errors, w, h;
+
+    passes = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 10;
+    clamp(passes, 1, 1000);
+
+    list = FS_ListFiles(NULL, "textures/*/*.wal", FS_SEARCH_BYFILTER | FS_SEARCH_SAVEPATH, &count);
+    if (!list) {
+        Com_Printf("No textures found\n");
+        return;
+    }
+
+    memset(msec, 0, sizeof(msec));
+    numtested = errors = 0;
+
+    for (i = 0; i < count; i++) {
+        len = FS_LoadFile(list[i], (void **)&data);
+        if (!data) {
+            continue;
+        }
+
+        memset(&image, 0, sizeof(image));
+        pic = NULL;
+        if (img_loaders[IM_WAL].load(data, len, &image, &pic) < 0) {
+            FS_FreeFile(data);
+            continue;
+        }
+        FS_FreeFile(data);
+
+        // upsample to twice the size, then mipmap back down
+        w = image.width * 2;
+        h = image.height * 2;
+        if (w > MAX_TEXTURE_SIZE) {
+            IMG_FreePixels(pic);
+            continue;
+        }
+
+        // reference resample output is followed by reference mipmap
+        out = IMG_AllocPixels(w * h * 4);
+        ref = IMG_AllocPixels(w * h * 5);
+
+        for (j = q_countof(img_kernels) - 1; j >= 0; j--) {
+            if ((img_kernels[j].cpu & features) != img_kernels[j].cpu) {
+                continue;
+            }
+
+            start = Sys_Milliseconds();
+            for (k = 0; k < passes; k++) {
+                resample_texture(img_kernels[j].resample, pic,
+                                 image.width, image.height, out, w, h);
+            }
+            msec[j][0] += Sys_Milliseconds() - start;
+
+            // scalar kernel runs first and provides the reference output
+            if (j == q_countof(img_kernels) - 1) {
+                memcpy(ref, out, w * h * 4);
+            } else if (memcmp(ref, out, w * h * 4)) {
+                Com_Printf("%s: %s resample mismatch\n", (char *)list[i], img_kernels[j].name);
+                errors++;
+            }
+
+            start = Sys_Milliseconds();
+            for (k = 0; k < passes; k++) {
+                mipmap(img_kernels[j].mipmap, out, ref, w, h);
+            }
+            msec[j][1] += Sys_Milliseconds() - start;
+
+            if (j == q_countof(img_kernels) - 1) {
+                memcpy(ref + w * h * 4, out, w * h);
+            } else if (memcmp(ref + w * h * 4, out, w * h)) {
+                Com_Printf("%s: %s mipmap mismatch\n", (char *)list[i], img_kernels[j].name);
+                errors++;
+            }
+        }
+
+        IMG_FreePixels(ref);
+        IMG_FreePixels(out);
+        IMG_FreePixels(pic);
+        numtested++;
+    }
+
+    FS_FreeList(list);
+
+    for (j = 0; j < q_countof(img_kernels); j++) {
+        if ((img_kernels[j].cpu & features) == img_kernels[j].cpu) {
+            Com_Printf("%-4s: %5u msec resample, %5u msec mipmap%s\n", img_kernels[j].name,
+                       msec[j][0], msec[j][1], j == img_kernel ? " (selected)" : "");
+        }
+    }
+
+    Com_Printf("%d failures, %d textures tested (%d passes)\n", errors, numtested, passes);
+}
+
+#endif // USE_TESTS
+
 static const cmdreg_t img_cmd[] = {
     { "imagelist", IMG_List_f },
     { "screenshot", IMG_ScreenShot_f },
     { "screenshottga", IMG_ScreenShotTGA_f },
     { "screenshotjpg", IMG_ScreenShotJPG_f },
     { "screenshotpng", IMG_ScreenShotPNG_f },
+#if USE_TESTS
+    { "imagetest", IMG_TestKernels_f },
+#endif
     { NULL }
 };
 
 void IMG_Init(void)
 {
-    int i;
-
     if (r_numImages) {
         Com_Error(ERR_FATAL, "%s: %d images not freed", __func__, r_numImages);
     }
 
 
     r_override_textures = Cvar_Get("r_override_textures", "1", CVAR_FILES);
-    r_texture_formats = Cvar_Get("r_texture_formats", "pjt", 0);
+    r_texture_formats = Cvar_Get("r_texture_formats", "dpjt", 0);
     r_texture_formats->changed = r_texture_formats_changed;
     r_texture_formats_changed(r_texture_formats);
 
@@ -1437,9 +2248,7 @@ void IMG_Init(void)
 
     Cmd_Register(img_cmd);
 
-    for (i = 0; i < RIMAGES_HASH; i++) {
-        List_Init(&r_imageHash[i]);
-    }
+    select_kernels();
 
     // &r_images[0] == R_NOTEXTURE
     r_numImages = 1;
@@ -41,6 +41,42 @@ int          r_numModels;
 
 extern cvar_t *vid_rtx;
 
+// models not registered for the current map are kept in memory up to this
+// budget, so that going back to a map doesn't parse its models again
+static cvar_t   *r_model_cache;
+
+// reuse statistics of the current registration
+static struct {
+    int     loaded;     // parsed from file
+    int     reused;     // kept from the previous map
+    int     cached;     // kept in the cache from an earlier map
+    int     evicted;
+} mod_stats;
+
+static void MOD_Free(model_t *model)
+{
+    Hunk_Free(&model->hunk);
+    memset(model, 0, sizeof(*model));
+}
+
+// least recently used model that is not registered for the current map
+static model_t *MOD_FindLRU(void)
+{
+    model_t *model, *best = NULL;
+    int i;
+
+    for (i = 0, model = r_models; i < r_numModels; i++, model++) {
+        if (!model->type || model->registration_sequence == registration_sequence) {
+            continue;
+        }
+        if (!best || model->registration_sequence < best->registration_sequence) {
+            best = model;
+        }
+    }
+
+    return best;
+}
+
 static model_t *MOD_Alloc(void)
 {
     model_t *model;
@@ -54,7 +90,14 @@ static model_t *MOD_Alloc(void)
 
     if (i == r_numModels) {
         if (r_numModels == MAX_RMODELS) {
-            return NULL;
+            // make room by dropping a cached model
+            model = MOD_FindLRU();
+            if (!model) {
+                return NULL;
+            }
+            MOD_Free(model);
+            mod_stats.evicted++;
+            return model;
         }
         r_numModels++;
     }
@@ -82,31 +125,61 @@ static model_t *MOD_Find(const char *name)
 static void MOD_List_f(void)
 {
     static const char types[4] = "FASE";
-    int     i, count;
+    int     i, count, numcached;
     model_t *model;
-    size_t  bytes;
+    size_t  bytes, cached;
 
     Com_Printf("------------------\n");
-    bytes = count = 0;
+    bytes = cached = count = numcached = 0;
 
     for (i = 0, model = r_models; i < r_numModels; i++, model++) {
         if (!model->type) {
             continue;
         }
-        Com_Printf("%c %8"PRIz" : %s\n", types[model->type],
-                   model->hunk.mapped, model->name);
+        Com_Printf("%c %8"PRIz" : %s%s\n", types[model->type],
+                   model->hunk.mapped, model->name,
+                   model->registration_sequence == registration_sequence ? "" : " (cached)");
         bytes += model->hunk.mapped;
         count++;
+        if (model->registration_sequence != registration_sequence) {
+            cached += model->hunk.mapped;
+            numcached++;
+        }
     }
     Com_Printf("Total models: %d (out of %d slots)\n", count, r_numModels);
     Com_Printf("Total resident: %"PRIz"\n", bytes);
+    Com_Printf("Cached: %d models, %"PRIz" bytes\n", numcached, cached);
+}
+
+static int MOD_CompareLRU(const void *p1, const void *p2)
+{
+    const model_t *m1 = *(const model_t **)p1;
+    const model_t *m2 = *(const model_t **)p2;
+
+    // most recently used first, then in slot order
+    if (m1->registration_sequence != m2->registration_sequence) {
+        return m2->registration_sequence - m1->registration_sequence;
+    }
+    return m1 - m2;
+}
+
+// keeps the images of a cached model registered without marking it as used
+static void MOD_Retain(model_t *model)
+{
+    int sequence = model->registration_sequence;
+
+    MOD_Reference(model);
+    model->registration_sequence = sequence;
 }
 
+// must be called before IMG_FreeUnused, cached models keep their skins
 void MOD_FreeUnused(void)
 {
-    model_t *model;
-    int i;
+    model_t *model, *unused[MAX_RMODELS];
+    int i, numunused, numcached;
+    size_t budget, bytes;
 
+    numunused = 0;
     for (i = 0, model = r_models; i < r_numModels; i++, model++) {
         if (!model->type) {
             continue;
@@ -114,12 +187,39 @@ void MOD_FreeUnused(void)
         if (model->registration_sequence == registration_sequence) {
             // make sure it is paged in
             Com_PageInMemory(model->hunk.base, model->hunk.cursize);
+        } else {
+            unused[numunused++] = model;
+        }
+    }
+
+    // keep the most recently used of the other models within the budget
+    qsort(unused, numunused, sizeof(unused[0]), MOD_CompareLRU);
+
+    budget = r_model_cache->value > 0 ? (size_t)(r_model_cache->value * 1024 * 1024) : 0;
+    bytes = 0;
+    numcached = 0;
+
+    for (i = 0; i < numunused; i++) {
+        model = unused[i];
+        if (bytes + model->hunk.mapped <= budget) {
+            bytes += model->hunk.mapped;
+            numcached++;
+            MOD_Retain(model);
         } else {
             // don't need this model
-            Hunk_Free(&model->hunk);
-            memset(model, 0, sizeof(*model));
+            MOD_Free(model);
+            mod_stats.evicted++;
         }
     }
+
+    if (developer->integer) {
+        Com_Printf("%s: %d loaded, %d reused, %d from cache, %d evicted, "
+                   "%d cached (%"PRIz" KB)\n", __func__, mod_stats.loaded,
+                   mod_stats.reused, mod_stats.cached, mod_stats.evicted,
+                   numcached, bytes / 1024);
+    }
+
+    memset(&mod_stats, 0, sizeof(mod_stats));
 }
 
 void MOD_FreeAll(void)
@@ -132,8 +232,7 @@ void MOD_FreeAll(void)
             continue;
         }
 
-        Hunk_Free(&model->hunk);
-        memset(model, 0, sizeof(*model));
+        MOD_Free(model);
     }
 
     r_numModels = 0;
@@ -340,6 +439,11 @@ qhandle_t R_RegisterModel(const char *name)
     // see if it's already loaded
     model = MOD_Find(normalized);
     if (model) {
+        if (model->registration_sequence == registration_sequence - 1) {
+            mod_stats.reused++;
+        } else if (model->registration_sequence < registration_sequence) {
+            mod_stats.cached++;
+        }
         MOD_Reference(model);
         goto done;
     }
@@ -410,6 +514,8 @@ qhandle_t R_RegisterModel(const char *name)
         goto fail1;
     }
 
+    mod_stats.loaded++;
+
 	model->model_class = get_model_class(model->name);
 
 done:
@@ -453,6 +559,8 @@ void MOD_Init(void)
         Com_Error(ERR_FATAL, "%s: %d models not freed", __func__, r_numModels);
     }
 
+    r_model_cache = Cvar_Get("r_model_cache", "32", 0);
+
     Cmd_AddCommand("modellist", MOD_List_f);
 }
 
@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "vkpt.h"
 #include "shader/global_textures.h"
 #include "material.h"
+#include "common/jobs.h"
+#include "system/system.h"
 
 #include <assert.h>
 #include <float.h>
@@ -28,17 +30,27 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <tinyobj_loader_c.h>
 
 extern cvar_t *cvar_pt_enable_nodraw;
+extern cvar_t *cvar_pt_mesh_cache;
 
+/*
+  Drops the polygon vertices that lie on the line between their neighbours
+  in a single pass, compacting the arrays in place. The first vertex is
+  always kept, so a fan over the result starts from the same corner.
+*/
 static void
 remove_collinear_edges(float* positions, float* tex_coords, int* num_vertices)
 {
-	int num_vertices_local = *num_vertices;
+	int num_vertices_in = *num_vertices;
+	int num_vertices_out = 1;
 
-	for (int i = 1; i < num_vertices_local;)
+	if (num_vertices_in < 2)
+		return;
+
+	for (int i = 1; i < num_vertices_in; i++)
 	{
-		float* p0 = positions + (i - 1) * 3;
-		float* p1 = positions + (i % num_vertices_local) * 3;
-		float* p2 = positions + ((i + 1) % num_vertices_local) * 3;
+		const float* p0 = positions + (num_vertices_out - 1) * 3;
+		const float* p1 = positions + i * 3;
+		const float* p2 = positions + ((i + 1) % num_vertices_in) * 3;
 
 		vec3_t e1, e2;
 		VectorSubtract(p1, p0, e1);
@@ -62,28 +74,23 @@ remove_collinear_edges(float* positions, float* tex_coords, int* num_vertices)
 		}
 
 		if (remove)
+			continue;
+
+		if (num_vertices_out != i)
 		{
-			if (num_vertices_local - i >= 1)
-			{
-				memcpy(p1, p2, (num_vertices_local - i - 1) * 3 * sizeof(float));
+			VectorCopy(p1, positions + num_vertices_out * 3);
 
-				if (tex_coords)
-				{
-					float* t1 = tex_coords + (i % num_vertices_local) * 2;
-					float* t2 = tex_coords + ((i + 1) % num_vertices_local) * 2;
-					memcpy(t1, t2, (num_vertices_local - i - 1) * 2 * sizeof(float));
-				}
+			if (tex_coords)
+			{
+				tex_coords[num_vertices_out * 2 + 0] = tex_coords[i * 2 + 0];
+				tex_coords[num_vertices_out * 2 + 1] = tex_coords[i * 2 + 1];
 			}
-
-			num_vertices_local--;
-		}
-		else
-		{
-			i++;
 		}
+
+		num_vertices_out++;
 	}
 
-	*num_vertices = num_vertices_local;
+	*num_vertices = num_vertices_out;
 }
 
 #define DUMP_WORLD_MESH_TO_OBJ 0
@@ -92,6 +99,32 @@ static FILE* obj_dump_file = NULL;
 static int obj_vertex_num = 0;
 #endif
 
+// create_poly never emits more triangles for a face than it has edges
+static inline int
+max_poly_vertices(const mface_t *surf)
+{
+	int num_edges = surf->numsurfedges;
+
+	return (num_edges > 4 ? num_edges : num_edges - 2) * 3;
+}
+
+static int
+count_world_vertices(const bsp_t *bsp)
+{
+	int num_vertices = 0;
+
+	for (int i = 0; i < bsp->numfaces; i++)
+		num_vertices += max_poly_vertices(bsp->faces + i);
+
+	return num_vertices;
+}
+
+/*
+  Triangulates a face into the world mesh arrays and returns the number of
+  vertices written, which is at most max_poly_vertices. Faces with more than
+  4 vertices are fanned around their center, other faces and the sky are
+  fanned from the first vertex. Materials are written per triangle.
+*/
 static int
 create_poly(
 	const mface_t *surf,
@@ -171,32 +204,12 @@ create_poly(
 		remove_collinear_edges(positions, tex_coords, &num_vertices);
 	}
 
-#define CP_V(idx, src) \
-    do { \
-        if(positions_out) { \
-            memcpy(positions_out + (idx) * 3, src, sizeof(float) * 3); \
-        } \
-    } while(0)
-
-#define CP_T(idx, src) \
-    do { \
-        if(tex_coord_out) { \
-            memcpy(tex_coord_out + (idx) * 2, src, sizeof(float) * 2); \
-        } \
-    } while(0)
-
-#define CP_M(idx) \
-    do { \
-        if(material_out) { \
-            material_out[k] = material_id; \
-        } \
-    } while(0)
-
-	int k = 0;
 	/* switch between triangle fan around center or first vertex */
-	//int tess_center = 0;
 	int tess_center = num_vertices > 4 && !is_sky;
 
+	const float *pos_pivot = tess_center ? pos_center : positions;
+	const float *tc_pivot = tess_center ? tc_center : tex_coords;
+
 	const int num_triangles = tess_center
 		? num_vertices
 		: num_vertices - 2;
@@ -206,29 +219,24 @@ create_poly(
 		int i1 = (i + 2 - tess_center) % num_vertices;
 		int i2 = (i + 1 - tess_center) % num_vertices;
 
-		CP_V(k, tess_center ? pos_center : positions);
-		CP_T(k, tess_center ? tc_center : tex_coords);
-		CP_M(k);
-		k++;
+		float *p = positions_out + i * 9;
+		float *t = tex_coord_out + i * 6;
 
-		CP_V(k, positions + i1 * 3);
-		CP_T(k, tex_coords + i1 * 2);
-		CP_M(k);
-		k++;
+		VectorCopy(pos_pivot, p + 0);
+		VectorCopy(positions + i1 * 3, p + 3);
+		VectorCopy(positions + i2 * 3, p + 6);
 
-		CP_V(k, positions + i2 * 3);
-		CP_T(k, tex_coords + i2 * 2);
-		CP_M(k);
-		k++;
+		t[0] = tc_pivot[0];
+		t[1] = tc_pivot[1];
+		t[2] = tex_coords[i1 * 2 + 0];
+		t[3] = tex_coords[i1 * 2 + 1];
+		t[4] = tex_coords[i2 * 2 + 0];
+		t[5] = tex_coords[i2 * 2 + 1];
 
+		material_out[i] = material_id;
 	}
 
-#undef CP_V
-#undef CP_T
-#undef CP_M
-
-	assert(k % 3 == 0);
-	return k;
+	return max(num_triangles, 0) * 3;
 }
 
 static int
@@ -380,22 +388,35 @@ is_sky_or_lava_cluster(bsp_mesh_t* wm, mface_t* surf, int cluster, int material_
 	return qfalse;
 }
 
-static void merge_pvs_rows(bsp_t* bsp, char* src, char* dst)
+static void merge_pvs_rows(bsp_t* bsp, const char* src, char* dst)
 {
-	for (int i = 0; i < bsp->visrowsize; i++)
+	int i = 0;
+
+	for (; i + 8 <= bsp->visrowsize; i += 8)
+	{
+		uint64_t a, b;
+		memcpy(&a, src + i, 8);
+		memcpy(&b, dst + i, 8);
+		a |= b;
+		memcpy(dst + i, &a, 8);
+	}
+
+	for (; i < bsp->visrowsize; i++)
 	{
 		dst[i] |= src[i];
 	}
 }
 
+// visits set bits in ascending order. the word is cleared before the body
+// runs, so the body may use continue but must not modify the row itself.
 #define FOREACH_BIT_BEGIN(SET,ROWSIZE,VAR) \
-	for (int _byte_idx = 0; _byte_idx < ROWSIZE; _byte_idx++) { \
-	if (SET[_byte_idx]) { \
-		for (int _bit_idx = 0; _bit_idx < 8; _bit_idx++) { \
-			if (SET[_byte_idx] & (1 << _bit_idx)) { \
-				int VAR = (_byte_idx << 3) | _bit_idx;
+	for (int _byte_idx = 0; _byte_idx < ROWSIZE; _byte_idx += 8) { \
+		uint64_t _word = load_pvs_word(SET, _byte_idx, ROWSIZE); \
+		while (_word) { \
+			int VAR = (_byte_idx << 3) | ctz64(_word); \
+			_word &= _word - 1;
 
-#define FOREACH_BIT_END  } } } }
+#define FOREACH_BIT_END  } }
 
 static void connect_pvs(bsp_t* bsp, int cluster_a, char* pvs_a, int cluster_b, char* pvs_b)
 {
@@ -417,40 +438,94 @@ static void connect_pvs(bsp_t* bsp, int cluster_a, char* pvs_a, int cluster_b, c
 	merge_pvs_rows(bsp, pvs_b, pvs_a);
 }
 
-static void make_pvs_symmetric(bsp_t* bsp)
+typedef struct {
+	bsp_t* bsp;
+	char* matrix;
+} pvs_job_t;
+
+// builds rows of a block of 64 clusters of the symmetric matrix by
+// gathering their columns, one word per source row
+static void
+make_pvs_symmetric_job(void* arg, int block)
 {
+	pvs_job_t* job = arg;
+	bsp_t* bsp = job->bsp;
+	int rowsize = bsp->visrowsize;
+	int first = block * PVS_WORD_CLUSTERS;
+	int count = min(bsp->vis->numclusters - first, PVS_WORD_CLUSTERS);
+	uint64_t mask = count < 64 ? (1ull << count) - 1 : ~0ull;
+	char* dst = job->matrix + (size_t)first * rowsize;
+
+	memcpy(dst, BSP_GetPvs(bsp, first), (size_t)count * rowsize);
+
 	for (int cluster = 0; cluster < bsp->vis->numclusters; cluster++)
 	{
-		char* pvs = BSP_GetPvs(bsp, cluster);
+		uint64_t word = load_pvs_word(BSP_GetPvs(bsp, cluster), first >> 3, rowsize) & mask;
 
-		FOREACH_BIT_BEGIN(pvs, bsp->visrowsize, vis_cluster)
-			if (vis_cluster != cluster)
-			{
-				char* vis_pvs = BSP_GetPvs(bsp, vis_cluster);
-				Q_SetBit(vis_pvs, cluster);
-			}
-		FOREACH_BIT_END
+		while (word)
+		{
+			int vis_cluster = ctz64(word);
+			word &= word - 1;
+			Q_SetBit(dst + vis_cluster * rowsize, cluster);
+		}
 	}
 }
 
+static void make_pvs_symmetric(bsp_t* bsp)
+{
+	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
+	pvs_job_t job = { bsp, Z_Malloc(matrix_size) };
+
+	Job_ParallelFor(make_pvs_symmetric_job, &job,
+		(bsp->vis->numclusters + PVS_WORD_CLUSTERS - 1) / PVS_WORD_CLUSTERS);
+
+	memcpy(bsp->pvs_matrix, job.matrix, matrix_size);
+	Z_Free(job.matrix);
+}
+
+static void
+build_pvs2_job(void* arg, int cluster)
+{
+	pvs_job_t* job = arg;
+	bsp_t* bsp = job->bsp;
+	char* pvs = BSP_GetPvs(bsp, cluster);
+	char* dest_pvs = job->matrix + (size_t)cluster * bsp->visrowsize;
+
+	memcpy(dest_pvs, pvs, bsp->visrowsize);
+
+	FOREACH_BIT_BEGIN(pvs, bsp->visrowsize, vis_cluster)
+		char* pvs2 = BSP_GetPvs(bsp, vis_cluster);
+		merge_pvs_rows(bsp, pvs2, dest_pvs);
+	FOREACH_BIT_END
+}
+
 static void build_pvs2(bsp_t* bsp)
 {
 	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
+	pvs_job_t job = { bsp, Z_Mallocz(matrix_size) };
 
-	bsp->pvs2_matrix = Z_Mallocz(matrix_size);
+	Job_ParallelFor(build_pvs2_job, &job, bsp->vis->numclusters);
 
-	for (int cluster = 0; cluster < bsp->vis->numclusters; cluster++)
-	{
-		char* pvs = BSP_GetPvs(bsp, cluster);
-		char* dest_pvs = BSP_GetPvs2(bsp, cluster);
-		memcpy(dest_pvs, pvs, bsp->visrowsize);
+	bsp->pvs2_matrix = job.matrix;
+}
 
-		FOREACH_BIT_BEGIN(pvs, bsp->visrowsize, vis_cluster)
-			char* pvs2 = BSP_GetPvs(bsp, vis_cluster);
-			merge_pvs_rows(bsp, pvs2, dest_pvs);
-		FOREACH_BIT_END
-	}
+/*
+  The per vertex and per triangle arrays of the world mesh are sized from
+  the faces of the map instead of the vertex buffer limit, and only grow
+  for the custom sky geometry that is added on top of them, or for faces
+  that are listed by more than one submodel.
+*/
+static void
+reserve_world_mesh(bsp_mesh_t *wm, int num_vertices)
+{
+	if (num_vertices <= wm->allocated_vertices)
+		return;
 
+	wm->positions = Z_Realloc(wm->positions, num_vertices * 3 * sizeof(*wm->positions));
+	wm->tex_coords = Z_Realloc(wm->tex_coords, num_vertices * 2 * sizeof(*wm->tex_coords));
+	wm->materials = Z_Realloc(wm->materials, num_vertices / 3 * sizeof(*wm->materials));
+	wm->clusters = Z_Realloc(wm->clusters, num_vertices / 3 * sizeof(*wm->clusters));
+	wm->allocated_vertices = num_vertices;
 }
 
 static void
@@ -513,9 +588,13 @@ collect_surfaces(int *idx_ctr, bsp_mesh_t *wm, bsp_t *bsp, int model_idx, int (*
 			material_id = (material_id & ~MATERIAL_LIGHT_STYLE_MASK) | ((camera_id << MATERIAL_LIGHT_STYLE_SHIFT) & MATERIAL_LIGHT_STYLE_MASK);
 		}
 
-		if (*idx_ctr + create_poly(surf, material_id, NULL, NULL, NULL) >= MAX_VERT_BSP) {
+		// the mesh arrays are sized for each face of the map once, but nothing
+		// stops a broken map from listing a face in several submodels
+		int max_cnt = max_poly_vertices(surf);
+		if (*idx_ctr + max_cnt >= MAX_VERT_BSP) {
 			Com_Error(ERR_FATAL, "error: exceeding max vertex limit\n");
 		}
+		reserve_world_mesh(wm, *idx_ctr + max_cnt);
 
 		int cnt = create_poly(surf, material_id,
 			&wm->positions[*idx_ctr * 3],
@@ -1135,8 +1214,8 @@ compute_world_tangents(bsp_mesh_t* wm)
 
 	// tangent space is co-planar to triangle : only need to compute
 	// 1 vertex because all 3 verts share the same tangent space
-	wm->tangents = Z_Malloc(MAX_VERT_BSP * sizeof(*wm->tangents));
-	wm->texel_density = Z_Malloc(MAX_VERT_BSP * sizeof(float) / 3);
+	wm->tangents = Z_Malloc(ntriangles * 3 * sizeof(*wm->tangents));
+	wm->texel_density = Z_Malloc(ntriangles * sizeof(*wm->texel_density));
 
 	for (int idx_tri = 0; idx_tri < ntriangles; ++idx_tri)
 	{
@@ -1426,25 +1505,29 @@ get_aabb_corner(aabb_t* aabb, int corner_idx, vec3_t corner)
 	corner[2] = (corner_idx & 4) ? aabb->maxs[2] : aabb->mins[2];
 }
 
-static qboolean
-light_affects_cluster(light_poly_t* light, aabb_t* aabb)
+static void
+get_light_plane(const light_poly_t* light, vec4_t plane)
 {
-	// Empty cluster, nothing is visible
-	if (aabb->mins[0] > aabb->maxs[0])
-		return qfalse;
-
 	const float* v0 = light->positions + 0;
 	const float* v1 = light->positions + 3;
 	const float* v2 = light->positions + 6;
 	
 	// Get the light plane equation
-	vec3_t e1, e2, normal;
+	vec3_t e1, e2;
 	VectorSubtract(v1, v0, e1);
 	VectorSubtract(v2, v0, e2);
-	CrossProduct(e1, e2, normal);
-	VectorNormalize(normal);
+	CrossProduct(e1, e2, plane);
+	VectorNormalize(plane);
 	
-	float plane_distance = -DotProduct(normal, v0);
+	plane[3] = -DotProduct(plane, v0);
+}
+
+static qboolean
+light_affects_cluster(const vec4_t plane, aabb_t* aabb)
+{
+	// Empty cluster, nothing is visible
+	if (aabb->mins[0] > aabb->maxs[0])
+		return qfalse;
 
 	qboolean all_culled = qtrue;
 
@@ -1454,7 +1537,7 @@ light_affects_cluster(light_poly_t* light, aabb_t* aabb)
 		vec3_t corner;
 		get_aabb_corner(aabb, corner_idx, corner);
 
-		float side = DotProduct(normal, corner) + plane_distance;
+		float side = DotProduct(plane, corner) + plane[3];
 		if (side > 0)
 			all_culled = qfalse;
 	}
@@ -1467,15 +1550,35 @@ light_affects_cluster(light_poly_t* light, aabb_t* aabb)
 	return qtrue;
 }
 
+#define MAX_LIGHTS_PER_CLUSTER 1024
+
+typedef struct {
+	bsp_mesh_t* wm;
+	bsp_t* bsp;
+	vec4_t* planes;
+	int* cluster_lights;
+	int* cluster_light_counts;
+} cluster_lights_job_t;
+
 static void
-collect_cluster_lights(bsp_mesh_t *wm, bsp_t *bsp)
+light_planes_job(void* arg, int nlight)
 {
-#define MAX_LIGHTS_PER_CLUSTER 1024
-	int* cluster_lights = Z_Malloc(MAX_LIGHTS_PER_CLUSTER * wm->num_clusters * sizeof(int));
-	int* cluster_light_counts = Z_Mallocz(wm->num_clusters * sizeof(int));
+	cluster_lights_job_t* job = arg;
 
-	// Construct an array of visible lights for each cluster.
-	// The array is in `cluster_lights`, with MAX_LIGHTS_PER_CLUSTER stride.
+	get_light_plane(job->wm->light_polys + nlight, job->planes[nlight]);
+}
+
+// fills the light lists of a block of 64 clusters. lights are visited in
+// ascending order, so every list comes out sorted like a serial pass.
+static void
+cluster_lights_job(void* arg, int block)
+{
+	cluster_lights_job_t* job = arg;
+	bsp_mesh_t* wm = job->wm;
+	bsp_t* bsp = job->bsp;
+	int first = block * PVS_WORD_CLUSTERS;
+	int count = min(wm->num_clusters - first, PVS_WORD_CLUSTERS);
+	uint64_t mask = count < 64 ? (1ull << count) - 1 : ~0ull;
 
 	for (int nlight = 0; nlight < wm->num_light_polys; nlight++)
 	{
@@ -1484,21 +1587,48 @@ collect_cluster_lights(bsp_mesh_t *wm, bsp_t *bsp)
 		if(light->cluster < 0)
 			continue;
 
-		const byte* pvs = BSP_GetPvs(bsp, light->cluster);
+		const char* pvs = BSP_GetPvs(bsp, light->cluster);
+		uint64_t word = load_pvs_word(pvs, first >> 3, bsp->visrowsize) & mask;
+
+		while (word)
+		{
+			int other_cluster = first + ctz64(word);
+			word &= word - 1;
 
-		FOREACH_BIT_BEGIN(pvs, bsp->visrowsize, other_cluster)
 			aabb_t* cluster_aabb = wm->cluster_aabbs + other_cluster;
-			if (light_affects_cluster(light, cluster_aabb))
+			if (light_affects_cluster(job->planes[nlight], cluster_aabb))
 			{
-				int* num_cluster_lights = cluster_light_counts + other_cluster;
+				int* num_cluster_lights = job->cluster_light_counts + other_cluster;
 				if (*num_cluster_lights < MAX_LIGHTS_PER_CLUSTER)
 				{
-					cluster_lights[other_cluster * MAX_LIGHTS_PER_CLUSTER + *num_cluster_lights] = nlight;
+					job->cluster_lights[other_cluster * MAX_LIGHTS_PER_CLUSTER + *num_cluster_lights] = nlight;
 					(*num_cluster_lights)++;
 				}
 			}
-		FOREACH_BIT_END
+		}
 	}
+}
+
+static void
+collect_cluster_lights(bsp_mesh_t *wm, bsp_t *bsp)
+{
+	cluster_lights_job_t job;
+	int* cluster_lights = Z_Malloc(MAX_LIGHTS_PER_CLUSTER * wm->num_clusters * sizeof(int));
+	int* cluster_light_counts = Z_Mallocz(wm->num_clusters * sizeof(int));
+
+	// Construct an array of visible lights for each cluster.
+	// The array is in `cluster_lights`, with MAX_LIGHTS_PER_CLUSTER stride.
+
+	job.wm = wm;
+	job.bsp = bsp;
+	job.planes = Z_Malloc(max(wm->num_light_polys, 1) * sizeof(vec4_t));
+	job.cluster_lights = cluster_lights;
+	job.cluster_light_counts = cluster_light_counts;
+
+	Job_ParallelFor(light_planes_job, &job, wm->num_light_polys);
+	Job_ParallelFor(cluster_lights_job, &job, (wm->num_clusters + PVS_WORD_CLUSTERS - 1) / PVS_WORD_CLUSTERS);
+
+	Z_Free(job.planes);
 
 	// Count the total number of cluster <-> light relations to allocate memory
 
@@ -1531,66 +1661,596 @@ collect_cluster_lights(bsp_mesh_t *wm, bsp_t *bsp)
 
 	Z_Free(cluster_lights);
 	Z_Free(cluster_light_counts);
-#undef MAX_LIGHTS_PER_CLUSTER
 }
 
-static qboolean
-bsp_mesh_load_custom_sky(int *idx_ctr, bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
-{
-	char filename[MAX_QPATH];
-	Q_snprintf(filename, sizeof(filename), "maps/sky/%s.obj", map_name);
-
-	void* file_buffer = NULL;
-	ssize_t file_size = FS_LoadFile(filename, &file_buffer);
-	if (!file_buffer)
-		return qfalse;
+#if USE_TESTS
 
-	tinyobj_attrib_t attrib;
-	tinyobj_shape_t* shapes = NULL;
-	size_t num_shapes;
-	tinyobj_material_t* materials = NULL;
-	size_t num_materials;
+/*
+  Reference implementations of the PVS and cluster light list builders
+  that visit one bit at a time, used to check the word-wide versions.
+*/
 
-	unsigned int flags = TINYOBJ_FLAG_TRIANGULATE;
-	int ret = tinyobj_parse_obj(&attrib, &shapes, &num_shapes, &materials,
-		&num_materials, (const char*)file_buffer, file_size, flags);
+#define FOREACH_BIT_REF_BEGIN(SET,ROWSIZE,VAR) \
+	for (int _byte_idx = 0; _byte_idx < ROWSIZE; _byte_idx++) { \
+	if (SET[_byte_idx]) { \
+		for (int _bit_idx = 0; _bit_idx < 8; _bit_idx++) { \
+			if (SET[_byte_idx] & (1 << _bit_idx)) { \
+				int VAR = (_byte_idx << 3) | _bit_idx;
 
-	FS_FreeFile(file_buffer);
+#define FOREACH_BIT_REF_END  } } } }
 
-	if (ret != TINYOBJ_SUCCESS) {
-		Com_WPrintf("Couldn't parse sky polygon definition file %s.\n", filename);
-		return qfalse;
+static void merge_pvs_rows_ref(bsp_t* bsp, const char* src, char* dst)
+{
+	for (int i = 0; i < bsp->visrowsize; i++)
+	{
+		dst[i] |= src[i];
 	}
+}
 
-	int face_offset = 0;
-	for (int nprim = 0; nprim < attrib.num_face_num_verts; nprim++)
+static void make_pvs_symmetric_ref(bsp_t* bsp)
+{
+	for (int cluster = 0; cluster < bsp->vis->numclusters; cluster++)
 	{
-		int face_num_verts = attrib.face_num_verts[nprim];
-		int i0 = attrib.faces[face_offset + 0].v_idx;
-		int i1 = attrib.faces[face_offset + 1].v_idx;
-		int i2 = attrib.faces[face_offset + 2].v_idx;
-
-		vec3_t v0, v1, v2;
-		VectorCopy(attrib.vertices + i0 * 3, v0);
-		VectorCopy(attrib.vertices + i1 * 3, v1);
-		VectorCopy(attrib.vertices + i2 * 3, v2);
+		char* pvs = BSP_GetPvs(bsp, cluster);
 
-		int wm_index = *idx_ctr;
-		int wm_prim = wm_index / 3;
+		FOREACH_BIT_REF_BEGIN(pvs, bsp->visrowsize, vis_cluster)
+			if (vis_cluster != cluster)
+			{
+				char* vis_pvs = BSP_GetPvs(bsp, vis_cluster);
+				Q_SetBit(vis_pvs, cluster);
+			}
+		FOREACH_BIT_REF_END
+	}
+}
 
-		VectorCopy(v0, wm->positions + wm_index * 3 + 0);
-		VectorCopy(v1, wm->positions + wm_index * 3 + 3);
-		VectorCopy(v2, wm->positions + wm_index * 3 + 6);
+static void build_pvs2_ref(bsp_t* bsp)
+{
+	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
 
-		wm->tex_coords[wm_index * 2 + 0] = 0.f;
-		wm->tex_coords[wm_index * 2 + 1] = 0.f;
-		wm->tex_coords[wm_index * 2 + 2] = 0.f;
-		wm->tex_coords[wm_index * 2 + 3] = 0.f;
-		wm->tex_coords[wm_index * 2 + 4] = 0.f;
-		wm->tex_coords[wm_index * 2 + 5] = 0.f;
+	bsp->pvs2_matrix = Z_Mallocz(matrix_size);
 
-		vec3_t center;
-		get_triangle_off_center(wm->positions + wm_index * 3, center, NULL);
+	for (int cluster = 0; cluster < bsp->vis->numclusters; cluster++)
+	{
+		char* pvs = BSP_GetPvs(bsp, cluster);
+		char* dest_pvs = BSP_GetPvs2(bsp, cluster);
+		memcpy(dest_pvs, pvs, bsp->visrowsize);
+
+		FOREACH_BIT_REF_BEGIN(pvs, bsp->visrowsize, vis_cluster)
+			char* pvs2 = BSP_GetPvs(bsp, vis_cluster);
+			merge_pvs_rows_ref(bsp, pvs2, dest_pvs);
+		FOREACH_BIT_REF_END
+	}
+}
+
+static int
+collect_cluster_lights_ref(bsp_mesh_t *wm, bsp_t *bsp, int** lists, int** offsets)
+{
+	int* cluster_lights = Z_Malloc(MAX_LIGHTS_PER_CLUSTER * wm->num_clusters * sizeof(int));
+	int* cluster_light_counts = Z_Mallocz(wm->num_clusters * sizeof(int));
+
+	for (int nlight = 0; nlight < wm->num_light_polys; nlight++)
+	{
+		light_poly_t* light = wm->light_polys + nlight;
+
+		if(light->cluster < 0)
+			continue;
+
+		vec4_t plane;
+		get_light_plane(light, plane);
+
+		const char* pvs = BSP_GetPvs(bsp, light->cluster);
+
+		FOREACH_BIT_REF_BEGIN(pvs, bsp->visrowsize, other_cluster)
+			aabb_t* cluster_aabb = wm->cluster_aabbs + other_cluster;
+			if (light_affects_cluster(plane, cluster_aabb))
+			{
+				int* num_cluster_lights = cluster_light_counts + other_cluster;
+				if (*num_cluster_lights < MAX_LIGHTS_PER_CLUSTER)
+				{
+					cluster_lights[other_cluster * MAX_LIGHTS_PER_CLUSTER + *num_cluster_lights] = nlight;
+					(*num_cluster_lights)++;
+				}
+			}
+		FOREACH_BIT_REF_END
+	}
+
+	int total = 0;
+	for (int cluster = 0; cluster < wm->num_clusters; cluster++)
+		total += cluster_light_counts[cluster];
+
+	*lists = Z_Malloc(max(total, 1) * sizeof(int));
+	*offsets = Z_Malloc((wm->num_clusters + 1) * sizeof(int));
+
+	int list_offset = 0;
+	for (int cluster = 0; cluster < wm->num_clusters; cluster++)
+	{
+		(*offsets)[cluster] = list_offset;
+		memcpy(*lists + list_offset, cluster_lights + MAX_LIGHTS_PER_CLUSTER * cluster,
+			cluster_light_counts[cluster] * sizeof(int));
+		list_offset += cluster_light_counts[cluster];
+	}
+	(*offsets)[wm->num_clusters] = list_offset;
+
+	Z_Free(cluster_lights);
+	Z_Free(cluster_light_counts);
+
+	return total;
+}
+
+// runs reference and word-wide PVS builders on copies of the matrix
+static int
+test_pvs_builders(bsp_t *bsp, unsigned msec[2][2])
+{
+	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
+	bsp_t ref = *bsp, opt = *bsp;
+	unsigned start;
+	int errors = 0;
+
+	ref.pvs_matrix = Z_Malloc(matrix_size);
+	opt.pvs_matrix = Z_Malloc(matrix_size);
+	memcpy(ref.pvs_matrix, bsp->pvs_matrix, matrix_size);
+	memcpy(opt.pvs_matrix, bsp->pvs_matrix, matrix_size);
+	ref.pvs2_matrix = opt.pvs2_matrix = NULL;
+
+	start = Sys_Milliseconds();
+	build_pvs2_ref(&ref);
+	msec[0][0] += Sys_Milliseconds() - start;
+
+	start = Sys_Milliseconds();
+	build_pvs2(&opt);
+	msec[0][1] += Sys_Milliseconds() - start;
+
+	if (memcmp(ref.pvs2_matrix, opt.pvs2_matrix, matrix_size))
+	{
+		Com_Printf("%s: pvs2 mismatch\n", bsp->name);
+		errors++;
+	}
+
+	start = Sys_Milliseconds();
+	make_pvs_symmetric_ref(&ref);
+	msec[1][0] += Sys_Milliseconds() - start;
+
+	start = Sys_Milliseconds();
+	make_pvs_symmetric(&opt);
+	msec[1][1] += Sys_Milliseconds() - start;
+
+	if (memcmp(ref.pvs_matrix, opt.pvs_matrix, matrix_size))
+	{
+		Com_Printf("%s: symmetric pvs mismatch\n", bsp->name);
+		errors++;
+	}
+
+	Z_Free(ref.pvs_matrix);
+	Z_Free(ref.pvs2_matrix);
+	Z_Free(opt.pvs_matrix);
+	Z_Free(opt.pvs2_matrix);
+
+	return errors;
+}
+
+/*
+  Times the PVS builders on all maps and checks them against the
+  reference versions. Cluster light lists are checked on the loaded map.
+*/
+void
+bsp_mesh_test_pvs(bsp_mesh_t *wm, bsp_t *world)
+{
+	unsigned msec[2][2];
+	void **list;
+	int i, count, numtested, errors;
+
+	memset(msec, 0, sizeof(msec));
+	numtested = errors = 0;
+
+	list = FS_ListFiles(NULL, "maps/*.bsp", FS_SEARCH_BYFILTER | FS_SEARCH_SAVEPATH, &count);
+
+	for (i = 0; i < count; i++) {
+		bsp_t *bsp;
+
+		if (BSP_Load(list[i], &bsp) < 0)
+			continue;
+
+		if (bsp->vis && bsp->pvs_matrix) {
+			errors += test_pvs_builders(bsp, msec);
+			numtested++;
+		}
+
+		BSP_Free(bsp);
+	}
+
+	if (list)
+		FS_FreeList(list);
+
+	Com_Printf("pvs2:      %5u msec reference, %5u msec word-wide\n", msec[0][0], msec[0][1]);
+	Com_Printf("symmetric: %5u msec reference, %5u msec word-wide\n", msec[1][0], msec[1][1]);
+
+	if (wm && world && wm->cluster_aabbs) {
+		int *ref_lists, *ref_offsets, ref_count;
+		unsigned start, ref_msec, opt_msec;
+
+		start = Sys_Milliseconds();
+		ref_count = collect_cluster_lights_ref(wm, world, &ref_lists, &ref_offsets);
+		ref_msec = Sys_Milliseconds() - start;
+
+		Z_Free(wm->cluster_lights);
+		Z_Free(wm->cluster_light_offsets);
+
+		start = Sys_Milliseconds();
+		collect_cluster_lights(wm, world);
+		opt_msec = Sys_Milliseconds() - start;
+
+		if (ref_count != wm->num_cluster_lights ||
+			memcmp(ref_lists, wm->cluster_lights, ref_count * sizeof(int)) ||
+			memcmp(ref_offsets, wm->cluster_light_offsets, (wm->num_clusters + 1) * sizeof(int))) {
+			Com_Printf("%s: cluster light list mismatch\n", world->name);
+			errors++;
+		}
+
+		Com_Printf("lights:    %5u msec reference, %5u msec parallel\n", ref_msec, opt_msec);
+
+		Z_Free(ref_lists);
+		Z_Free(ref_offsets);
+
+		// the new lists are in the original order
+		vkpt_light_trees_create(wm);
+	}
+
+	Com_Printf("%d failures, %d maps tested\n", errors, numtested);
+}
+
+/*
+  Reference face triangulation that removes collinear edges by shifting the
+  arrays and is run twice per face, once to count the vertices.
+*/
+
+static void
+remove_collinear_edges_ref(float* positions, float* tex_coords, int* num_vertices)
+{
+	int num_vertices_local = *num_vertices;
+
+	for (int i = 1; i < num_vertices_local;)
+	{
+		float* p0 = positions + (i - 1) * 3;
+		float* p1 = positions + (i % num_vertices_local) * 3;
+		float* p2 = positions + ((i + 1) % num_vertices_local) * 3;
+
+		vec3_t e1, e2;
+		VectorSubtract(p1, p0, e1);
+		VectorSubtract(p2, p1, e2);
+		float l1 = VectorLength(e1);
+		float l2 = VectorLength(e2);
+
+		qboolean remove = qfalse;
+		if (l1 == 0)
+		{
+			remove = qtrue;
+		}
+		else if (l2 > 0)
+		{
+			VectorScale(e1, 1.f / l1, e1);
+			VectorScale(e2, 1.f / l2, e2);
+
+			float dot = DotProduct(e1, e2);
+			if (dot > 0.999f)
+				remove = qtrue;
+		}
+
+		if (remove)
+		{
+			if (num_vertices_local - i >= 1)
+			{
+				memcpy(p1, p2, (num_vertices_local - i - 1) * 3 * sizeof(float));
+
+				if (tex_coords)
+				{
+					float* t1 = tex_coords + (i % num_vertices_local) * 2;
+					float* t2 = tex_coords + ((i + 1) % num_vertices_local) * 2;
+					memcpy(t1, t2, (num_vertices_local - i - 1) * 2 * sizeof(float));
+				}
+			}
+
+			num_vertices_local--;
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	*num_vertices = num_vertices_local;
+}
+
+static int
+create_poly_ref(
+	const mface_t *surf,
+	uint32_t  material_id,
+	float    *positions_out,
+	float    *tex_coord_out,
+	uint32_t *material_out)
+{
+	static const int max_vertices = 32;
+	float positions [3 * /*max_vertices*/ 32];
+	float tex_coords[2 * /*max_vertices*/ 32];
+	mtexinfo_t *texinfo = surf->texinfo;
+	assert(surf->numsurfedges < max_vertices);
+	
+	float sc[2] = { 1.f, 1.f };
+	if (texinfo->material)
+	{
+		image_t* image_diffuse = texinfo->material->image_diffuse;
+		sc[0] = 1.0f / image_diffuse->width;
+		sc[1] = 1.0f / image_diffuse->height;
+	}
+
+	float pos_center[3] = { 0 };
+	float tc_center[2];
+
+	for (int i = 0; i < surf->numsurfedges; i++) {
+		msurfedge_t *src_surfedge = surf->firstsurfedge + i;
+		medge_t     *src_edge     = src_surfedge->edge;
+		mvertex_t   *src_vert     = src_edge->v[src_surfedge->vert];
+
+		float *p = positions + i * 3;
+		float *t = tex_coords + i * 2;
+
+		VectorCopy(src_vert->point, p);
+
+		pos_center[0] += src_vert->point[0];
+		pos_center[1] += src_vert->point[1];
+		pos_center[2] += src_vert->point[2];
+
+		t[0] = (DotProduct(p, texinfo->axis[0]) + texinfo->offset[0]) * sc[0];
+		t[1] = (DotProduct(p, texinfo->axis[1]) + texinfo->offset[1]) * sc[1];
+	}
+
+	pos_center[0] /= (float)surf->numsurfedges;
+	pos_center[1] /= (float)surf->numsurfedges;
+	pos_center[2] /= (float)surf->numsurfedges;
+
+	tc_center[0] = (DotProduct(pos_center, texinfo->axis[0]) + texinfo->offset[0]) * sc[0];
+	tc_center[1] = (DotProduct(pos_center, texinfo->axis[1]) + texinfo->offset[1]) * sc[1];
+
+	int num_vertices = surf->numsurfedges;
+
+	qboolean is_sky = MAT_IsKind(material_id, MATERIAL_KIND_SKY);
+	if (is_sky)
+	{
+		// process skybox geometry in the same way as we process it for analytic light generation
+		// to avoid mismatches between lights and geometry
+		remove_collinear_edges_ref(positions, tex_coords, &num_vertices);
+	}
+
+#define CP_V(idx, src) \
+    do { \
+        if(positions_out) { \
+            memcpy(positions_out + (idx) * 3, src, sizeof(float) * 3); \
+        } \
+    } while(0)
+
+#define CP_T(idx, src) \
+    do { \
+        if(tex_coord_out) { \
+            memcpy(tex_coord_out + (idx) * 2, src, sizeof(float) * 2); \
+        } \
+    } while(0)
+
+#define CP_M(idx) \
+    do { \
+        if(material_out) { \
+            material_out[k] = material_id; \
+        } \
+    } while(0)
+
+	int k = 0;
+	/* switch between triangle fan around center or first vertex */
+	//int tess_center = 0;
+	int tess_center = num_vertices > 4 && !is_sky;
+
+	const int num_triangles = tess_center
+		? num_vertices
+		: num_vertices - 2;
+
+	for (int i = 0; i < num_triangles; i++)
+	{
+		int i1 = (i + 2 - tess_center) % num_vertices;
+		int i2 = (i + 1 - tess_center) % num_vertices;
+
+		CP_V(k, tess_center ? pos_center : positions);
+		CP_T(k, tess_center ? tc_center : tex_coords);
+		CP_M(k);
+		k++;
+
+		CP_V(k, positions + i1 * 3);
+		CP_T(k, tex_coords + i1 * 2);
+		CP_M(k);
+		k++;
+
+		CP_V(k, positions + i2 * 3);
+		CP_T(k, tex_coords + i2 * 2);
+		CP_M(k);
+		k++;
+
+	}
+
+#undef CP_V
+#undef CP_T
+#undef CP_M
+
+	assert(k % 3 == 0);
+	return k;
+}
+
+static int
+test_poly_builders(bsp_t *bsp, unsigned msec[2], int *num_triangles)
+{
+	static const uint32_t kinds[2] = { MATERIAL_KIND_REGULAR, MATERIAL_KIND_SKY };
+	int max_vertices = count_world_vertices(bsp);
+	float *positions[2], *tex_coords[2];
+	uint32_t *materials[2];
+	int num_vertices[2];
+	int errors = 0;
+
+	for (int i = 0; i < 2; i++)
+	{
+		positions[i] = Z_Malloc(max(max_vertices, 3) * 3 * sizeof(float));
+		tex_coords[i] = Z_Malloc(max(max_vertices, 3) * 2 * sizeof(float));
+		// the reference writes a material for every vertex
+		materials[i] = Z_Malloc(max(max_vertices, 3) * sizeof(uint32_t));
+	}
+
+	for (int k = 0; k < 2; k++)
+	{
+		unsigned start = Sys_Milliseconds();
+
+		num_vertices[0] = 0;
+		for (int i = 0; i < bsp->numfaces; i++)
+		{
+			const mface_t *surf = bsp->faces + i;
+			int idx = num_vertices[0];
+
+			if (idx + create_poly_ref(surf, kinds[k], NULL, NULL, NULL) > max_vertices)
+				break;
+
+			num_vertices[0] += create_poly_ref(surf, kinds[k],
+				positions[0] + idx * 3, tex_coords[0] + idx * 2, materials[0] + idx / 3);
+		}
+
+		msec[0] += Sys_Milliseconds() - start;
+		start = Sys_Milliseconds();
+
+		num_vertices[1] = 0;
+		for (int i = 0; i < bsp->numfaces; i++)
+		{
+			const mface_t *surf = bsp->faces + i;
+			int idx = num_vertices[1];
+
+			num_vertices[1] += create_poly(surf, kinds[k],
+				positions[1] + idx * 3, tex_coords[1] + idx * 2, materials[1] + idx / 3);
+
+			if (num_vertices[1] - idx > max_poly_vertices(surf))
+				errors++;
+		}
+
+		msec[1] += Sys_Milliseconds() - start;
+
+		if (num_vertices[0] != num_vertices[1] ||
+			memcmp(positions[0], positions[1], num_vertices[0] * 3 * sizeof(float)) ||
+			memcmp(tex_coords[0], tex_coords[1], num_vertices[0] * 2 * sizeof(float)) ||
+			memcmp(materials[0], materials[1], num_vertices[0] / 3 * sizeof(uint32_t))) {
+			Com_Printf("%s: %s triangle mismatch, %d reference, %d single pass\n", bsp->name,
+				k ? "sky" : "regular", num_vertices[0] / 3, num_vertices[1] / 3);
+			errors++;
+		}
+
+		*num_triangles += num_vertices[1] / 3;
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		Z_Free(positions[i]);
+		Z_Free(tex_coords[i]);
+		Z_Free(materials[i]);
+	}
+
+	return errors;
+}
+
+/*
+  Triangulates the faces of all maps as regular and as sky surfaces with
+  both versions of create_poly and checks that they emit the same triangles.
+*/
+void
+bsp_mesh_test_polys(void)
+{
+	unsigned msec[2];
+	void **list;
+	int i, count, numtested, errors, num_triangles;
+
+	memset(msec, 0, sizeof(msec));
+	numtested = errors = num_triangles = 0;
+
+	list = FS_ListFiles(NULL, "maps/*.bsp", FS_SEARCH_BYFILTER | FS_SEARCH_SAVEPATH, &count);
+
+	for (i = 0; i < count; i++) {
+		bsp_t *bsp;
+
+		if (BSP_Load(list[i], &bsp) < 0)
+			continue;
+
+		errors += test_poly_builders(bsp, msec, &num_triangles);
+		numtested++;
+
+		BSP_Free(bsp);
+	}
+
+	if (list)
+		FS_FreeList(list);
+
+	Com_Printf("polys: %5u msec reference, %5u msec single pass\n", msec[0], msec[1]);
+	Com_Printf("%d failures, %d maps tested, %d triangles\n", errors, numtested, num_triangles);
+}
+
+#endif // USE_TESTS
+
+static qboolean
+bsp_mesh_load_custom_sky(int *idx_ctr, bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
+{
+	char filename[MAX_QPATH];
+	Q_snprintf(filename, sizeof(filename), "maps/sky/%s.obj", map_name);
+
+	void* file_buffer = NULL;
+	ssize_t file_size = FS_LoadFile(filename, &file_buffer);
+	if (!file_buffer)
+		return qfalse;
+
+	tinyobj_attrib_t attrib;
+	tinyobj_shape_t* shapes = NULL;
+	size_t num_shapes;
+	tinyobj_material_t* materials = NULL;
+	size_t num_materials;
+
+	unsigned int flags = TINYOBJ_FLAG_TRIANGULATE;
+	int ret = tinyobj_parse_obj(&attrib, &shapes, &num_shapes, &materials,
+		&num_materials, (const char*)file_buffer, file_size, flags);
+
+	FS_FreeFile(file_buffer);
+
+	if (ret != TINYOBJ_SUCCESS) {
+		Com_WPrintf("Couldn't parse sky polygon definition file %s.\n", filename);
+		return qfalse;
+	}
+
+	reserve_world_mesh(wm, *idx_ctr + attrib.num_face_num_verts * 3);
+
+	int face_offset = 0;
+	for (int nprim = 0; nprim < attrib.num_face_num_verts; nprim++)
+	{
+		int face_num_verts = attrib.face_num_verts[nprim];
+		int i0 = attrib.faces[face_offset + 0].v_idx;
+		int i1 = attrib.faces[face_offset + 1].v_idx;
+		int i2 = attrib.faces[face_offset + 2].v_idx;
+
+		vec3_t v0, v1, v2;
+		VectorCopy(attrib.vertices + i0 * 3, v0);
+		VectorCopy(attrib.vertices + i1 * 3, v1);
+		VectorCopy(attrib.vertices + i2 * 3, v2);
+
+		int wm_index = *idx_ctr;
+		int wm_prim = wm_index / 3;
+
+		VectorCopy(v0, wm->positions + wm_index * 3 + 0);
+		VectorCopy(v1, wm->positions + wm_index * 3 + 3);
+		VectorCopy(v2, wm->positions + wm_index * 3 + 6);
+
+		wm->tex_coords[wm_index * 2 + 0] = 0.f;
+		wm->tex_coords[wm_index * 2 + 1] = 0.f;
+		wm->tex_coords[wm_index * 2 + 2] = 0.f;
+		wm->tex_coords[wm_index * 2 + 3] = 0.f;
+		wm->tex_coords[wm_index * 2 + 4] = 0.f;
+		wm->tex_coords[wm_index * 2 + 5] = 0.f;
+
+		vec3_t center;
+		get_triangle_off_center(wm->positions + wm_index * 3, center, NULL);
 
 		int cluster = BSP_PointLeaf(bsp->nodes, center)->cluster;
 		wm->clusters[wm_prim] = cluster;
@@ -1619,20 +2279,21 @@ bsp_mesh_load_custom_sky(int *idx_ctr, bsp_mesh_t *wm, bsp_t *bsp, const char* m
 	return qtrue;
 }
 
-void
-bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
+static const char*
+get_full_game_map_name(const char* map_name)
 {
-	const char* full_game_map_name = map_name;
 	if (strcmp(map_name, "demo1") == 0)
-		full_game_map_name = "base1";
-	else if (strcmp(map_name, "demo2") == 0)
-		full_game_map_name = "base2";
-	else if (strcmp(map_name, "demo3") == 0)
-		full_game_map_name = "base3";
-
-	load_sky_and_lava_clusters(wm, full_game_map_name);
-	load_cameras(wm, full_game_map_name);
+		return "base1";
+	if (strcmp(map_name, "demo2") == 0)
+		return "base2";
+	if (strcmp(map_name, "demo3") == 0)
+		return "base3";
+	return map_name;
+}
 
+static void
+build_world_mesh(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name, const char* full_game_map_name)
+{
 	wm->models = Z_Malloc(bsp->nummodels * sizeof(bsp_model_t));
 	memset(wm->models, 0, bsp->nummodels * sizeof(bsp_model_t));
 
@@ -1646,10 +2307,12 @@ bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
 
     wm->num_vertices = 0;
     wm->num_indices = 0;
-    wm->positions = Z_Malloc(MAX_VERT_BSP * 3 * sizeof(*wm->positions));
-    wm->tex_coords = Z_Malloc(MAX_VERT_BSP * 2 * sizeof(*wm->tex_coords));
-    wm->materials = Z_Malloc(MAX_VERT_BSP / 3 * sizeof(*wm->materials));
-    wm->clusters = Z_Malloc(MAX_VERT_BSP / 3 * sizeof(*wm->clusters));
+    wm->allocated_vertices = 0;
+    wm->positions = NULL;
+    wm->tex_coords = NULL;
+    wm->materials = NULL;
+    wm->clusters = NULL;
+    reserve_world_mesh(wm, count_world_vertices(bsp));
 
 	// clear these here because `bsp_mesh_load_custom_sky` creates lights before `collect_ligth_polys`
 	wm->num_light_polys = 0;
@@ -1702,6 +2365,8 @@ bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
 		{
 			Com_EPrintf("Couldn't save patched PVS for %s.\n", bsp->name);
 		}
+
+		bsp->pvs_patched = qtrue;
 	}
 
     wm->num_indices = idx_ctr;
@@ -1756,6 +2421,590 @@ bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
 	compute_sky_visibility(wm, bsp);
 }
 
+/*
+  World mesh cache.
+
+  Everything computed above only depends on the BSP file, the materials
+  it references and a few map side files, so the result is saved to
+  maps/mesh/<map>.bin after a full build and read back on subsequent
+  loads. The file is a header followed by 16 byte aligned lumps in
+  native byte order, laid out so that it can be used from a mapped view.
+*/
+
+#define WMC_IDENT       MakeRawLong('W', 'M', 'C', 'F')
+#define WMC_VERSION     1
+
+enum {
+	WMC_POSITIONS,
+	WMC_TEX_COORDS,
+	WMC_TANGENTS,
+	WMC_MATERIALS,
+	WMC_CLUSTERS,
+	WMC_TEXEL_DENSITY,
+	WMC_MODELS,
+	WMC_LIGHTS,             // world lights followed by model lights
+	WMC_CLUSTER_LIGHT_OFFSETS,
+	WMC_CLUSTER_LIGHTS,
+	WMC_CLUSTER_AABBS,
+	WMC_SKY_VISIBILITY,
+
+	WMC_NUM_LUMPS
+};
+
+typedef struct {
+	uint32_t ofs;
+	uint32_t len;
+} wmc_lump_t;
+
+typedef struct {
+	uint32_t ident;
+	uint32_t version;
+	uint32_t bsp_checksum;
+	uint32_t key;           // hash of materials and map side inputs
+
+	uint32_t num_vertices;
+	uint32_t num_models;
+	uint32_t num_clusters;
+	uint32_t num_light_polys;
+	uint32_t num_model_light_polys;
+	uint32_t num_cluster_lights;
+
+	uint32_t world_idx_count;
+	uint32_t world_transparent_offset;
+	uint32_t world_transparent_count;
+	uint32_t world_sky_offset;
+	uint32_t world_sky_count;
+	uint32_t world_custom_sky_offset;
+	uint32_t world_custom_sky_count;
+	aabb_t world_aabb;
+
+	wmc_lump_t lumps[WMC_NUM_LUMPS];
+} wmc_header_t;
+
+typedef struct {
+	uint32_t idx_offset;
+	uint32_t idx_count;
+	vec3_t center;
+	vec3_t aabb_min;
+	vec3_t aabb_max;
+	int32_t num_light_polys;
+	int32_t transparent;
+} wmc_model_t;
+
+// light_poly_t with the material pointer replaced by table index
+typedef struct {
+	float positions[9];
+	vec3_t off_center;
+	vec3_t color;
+	int32_t material;
+	int32_t cluster;
+	int32_t style;
+} wmc_light_t;
+
+static uint32_t
+hash_data(uint32_t hash, const void* data, size_t len)
+{
+	const byte* p = data;
+
+	while (len--)
+		hash = (hash ^ *p++) * 16777619u;
+
+	return hash;
+}
+
+static uint32_t
+hash_material(uint32_t hash, const pbr_material_t* mat)
+{
+	if (!mat)
+		return hash_data(hash, "", 1);
+
+	hash = hash_data(hash, mat->name, strlen(mat->name) + 1);
+	hash = hash_data(hash, &mat->flags, sizeof(mat->flags));
+	hash = hash_data(hash, &mat->enable_light_styles, sizeof(mat->enable_light_styles));
+
+	const image_t* diffuse = mat->image_diffuse;
+	if (diffuse)
+	{
+		hash = hash_data(hash, &diffuse->width, sizeof(diffuse->width));
+		hash = hash_data(hash, &diffuse->height, sizeof(diffuse->height));
+	}
+
+	const image_t* emissive = mat->image_emissive;
+	if (emissive)
+	{
+		hash = hash_data(hash, &emissive->entire_texture_emissive, sizeof(emissive->entire_texture_emissive));
+		hash = hash_data(hash, emissive->light_color, sizeof(emissive->light_color));
+		hash = hash_data(hash, emissive->min_light_texcoord, sizeof(emissive->min_light_texcoord));
+		hash = hash_data(hash, emissive->max_light_texcoord, sizeof(emissive->max_light_texcoord));
+	}
+
+	return hash;
+}
+
+// hashes all inputs of the world mesh besides the BSP file itself
+static uint32_t
+compute_cache_key(bsp_mesh_t *wm, bsp_t *bsp, const char* full_game_map_name)
+{
+	uint32_t hash = 2166136261u;
+
+	for (int i = 0; i < bsp->numtexinfo; i++)
+		hash = hash_material(hash, bsp->texinfo[i].material);
+
+	// custom sky triangles use material 0 for texel density
+	hash = hash_material(hash, MAT_GetPBRMaterial(0));
+
+	hash = hash_data(hash, &cvar_pt_enable_nodraw->integer, sizeof(int));
+	hash = hash_data(hash, &wm->all_lava_emissive, sizeof(wm->all_lava_emissive));
+	hash = hash_data(hash, &wm->num_sky_clusters, sizeof(wm->num_sky_clusters));
+	hash = hash_data(hash, wm->sky_clusters, wm->num_sky_clusters * sizeof(wm->sky_clusters[0]));
+	hash = hash_data(hash, &wm->num_cameras, sizeof(wm->num_cameras));
+
+	char filename[MAX_QPATH];
+	Q_snprintf(filename, sizeof(filename), "maps/sky/%s.obj", full_game_map_name);
+
+	void* file_buffer = NULL;
+	ssize_t file_size = FS_LoadFile(filename, &file_buffer);
+	if (file_buffer)
+	{
+		hash = hash_data(hash, file_buffer, file_size);
+		FS_FreeFile(file_buffer);
+	}
+
+	return hash;
+}
+
+static void
+get_lump_sizes(const wmc_header_t* header, size_t* sizes)
+{
+	size_t num_tris = header->num_vertices / 3;
+
+	sizes[WMC_POSITIONS] = header->num_vertices * 3 * sizeof(float);
+	sizes[WMC_TEX_COORDS] = header->num_vertices * 2 * sizeof(float);
+	sizes[WMC_TANGENTS] = num_tris * 3 * sizeof(float);
+	sizes[WMC_MATERIALS] = num_tris * sizeof(uint32_t);
+	sizes[WMC_CLUSTERS] = num_tris * sizeof(int);
+	sizes[WMC_TEXEL_DENSITY] = num_tris * sizeof(float);
+	sizes[WMC_MODELS] = header->num_models * sizeof(wmc_model_t);
+	sizes[WMC_LIGHTS] = (header->num_light_polys + header->num_model_light_polys) * sizeof(wmc_light_t);
+	sizes[WMC_CLUSTER_LIGHT_OFFSETS] = (header->num_clusters + 1) * sizeof(int);
+	sizes[WMC_CLUSTER_LIGHTS] = header->num_cluster_lights * sizeof(int);
+	sizes[WMC_CLUSTER_AABBS] = header->num_clusters * sizeof(aabb_t);
+	sizes[WMC_SKY_VISIBILITY] = VIS_MAX_BYTES;
+}
+
+static void
+write_lights(wmc_light_t* dst, const light_poly_t* src, int count)
+{
+	for (int i = 0; i < count; i++, dst++, src++)
+	{
+		memcpy(dst->positions, src->positions, sizeof(dst->positions));
+		VectorCopy(src->off_center, dst->off_center);
+		VectorCopy(src->color, dst->color);
+		dst->material = src->material ? MAT_GetPBRMaterialIndex(src->material) : -1;
+		dst->cluster = src->cluster;
+		dst->style = src->style;
+	}
+}
+
+static void
+read_lights(light_poly_t* dst, const wmc_light_t* src, int count)
+{
+	for (int i = 0; i < count; i++, dst++, src++)
+	{
+		memcpy(dst->positions, src->positions, sizeof(dst->positions));
+		VectorCopy(src->off_center, dst->off_center);
+		VectorCopy(src->color, dst->color);
+		dst->material = src->material >= 0 ? MAT_GetPBRMaterial(src->material) : NULL;
+		dst->cluster = src->cluster;
+		dst->style = src->style;
+	}
+}
+
+static void
+save_mesh_cache(bsp_mesh_t *wm, bsp_t *bsp, const char* path, uint32_t key)
+{
+	wmc_header_t header;
+	size_t sizes[WMC_NUM_LUMPS];
+
+	memset(&header, 0, sizeof(header));
+	header.ident = WMC_IDENT;
+	header.version = WMC_VERSION;
+	header.bsp_checksum = bsp->checksum;
+	header.key = key;
+	header.num_vertices = wm->num_vertices;
+	header.num_models = wm->num_models;
+	header.num_clusters = wm->num_clusters;
+	header.num_light_polys = wm->num_light_polys;
+	header.num_cluster_lights = wm->num_cluster_lights;
+	header.world_idx_count = wm->world_idx_count;
+	header.world_transparent_offset = wm->world_transparent_offset;
+	header.world_transparent_count = wm->world_transparent_count;
+	header.world_sky_offset = wm->world_sky_offset;
+	header.world_sky_count = wm->world_sky_count;
+	header.world_custom_sky_offset = wm->world_custom_sky_offset;
+	header.world_custom_sky_count = wm->world_custom_sky_count;
+	header.world_aabb = wm->world_aabb;
+
+	for (int i = 0; i < wm->num_models; i++)
+		header.num_model_light_polys += wm->models[i].num_light_polys;
+
+	get_lump_sizes(&header, sizes);
+
+	size_t file_size = (sizeof(header) + 15) & ~15;
+	for (int i = 0; i < WMC_NUM_LUMPS; i++)
+	{
+		header.lumps[i].ofs = file_size;
+		header.lumps[i].len = sizes[i];
+		file_size += (sizes[i] + 15) & ~15;
+	}
+
+	byte* buffer = Z_Mallocz(file_size);
+#define LUMP(n) (buffer + header.lumps[n].ofs)
+
+	memcpy(buffer, &header, sizeof(header));
+	memcpy(LUMP(WMC_POSITIONS), wm->positions, sizes[WMC_POSITIONS]);
+	memcpy(LUMP(WMC_TEX_COORDS), wm->tex_coords, sizes[WMC_TEX_COORDS]);
+	memcpy(LUMP(WMC_TANGENTS), wm->tangents, sizes[WMC_TANGENTS]);
+	memcpy(LUMP(WMC_MATERIALS), wm->materials, sizes[WMC_MATERIALS]);
+	memcpy(LUMP(WMC_CLUSTERS), wm->clusters, sizes[WMC_CLUSTERS]);
+	memcpy(LUMP(WMC_TEXEL_DENSITY), wm->texel_density, sizes[WMC_TEXEL_DENSITY]);
+	memcpy(LUMP(WMC_CLUSTER_LIGHT_OFFSETS), wm->cluster_light_offsets, sizes[WMC_CLUSTER_LIGHT_OFFSETS]);
+	memcpy(LUMP(WMC_CLUSTER_LIGHTS), wm->cluster_lights, sizes[WMC_CLUSTER_LIGHTS]);
+	memcpy(LUMP(WMC_CLUSTER_AABBS), wm->cluster_aabbs, sizes[WMC_CLUSTER_AABBS]);
+	memcpy(LUMP(WMC_SKY_VISIBILITY), wm->sky_visibility, sizes[WMC_SKY_VISIBILITY]);
+
+	wmc_light_t* dst_light = (wmc_light_t*)LUMP(WMC_LIGHTS);
+	write_lights(dst_light, wm->light_polys, wm->num_light_polys);
+	dst_light += wm->num_light_polys;
+
+	wmc_model_t* dst_model = (wmc_model_t*)LUMP(WMC_MODELS);
+	for (int i = 0; i < wm->num_models; i++, dst_model++)
+	{
+		const bsp_model_t* model = wm->models + i;
+
+		dst_model->idx_offset = model->idx_offset;
+		dst_model->idx_count = model->idx_count;
+		VectorCopy(model->center, dst_model->center);
+		VectorCopy(model->aabb_min, dst_model->aabb_min);
+		VectorCopy(model->aabb_max, dst_model->aabb_max);
+		dst_model->num_light_polys = model->num_light_polys;
+		dst_model->transparent = model->transparent;
+
+		write_lights(dst_light, model->light_polys, model->num_light_polys);
+		dst_light += model->num_light_polys;
+	}
+
+#undef LUMP
+
+	if (FS_WriteFile(path, buffer, file_size) < 0)
+		Com_EPrintf("Couldn't save world mesh cache %s.\n", path);
+
+	Z_Free(buffer);
+}
+
+static void*
+copy_lump(const byte* buffer, const wmc_header_t* header, int lump)
+{
+	size_t len = header->lumps[lump].len;
+	void* data = Z_Malloc(len ? len : 1);
+	memcpy(data, buffer + header->lumps[lump].ofs, len);
+	return data;
+}
+
+static qboolean
+load_mesh_cache(bsp_mesh_t *wm, bsp_t *bsp, const char* path, uint32_t key)
+{
+	byte* buffer = NULL;
+	ssize_t file_size = FS_LoadFile(path, (void**)&buffer);
+	if (!buffer)
+		return qfalse;
+
+	wmc_header_t header;
+	size_t sizes[WMC_NUM_LUMPS];
+
+	if (file_size < (ssize_t)sizeof(header))
+		goto fail;
+
+	memcpy(&header, buffer, sizeof(header));
+
+	if (header.ident != WMC_IDENT || header.version != WMC_VERSION)
+		goto fail;
+
+	// stale cache, the map or its materials have changed
+	if (header.bsp_checksum != bsp->checksum || header.key != key)
+		goto fail;
+
+	if (header.num_models != bsp->nummodels || header.num_clusters != bsp->vis->numclusters)
+		goto fail;
+
+	if (header.num_vertices % 3 || header.num_vertices >= MAX_VERT_BSP)
+		goto fail;
+
+	get_lump_sizes(&header, sizes);
+
+	for (int i = 0; i < WMC_NUM_LUMPS; i++)
+	{
+		const wmc_lump_t* lump = header.lumps + i;
+		if (lump->len != sizes[i] || lump->ofs & 15 || lump->ofs > file_size || lump->len > file_size - lump->ofs)
+			goto fail;
+	}
+
+	const wmc_model_t* src_model = (const wmc_model_t*)(buffer + header.lumps[WMC_MODELS].ofs);
+	uint32_t num_model_light_polys = 0;
+	for (int i = 0; i < header.num_models; i++)
+	{
+		if (src_model[i].num_light_polys < 0)
+			goto fail;
+		num_model_light_polys += src_model[i].num_light_polys;
+	}
+	if (num_model_light_polys != header.num_model_light_polys)
+		goto fail;
+
+	const wmc_light_t* src_light = (const wmc_light_t*)(buffer + header.lumps[WMC_LIGHTS].ofs);
+	for (int i = 0; i < header.num_light_polys + header.num_model_light_polys; i++)
+	{
+		if (src_light[i].material >= MAT_GetNumPBRMaterials())
+			goto fail;
+	}
+
+	wm->num_light_polys = wm->allocated_light_polys = header.num_light_polys;
+	wm->light_polys = Z_Malloc(max(header.num_light_polys, 1) * sizeof(light_poly_t));
+	read_lights(wm->light_polys, src_light, header.num_light_polys);
+	src_light += header.num_light_polys;
+
+	wm->num_models = header.num_models;
+	wm->models = Z_Mallocz(max(header.num_models, 1) * sizeof(bsp_model_t));
+
+	for (int i = 0; i < header.num_models; i++, src_model++)
+	{
+		bsp_model_t* model = wm->models + i;
+
+		model->idx_offset = src_model->idx_offset;
+		model->idx_count = src_model->idx_count;
+		VectorCopy(src_model->center, model->center);
+		VectorCopy(src_model->aabb_min, model->aabb_min);
+		VectorCopy(src_model->aabb_max, model->aabb_max);
+		model->transparent = src_model->transparent;
+
+		if (src_model->num_light_polys)
+		{
+			model->num_light_polys = model->allocated_light_polys = src_model->num_light_polys;
+			model->light_polys = Z_Malloc(model->num_light_polys * sizeof(light_poly_t));
+			read_lights(model->light_polys, src_light, model->num_light_polys);
+			src_light += model->num_light_polys;
+		}
+	}
+
+	wm->num_vertices = wm->num_indices = wm->allocated_vertices = header.num_vertices;
+	wm->num_clusters = header.num_clusters;
+	wm->num_cluster_lights = header.num_cluster_lights;
+	wm->world_idx_count = header.world_idx_count;
+	wm->world_transparent_offset = header.world_transparent_offset;
+	wm->world_transparent_count = header.world_transparent_count;
+	wm->world_sky_offset = header.world_sky_offset;
+	wm->world_sky_count = header.world_sky_count;
+	wm->world_custom_sky_offset = header.world_custom_sky_offset;
+	wm->world_custom_sky_count = header.world_custom_sky_count;
+	wm->world_aabb = header.world_aabb;
+
+	wm->positions = copy_lump(buffer, &header, WMC_POSITIONS);
+	wm->tex_coords = copy_lump(buffer, &header, WMC_TEX_COORDS);
+	wm->tangents = copy_lump(buffer, &header, WMC_TANGENTS);
+	wm->materials = copy_lump(buffer, &header, WMC_MATERIALS);
+	wm->clusters = copy_lump(buffer, &header, WMC_CLUSTERS);
+	wm->texel_density = copy_lump(buffer, &header, WMC_TEXEL_DENSITY);
+	wm->cluster_light_offsets = copy_lump(buffer, &header, WMC_CLUSTER_LIGHT_OFFSETS);
+	wm->cluster_lights = copy_lump(buffer, &header, WMC_CLUSTER_LIGHTS);
+	wm->cluster_aabbs = copy_lump(buffer, &header, WMC_CLUSTER_AABBS);
+	memcpy(wm->sky_visibility, buffer + header.lumps[WMC_SKY_VISIBILITY].ofs, VIS_MAX_BYTES);
+
+	// the mesh is not indexed
+	wm->indices = Z_Malloc(max(wm->num_indices, 1) * sizeof(int));
+	for (int i = 0; i < wm->num_indices; i++)
+		wm->indices[i] = i;
+
+	FS_FreeFile(buffer);
+	return qtrue;
+
+fail:
+	Com_DPrintf("World mesh cache %s is out of date.\n", path);
+	FS_FreeFile(buffer);
+	return qfalse;
+}
+
+static const char*
+prepare_world_mesh(bsp_mesh_t *wm, const char* map_name, char* cache_path)
+{
+	const char* full_game_map_name = get_full_game_map_name(map_name);
+
+	load_sky_and_lava_clusters(wm, full_game_map_name);
+	load_cameras(wm, full_game_map_name);
+
+	Q_snprintf(cache_path, MAX_QPATH, "maps/mesh/%s.bin", map_name);
+
+	return full_game_map_name;
+}
+
+// size of the per vertex and per triangle arrays of the world mesh
+static size_t
+world_mesh_size(const bsp_mesh_t *wm)
+{
+	size_t vertex_size = 5 * sizeof(float) + sizeof(int);
+	size_t triangle_size = 4 * sizeof(float) + 2 * sizeof(uint32_t);
+
+	return wm->allocated_vertices * vertex_size + wm->allocated_vertices / 3 * triangle_size;
+}
+
+void
+bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
+{
+	unsigned start = Sys_Milliseconds();
+	char cache_path[MAX_QPATH];
+
+	const char* full_game_map_name = prepare_world_mesh(wm, map_name, cache_path);
+	uint32_t key = compute_cache_key(wm, bsp, full_game_map_name);
+
+	// first load of a map also patches the PVS, so it always does a full build
+	if (bsp->pvs_patched && cvar_pt_mesh_cache->integer && load_mesh_cache(wm, bsp, cache_path, key))
+	{
+		if (developer->integer)
+			Com_Printf("Loaded world mesh for %s from cache in %u msec, %d triangles, %zu KB\n", map_name,
+				Sys_Milliseconds() - start, wm->num_vertices / 3, world_mesh_size(wm) / 1024);
+	}
+	else
+	{
+		build_world_mesh(wm, bsp, map_name, full_game_map_name);
+
+		if (cvar_pt_mesh_cache->integer)
+			save_mesh_cache(wm, bsp, cache_path, key);
+
+		if (developer->integer)
+			Com_Printf("Built world mesh for %s in %u msec, %d triangles, %zu KB\n", map_name,
+				Sys_Milliseconds() - start, wm->num_vertices / 3, world_mesh_size(wm) / 1024);
+	}
+
+	// reorders the cluster light lists, the trees don't depend on their order
+	vkpt_light_trees_create(wm);
+}
+
+#if USE_TESTS
+
+static qboolean
+light_polys_equal(const light_poly_t* a, const light_poly_t* b, int count)
+{
+	for (int i = 0; i < count; i++, a++, b++)
+	{
+		if (memcmp(a->positions, b->positions, sizeof(a->positions)) ||
+			!VectorCompare(a->off_center, b->off_center) ||
+			!VectorCompare(a->color, b->color) ||
+			a->material != b->material || a->cluster != b->cluster || a->style != b->style)
+			return qfalse;
+	}
+
+	return qtrue;
+}
+
+static int
+compare_world_meshes(const bsp_mesh_t* a, const bsp_mesh_t* b)
+{
+	int errors = 0;
+
+#define CHECK(what, cond) \
+	if (!(cond)) { Com_Printf("%s differs\n", what); errors++; }
+#define CHECK_ARRAY(field, count) \
+	CHECK(#field, !memcmp(a->field, b->field, (count) * sizeof(*a->field)))
+
+	CHECK("counts", a->num_vertices == b->num_vertices && a->num_models == b->num_models &&
+		a->num_light_polys == b->num_light_polys && a->num_cluster_lights == b->num_cluster_lights &&
+		a->world_idx_count == b->world_idx_count &&
+		a->world_transparent_offset == b->world_transparent_offset &&
+		a->world_transparent_count == b->world_transparent_count &&
+		a->world_sky_offset == b->world_sky_offset && a->world_sky_count == b->world_sky_count &&
+		a->world_custom_sky_offset == b->world_custom_sky_offset &&
+		a->world_custom_sky_count == b->world_custom_sky_count);
+	if (errors)
+		return errors;
+
+	CHECK_ARRAY(positions, a->num_vertices * 3);
+	CHECK_ARRAY(tex_coords, a->num_vertices * 2);
+	CHECK_ARRAY(tangents, a->num_vertices);
+	CHECK_ARRAY(materials, a->num_vertices / 3);
+	CHECK_ARRAY(clusters, a->num_vertices / 3);
+	CHECK_ARRAY(texel_density, a->num_vertices / 3);
+	CHECK_ARRAY(cluster_light_offsets, a->num_clusters + 1);
+	CHECK_ARRAY(cluster_lights, a->num_cluster_lights);
+	CHECK_ARRAY(cluster_aabbs, a->num_clusters);
+	CHECK_ARRAY(sky_visibility, VIS_MAX_BYTES);
+	CHECK("world_aabb", !memcmp(&a->world_aabb, &b->world_aabb, sizeof(aabb_t)));
+	CHECK("light_polys", light_polys_equal(a->light_polys, b->light_polys, a->num_light_polys));
+
+	for (int i = 0; i < a->num_models; i++)
+	{
+		const bsp_model_t* ma = a->models + i;
+		const bsp_model_t* mb = b->models + i;
+
+		CHECK(va("model %d", i), ma->idx_offset == mb->idx_offset && ma->idx_count == mb->idx_count &&
+			VectorCompare(ma->center, mb->center) && VectorCompare(ma->aabb_min, mb->aabb_min) &&
+			VectorCompare(ma->aabb_max, mb->aabb_max) && ma->transparent == mb->transparent &&
+			ma->num_light_polys == mb->num_light_polys &&
+			light_polys_equal(ma->light_polys, mb->light_polys, ma->num_light_polys));
+	}
+
+#undef CHECK_ARRAY
+#undef CHECK
+
+	return errors;
+}
+
+/*
+  Builds the world mesh of the given map from scratch, round trips it
+  through the cache file and compares the results. Only needs the CPU
+  side of the renderer, materials of the map must be registered.
+*/
+void
+bsp_mesh_test_cache(bsp_t *bsp)
+{
+	char map_name[MAX_QPATH];
+	char cache_path[MAX_QPATH];
+	bsp_mesh_t *built, *cached;
+	unsigned start, build_msec, load_msec;
+
+	COM_StripExtension(COM_SkipPath(bsp->name), map_name, sizeof(map_name));
+
+	built = Z_Mallocz(sizeof(*built));
+	cached = Z_Mallocz(sizeof(*cached));
+
+	const char* full_game_map_name = prepare_world_mesh(built, map_name, cache_path);
+	uint32_t key = compute_cache_key(built, bsp, full_game_map_name);
+
+	start = Sys_Milliseconds();
+	build_world_mesh(built, bsp, map_name, full_game_map_name);
+	build_msec = Sys_Milliseconds() - start;
+
+	save_mesh_cache(built, bsp, cache_path, key);
+
+	prepare_world_mesh(cached, map_name, cache_path);
+
+	start = Sys_Milliseconds();
+	if (load_mesh_cache(cached, bsp, cache_path, key))
+	{
+		load_msec = Sys_Milliseconds() - start;
+		Com_Printf("%s: %d failures, %u msec build, %u msec cached\n", map_name,
+			compare_world_meshes(built, cached), build_msec, load_msec);
+		bsp_mesh_destroy(cached);
+	}
+	else
+	{
+		Com_Printf("%s: couldn't load %s\n", map_name, cache_path);
+	}
+
+	bsp_mesh_destroy(built);
+	Z_Free(built);
+	Z_Free(cached);
+}
+
+#endif // USE_TESTS
+
 void
 bsp_mesh_destroy(bsp_mesh_t *wm)
 {
@@ -1773,13 +3022,48 @@ bsp_mesh_destroy(bsp_mesh_t *wm)
 	Z_Free(wm->cluster_lights);
 	Z_Free(wm->cluster_light_offsets);
 	Z_Free(wm->cluster_aabbs);
+	vkpt_light_trees_destroy(wm);
 
 	memset(wm, 0, sizeof(*wm));
 }
 
+// queues all texinfo images of the given variant for parallel loading
+static void
+request_texinfo_images(bsp_t *bsp, const char *suffix, qboolean srgb)
+{
+	for (int i = 0; i < bsp->numtexinfo; i++) {
+		mtexinfo_t *info = bsp->texinfo + i;
+		imageflags_t flags = (info->c.flags & SURF_WARP) ? IF_TURBULENT : IF_NONE;
+		char buffer[MAX_QPATH];
+
+		if (srgb)
+			flags |= IF_SRGB;
+
+		if (*suffix) {
+			// only look for extra maps of textures that exist
+			Q_concat(buffer, sizeof(buffer), "textures/", info->name, ".wal", NULL);
+			FS_NormalizePath(buffer, buffer);
+			if (IMG_Find(buffer, IT_WALL, flags | IF_SRGB) == R_NOTEXTURE)
+				continue;
+		}
+
+		Q_concat(buffer, sizeof(buffer), "textures/", info->name, suffix, NULL);
+		FS_NormalizePath(buffer, buffer);
+		IMG_Request(buffer, IT_WALL, flags);
+	}
+
+	IMG_LoadRequested();
+}
+
 void
 bsp_mesh_register_textures(bsp_t *bsp)
 {
+	// decode the diffuse maps first, then normal and emissive maps
+	// of the ones that exist, in parallel batches
+	request_texinfo_images(bsp, ".wal", qtrue);
+	request_texinfo_images(bsp, "_n.tga", qfalse);
+	request_texinfo_images(bsp, "_light.tga", qtrue);
+
 	for (int i = 0; i < bsp->numtexinfo; i++) {
 		mtexinfo_t *info = bsp->texinfo + i;
 		imageflags_t flags;
@@ -0,0 +1,636 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+  Light trees for polygon light sampling.
+
+  Every cluster with more static lights than fit into one leaf gets a
+  binary tree over its light list. Nodes store a bounding sphere, a cone
+  bounding the emission directions, and the total power of their lights.
+  The light list of the cluster is reordered so that the lights of every
+  node are contiguous, which lets the shader walk down the tree picking
+  children by importance, and then sample the lights of the leaf from the
+  regular light list like it does for small clusters.
+
+  Trees are built with median splits along the longest axis of the light
+  centers. Leaves are sorted by light index and inner nodes are merged
+  from their children, so the result doesn't depend on the order of the
+  input list and rebuilding a reordered list gives the same tree.
+*/
+
+#include "vkpt.h"
+#include "material.h"
+#include "common/jobs.h"
+#include "system/system.h"
+
+#include <float.h>
+
+// slack added to the cone angles for rounding in the shader
+#define LIGHT_TREE_CONE_EPSILON 0.001f
+
+typedef struct {
+	vec3_t mins, maxs;
+	vec3_t center;
+	vec3_t normal;
+	float power;
+} tree_light_t;
+
+typedef struct {
+	bsp_mesh_t* wm;
+	tree_light_t* lights;
+	int* first_nodes;
+	int* depths;
+} light_tree_job_t;
+
+typedef struct {
+	const tree_light_t* lights;
+	int* list;
+	light_tree_node_t* nodes;
+	int next_node;
+	int depth;
+} light_tree_build_t;
+
+static int
+count_tree_nodes(int num_lights)
+{
+	if (num_lights <= LIGHT_TREE_LEAF_SIZE)
+		return 1;
+
+	return 1 + count_tree_nodes(num_lights / 2) + count_tree_nodes(num_lights - num_lights / 2);
+}
+
+static void
+tree_light_job(void* arg, int nlight)
+{
+	light_tree_job_t* job = arg;
+	const light_poly_t* light = job->wm->light_polys + nlight;
+	tree_light_t* dst = job->lights + nlight;
+	const float* v0 = light->positions + 0;
+	const float* v1 = light->positions + 3;
+	const float* v2 = light->positions + 6;
+	vec3_t e1, e2;
+
+	ClearBounds(dst->mins, dst->maxs);
+	AddPointToBounds(v0, dst->mins, dst->maxs);
+	AddPointToBounds(v1, dst->mins, dst->maxs);
+	AddPointToBounds(v2, dst->mins, dst->maxs);
+
+	VectorAdd(v0, v1, dst->center);
+	VectorAdd(dst->center, v2, dst->center);
+	VectorScale(dst->center, 1.f / 3.f, dst->center);
+
+	VectorSubtract(v1, v0, e1);
+	VectorSubtract(v2, v0, e2);
+	CrossProduct(e1, e2, dst->normal);
+	float area = VectorNormalize(dst->normal) * 0.5f;
+
+	// Same luminance as the shader, sky lights have negative colors.
+	// Light styles can only dim a light, so they are left out.
+	float lum = fabsf(light->color[0] * 0.299f + light->color[1] * 0.587f + light->color[2] * 0.114f);
+	if (light->material)
+		lum *= light->material->emissive_scale;
+
+	// Lights with no power still need a chance to be picked
+	dst->power = max(area * lum, 1e-6f);
+}
+
+// merges two cones of directions, see "Importance Sampling of Many Lights
+// with Adaptive Tree Splitting" by Conty Estevez and Kulla
+static void
+merge_cones(const float* axis_a, float angle_a, const float* axis_b, float angle_b, float* axis, float* angle)
+{
+	if (angle_b > angle_a)
+	{
+		const float* t = axis_a; axis_a = axis_b; axis_b = t;
+		float f = angle_a; angle_a = angle_b; angle_b = f;
+	}
+
+	float cos_d = DotProduct(axis_a, axis_b);
+	float theta_d = acosf(max(-1.f, min(1.f, cos_d)));
+	float theta_o = (angle_a + theta_d + angle_b) * 0.5f;
+
+	if (min(theta_d + angle_b, (float)M_PI) <= angle_a)
+	{
+		VectorCopy(axis_a, axis);
+		*angle = angle_a;
+		return;
+	}
+
+	if (theta_o >= (float)M_PI)
+	{
+		VectorCopy(axis_a, axis);
+		*angle = (float)M_PI;
+		return;
+	}
+
+	// Rotate the wider cone towards the other one
+	vec3_t ortho;
+	VectorMA(axis_b, -cos_d, axis_a, ortho);
+	if (VectorNormalize(ortho) < 1e-6f)
+	{
+		// The axes are opposite, any direction orthogonal to them will do
+		vec3_t helper = { 0.f, 0.f, 0.f };
+		helper[fabsf(axis_a[0]) < 0.5f ? 0 : 1] = 1.f;
+		CrossProduct(axis_a, helper, ortho);
+		VectorNormalize(ortho);
+	}
+
+	float theta_r = theta_o - angle_a;
+	VectorScale(axis_a, cosf(theta_r), axis);
+	VectorMA(axis, sinf(theta_r), ortho, axis);
+	VectorNormalize(axis);
+	*angle = theta_o;
+}
+
+static qboolean
+light_less(const tree_light_t* lights, int a, int b, int axis)
+{
+	float ka = lights[a].center[axis];
+	float kb = lights[b].center[axis];
+
+	return ka < kb || (ka == kb && a < b);
+}
+
+// partitions the list so that the first k entries are the smallest ones
+static void
+select_lights(const tree_light_t* lights, int* list, int count, int k, int axis)
+{
+	int lo = 0, hi = count - 1;
+
+	while (lo < hi)
+	{
+		int pivot = list[(lo + hi) / 2];
+		int i = lo, j = hi;
+
+		while (i <= j)
+		{
+			while (light_less(lights, list[i], pivot, axis))
+				i++;
+			while (light_less(lights, pivot, list[j], axis))
+				j--;
+			if (i <= j)
+			{
+				int t = list[i]; list[i] = list[j]; list[j] = t;
+				i++;
+				j--;
+			}
+		}
+
+		if (k <= j)
+			hi = j;
+		else if (k >= i)
+			lo = i;
+		else
+			break;
+	}
+}
+
+static void
+set_node_bounds(light_tree_node_t* node, const vec3_t mins, const vec3_t maxs)
+{
+	vec3_t size;
+
+	VectorAdd(mins, maxs, node->center);
+	VectorScale(node->center, 0.5f, node->center);
+	VectorSubtract(maxs, mins, size);
+	node->radius = VectorLength(size) * 0.5f;
+}
+
+static void
+build_tree_node(light_tree_build_t* b, int index, int first, int count, int depth, vec3_t mins, vec3_t maxs)
+{
+	light_tree_node_t* node = b->nodes + index;
+	int* list = b->list + first;
+
+	node->first = first;
+	node->count = count;
+	b->depth = max(b->depth, depth);
+
+	if (count <= LIGHT_TREE_LEAF_SIZE)
+	{
+		for (int i = 1; i < count; i++)
+		{
+			int light = list[i], j = i;
+			for (; j > 0 && list[j - 1] > light; j--)
+				list[j] = list[j - 1];
+			list[j] = light;
+		}
+
+		const tree_light_t* light = b->lights + list[0];
+		VectorCopy(light->mins, mins);
+		VectorCopy(light->maxs, maxs);
+		VectorCopy(light->normal, node->axis);
+		node->cone_angle = 0.f;
+		node->power = light->power;
+
+		for (int i = 1; i < count; i++)
+		{
+			light = b->lights + list[i];
+			AddPointToBounds(light->mins, mins, maxs);
+			AddPointToBounds(light->maxs, mins, maxs);
+			merge_cones(node->axis, node->cone_angle, light->normal, 0.f, node->axis, &node->cone_angle);
+			node->power += light->power;
+		}
+
+		node->children = 0;
+		set_node_bounds(node, mins, maxs);
+		return;
+	}
+
+	vec3_t center_mins, center_maxs, size;
+	ClearBounds(center_mins, center_maxs);
+	for (int i = 0; i < count; i++)
+		AddPointToBounds(b->lights[list[i]].center, center_mins, center_maxs);
+
+	VectorSubtract(center_maxs, center_mins, size);
+	int axis = (size[0] >= size[1] && size[0] >= size[2]) ? 0 : (size[1] >= size[2]) ? 1 : 2;
+
+	int half = count / 2;
+	select_lights(b->lights, list, count, half, axis);
+
+	int child = b->next_node;
+	b->next_node += 2;
+	node->children = child;
+
+	vec3_t mins_b, maxs_b;
+	build_tree_node(b, child, first, half, depth + 1, mins, maxs);
+	build_tree_node(b, child + 1, first + half, count - half, depth + 1, mins_b, maxs_b);
+
+	const light_tree_node_t* left = b->nodes + child;
+	const light_tree_node_t* right = b->nodes + child + 1;
+
+	AddPointToBounds(mins_b, mins, maxs);
+	AddPointToBounds(maxs_b, mins, maxs);
+	set_node_bounds(node, mins, maxs);
+	merge_cones(left->axis, left->cone_angle, right->axis, right->cone_angle, node->axis, &node->cone_angle);
+	node->power = left->power + right->power;
+}
+
+static void
+light_tree_job(void* arg, int cluster)
+{
+	light_tree_job_t* job = arg;
+	bsp_mesh_t* wm = job->wm;
+	int first_node = job->first_nodes[cluster];
+
+	if (first_node < 0)
+		return;
+
+	light_tree_build_t b;
+	vec3_t mins, maxs;
+	int list_start = wm->cluster_light_offsets[cluster];
+	int count = wm->cluster_light_offsets[cluster + 1] - list_start;
+
+	b.lights = job->lights;
+	b.list = wm->cluster_lights + list_start;
+	b.nodes = wm->light_tree_nodes;
+	b.next_node = first_node + 1;
+	b.depth = 0;
+
+	build_tree_node(&b, first_node, 0, count, 0, mins, maxs);
+
+	for (int i = first_node; i < b.next_node; i++)
+		wm->light_tree_nodes[i].cone_angle = min(wm->light_tree_nodes[i].cone_angle + LIGHT_TREE_CONE_EPSILON, (float)M_PI);
+
+	wm->light_tree_roots[cluster] = first_node;
+	job->depths[cluster] = b.depth;
+}
+
+void
+vkpt_light_trees_destroy(bsp_mesh_t* wm)
+{
+	Z_Free(wm->light_tree_nodes);
+	Z_Free(wm->light_tree_roots);
+	wm->light_tree_nodes = NULL;
+	wm->light_tree_roots = NULL;
+	wm->num_light_tree_nodes = 0;
+}
+
+void
+vkpt_light_trees_create(bsp_mesh_t* wm)
+{
+	unsigned start = Sys_Milliseconds();
+	light_tree_job_t job;
+	int num_trees = 0, max_depth = 0;
+
+	vkpt_light_trees_destroy(wm);
+
+	if (!wm->num_clusters)
+		return;
+
+	// Hand out node ranges up front, so that clusters can be built in parallel
+
+	job.wm = wm;
+	job.first_nodes = Z_Malloc(wm->num_clusters * sizeof(int));
+	job.depths = Z_Mallocz(wm->num_clusters * sizeof(int));
+	wm->light_tree_roots = Z_Malloc(wm->num_clusters * sizeof(uint32_t));
+	memset(wm->light_tree_roots, 0xff, wm->num_clusters * sizeof(uint32_t));
+
+	for (int c = 0; c < wm->num_clusters; c++)
+	{
+		int count = wm->cluster_light_offsets[c + 1] - wm->cluster_light_offsets[c];
+		int num_nodes = count_tree_nodes(count);
+
+		job.first_nodes[c] = -1;
+
+		// Small clusters are sampled from the flat list
+		if (count <= LIGHT_TREE_LEAF_SIZE)
+			continue;
+
+		if (wm->num_light_tree_nodes + num_nodes > MAX_LIGHT_TREE_NODES)
+			continue;
+
+		job.first_nodes[c] = wm->num_light_tree_nodes;
+		wm->num_light_tree_nodes += num_nodes;
+		num_trees++;
+	}
+
+	wm->light_tree_nodes = Z_Malloc(max(wm->num_light_tree_nodes, 1) * sizeof(light_tree_node_t));
+	job.lights = Z_Malloc(max(wm->num_light_polys, 1) * sizeof(tree_light_t));
+
+	Job_ParallelFor(tree_light_job, &job, wm->num_light_polys);
+	Job_ParallelFor(light_tree_job, &job, wm->num_clusters);
+
+	for (int c = 0; c < wm->num_clusters; c++)
+		max_depth = max(max_depth, job.depths[c]);
+
+	Z_Free(job.lights);
+	Z_Free(job.first_nodes);
+	Z_Free(job.depths);
+
+	if (developer->integer)
+		Com_Printf("Built %d light trees with %d nodes, max depth %d, in %u msec\n",
+			num_trees, wm->num_light_tree_nodes, max_depth, Sys_Milliseconds() - start);
+}
+
+#if USE_TESTS
+
+// same as light_tree_importance in the shader
+static float
+light_tree_importance(const light_tree_node_t* node, const vec3_t p, const vec3_t gn)
+{
+	vec3_t d;
+	VectorSubtract(node->center, p, d);
+	float dist2 = DotProduct(d, d);
+	float r2 = node->radius * node->radius;
+
+	if (dist2 <= r2)
+		return node->power / max(r2, 1.f);
+
+	float dist = sqrtf(dist2);
+	VectorScale(d, 1.f / dist, d);
+
+	float sin_u = node->radius / dist;
+	float cos_u = sqrtf(max(0.f, 1.f - sin_u * sin_u));
+
+	float cos_i = DotProduct(gn, d);
+	float cos_i_u = cos_i >= cos_u ? 1.f : cos_i * cos_u + sqrtf(max(0.f, 1.f - cos_i * cos_i)) * sin_u;
+	if (cos_i_u <= 0.f)
+		return 0.f;
+
+	float theta = acosf(max(-1.f, min(1.f, -DotProduct(node->axis, d))));
+	float theta_e = max(0.f, theta - node->cone_angle - asinf(min(sin_u, 1.f)));
+	if (theta_e >= (float)M_PI * 0.5f)
+		return 0.f;
+
+	return node->power * cos_i_u * cosf(theta_e) / max(dist2, 1.f);
+}
+
+// checks that a light can send some light to the point. the light faces
+// the point or not as a whole, and some part of it is in front of the
+// surface if some vertex is.
+static qboolean
+light_reaches_point(const light_poly_t* light, const vec3_t p, const vec3_t gn)
+{
+	vec3_t e1, e2, normal, L;
+	VectorSubtract(light->positions + 3, light->positions + 0, e1);
+	VectorSubtract(light->positions + 6, light->positions + 0, e2);
+	CrossProduct(e1, e2, normal);
+	if (VectorNormalize(normal) == 0.f)
+		return qfalse;
+
+	// stay clear of the edge cases that rounding could decide either way
+	VectorSubtract(light->positions, p, L);
+	if (DotProduct(L, normal) > -0.01f)
+		return qfalse;
+
+	for (int v = 0; v < 3; v++)
+	{
+		VectorSubtract(light->positions + v * 3, p, L);
+		if (DotProduct(L, gn) > 0.01f)
+			return qtrue;
+	}
+
+	return qfalse;
+}
+
+typedef struct {
+	const bsp_mesh_t* wm;
+	const float* p;
+	const float* gn;
+	float* light_probs;
+} light_tree_walk_t;
+
+// spreads the probability of reaching a node over its lights like the
+// shader does when walking down the tree. the lights of a leaf share its
+// probability evenly, the shader weighs them differently but only their
+// sum matters here.
+static void
+walk_tree(light_tree_walk_t* w, uint32_t index, float prob)
+{
+	const light_tree_node_t* node = w->wm->light_tree_nodes + index;
+
+	if (!node->children)
+	{
+		for (uint32_t i = 0; i < node->count; i++)
+			w->light_probs[node->first + i] = prob / node->count;
+		return;
+	}
+
+	float i0 = light_tree_importance(w->wm->light_tree_nodes + node->children, w->p, w->gn);
+	float i1 = light_tree_importance(w->wm->light_tree_nodes + node->children + 1, w->p, w->gn);
+	float total = i0 + i1;
+
+	walk_tree(w, node->children, total > 0.f ? prob * i0 / total : 0.f);
+	walk_tree(w, node->children + 1, total > 0.f ? prob * i1 / total : 0.f);
+}
+
+typedef struct {
+	int leaves;
+	int leaf_lights;
+	double leaf_depths;     // sum of leaf depths weighted by their lights
+} light_tree_stats_t;
+
+static int
+check_tree_node(const bsp_mesh_t* wm, const int* list, uint32_t index, int depth, light_tree_stats_t* stats)
+{
+	const light_tree_node_t* node = wm->light_tree_nodes + index;
+	int errors = 0;
+
+	for (uint32_t i = 0; i < node->count; i++)
+	{
+		const light_poly_t* light = wm->light_polys + list[node->first + i];
+		vec3_t e1, e2, normal;
+
+		for (int v = 0; v < 3; v++)
+		{
+			if (Distance(light->positions + v * 3, node->center) > node->radius * 1.001f + 0.01f)
+				errors++;
+		}
+
+		VectorSubtract(light->positions + 3, light->positions + 0, e1);
+		VectorSubtract(light->positions + 6, light->positions + 0, e2);
+		CrossProduct(e1, e2, normal);
+		if (VectorNormalize(normal) > 0.f &&
+			acosf(max(-1.f, min(1.f, DotProduct(normal, node->axis)))) > node->cone_angle)
+			errors++;
+	}
+
+	if (!node->children)
+	{
+		stats->leaves++;
+		stats->leaf_lights += node->count;
+		stats->leaf_depths += (double)depth * node->count;
+		return errors;
+	}
+
+	const light_tree_node_t* left = wm->light_tree_nodes + node->children;
+	const light_tree_node_t* right = left + 1;
+
+	if (left->first != node->first || right->first != left->first + left->count ||
+		left->count + right->count != node->count)
+		errors++;
+
+	errors += check_tree_node(wm, list, node->children, depth + 1, stats);
+	errors += check_tree_node(wm, list, node->children + 1, depth + 1, stats);
+
+	return errors;
+}
+
+/*
+  Checks the light trees of the world: node bounds and cones enclose
+  their lights, children split the light range of their parent, and
+  walking the tree from random points gives every light that can reach
+  the point a non-zero probability, with probabilities adding up to at
+  most one. Subtrees that can't reach the point get no probability.
+  Also prints tree statistics. Only uses the CPU side of the mesh.
+*/
+void
+vkpt_light_trees_test(bsp_mesh_t* wm)
+{
+	enum { POINTS_PER_CLUSTER = 16 };
+	light_tree_stats_t stats;
+	int num_trees = 0, errors = 0, walks = 0, max_lights = 0;
+	double flat_lights = 0;
+
+	if (!wm->light_tree_roots)
+	{
+		Com_Printf("No light trees.\n");
+		return;
+	}
+
+	for (int c = 0; c < wm->num_clusters; c++)
+		max_lights = max(max_lights, wm->cluster_light_offsets[c + 1] - wm->cluster_light_offsets[c]);
+
+	float* light_probs = Z_Malloc(max(max_lights, 1) * sizeof(float));
+
+	memset(&stats, 0, sizeof(stats));
+
+	for (int c = 0; c < wm->num_clusters; c++)
+	{
+		uint32_t root = wm->light_tree_roots[c];
+		const int* list = wm->cluster_lights + wm->cluster_light_offsets[c];
+		int count = wm->cluster_light_offsets[c + 1] - wm->cluster_light_offsets[c];
+
+		if (root == ~0u)
+			continue;
+
+		num_trees++;
+		flat_lights += count;
+
+		if (wm->light_tree_nodes[root].first != 0 || wm->light_tree_nodes[root].count != count)
+		{
+			Com_Printf("Cluster %d: root doesn't cover the light list\n", c);
+			errors++;
+			continue;
+		}
+
+		if (check_tree_node(wm, list, root, 0, &stats))
+		{
+			Com_Printf("Cluster %d: lights outside of their node bounds\n", c);
+			errors++;
+		}
+
+		const aabb_t* aabb = wm->cluster_aabbs + c;
+		if (aabb->mins[0] > aabb->maxs[0])
+			continue;
+
+		for (int i = 0; i < POINTS_PER_CLUSTER; i++)
+		{
+			light_tree_walk_t w;
+			vec3_t p, gn;
+
+			for (int k = 0; k < 3; k++)
+			{
+				p[k] = aabb->mins[k] + frand() * (aabb->maxs[k] - aabb->mins[k]);
+				gn[k] = crand();
+			}
+			if (VectorNormalize(gn) == 0.f)
+				gn[2] = 1.f;
+
+			w.wm = wm;
+			w.p = p;
+			w.gn = gn;
+			w.light_probs = light_probs;
+
+			walk_tree(&w, root, 1.f);
+			walks++;
+
+			float sum = 0.f;
+			int missed = 0;
+			for (int k = 0; k < count; k++)
+			{
+				sum += light_probs[k];
+				if (light_probs[k] <= 0.f && light_reaches_point(wm->light_polys + list[k], p, gn))
+					missed++;
+			}
+
+			if (missed || sum > 1.f + 1e-3f)
+			{
+				Com_Printf("Cluster %d: %d visible lights never picked, probabilities add up to %f\n", c, missed, sum);
+				errors++;
+				break;
+			}
+		}
+	}
+
+	Com_Printf("%d light trees, %d nodes, %d leaves, up to %d lights per cluster\n",
+		num_trees, wm->num_light_tree_nodes, stats.leaves, max_lights);
+	if (num_trees && stats.leaf_lights)
+	{
+		// a sample examines two children per level and the lights of one leaf
+		double depth = stats.leaf_depths / stats.leaf_lights;
+		Com_Printf("%.1f nodes and lights examined per sample, %.1f lights per flat list\n",
+			2 * depth + (double)stats.leaf_lights / stats.leaves, flat_lights / num_trees);
+	}
+	Com_Printf("%d walks from random points, %d failures\n", walks, errors);
+
+	Z_Free(light_probs);
+}
+
+#endif // USE_TESTS
@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/common.h"
 #include "common/cvar.h"
 #include "common/files.h"
+#include "common/jobs.h"
 #include "common/math.h"
 #include "client/video.h"
 #include "client/client.h"
@@ -51,6 +52,7 @@ cvar_t *cvar_profiler = NULL;
 cvar_t *cvar_vsync = NULL;
 cvar_t *cvar_pt_caustics = NULL;
 cvar_t *cvar_pt_enable_nodraw = NULL;
+cvar_t *cvar_pt_mesh_cache = NULL;
 cvar_t *cvar_pt_accumulation_rendering = NULL;
 cvar_t *cvar_pt_accumulation_rendering_framenum = NULL;
 cvar_t *cvar_pt_projection = NULL;
@@ -906,6 +908,12 @@ init_vulkan()
 
 	qvk.physical_device = devices[picked_device];
 
+	{
+		VkPhysicalDeviceFeatures dev_features;
+		vkGetPhysicalDeviceFeatures(qvk.physical_device, &dev_features);
+		qvk.supports_bc = !!dev_features.textureCompressionBC;
+	}
+
 	{
 		VkPhysicalDeviceProperties dev_properties;
 		vkGetPhysicalDeviceProperties(devices[picked_device], &dev_properties);
@@ -1050,7 +1058,7 @@ init_vulkan()
 			.samplerAnisotropy = 1,
 			.textureCompressionETC2 = 0,
 			.textureCompressionASTC_LDR = 0,
-			.textureCompressionBC = 0,
+			.textureCompressionBC = qvk.supports_bc,
 			.occlusionQueryPrecise = 0,
 			.pipelineStatisticsQuery = 1,
 			.vertexPipelineStoresAndAtomics = 1,
@@ -1266,28 +1274,75 @@ static int world_entity_id_count[2];
 static int num_model_lights = 0;
 static light_poly_t model_lights[MAX_MODEL_LIGHTS];
 
-static pbr_material_t const * get_mesh_material(const entity_t* entity, const maliasmesh_t* mesh)
+#define MESH_FILTER_TRANSPARENT 1
+#define MESH_FILTER_OPAQUE 2
+#define MESH_FILTER_ALL 3
+
+// vkpt_build_cylinder_light makes a prism out of this many triangles
+#define CYLINDER_LIGHT_POLYS 6
+
+/*
+  Entities are prepared in passes: a pass draws one entity with one mesh
+  filter, so entities with opaque and transparent meshes get two passes.
+  The passes are counted in parallel, then their instance, vertex and light
+  slots are handed out in drawing order by a prefix sum on the main thread,
+  and then they are filled in parallel. Model lights are written into a
+  range per pass first and packed into model_lights in order afterwards.
+*/
+typedef struct {
+	const entity_t* entity;
+	const model_t* model;               // NULL for BSP models
+	const bsp_model_t* bsp_model;
+	pbr_material_t const * skin;        // skins are updated on the main thread
+	int mesh_filter;
+	qboolean is_viewer_weapon;
+	qboolean is_double_sided;
+
+	// filled by count_entity_pass
+	int num_instances;
+	int num_vertices;
+	int max_lights;
+	qboolean contains_transparent;
+	qboolean missing_material;
+
+	// slots from the prefix sum
+	int instance_offset;                // model instance or BSP mesh index
+	int index_offset;                   // into model_indices
+	int vertex_offset;
+	int light_offset;                   // into entity_pass_lights
+
+	int num_lights;
+} entity_pass_t;
+
+static entity_pass_t entity_passes[MAX_ENTITIES * 2];
+static light_poly_t* entity_pass_lights;
+static int entity_pass_lights_size;
+
+// below this many passes, waking up the job threads costs more than it saves
+static int min_parallel_entity_passes = 32;
+
+static pbr_material_t const * get_mesh_material(const entity_pass_t* pass, const maliasmesh_t* mesh)
 {
-	if (entity->skin)
+	if (pass->entity->skin)
 	{
-		return MAT_UpdatePBRMaterialSkin(IMG_ForHandle(entity->skin));
+		return pass->skin;
 	}
 
 	int skinnum = 0;
-	if (mesh->materials[entity->skinnum])
-		skinnum = entity->skinnum;
+	if (mesh->materials[pass->entity->skinnum])
+		skinnum = pass->entity->skinnum;
 
 	return mesh->materials[skinnum];
 }
 
-static inline uint32_t fill_model_instance(const entity_t* entity, const model_t* model, const maliasmesh_t* mesh,
-	const float* transform, int model_instance_index, qboolean is_viewer_weapon, qboolean is_double_sided)
+// returns the material flags of a mesh instance, or 0 if the mesh is not drawn
+static uint32_t get_instance_material(entity_pass_t* pass, const maliasmesh_t* mesh)
 {
-	pbr_material_t const * material = get_mesh_material(entity, mesh);
+	pbr_material_t const * material = get_mesh_material(pass, mesh);
 
 	if (!material)
 	{
-		Com_EPrintf("Cannot find material for model '%s'\n", model->name);
+		pass->missing_material = qtrue;
 		return 0;
 	}
 
@@ -1299,29 +1354,35 @@ static inline uint32_t fill_model_instance(const entity_t* entity, const model_t
 	if(MAT_IsKind(material_id, MATERIAL_KIND_CHROME))
 		material_id = MAT_SetKind(material_id, MATERIAL_KIND_CHROME_MODEL);
 
-	if (model->model_class == MCLASS_EXPLOSION)
+	if (pass->model->model_class == MCLASS_EXPLOSION)
 	{
 		material_id = MAT_SetKind(material_id, MATERIAL_KIND_EXPLOSION);
 		material_id |= MATERIAL_FLAG_LIGHT;
 	}
 
-	if (is_viewer_weapon)
+	if (pass->is_viewer_weapon)
 		material_id |= MATERIAL_FLAG_WEAPON;
 
-	if (is_double_sided)
+	if (pass->is_double_sided)
 		material_id |= MATERIAL_FLAG_DOUBLE_SIDED;
 
-	if (!MAT_IsKind(material_id, MATERIAL_KIND_GLASS))  
+	if (!MAT_IsKind(material_id, MATERIAL_KIND_GLASS))
 	{
-		if (entity->flags & RF_SHELL_RED)
+		if (pass->entity->flags & RF_SHELL_RED)
 			material_id |= MATERIAL_FLAG_SHELL_RED;
-		if (entity->flags & RF_SHELL_GREEN)
+		if (pass->entity->flags & RF_SHELL_GREEN)
 			material_id |= MATERIAL_FLAG_SHELL_GREEN;
-		if (entity->flags & RF_SHELL_BLUE)
+		if (pass->entity->flags & RF_SHELL_BLUE)
 			material_id |= MATERIAL_FLAG_SHELL_BLUE;
 	}
 
-	ModelInstance* instance = &vkpt_refdef.uniform_instance_buffer.model_instances[model_instance_index];
+	return material_id;
+}
+
+static inline void fill_model_instance(const entity_t* entity, const model_t* model, const maliasmesh_t* mesh,
+	const float* transform, int model_instance_index, uint32_t material_id)
+{
+	ModelInstance* instance = &vkpt_refdef.uniform_instance_buffer.model_instances[entity_frame_num][model_instance_index];
 
 	int frame = entity->frame;
 	int oldframe = entity->oldframe;
@@ -1334,8 +1395,6 @@ static inline uint32_t fill_model_instance(const entity_t* entity, const model_t
 	instance->backlerp = entity->backlerp;
 	instance->material = material_id;
 	instance->alpha = (entity->flags & RF_TRANSLUCENT) ? entity->alpha : 1.0f;
-
-	return material_id;
 }
 
 static void
@@ -1369,45 +1428,94 @@ static inline void transform_point(const float* p, const float* matrix, float* r
 	VectorCopy(transformed, result); // vec4 -> vec3
 }
 
-static void process_bsp_entity(const entity_t* entity, int* bsp_mesh_idx, int* instance_idx, int* num_instanced_vert)
+static inline qboolean is_transparent_material(uint32_t material)
 {
-	QVKInstanceBuffer_t* uniform_instance_buffer = &vkpt_refdef.uniform_instance_buffer;
-	uint32_t* ubo_bsp_cluster_id = (uint32_t*)uniform_instance_buffer->bsp_cluster_id;
-	uint32_t* ubo_bsp_prim_offset = (uint32_t*)uniform_instance_buffer->bsp_prim_offset;
-	uint32_t* ubo_instance_buf_offset = (uint32_t*)uniform_instance_buffer->bsp_instance_buf_offset;
-	uint32_t* ubo_instance_buf_size = (uint32_t*)uniform_instance_buffer->bsp_instance_buf_size;
+	return MAT_IsKind(material, MATERIAL_KIND_SLIME)
+		|| MAT_IsKind(material, MATERIAL_KIND_WATER)
+		|| MAT_IsKind(material, MATERIAL_KIND_GLASS)
+		|| MAT_IsKind(material, MATERIAL_KIND_TRANSPARENT);
+}
+
+static qboolean is_mesh_in_pass(entity_pass_t* pass, uint32_t material_id)
+{
+	if (is_transparent_material(material_id))
+	{
+		pass->contains_transparent = qtrue;
+		return (pass->mesh_filter & MESH_FILTER_TRANSPARENT) != 0;
+	}
+
+	return (pass->mesh_filter & MESH_FILTER_OPAQUE) != 0;
+}
 
-	const int current_bsp_mesh_index = *bsp_mesh_idx;
-	if (current_bsp_mesh_index >= SHADER_MAX_BSP_ENTITIES)
+// counts the instances and vertices of a pass, up to max_instances
+static void count_entity_pass(entity_pass_t* pass, int max_instances)
+{
+	pass->num_instances = 0;
+	pass->num_vertices = 0;
+	pass->max_lights = 0;
+	pass->contains_transparent = qfalse;
+
+	if (!pass->model)
 	{
-		assert(!"BSP entity count overflow");
+		if (max_instances > 0)
+		{
+			pass->num_instances = 1;
+			pass->num_vertices = pass->bsp_model->idx_count;
+			pass->max_lights = pass->bsp_model->num_light_polys;
+		}
 		return;
 	}
 
-	if (*instance_idx >= (SHADER_MAX_ENTITIES + SHADER_MAX_BSP_ENTITIES))
+	for (int i = 0; i < pass->model->nummeshes && pass->num_instances < max_instances; i++)
 	{
-		assert(!"Total entity count overflow");
-		return;
+		const maliasmesh_t* mesh = pass->model->meshes + i;
+
+		uint32_t material_id = get_instance_material(pass, mesh);
+		if (!material_id || !is_mesh_in_pass(pass, material_id))
+			continue;
+
+		pass->num_instances++;
+		pass->num_vertices += mesh->numtris * 3;
 	}
 
+	// the transparent pass of an opaque entity only draws its transparent meshes, if any
+	if (pass->model->model_class == MCLASS_STATIC_LIGHT &&
+		(pass->mesh_filter != MESH_FILTER_TRANSPARENT || pass->contains_transparent))
+		pass->max_lights = CYLINDER_LIGHT_POLYS;
+}
+
+static void fill_bsp_pass(entity_pass_t* pass)
+{
+	QVKInstanceBuffer_t* uniform_instance_buffer = &vkpt_refdef.uniform_instance_buffer;
+	uint32_t* ubo_bsp_cluster_id = (uint32_t*)uniform_instance_buffer->bsp_cluster_id[entity_frame_num];
+	uint32_t* ubo_bsp_prim_offset = (uint32_t*)uniform_instance_buffer->bsp_prim_offset;
+	uint32_t* ubo_instance_buf_offset = (uint32_t*)uniform_instance_buffer->bsp_instance_buf_offset;
+	uint32_t* ubo_instance_buf_size = (uint32_t*)uniform_instance_buffer->bsp_instance_buf_size;
+
+	// dropped by the prefix sum
+	if (!pass->num_instances)
+		return;
+
+	const entity_t* entity = pass->entity;
+	const bsp_model_t* model = pass->bsp_model;
+	const int current_bsp_mesh_index = pass->instance_offset;
+
 	world_entity_ids[entity_frame_num][current_bsp_mesh_index] = entity->id;
 
 	float transform[16];
 	create_entity_matrix(transform, (entity_t*)entity, qfalse);
-	BspMeshInstance* ubo_instance_info = uniform_instance_buffer->bsp_mesh_instances + current_bsp_mesh_index;
+	BspMeshInstance* ubo_instance_info = uniform_instance_buffer->bsp_mesh_instances[entity_frame_num] + current_bsp_mesh_index;
 	memcpy(&ubo_instance_info->M, transform, sizeof(transform));
 	ubo_instance_info->frame = entity->frame;
 	memset(ubo_instance_info->padding, 0, sizeof(ubo_instance_info->padding));
 
-	bsp_model_t* model = vkpt_refdef.bsp_mesh_world.models + (~entity->model);
-
 	vec3_t origin;
 	transform_point(model->center, transform, origin);
 	int cluster = BSP_PointLeaf(bsp_world_model->nodes, origin)->cluster;
 
 	if (cluster < 0)
 	{
-		// In some cases, a model slides into a wall, like a push button, so that its center 
+		// In some cases, a model slides into a wall, like a push button, so that its center
 		// is no longer in any BSP node. We still need to assign a cluster to the model,
 		// so try the corners of the model instead, see if any of them has a valid cluster.
 
@@ -1431,26 +1539,16 @@ static void process_bsp_entity(const entity_t* entity, int* bsp_mesh_idx, int* i
 	ubo_bsp_cluster_id[current_bsp_mesh_index] = cluster;
 
 	ubo_bsp_prim_offset[current_bsp_mesh_index] = model->idx_offset / 3;
-	
-	const int mesh_vertex_num = model->idx_count;
 
-	ubo_instance_buf_offset[current_bsp_mesh_index] = *num_instanced_vert / 3;
-	ubo_instance_buf_size[current_bsp_mesh_index] = mesh_vertex_num / 3;
-	
-	((int*)uniform_instance_buffer->model_indices)[*instance_idx] = ~current_bsp_mesh_index;
+	ubo_instance_buf_offset[current_bsp_mesh_index] = pass->vertex_offset / 3;
+	ubo_instance_buf_size[current_bsp_mesh_index] = model->idx_count / 3;
 
-	*num_instanced_vert += mesh_vertex_num;
+	((int*)uniform_instance_buffer->model_indices)[pass->index_offset] = ~current_bsp_mesh_index;
 
 	for (int nlight = 0; nlight < model->num_light_polys; nlight++)
 	{
-		if (num_model_lights >= MAX_MODEL_LIGHTS)
-		{
-			assert(!"Model light count overflow");
-			break;
-		}
-
 		const light_poly_t* src_light = model->light_polys + nlight;
-		light_poly_t* dst_light = model_lights + num_model_lights;
+		light_poly_t* dst_light = entity_pass_lights + pass->light_offset + pass->num_lights;
 
 		// Transform the light's positions and center
 		transform_point(src_light->positions + 0, transform, dst_light->positions + 0);
@@ -1468,86 +1566,44 @@ static void process_bsp_entity(const entity_t* entity, int* bsp_mesh_idx, int* i
 		// Copy the other light properties
 		VectorCopy(src_light->color, dst_light->color);
 		dst_light->material = src_light->material;
+		dst_light->style = 0;
 
-		num_model_lights++;
+		pass->num_lights++;
 	}
-
-	(*bsp_mesh_idx)++;
-	(*instance_idx)++;
 }
 
-static inline qboolean is_transparent_material(uint32_t material)
-{
-	return MAT_IsKind(material, MATERIAL_KIND_SLIME)
-		|| MAT_IsKind(material, MATERIAL_KIND_WATER)
-		|| MAT_IsKind(material, MATERIAL_KIND_GLASS)
-		|| MAT_IsKind(material, MATERIAL_KIND_TRANSPARENT);
-}
-
-#define MESH_FILTER_TRANSPARENT 1
-#define MESH_FILTER_OPAQUE 2
-#define MESH_FILTER_ALL 3
-
-static void process_regular_entity(
-	const entity_t* entity, 
-	const model_t* model, 
-	qboolean is_viewer_weapon, 
-	qboolean is_double_sided, 
-	int* model_instance_idx, 
-	int* instance_idx, 
-	int* num_instanced_vert, 
-	int mesh_filter, 
-	qboolean* contains_transparent)
+static void fill_model_pass(entity_pass_t* pass)
 {
 	QVKInstanceBuffer_t* uniform_instance_buffer = &vkpt_refdef.uniform_instance_buffer;
 	uint32_t* ubo_instance_buf_offset = (uint32_t*)uniform_instance_buffer->model_instance_buf_offset;
 	uint32_t* ubo_instance_buf_size = (uint32_t*)uniform_instance_buffer->model_instance_buf_size;
 	uint32_t* ubo_model_idx_offset = (uint32_t*)uniform_instance_buffer->model_idx_offset;
-	uint32_t* ubo_model_cluster_id = (uint32_t*)uniform_instance_buffer->model_cluster_id;
+	uint32_t* ubo_model_cluster_id = (uint32_t*)uniform_instance_buffer->model_cluster_id[entity_frame_num];
+
+	const entity_t* entity = pass->entity;
+	const model_t* model = pass->model;
 
 	float transform[16];
-	create_entity_matrix(transform, (entity_t*)entity, is_viewer_weapon);
-	
-	int current_model_instance_index = *model_instance_idx;
-	int current_instance_index = *instance_idx;
-	int current_num_instanced_vert = *num_instanced_vert;
+	create_entity_matrix(transform, (entity_t*)entity, pass->is_viewer_weapon);
+
+	uint32_t cluster_id = ~0u;
+	if(bsp_world_model && pass->num_instances)
+		cluster_id = BSP_PointLeaf(bsp_world_model->nodes, ((entity_t*)entity)->origin)->cluster;
 
-	if (contains_transparent)
-		*contains_transparent = qfalse;
+	int current_model_instance_index = pass->instance_offset;
+	int current_instance_index = pass->index_offset;
+	int current_num_instanced_vert = pass->vertex_offset;
+	const int end_model_instance_index = pass->instance_offset + pass->num_instances;
 
-	for (int i = 0; i < model->nummeshes; i++)
+	for (int i = 0; i < model->nummeshes && current_model_instance_index < end_model_instance_index; i++)
 	{
 		const maliasmesh_t* mesh = model->meshes + i;
 
-		if (current_model_instance_index >= SHADER_MAX_ENTITIES)
-		{
-			assert(!"Model entity count overflow");
-			break;
-		}
-
-		if (current_instance_index >= (SHADER_MAX_ENTITIES + SHADER_MAX_BSP_ENTITIES))
-		{
-			assert(!"Total entity count overflow");
-			break;
-		}
-
-		uint32_t material_id = fill_model_instance(entity, model, mesh, transform, current_model_instance_index, is_viewer_weapon, is_double_sided);
-		if (!material_id)
+		uint32_t material_id = get_instance_material(pass, mesh);
+		if (!material_id || !is_mesh_in_pass(pass, material_id))
 			continue;
 
-		if (is_transparent_material(material_id))
-		{
-			if(contains_transparent)
-				*contains_transparent = qtrue;
-
-			if(!(mesh_filter & MESH_FILTER_TRANSPARENT))
-				continue;
-		}
-		else
-		{
-			if (!(mesh_filter & MESH_FILTER_OPAQUE))
-				continue;
-		}
+		fill_model_instance(entity, model, mesh, transform, current_model_instance_index, material_id);
 
 		entity_hash_t hash;
 		hash.entity = entity->id;
@@ -1556,9 +1612,6 @@ static void process_regular_entity(
 
 		model_entity_ids[entity_frame_num][current_model_instance_index] = *(uint32_t*)&hash;
 
-		uint32_t cluster_id = ~0u;
-		if(bsp_world_model) 
-			cluster_id = BSP_PointLeaf(bsp_world_model->nodes, ((entity_t*)entity)->origin)->cluster;
 		ubo_model_cluster_id[current_model_instance_index] = cluster_id;
 
 		ubo_model_idx_offset[current_model_instance_index] = mesh->idx_offset;
@@ -1574,7 +1627,7 @@ static void process_regular_entity(
 	}
 
 	// add cylinder lights for wall lamps
-	if (model->model_class == MCLASS_STATIC_LIGHT)
+	if (pass->max_lights)
 	{
 		vec4_t begin, end, color;
 		vec4_t offset1 = { 0.f, 0.5f, -10.f, 1.f };
@@ -1584,12 +1637,37 @@ static void process_regular_entity(
 		mult_matrix_vector(end, transform, offset2);
 		VectorSet(color, 0.25f, 0.5f, 0.07f);
 
-		vkpt_build_cylinder_light(model_lights, &num_model_lights, MAX_MODEL_LIGHTS, bsp_world_model, begin, end, color, 1.5f);
+		vkpt_build_cylinder_light(entity_pass_lights + pass->light_offset, &pass->num_lights, pass->max_lights, bsp_world_model, begin, end, color, 1.5f);
 	}
+}
 
-	*model_instance_idx = current_model_instance_index;
-	*instance_idx = current_instance_index;
-	*num_instanced_vert = current_num_instanced_vert;
+static void count_entity_pass_job(void* arg, int index)
+{
+	entity_pass_t* pass = (entity_pass_t*)arg + index;
+
+	count_entity_pass(pass, INT_MAX);
+}
+
+static void fill_entity_pass_job(void* arg, int index)
+{
+	entity_pass_t* pass = (entity_pass_t*)arg + index;
+
+	if (pass->model)
+		fill_model_pass(pass);
+	else
+		fill_bsp_pass(pass);
+}
+
+static void run_entity_pass_jobs(jobfunc_t func, int num_passes)
+{
+	if (num_passes < min_parallel_entity_passes)
+	{
+		for (int i = 0; i < num_passes; i++)
+			func(entity_passes, i);
+		return;
+	}
+
+	Job_ParallelFor(func, entity_passes, num_passes);
 }
 
 #if CL_RTX_SHADERBALLS
@@ -1603,6 +1681,37 @@ vkpt_drop_shaderballs()
 }
 #endif
 
+enum {
+	ENTITY_GROUP_OPAQUE,
+	ENTITY_GROUP_TRANSPARENT,
+	ENTITY_GROUP_VIEWER_MODEL,
+	ENTITY_GROUP_VIEWER_WEAPON,
+	ENTITY_GROUP_EXPLOSION,
+	NUM_ENTITY_GROUPS
+};
+
+static entity_pass_t* add_entity_pass(int* num_passes, const entity_t* entity, int mesh_filter)
+{
+	entity_pass_t* pass = entity_passes + (*num_passes)++;
+
+	memset(pass, 0, sizeof(*pass));
+	pass->entity = entity;
+	pass->mesh_filter = mesh_filter;
+
+	if (entity->model & 0x80000000)
+	{
+		pass->bsp_model = vkpt_refdef.bsp_mesh_world.models + (~entity->model);
+	}
+	else
+	{
+		pass->model = MOD_ForHandle(entity->model);
+		if (entity->skin)
+			pass->skin = MAT_UpdatePBRMaterialSkin(IMG_ForHandle(entity->skin));
+	}
+
+	return pass;
+}
+
 static void
 prepare_entities(EntityUploadInfo* upload_info)
 {
@@ -1610,13 +1719,8 @@ prepare_entities(EntityUploadInfo* upload_info)
 
 	QVKInstanceBuffer_t* instance_buffer = &vkpt_refdef.uniform_instance_buffer;
 
-	memcpy(instance_buffer->bsp_mesh_instances_prev, instance_buffer->bsp_mesh_instances,
-		sizeof(instance_buffer->bsp_mesh_instances_prev));
-	memcpy(instance_buffer->model_instances_prev, instance_buffer->model_instances,
-		sizeof(instance_buffer->model_instances_prev));
-
-	memcpy(instance_buffer->bsp_cluster_id_prev, instance_buffer->bsp_cluster_id, sizeof(instance_buffer->bsp_cluster_id));
-	memcpy(instance_buffer->model_cluster_id_prev, instance_buffer->model_cluster_id, sizeof(instance_buffer->model_cluster_id));
+	// The instance buffer keeps the previous frame in the other set
+	vkpt_refdef.uniform_buffer.instance_set = entity_frame_num;
 
 	static int transparent_model_indices[MAX_ENTITIES];
 	static int viewer_model_indices[MAX_ENTITIES];
@@ -1627,13 +1731,12 @@ prepare_entities(EntityUploadInfo* upload_info)
 	int viewer_weapon_num = 0;
 	int explosion_num = 0;
 
-	int model_instance_idx = 0;
-	int bsp_mesh_idx = 0;
-	int num_instanced_vert = 0; /* need to track this here to find lights */
-	int instance_idx = 0;
+	int group_passes[NUM_ENTITY_GROUPS + 1];
+	int num_passes = 0;
 
 	const qboolean first_person_model = (cl_player_model->integer == CL_PLAYER_MODEL_FIRST_PERSON) && cl.baseclientinfo.model;
 
+	group_passes[ENTITY_GROUP_OPAQUE] = num_passes;
 	for (int i = 0; i < vkpt_refdef.fd->num_entities; i++)
 	{
 		const entity_t* entity = vkpt_refdef.fd->entities + i;
@@ -1644,7 +1747,7 @@ prepare_entities(EntityUploadInfo* upload_info)
 			if (model->transparent)
 				transparent_model_indices[transparent_model_num++] = i;
 			else
-				process_bsp_entity(entity, &bsp_mesh_idx, &instance_idx, &num_instanced_vert); /* embedded in bsp */
+				add_entity_pass(&num_passes, entity, MESH_FILTER_ALL); /* embedded in bsp */
 		}
 		else
 		{
@@ -1660,76 +1763,133 @@ prepare_entities(EntityUploadInfo* upload_info)
 				explosion_indices[explosion_num++] = i;
 			else
 			{
-				qboolean contains_transparent = qfalse;
-				process_regular_entity(entity, model, qfalse, qfalse, &model_instance_idx, &instance_idx, &num_instanced_vert, MESH_FILTER_OPAQUE, &contains_transparent);
-
-				if(contains_transparent)
-					transparent_model_indices[transparent_model_num++] = i;
+				// also gets a transparent pass, which is empty if there are no transparent meshes
+				add_entity_pass(&num_passes, entity, MESH_FILTER_OPAQUE);
+				transparent_model_indices[transparent_model_num++] = i;
 			}
 		}
 	}
-	
-	upload_info->dynamic_vertex_num = num_instanced_vert;
 
-	const uint32_t transparent_model_base_vertex_num = num_instanced_vert;
+	group_passes[ENTITY_GROUP_TRANSPARENT] = num_passes;
 	for (int i = 0; i < transparent_model_num; i++)
-	{
-		const entity_t* entity = vkpt_refdef.fd->entities + transparent_model_indices[i];
+		add_entity_pass(&num_passes, vkpt_refdef.fd->entities + transparent_model_indices[i], MESH_FILTER_TRANSPARENT);
 
-		if (entity->model & 0x80000000)
-		{
-			process_bsp_entity(entity, &bsp_mesh_idx, &instance_idx, &num_instanced_vert);
-		}
-		else
-		{
-			const model_t* model = MOD_ForHandle(entity->model);
-			process_regular_entity(entity, model, qfalse, qfalse, &model_instance_idx, &instance_idx, &num_instanced_vert, MESH_FILTER_TRANSPARENT, NULL);
-		}
-	}
-
-	upload_info->transparent_model_vertex_offset = transparent_model_base_vertex_num;
-	upload_info->transparent_model_vertex_num = num_instanced_vert - transparent_model_base_vertex_num;
-
-	const uint32_t viewer_model_base_vertex_num = num_instanced_vert;
+	group_passes[ENTITY_GROUP_VIEWER_MODEL] = num_passes;
 	if (first_person_model)
 	{
 		for (int i = 0; i < viewer_model_num; i++)
-		{
-			const entity_t* entity = vkpt_refdef.fd->entities + viewer_model_indices[i];
-			const model_t* model = MOD_ForHandle(entity->model);
-			process_regular_entity(entity, model, qfalse, qtrue, &model_instance_idx, &instance_idx, &num_instanced_vert, MESH_FILTER_ALL, NULL);
-		}
+			add_entity_pass(&num_passes, vkpt_refdef.fd->entities + viewer_model_indices[i], MESH_FILTER_ALL)->is_double_sided = qtrue;
 	}
 
-	upload_info->viewer_model_vertex_offset = viewer_model_base_vertex_num;
-	upload_info->viewer_model_vertex_num = num_instanced_vert - viewer_model_base_vertex_num;
-
 	upload_info->weapon_left_handed = qfalse;
 
-	const uint32_t viewer_weapon_base_vertex_num = num_instanced_vert;
+	group_passes[ENTITY_GROUP_VIEWER_WEAPON] = num_passes;
 	for (int i = 0; i < viewer_weapon_num; i++)
 	{
 		const entity_t* entity = vkpt_refdef.fd->entities + viewer_weapon_indices[i];
-		const model_t* model = MOD_ForHandle(entity->model);
-		process_regular_entity(entity, model, qtrue, qfalse, &model_instance_idx, &instance_idx, &num_instanced_vert, MESH_FILTER_ALL, NULL);
+		add_entity_pass(&num_passes, entity, MESH_FILTER_ALL)->is_viewer_weapon = qtrue;
 
 		if (entity->flags & RF_LEFTHAND)
 			upload_info->weapon_left_handed = qtrue;
 	}
 
-	upload_info->viewer_weapon_vertex_offset = viewer_weapon_base_vertex_num;
-	upload_info->viewer_weapon_vertex_num = num_instanced_vert - viewer_weapon_base_vertex_num;
-
-	const uint32_t explosion_base_vertex_num = num_instanced_vert;
+	group_passes[ENTITY_GROUP_EXPLOSION] = num_passes;
 	for (int i = 0; i < explosion_num; i++)
+		add_entity_pass(&num_passes, vkpt_refdef.fd->entities + explosion_indices[i], MESH_FILTER_ALL);
+
+	group_passes[NUM_ENTITY_GROUPS] = num_passes;
+
+	run_entity_pass_jobs(count_entity_pass_job, num_passes);
+
+	// Hand out the slots in drawing order
+
+	int model_instance_idx = 0;
+	int bsp_mesh_idx = 0;
+	int num_instanced_vert = 0; /* need to track this here to find lights */
+	int instance_idx = 0;
+	int num_pass_lights = 0;
+	int group_vertices[NUM_ENTITY_GROUPS + 1];
+	int group = 0;
+
+	for (int i = 0; i <= num_passes; i++)
+	{
+		while (group <= NUM_ENTITY_GROUPS && group_passes[group] == i)
+			group_vertices[group++] = num_instanced_vert;
+
+		if (i == num_passes)
+			break;
+
+		entity_pass_t* pass = entity_passes + i;
+
+		if (pass->missing_material)
+			Com_EPrintf("Cannot find material for model '%s'\n", pass->model->name);
+
+		if (pass->model)
+		{
+			if (pass->num_instances > SHADER_MAX_ENTITIES - model_instance_idx)
+			{
+				assert(!"Model entity count overflow");
+				count_entity_pass(pass, SHADER_MAX_ENTITIES - model_instance_idx);
+			}
+
+			pass->instance_offset = model_instance_idx;
+			model_instance_idx += pass->num_instances;
+		}
+		else
+		{
+			if (bsp_mesh_idx >= SHADER_MAX_BSP_ENTITIES)
+			{
+				assert(!"BSP entity count overflow");
+				count_entity_pass(pass, 0);
+			}
+
+			pass->instance_offset = bsp_mesh_idx;
+			bsp_mesh_idx += pass->num_instances;
+		}
+
+		pass->index_offset = instance_idx;
+		pass->vertex_offset = num_instanced_vert;
+		pass->light_offset = num_pass_lights;
+
+		instance_idx += pass->num_instances;
+		num_instanced_vert += pass->num_vertices;
+		num_pass_lights += pass->max_lights;
+	}
+
+	if (num_pass_lights > entity_pass_lights_size)
 	{
-		const entity_t* entity = vkpt_refdef.fd->entities + explosion_indices[i];
-		const model_t* model = MOD_ForHandle(entity->model);
-		process_regular_entity(entity, model, qfalse, qfalse, &model_instance_idx, &instance_idx, &num_instanced_vert, MESH_FILTER_ALL, NULL);
+		Z_Free(entity_pass_lights);
+		entity_pass_lights_size = max(num_pass_lights, entity_pass_lights_size * 2);
+		entity_pass_lights = Z_Malloc(entity_pass_lights_size * sizeof(light_poly_t));
 	}
 
-	upload_info->explosions_vertex_offset = explosion_base_vertex_num;
-	upload_info->explosions_vertex_num = num_instanced_vert - explosion_base_vertex_num;
+	run_entity_pass_jobs(fill_entity_pass_job, num_passes);
+
+	for (int i = 0; i < num_passes; i++)
+	{
+		const entity_pass_t* pass = entity_passes + i;
+		int count = min(pass->num_lights, MAX_MODEL_LIGHTS - num_model_lights);
+
+		if (count < pass->num_lights)
+			assert(!"Model light count overflow");
+
+		memcpy(model_lights + num_model_lights, entity_pass_lights + pass->light_offset, count * sizeof(light_poly_t));
+		num_model_lights += count;
+	}
+
+	upload_info->dynamic_vertex_num = group_vertices[ENTITY_GROUP_TRANSPARENT];
+
+	upload_info->transparent_model_vertex_offset = group_vertices[ENTITY_GROUP_TRANSPARENT];
+	upload_info->transparent_model_vertex_num = group_vertices[ENTITY_GROUP_VIEWER_MODEL] - group_vertices[ENTITY_GROUP_TRANSPARENT];
+
+	upload_info->viewer_model_vertex_offset = group_vertices[ENTITY_GROUP_VIEWER_MODEL];
+	upload_info->viewer_model_vertex_num = group_vertices[ENTITY_GROUP_VIEWER_WEAPON] - group_vertices[ENTITY_GROUP_VIEWER_MODEL];
+
+	upload_info->viewer_weapon_vertex_offset = group_vertices[ENTITY_GROUP_VIEWER_WEAPON];
+	upload_info->viewer_weapon_vertex_num = group_vertices[ENTITY_GROUP_EXPLOSION] - group_vertices[ENTITY_GROUP_VIEWER_WEAPON];
+
+	upload_info->explosions_vertex_offset = group_vertices[ENTITY_GROUP_EXPLOSION];
+	upload_info->explosions_vertex_num = group_vertices[NUM_ENTITY_GROUPS] - group_vertices[ENTITY_GROUP_EXPLOSION];
 
 	upload_info->num_instances = instance_idx;
 	upload_info->num_vertices  = num_instanced_vert;
@@ -2865,6 +3025,214 @@ vkpt_show_pvs(void)
 	cluster_debug_index = vkpt_refdef.fd->feedback.lookatcluster;
 }
 
+#if USE_TESTS
+static void
+vkpt_test_mesh_cache(void)
+{
+	if (!bsp_world_model)
+	{
+		Com_Printf("No map loaded.\n");
+		return;
+	}
+
+	bsp_mesh_test_cache(bsp_world_model);
+}
+
+static void
+vkpt_test_pvs(void)
+{
+	bsp_mesh_test_pvs(vkpt_refdef.bsp_mesh_world_loaded ? &vkpt_refdef.bsp_mesh_world : NULL, bsp_world_model);
+
+	// the test rebuilds the light trees, which the GPU only gets with the map
+	if (vkpt_refdef.bsp_mesh_world_loaded)
+	{
+		vkDeviceWaitIdle(qvk.device);
+		_VK(vkpt_vertex_buffer_upload_bsp_mesh_to_staging(&vkpt_refdef.bsp_mesh_world));
+		_VK(vkpt_vertex_buffer_upload_staging());
+	}
+}
+
+static void
+vkpt_test_light_lists(void)
+{
+	if (!vkpt_refdef.bsp_mesh_world_loaded)
+	{
+		Com_Printf("No map loaded.\n");
+		return;
+	}
+
+	vkpt_light_buffer_test(&vkpt_refdef.bsp_mesh_world, bsp_world_model);
+}
+
+static void
+vkpt_test_light_trees(void)
+{
+	if (!vkpt_refdef.bsp_mesh_world_loaded)
+	{
+		Com_Printf("No map loaded.\n");
+		return;
+	}
+
+	vkpt_light_trees_test(&vkpt_refdef.bsp_mesh_world);
+}
+
+/*
+  Prepares a synthetic entity list made of the registered models and the
+  inline models of the map, once with the entity passes filled on the main
+  thread and once with the job threads. Checks that both give the same
+  instance buffer and model lights, and prints the timings.
+*/
+static void
+vkpt_test_entities(void)
+{
+	enum { NUM_ITERATIONS = 200 };
+	static entity_t entities[MAX_ENTITIES];
+	static refdef_t fd;
+	static QVKInstanceBuffer_t serial_instances;
+	static light_poly_t serial_lights[MAX_MODEL_LIGHTS];
+	static QVKInstanceBuffer_t saved_instances;
+	static int saved_model_ids[2][MAX_ENTITIES];
+	static int saved_world_ids[2][MAX_ENTITIES];
+	static light_poly_t saved_lights[MAX_MODEL_LIGHTS];
+	EntityUploadInfo serial_info, info;
+	int num_entities = 0, num_meshes = 0, num_bsp_models = 0, num_lights = 0, num_handles = 0;
+
+	if (!vkpt_refdef.bsp_mesh_world_loaded || !bsp_world_model || !vkpt_refdef.fd)
+	{
+		Com_Printf("No map loaded.\n");
+		return;
+	}
+
+	qhandle_t* handles = Z_Malloc(max(r_numModels, 1) * sizeof(qhandle_t));
+	for (int i = 0; i < r_numModels; i++)
+	{
+		if (r_models[i].type && r_models[i].meshes && r_models[i].registration_sequence == registration_sequence)
+			handles[num_handles++] = i + 1;
+	}
+
+	const bsp_mesh_t* wm = &vkpt_refdef.bsp_mesh_world;
+
+	// Stay within the instance buffer and model light limits
+	for (int attempt = 0; attempt < MAX_ENTITIES * 4 && num_entities < MAX_ENTITIES; attempt++)
+	{
+		entity_t* entity = entities + num_entities;
+		memset(entity, 0, sizeof(*entity));
+
+		if (wm->num_models > 1 && (rand() & 15) == 0)
+		{
+			int index = 1 + rand() % (wm->num_models - 1);
+			int lights = wm->models[index].num_light_polys;
+
+			if (num_bsp_models >= SHADER_MAX_BSP_ENTITIES || num_lights + lights > MAX_MODEL_LIGHTS)
+				continue;
+
+			entity->model = ~index;
+			for (int k = 0; k < 3; k++)
+				entity->origin[k] = crand() * 16.f;
+			num_bsp_models++;
+			num_lights += lights;
+		}
+		else if (num_handles)
+		{
+			qhandle_t handle = handles[rand() % num_handles];
+			const model_t* model = MOD_ForHandle(handle);
+			int lights = model->model_class == MCLASS_STATIC_LIGHT ? 2 * CYLINDER_LIGHT_POLYS : 0;
+
+			if (num_meshes + model->nummeshes > SHADER_MAX_ENTITIES || num_lights + lights > MAX_MODEL_LIGHTS)
+				continue;
+
+			entity->model = handle;
+			for (int k = 0; k < 3; k++)
+			{
+				entity->origin[k] = wm->world_aabb.mins[k] + frand() * (wm->world_aabb.maxs[k] - wm->world_aabb.mins[k]);
+				entity->angles[k] = frand() * 360.f;
+			}
+			entity->frame = rand() % max(model->numframes, 1);
+			entity->oldframe = rand() % max(model->numframes, 1);
+			entity->backlerp = frand();
+			num_meshes += model->nummeshes;
+			num_lights += lights;
+		}
+		else
+			continue;
+
+		VectorCopy(entity->origin, entity->oldorigin);
+		entity->id = num_entities + 1;
+		num_entities++;
+	}
+
+	Z_Free(handles);
+
+	refdef_t* saved_fd = vkpt_refdef.fd;
+	int saved_min_passes = min_parallel_entity_passes;
+	unsigned start, serial_msec, parallel_msec;
+
+	// The benchmark runs on the live instance state, keep the real frame's
+	// copy so that motion vectors of the next frame still line up
+	int saved_frame_num = entity_frame_num;
+	int saved_instance_set = vkpt_refdef.uniform_buffer.instance_set;
+	int saved_model_id_count[2] = { model_entity_id_count[0], model_entity_id_count[1] };
+	int saved_world_id_count[2] = { world_entity_id_count[0], world_entity_id_count[1] };
+	int saved_num_lights = num_model_lights;
+	memcpy(&saved_instances, &vkpt_refdef.uniform_instance_buffer, sizeof(saved_instances));
+	memcpy(saved_model_ids, model_entity_ids, sizeof(saved_model_ids));
+	memcpy(saved_world_ids, world_entity_ids, sizeof(saved_world_ids));
+	memcpy(saved_lights, model_lights, saved_num_lights * sizeof(light_poly_t));
+
+	fd = *saved_fd;
+	fd.entities = entities;
+	fd.num_entities = num_entities;
+	vkpt_refdef.fd = &fd;
+
+	// Even numbers of frames, so that both runs end up in the same instance set
+	min_parallel_entity_passes = INT_MAX;
+	start = Sys_Milliseconds();
+	for (int i = 0; i < NUM_ITERATIONS; i++)
+	{
+		memset(&serial_info, 0, sizeof(serial_info));
+		num_model_lights = 0;
+		prepare_entities(&serial_info);
+	}
+	serial_msec = Sys_Milliseconds() - start;
+
+	int serial_num_lights = num_model_lights;
+	memcpy(&serial_instances, &vkpt_refdef.uniform_instance_buffer, sizeof(serial_instances));
+	memcpy(serial_lights, model_lights, num_model_lights * sizeof(light_poly_t));
+
+	min_parallel_entity_passes = 0;
+	start = Sys_Milliseconds();
+	for (int i = 0; i < NUM_ITERATIONS; i++)
+	{
+		memset(&info, 0, sizeof(info));
+		num_model_lights = 0;
+		prepare_entities(&info);
+	}
+	parallel_msec = Sys_Milliseconds() - start;
+
+	qboolean match = num_model_lights == serial_num_lights &&
+		!memcmp(&info, &serial_info, sizeof(info)) &&
+		!memcmp(&serial_instances, &vkpt_refdef.uniform_instance_buffer, sizeof(serial_instances)) &&
+		!memcmp(serial_lights, model_lights, num_model_lights * sizeof(light_poly_t));
+
+	vkpt_refdef.fd = saved_fd;
+	min_parallel_entity_passes = saved_min_passes;
+
+	entity_frame_num = saved_frame_num;
+	vkpt_refdef.uniform_buffer.instance_set = saved_instance_set;
+	memcpy(model_entity_id_count, saved_model_id_count, sizeof(model_entity_id_count));
+	memcpy(world_entity_id_count, saved_world_id_count, sizeof(world_entity_id_count));
+	memcpy(&vkpt_refdef.uniform_instance_buffer, &saved_instances, sizeof(saved_instances));
+	memcpy(model_entity_ids, saved_model_ids, sizeof(saved_model_ids));
+	memcpy(world_entity_ids, saved_world_ids, sizeof(saved_world_ids));
+	memcpy(model_lights, saved_lights, saved_num_lights * sizeof(light_poly_t));
+	num_model_lights = saved_num_lights;
+
+	Com_Printf("%d entities, %d instances, %d model lights\n", num_entities, info.num_instances, serial_num_lights);
+	Com_Printf("%d frames: %u msec serial, %u msec with %d threads, results %s\n", NUM_ITERATIONS,
+		serial_msec, parallel_msec, Job_NumThreads(), match ? "match" : "DIFFER");
+}
+#endif
+
 /* called when the library is loaded */
 qboolean
 R_Init_RTX(qboolean total)
@@ -2885,6 +3253,9 @@ R_Init_RTX(qboolean total)
 	cvar_pt_caustics = Cvar_Get("pt_caustics", "1", CVAR_ARCHIVE);
 	cvar_pt_enable_nodraw = Cvar_Get("pt_enable_nodraw", "0", 0);
 
+	// 0 -> always build the world mesh from BSP; 1 -> use and update maps/mesh/*.bin
+	cvar_pt_mesh_cache = Cvar_Get("pt_mesh_cache", "1", 0);
+
 	// 0 -> disabled, regular pause; 1 -> enabled; 2 -> enabled, hide GUI
 	cvar_pt_accumulation_rendering = Cvar_Get("pt_accumulation_rendering", "1", CVAR_ARCHIVE);
 
@@ -2980,6 +3351,14 @@ R_Init_RTX(qboolean total)
 #if CL_RTX_SHADERBALLS
 	Cmd_AddCommand("drop_balls", (xcommand_t)&vkpt_drop_shaderballs);
 #endif
+#if USE_TESTS
+	Cmd_AddCommand("meshcachetest", (xcommand_t)&vkpt_test_mesh_cache);
+	Cmd_AddCommand("pvstest", (xcommand_t)&vkpt_test_pvs);
+	Cmd_AddCommand("polytest", (xcommand_t)&bsp_mesh_test_polys);
+	Cmd_AddCommand("lightlisttest", (xcommand_t)&vkpt_test_light_lists);
+	Cmd_AddCommand("lighttreetest", (xcommand_t)&vkpt_test_light_trees);
+	Cmd_AddCommand("entitytest", (xcommand_t)&vkpt_test_entities);
+#endif
 
 	for (int i = 0; i < 256; i++) {
 		qvk.sintab[i] = sinf(i * (2 * M_PI / 255));
@@ -3007,7 +3386,19 @@ R_Shutdown_RTX(qboolean total)
 #if CL_RTX_SHADERBALLS
 	Cmd_RemoveCommand("drop_balls");
 #endif
+#if USE_TESTS
+	Cmd_RemoveCommand("meshcachetest");
+	Cmd_RemoveCommand("pvstest");
+	Cmd_RemoveCommand("polytest");
+	Cmd_RemoveCommand("lightlisttest");
+	Cmd_RemoveCommand("lighttreetest");
+	Cmd_RemoveCommand("entitytest");
+#endif
 	
+	Z_Free(entity_pass_lights);
+	entity_pass_lights = NULL;
+	entity_pass_lights_size = 0;
+
 	IMG_FreeAll();
 	vkpt_textures_destroy_unused();
 
@@ -3201,11 +3592,7 @@ R_SetSky_RTX(const char *name, float rotate, vec3_t axis)
 		assert(w_prev == img->upload_width);
 		assert(h_prev == img->upload_height);
 
-		List_Remove(&img->entry);
-
-		IMG_Unload(img);
-
-		memset(img, 0, sizeof(*img));
+		IMG_FreeImage(img);
 	}
 
 	float inv_num_pixels = 1.0f / (w_prev * h_prev * 6);
@@ -3293,8 +3680,8 @@ R_EndRegistration_RTX(void)
     
     vkpt_physical_sky_endRegistration();
 
-	IMG_FreeUnused();
 	MOD_FreeUnused();
+	IMG_FreeUnused();
 	MAT_ResetUnused();
 }
 
@@ -3529,6 +3916,7 @@ void R_RegisterFunctionsRTX()
 	R_InterceptKey = R_InterceptKey_RTX;
 	IMG_Load = IMG_Load_RTX;
 	IMG_Unload = IMG_Unload_RTX;
+	IMG_SupportsCompressed = IMG_SupportsCompressed_RTX;
 	IMG_ReadPixels = IMG_ReadPixels_RTX;
 	MOD_LoadMD2 = MOD_LoadMD2_RTX;
 	MOD_LoadMD3 = MOD_LoadMD3_RTX;
@@ -43,6 +43,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "format/md3.h"
 #include "format/sp2.h"
 #include "material.h"
+#include "common/jobs.h"
 #include <assert.h>
 
 #if MAX_ALIAS_VERTS > TESS_MAX_VERTICES
@@ -53,6 +54,87 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #error TESS_MAX_INDICES
 #endif
 
+// texture space terms of a triangle, MD2 and MD3 texture coordinates
+// are the same in all frames so these are computed once per mesh
+typedef struct {
+    vec2_t dt0, dt1;
+    float r;
+} tangent_tri_t;
+
+typedef struct {
+    const maliasmesh_t * mesh;
+    const tangent_tri_t * tris;
+} tangent_job_t;
+
+static void computeFrameTangents(void * arg, int idx_frame)
+{
+    const tangent_job_t * job = arg;
+    const maliasmesh_t * mesh = job->mesh;
+
+    float * stangents = Z_Mallocz(mesh->numverts * 2 * 3 * sizeof(float));
+    float * ttangents = stangents + (mesh->numverts * 3);
+
+    uint32_t offset = idx_frame * mesh->numverts;
+
+    for (int idx_tri = 0; idx_tri < mesh->numtris; ++idx_tri)
+    {
+        uint32_t iA = mesh->indices[idx_tri * 3 + 0];
+        uint32_t iB = mesh->indices[idx_tri * 3 + 1];
+        uint32_t iC = mesh->indices[idx_tri * 3 + 2];
+
+        float const * pA = (float const *)mesh->positions + ((offset + iA) * 3);
+        float const * pB = (float const *)mesh->positions + ((offset + iB) * 3);
+        float const * pC = (float const *)mesh->positions + ((offset + iC) * 3);
+
+        float const * dt0 = job->tris[idx_tri].dt0;
+        float const * dt1 = job->tris[idx_tri].dt1;
+        float r = job->tris[idx_tri].r;
+
+        vec3_t dP0, dP1;
+        VectorSubtract(pB, pA, dP0);
+        VectorSubtract(pC, pA, dP1);
+
+        vec3_t sdir = {
+            (dt1[1] * dP0[0] - dt0[1] * dP1[0]) * r,
+            (dt1[1] * dP0[1] - dt0[1] * dP1[1]) * r,
+            (dt1[1] * dP0[2] - dt0[1] * dP1[2]) * r };
+
+        vec3_t tdir = {
+            (dt0[0] * dP1[0] - dt1[0] * dP0[0]) * r,
+            (dt0[0] * dP1[1] - dt1[0] * dP0[1]) * r,
+            (dt0[0] * dP1[2] - dt1[0] * dP0[2]) * r };
+
+        VectorAdd(stangents + (iA * 3), sdir, stangents + (iA * 3));
+        VectorAdd(stangents + (iB * 3), sdir, stangents + (iB * 3));
+        VectorAdd(stangents + (iC * 3), sdir, stangents + (iC * 3));
+
+        VectorAdd(ttangents + (iA * 3), tdir, ttangents + (iA * 3));
+        VectorAdd(ttangents + (iB * 3), tdir, ttangents + (iB * 3));
+        VectorAdd(ttangents + (iC * 3), tdir, ttangents + (iC * 3));
+    }
+
+    for (int idx_vert = 0; idx_vert < mesh->numverts; ++idx_vert)
+    {
+        float const * normal = (float const *)mesh->normals + ((offset + idx_vert) * 3);
+        float const * stan = stangents + (idx_vert * 3);
+        float const * ttan = ttangents + (idx_vert * 3);
+
+        float * tangent = (float *)mesh->tangents + ((offset+idx_vert) * 4);
+
+        vec3_t t;
+        VectorScale(normal, DotProduct(normal, stan), t);
+        VectorSubtract(stan, t, t);
+        VectorNormalize2(t, tangent); // Graham-Schmidt : t = normalize(t - n * (n.t))
+
+        vec3_t cross;
+        CrossProduct(normal, t, cross);
+        float dot = DotProduct(cross, ttan);
+        tangent[3] = dot < 0.0f ? -1.0f : 1.0f; // handedness
+    }
+
+    Z_Free(stangents);
+}
+
 static void computeTangents(model_t * model)
 {
     for (int idx_mesh = 0; idx_mesh < model->nummeshes; ++idx_mesh)
@@ -60,79 +142,30 @@ static void computeTangents(model_t * model)
         maliasmesh_t * mesh = &model->meshes[idx_mesh];
 
         assert(mesh->tangents);
-        float * stangents = Z_Malloc(mesh->numverts * 2 * 3 * sizeof(float));
-        float * ttangents = stangents + (mesh->numverts * 3);
- 
-        for (int idx_frame = 0; idx_frame < model->numframes; ++idx_frame)
+        tangent_tri_t * tris = Z_Malloc(mesh->numtris * sizeof(tangent_tri_t));
+
+        for (int idx_tri = 0; idx_tri < mesh->numtris; ++idx_tri)
         {
-            memset(stangents, 0, mesh->numverts * 2 * 3 * sizeof(float));
-
-            uint32_t ntriangles = mesh->numindices / 3,
-                     offset = idx_frame * mesh->numverts;
-            
-            for (int idx_tri = 0; idx_tri < mesh->numtris; ++idx_tri)
-            {
-                uint32_t iA = mesh->indices[idx_tri * 3 + 0];
-                uint32_t iB = mesh->indices[idx_tri * 3 + 1];
-                uint32_t iC = mesh->indices[idx_tri * 3 + 2];
-
-                float const * pA = (float const *)mesh->positions + ((offset + iA) * 3);
-                float const * pB = (float const *)mesh->positions + ((offset + iB) * 3);
-                float const * pC = (float const *)mesh->positions + ((offset + iC) * 3);
-
-                float const * tA = (float const *)mesh->tex_coords + ((offset + iA) * 2);
-                float const * tB = (float const *)mesh->tex_coords + ((offset + iB) * 2);
-                float const * tC = (float const *)mesh->tex_coords + ((offset + iC) * 2);
-
-                vec3_t dP0, dP1;
-                VectorSubtract(pB, pA, dP0);
-                VectorSubtract(pC, pA, dP1);
-
-                vec2_t dt0, dt1;
-                Vector2Subtract(tB, tA, dt0);
-                Vector2Subtract(tC, tA, dt1);
-
-                float r = 1.f / (dt0[0] * dt1[1] - dt1[0] * dt0[1]);
-
-                vec3_t sdir = {
-                    (dt1[1] * dP0[0] - dt0[1] * dP1[0]) * r,
-                    (dt1[1] * dP0[1] - dt0[1] * dP1[1]) * r,
-                    (dt1[1] * dP0[2] - dt0[1] * dP1[2]) * r };
-
-                vec3_t tdir = {
-                    (dt0[0] * dP1[0] - dt1[0] * dP0[0]) * r,
-                    (dt0[0] * dP1[1] - dt1[0] * dP0[1]) * r,
-                    (dt0[0] * dP1[2] - dt1[0] * dP0[2]) * r };
-
-                VectorAdd(stangents + (iA * 3), sdir, stangents + (iA * 3));
-                VectorAdd(stangents + (iB * 3), sdir, stangents + (iB * 3));
-                VectorAdd(stangents + (iC * 3), sdir, stangents + (iC * 3));
-
-                VectorAdd(ttangents + (iA * 3), tdir, ttangents + (iA * 3));
-                VectorAdd(ttangents + (iB * 3), tdir, ttangents + (iB * 3));
-                VectorAdd(ttangents + (iC * 3), tdir, ttangents + (iC * 3));
-            }
-
-            for (int idx_vert = 0; idx_vert < mesh->numverts; ++idx_vert)
-            {
-                float const * normal = (float const *)mesh->normals + ((offset + idx_vert) * 3);
-                float const * stan = stangents + (idx_vert * 3);
-                float const * ttan = ttangents + (idx_vert * 3);
-
-                float * tangent = (float *)mesh->tangents + ((offset+idx_vert) * 4);
-
-                vec3_t t;
-                VectorScale(normal, DotProduct(normal, stan), t);
-                VectorSubtract(stan, t, t);
-                VectorNormalize2(t, tangent); // Graham-Schmidt : t = normalize(t - n * (n.t))
-
-                vec3_t cross;
-                CrossProduct(normal, t, cross);
-                float dot = DotProduct(cross, ttan);
-                tangent[3] = dot < 0.0f ? -1.0f : 1.0f; // handedness
-            }
+            uint32_t iA = mesh->indices[idx_tri * 3 + 0];
+            uint32_t iB = mesh->indices[idx_tri * 3 + 1];
+            uint32_t iC = mesh->indices[idx_tri * 3 + 2];
+
+            float const * tA = (float const *)mesh->tex_coords + (iA * 2);
+            float const * tB = (float const *)mesh->tex_coords + (iB * 2);
+            float const * tC = (float const *)mesh->tex_coords + (iC * 2);
+
+            tangent_tri_t * tri = &tris[idx_tri];
+            Vector2Subtract(tB, tA, tri->dt0);
+            Vector2Subtract(tC, tA, tri->dt1);
+
+            tri->r = 1.f / (tri->dt0[0] * tri->dt1[1] - tri->dt1[0] * tri->dt0[1]);
         }
-        Z_Free(stangents);
+
+        // frames only differ in positions and normals, compute them in parallel
+        tangent_job_t job = { mesh, tris };
+        Job_ParallelFor(computeFrameTangents, &job, model->numframes);
+
+        Z_Free(tris);
     }
 }
 
@@ -303,6 +336,10 @@ qerror_t MOD_LoadMD2_RTX(model_t *model, const void *rawdata, size_t length)
 	}
 
 	Hunk_Begin(&model->hunk, 50u<<20);
+	Hunk_Prefault(&model->hunk, sizeof(maliasmesh_t) +
+		header.num_frames * sizeof(maliasframe_t) +
+		numverts * header.num_frames * (sizeof(vec3_t) * 2 + sizeof(vec2_t) + sizeof(vec4_t)) +
+		numindices * sizeof(int) + 64 * 8);
 	model->type = MOD_ALIAS;
 	model->nummeshes = 1;
 	model->numframes = header.num_frames;
@@ -23,7 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <math.h>
 
 #include <assert.h>
-#include "dds.h"
+#include "format/dds.h"
 
 // ----------------------------------------------------------------------------
 
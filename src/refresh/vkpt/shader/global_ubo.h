@@ -82,6 +82,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	UBO_CVAR_DO(pt_indirect_polygon_lights, 1) /* switch for bounce lighting from local polygon lights, 0 or 1 */ \
 	UBO_CVAR_DO(pt_indirect_sphere_lights, 1) /* switch for bounce lighting from local sphere lights, 0 or 1 */ \
 	UBO_CVAR_DO(pt_light_stats, 1) /* switch for statistical light PDF correction, 0 or 1 */ \
+	UBO_CVAR_DO(pt_light_tree, 0) /* switch for light tree sampling in clusters with many polygon lights, 0 or 1 */ \
 	UBO_CVAR_DO(pt_max_log_sky_luminance, -3) /* maximum sky luminance, log2 scale, used for polygon light selection, (-inf..inf) */ \
 	UBO_CVAR_DO(pt_min_log_sky_luminance, -10) /* minimum sky luminance, log2 scale, used for polygon light selection, (-inf..inf) */ \
 	UBO_CVAR_DO(pt_metallic_override, -1) /* overrides metallic parameter of all materials if non-negative, [0..1] */ \
@@ -177,7 +178,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	GLOBAL_UBO_VAR_LIST_DO(float,           inv_height)\
 	\
 	GLOBAL_UBO_VAR_LIST_DO(float,           prev_adapted_luminance) \
-	GLOBAL_UBO_VAR_LIST_DO(float,           padding1) \
+	GLOBAL_UBO_VAR_LIST_DO(int,             instance_set) \
 	GLOBAL_UBO_VAR_LIST_DO(float,           padding2) \
 	GLOBAL_UBO_VAR_LIST_DO(float,           padding3) \
 	\
@@ -208,14 +209,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	INSTANCE_BUFFER_VAR_LIST_DO(uint,            world_prev_to_current    [SHADER_MAX_BSP_ENTITIES]) \
 	INSTANCE_BUFFER_VAR_LIST_DO(uint,            bsp_prim_offset          [SHADER_MAX_BSP_ENTITIES]) \
 	INSTANCE_BUFFER_VAR_LIST_DO(uint,            model_idx_offset         [SHADER_MAX_ENTITIES]) \
-	INSTANCE_BUFFER_VAR_LIST_DO(uint,            model_cluster_id         [SHADER_MAX_ENTITIES]) \
-	INSTANCE_BUFFER_VAR_LIST_DO(uint,            model_cluster_id_prev    [SHADER_MAX_ENTITIES]) \
-	INSTANCE_BUFFER_VAR_LIST_DO(uint,            bsp_cluster_id           [SHADER_MAX_BSP_ENTITIES]) \
-	INSTANCE_BUFFER_VAR_LIST_DO(uint,            bsp_cluster_id_prev      [SHADER_MAX_BSP_ENTITIES]) \
-	INSTANCE_BUFFER_VAR_LIST_DO(ModelInstance,   model_instances          [SHADER_MAX_ENTITIES]) \
-	INSTANCE_BUFFER_VAR_LIST_DO(ModelInstance,   model_instances_prev     [SHADER_MAX_ENTITIES]) \
-	INSTANCE_BUFFER_VAR_LIST_DO(BspMeshInstance, bsp_mesh_instances       [SHADER_MAX_BSP_ENTITIES]) \
-	INSTANCE_BUFFER_VAR_LIST_DO(BspMeshInstance, bsp_mesh_instances_prev  [SHADER_MAX_BSP_ENTITIES]) \
+	/* two sets, global_ubo.instance_set is the current frame and the other one the previous frame */ \
+	INSTANCE_BUFFER_VAR_LIST_DO(uint,            model_cluster_id         [2][SHADER_MAX_ENTITIES]) \
+	INSTANCE_BUFFER_VAR_LIST_DO(uint,            bsp_cluster_id           [2][SHADER_MAX_BSP_ENTITIES]) \
+	INSTANCE_BUFFER_VAR_LIST_DO(ModelInstance,   model_instances          [2][SHADER_MAX_ENTITIES]) \
+	INSTANCE_BUFFER_VAR_LIST_DO(BspMeshInstance, bsp_mesh_instances       [2][SHADER_MAX_BSP_ENTITIES]) \
 	/* stores the offset into the instance buffer in numberof primitives */ \
 	INSTANCE_BUFFER_VAR_LIST_DO(uint,            model_instance_buf_offset[SHADER_MAX_ENTITIES]) \
 	INSTANCE_BUFFER_VAR_LIST_DO(uint,            model_instance_buf_size  [SHADER_MAX_ENTITIES]) \
@@ -290,6 +288,9 @@ layout(set = GLOBAL_UBO_DESC_SET_IDX, binding = GLOBAL_INSTANCE_BUFFER_BINDING_I
 	GlobalUniformInstanceBuffer instance_buffer;
 };
 
+#define INSTANCE_SET_CURR (global_ubo.instance_set)
+#define INSTANCE_SET_PREV (global_ubo.instance_set ^ 1)
+
 #endif
 
 #undef UBO_CVAR_DO
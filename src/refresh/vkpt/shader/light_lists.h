@@ -102,6 +102,109 @@ uint get_light_stats_addr(uint cluster, uint light, uint side)
 	return addr;
 }
 
+// Importance of a light tree node for a point, zero only if none of its
+// lights can reach the point. Same as light_tree_importance in light_tree.c
+float
+light_tree_importance(uint node, vec3 p, vec3 gn)
+{
+	vec4 sphere = get_light_tree_nodes(node * LIGHT_TREE_NODE_VEC4S + 0);
+	vec4 cone = get_light_tree_nodes(node * LIGHT_TREE_NODE_VEC4S + 1);
+	float power = get_light_tree_nodes(node * LIGHT_TREE_NODE_VEC4S + 2).x;
+
+	vec3 d = sphere.xyz - p;
+	float dist2 = dot(d, d);
+	float r2 = sphere.w * sphere.w;
+
+	if (dist2 <= r2)
+		return power / max(r2, 1);
+
+	float dist = sqrt(dist2);
+	d /= dist;
+
+	float sin_u = sphere.w / dist;
+	float cos_u = sqrt(max(0, 1 - sin_u * sin_u));
+
+	// Angle between the surface and the node, less the angle the node covers
+	float cos_i = dot(gn, d);
+	float cos_i_u = cos_i >= cos_u ? 1 : cos_i * cos_u + sqrt(max(0, 1 - cos_i * cos_i)) * sin_u;
+	if (cos_i_u <= 0)
+		return 0;
+
+	// Angle between the emission cone and the point
+	float theta = acos(clamp(-dot(cone.xyz, d), -1, 1));
+	float theta_e = max(0, theta - cone.w - asin(min(sin_u, 1)));
+	if (theta_e >= M_PI * 0.5)
+		return 0;
+
+	return power * cos_i_u * cos(theta_e) / max(dist2, 1);
+}
+
+// Walks down the light tree of the cluster picking children in proportion
+// to their importance, and narrows the list range to the lights of the leaf.
+// Model lights injected after the static lights are picked by their count.
+// Leaves the range empty if no light can reach the point.
+void
+select_light_tree_leaf(uint list_idx, vec3 p, vec3 gn, inout uint list_start, inout uint list_end, inout float rnd, out float pdf)
+{
+	pdf = 1;
+
+	uint root = get_light_tree_roots(list_idx);
+	if (root == ~0u)
+		return;
+
+	uint base = list_start;
+	uint static_end = base + floatBitsToUint(get_light_tree_nodes(root * LIGHT_TREE_NODE_VEC4S + 2).w);
+
+	if (static_end < list_end)
+	{
+		float p_static = float(static_end - base) / float(list_end - base);
+		if (rnd >= p_static)
+		{
+			rnd = min((rnd - p_static) / (1 - p_static), 0.99999);
+			pdf = 1 - p_static;
+			list_start = static_end;
+			return;
+		}
+		rnd /= p_static;
+		pdf = p_static;
+	}
+
+	uint node = root;
+	for (int depth = 0; depth < 32; depth++)
+	{
+		uint children = floatBitsToUint(get_light_tree_nodes(node * LIGHT_TREE_NODE_VEC4S + 2).y);
+		if (children == 0)
+			break;
+
+		float i0 = light_tree_importance(children, p, gn);
+		float i1 = light_tree_importance(children + 1, p, gn);
+		if (i0 + i1 <= 0)
+		{
+			list_end = list_start;
+			return;
+		}
+
+		float p0 = i0 / (i0 + i1);
+		if (rnd < p0)
+		{
+			node = children;
+			rnd /= p0;
+			pdf *= p0;
+		}
+		else
+		{
+			node = children + 1;
+			rnd = (rnd - p0) / (1 - p0);
+			pdf *= 1 - p0;
+		}
+		rnd = min(rnd, 0.99999);
+	}
+
+	vec4 leaf = get_light_tree_nodes(node * LIGHT_TREE_NODE_VEC4S + 2);
+	list_start = base + floatBitsToUint(leaf.z);
+	list_end = list_start + floatBitsToUint(leaf.w);
+}
+
 void
 sample_polygonal_lights(
 		uint list_idx,
@@ -130,6 +233,14 @@ sample_polygonal_lights(
 	uint list_start = get_light_list_offsets(list_idx);
 	uint list_end   = get_light_list_offsets(list_idx + 1);
 
+	float tree_pdf = 1;
+	if (global_ubo.pt_light_tree != 0)
+	{
+		select_light_tree_leaf(list_idx, p, gn, list_start, list_end, rng.x, tree_pdf);
+		if (list_start >= list_end)
+			return;
+	}
+
 	float partitions = ceil(float(list_end - list_start) / float(MAX_BRUTEFORCE_SAMPLING));
 	rng.x *= partitions;
 	float fpart = min(floor(rng.x), partitions-1);
@@ -231,6 +342,7 @@ sample_polygonal_lights(
 		return;
 
 	pdf /= mass;
+	pdf *= tree_pdf;
 
 	// assert: current_idx >= 0?
 	if (current_idx >= 0) {
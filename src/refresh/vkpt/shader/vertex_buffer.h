@@ -35,6 +35,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define MAX_LIGHT_POLYS         4096
 #define LIGHT_POLY_VEC4S        4
 
+#define MAX_LIGHT_TREE_NODES    (1 << 16)
+#define LIGHT_TREE_NODE_VEC4S   3
+// lights sampled at once from a tree leaf, same as MAX_BRUTEFORCE_SAMPLING
+#define LIGHT_TREE_LEAF_SIZE    8
+
 // should match the same constant declared in material.h
 #define MAX_PBR_MATERIALS      4096
 
@@ -83,6 +88,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	VERTEX_BUFFER_LIST_DO(float,    1, texel_density_instanced, (MAX_PRIM_MODEL    )) \
 	\
 	VERTEX_BUFFER_LIST_DO(uint32_t, 1, sky_visibility,        (MAX_LIGHT_LISTS / 32)) \
+	VERTEX_BUFFER_LIST_DO(float,    4, light_tree_nodes,      (MAX_LIGHT_TREE_NODES * LIGHT_TREE_NODE_VEC4S)) \
+	VERTEX_BUFFER_LIST_DO(uint32_t, 1, light_tree_roots,      (MAX_LIGHT_LISTS     )) \
 
 
 #define LIGHT_BUFFER_LIST \
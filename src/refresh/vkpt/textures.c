@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "vkpt.h"
 #include "vk_util.h"
 #include "refresh/images.h"
+#include "common/jobs.h"
+#include "system/system.h"
 #include "device_memory_allocator.h"
 
 #include <assert.h>
@@ -84,6 +86,8 @@ void vkpt_textures_prefetch()
         return;
     }
 
+    unsigned start_time = Sys_Milliseconds();
+
     char const * ptr = buffer;
 	char linebuf[MAX_QPATH];
 	while (sgets(linebuf, sizeof(linebuf), &ptr))
@@ -92,7 +96,7 @@ void vkpt_textures_prefetch()
 		if (!line)
 			continue;
 
-		image_t const * img1 = IMG_Find(line, IT_SKIN, IF_PERMANENT | IF_SRGB);
+		IMG_Request(line, IT_SKIN, IF_PERMANENT | IF_SRGB);
 
 		char other_name[MAX_QPATH];
 
@@ -101,18 +105,22 @@ void vkpt_textures_prefetch()
 			continue;
 		Q_concat(other_name, sizeof(other_name), other_name, "_n.tga", NULL);
 		FS_NormalizePath(other_name, other_name);
-		image_t const * img2 = IMG_Find(other_name, IT_SKIN, IF_PERMANENT);
-		/* if (img2 != R_NOTEXTURE)
-			Com_Printf("Prefetched '%s' (%d)\n", other_name, (int)(img2 - r_images)); */
+		IMG_Request(other_name, IT_SKIN, IF_PERMANENT);
 
 		// attempt loading a matching emissive map
 		if (!Q_strlcpy(other_name, line, strlen(line) - 3))
 			continue;
 		Q_concat(other_name, sizeof(other_name), other_name, "_light.tga", NULL);
 		FS_NormalizePath(other_name, other_name);
-		image_t const * img3 = IMG_Find(other_name, IT_SKIN, IF_PERMANENT | IF_SRGB);
+		IMG_Request(other_name, IT_SKIN, IF_PERMANENT | IF_SRGB);
 	}
-    // Com_Printf("Loaded '%s'\n", filename);
+
+	// decode everything in parallel
+	IMG_LoadRequested();
+
+    if (developer->integer)
+        Com_Printf("Prefetched textures in %u ms (%d threads)\n",
+            Sys_Milliseconds() - start_time, Job_NumThreads());
     FS_FreeFile(buffer);
 }
 
@@ -487,6 +495,29 @@ get_num_miplevels(int w, int h)
 	return 1 + log2(MAX(w, h));
 }
 
+static int
+get_image_miplevels(const image_t *image)
+{
+	if (image->bc_format != BC_NONE)
+		return image->bc_levels;
+
+	return get_num_miplevels(image->upload_width, image->upload_height);
+}
+
+static VkFormat
+get_image_format(const image_t *image)
+{
+	switch (image->bc_format)
+	{
+	case BC_1: return image->is_srgb ? VK_FORMAT_BC1_RGBA_SRGB_BLOCK : VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case BC_3: return image->is_srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+	case BC_4: return VK_FORMAT_BC4_UNORM_BLOCK;
+	case BC_5: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case BC_7: return image->is_srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+	default:   return image->is_srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+	}
+}
+
 
 /*
 ================
@@ -494,14 +525,24 @@ IMG_Load
 ================
 */
 
-static inline float decode_srgb(byte pix)
+// filled by vkpt_textures_initialize, replaces per-channel powf calls
+static float srgb_to_linear[256];
+
+static void init_srgb_table(void)
 {
-	float x = (float)pix / 255.f;
-	
-	if (x < 0.04045f)
-		return x / 12.92f;
+	for (int i = 0; i < 256; i++) {
+		float x = (float)i / 255.f;
 
-	return powf((x + 0.055f) / 1.055f, 2.4f);
+		if (x < 0.04045f)
+			srgb_to_linear[i] = x / 12.92f;
+		else
+			srgb_to_linear[i] = powf((x + 0.055f) / 1.055f, 2.4f);
+	}
+}
+
+static inline float decode_srgb(byte pix)
+{
+	return srgb_to_linear[pix];
 }
 
 static inline byte encode_srgb(float x)
@@ -535,6 +576,7 @@ vkpt_extract_emissive_texture_info(image_t *image)
 	int h = image->upload_height;
 
 	byte* current_pixel = image->pix_data;
+	byte* decoded = NULL;
 	vec3_t emissive_color;
 	VectorClear(emissive_color);
 
@@ -542,6 +584,27 @@ vkpt_extract_emissive_texture_info(image_t *image)
 	int max_x = -1;
 	int min_y = h;
 	int max_y = -1;
+
+	// analyze the top mip level of compressed textures
+	if (image->bc_format != BC_NONE)
+	{
+		decoded = Z_Malloc(w * h * 4);
+		if (!BC_Decode(image->bc_format, decoded, image->pix_data, w, h))
+		{
+			// blocks the decoder can't read come out black and would shrink
+			// or dim the light, so light the whole texture at full intensity
+			Com_WPrintf("%s uses BC7 modes that can't be analyzed, treating it as fully emissive\n", image->name);
+			Z_Free(decoded);
+
+			VectorSet(image->light_color, 1.f + EMISSIVE_TRANSFORM_BIAS, 1.f + EMISSIVE_TRANSFORM_BIAS, 1.f + EMISSIVE_TRANSFORM_BIAS);
+			image->min_light_texcoord[0] = image->min_light_texcoord[1] = 0.f;
+			image->max_light_texcoord[0] = image->max_light_texcoord[1] = 1.f;
+			image->entire_texture_emissive = qtrue;
+			image->processing_complete = qtrue;
+			return;
+		}
+		current_pixel = decoded;
+	}
 	
 	for (int y = 0; y < h; y++) {
 		for (int x = 0; x < w; x++) {
@@ -586,6 +649,9 @@ vkpt_extract_emissive_texture_info(image_t *image)
 	image->entire_texture_emissive = (min_x == 0) && (min_y == 0) && (max_x == w - 1) && (max_y == h - 1);
 
 	image->processing_complete = qtrue;
+
+	if (decoded)
+		Z_Free(decoded);
 }
 
 void
@@ -596,6 +662,13 @@ vkpt_normalize_normal_map(image_t *image)
 
     byte* current_pixel = image->pix_data;
 
+    // baked normal maps are normalized before compression
+    if (image->bc_format != BC_NONE)
+    {
+        image->processing_complete = qtrue;
+        return;
+    }
+
     for (int y = 0; y < h; y++) {
         for (int x = 0; x < w; x++) 
         {
@@ -635,6 +708,12 @@ IMG_Load_RTX(image_t *image, byte *pic)
 	image_loading_dirty_flag = 1;
 }
 
+qboolean
+IMG_SupportsCompressed_RTX(void)
+{
+	return qvk.supports_bc;
+}
+
 void
 IMG_Unload_RTX(image_t *image)
 {
@@ -691,11 +770,13 @@ void IMG_ReloadAll(void)
 
         // image has been modified : try loading in new_image
         image_t new_image;
-        if (load_img(filepath, &new_image) == Q_ERR_SUCCESS)
+        if (load_img(filepath, image->type, &new_image) == Q_ERR_SUCCESS)
         {
             Z_Free(image->pix_data);
 
             image->pix_data = new_image.pix_data;
+            image->bc_format = new_image.bc_format;
+            image->bc_levels = new_image.bc_levels;
             image->width = new_image.width;
             image->height = new_image.width;
             image->upload_width = new_image.upload_width;
@@ -704,7 +785,7 @@ void IMG_ReloadAll(void)
 
             IMG_Load(image, new_image.pix_data);
 
-            if (strstr(filepath, "_n."))
+            if (strstr(filepath, "_n.") && image->bc_format == BC_NONE)
             {
                 vkpt_normalize_normal_map(image);
             }
@@ -823,6 +904,8 @@ vkpt_textures_initialize()
 	memset(descriptor_set_dirty_flags, 0xff, sizeof(descriptor_set_dirty_flags));
 	memset(&texture_system, 0, sizeof(texture_system));
 
+	init_srgb_table();
+
 	tex_device_memory_allocator = create_device_memory_allocator(qvk.device);
 
 	create_invalid_texture();
@@ -1146,8 +1229,8 @@ vkpt_textures_end_registration()
 
 		img_info.extent.width = q_img->upload_width;
 		img_info.extent.height = q_img->upload_height;
-		img_info.mipLevels = get_num_miplevels(q_img->upload_width, q_img->upload_height);
-		img_info.format = q_img->is_srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+		img_info.mipLevels = get_image_miplevels(q_img);
+		img_info.format = get_image_format(q_img);
 
 		_VK(vkCreateImage(qvk.device, &img_info, NULL, tex_images + i));
 		ATTACH_LABEL_VARIABLE(tex_images[i], IMAGE);
@@ -1195,7 +1278,7 @@ vkpt_textures_end_registration()
 		if (tex_images[i] == VK_NULL_HANDLE || tex_image_views[i] != VK_NULL_HANDLE)
 			continue;
 
-		int num_mip_levels = get_num_miplevels(q_img->upload_width, q_img->upload_height);
+		int num_mip_levels = get_image_miplevels(q_img);
 
 		VkMemoryRequirements mem_req;
 		vkGetImageMemoryRequirements(qvk.device, tex_images[i], &mem_req);
@@ -1224,6 +1307,45 @@ vkpt_textures_end_registration()
 				.newLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
 		);
 
+		if (q_img->bc_format != BC_NONE)
+		{
+			// compressed textures come with their mip levels, copy them as is
+			size_t level_offset = offset;
+
+			memcpy(staging_buffer + offset, q_img->pix_data, BC_ChainSize(q_img->bc_format, wd, ht, num_mip_levels));
+
+			for (int mip = 0; mip < num_mip_levels; mip++)
+			{
+				VkBufferImageCopy cpy_info = {
+					.bufferOffset = level_offset,
+					.imageSubresource = {
+						.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+						.mipLevel       = mip,
+						.baseArrayLayer = 0,
+						.layerCount     = 1,
+					},
+					.imageOffset    = { 0, 0, 0 },
+					.imageExtent    = { wd, ht, 1 }
+				};
+
+				vkCmdCopyBufferToImage(cmd_buf, buf_img_upload.buffer, tex_images[i],
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &cpy_info);
+
+				level_offset += BC_LevelSize(q_img->bc_format, wd, ht);
+				wd = (wd > 1) ? (wd >> 1) : wd;
+				ht = (ht > 1) ? (ht >> 1) : ht;
+			}
+
+			IMAGE_BARRIER(cmd_buf,
+				.image = tex_images[i],
+				.subresourceRange = subresource_range,
+				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+				.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				);
+		}
+		else
 		{
 			memcpy(staging_buffer + offset, q_img->pix_data, wd * ht * 4);
 
@@ -1241,84 +1363,84 @@ vkpt_textures_end_registration()
 
 			vkCmdCopyBufferToImage(cmd_buf, buf_img_upload.buffer, tex_images[i],
 				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &cpy_info);
-		}
-
-		subresource_range.levelCount = 1;
 
-		for (int mip = 1; mip < num_mip_levels; mip++) 
-		{
-			subresource_range.baseMipLevel = mip - 1;
+			subresource_range.levelCount = 1;
 
-			IMAGE_BARRIER(cmd_buf,
-				.image = tex_images[i],
-				.subresourceRange = subresource_range,
-				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-				.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
-				.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-				);
+			for (int mip = 1; mip < num_mip_levels; mip++) 
+			{
+				subresource_range.baseMipLevel = mip - 1;
 
-			int nwd = (wd > 1) ? (wd >> 1) : wd;
-			int nht = (ht > 1) ? (ht >> 1) : ht;
+				IMAGE_BARRIER(cmd_buf,
+					.image = tex_images[i],
+					.subresourceRange = subresource_range,
+					.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+					.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+					.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					);
+
+				int nwd = (wd > 1) ? (wd >> 1) : wd;
+				int nht = (ht > 1) ? (ht >> 1) : ht;
+
+				VkImageBlit region = {
+					.srcSubresource = {
+						.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+						.mipLevel = mip - 1,
+						.baseArrayLayer = 0,
+						.layerCount = 1
+					},
+					.srcOffsets = { 
+						{ 0, 0, 0 }, 
+						{ wd, ht, 1 } },
+
+					.dstSubresource = {
+						.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+						.mipLevel = mip,
+						.baseArrayLayer = 0,
+						.layerCount = 1
+					},
+					.dstOffsets = { 
+						{ 0, 0, 0 }, 
+						{ nwd, nht, 1 } }
+				};
 
-			VkImageBlit region = {
-				.srcSubresource = {
-					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-					.mipLevel = mip - 1,
-					.baseArrayLayer = 0,
-					.layerCount = 1
-				},
-				.srcOffsets = { 
-					{ 0, 0, 0 }, 
-					{ wd, ht, 1 } },
+				vkCmdBlitImage(
+					cmd_buf, 
+					tex_images[i], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 
+					tex_images[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
+					1, &region, 
+					VK_FILTER_LINEAR);
 
-				.dstSubresource = {
-					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-					.mipLevel = mip,
-					.baseArrayLayer = 0,
-					.layerCount = 1
-				},
-				.dstOffsets = { 
-					{ 0, 0, 0 }, 
-					{ nwd, nht, 1 } }
-			};
+				subresource_range.baseMipLevel = mip - 1;
 
-			vkCmdBlitImage(
-				cmd_buf, 
-				tex_images[i], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 
-				tex_images[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
-				1, &region, 
-				VK_FILTER_LINEAR);
+				IMAGE_BARRIER(cmd_buf,
+					.image = tex_images[i],
+					.subresourceRange = subresource_range,
+					.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+					.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+					.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+					);
+
+				wd = nwd;
+				ht = nht;
+			}
 
-			subresource_range.baseMipLevel = mip - 1;
+			subresource_range.baseMipLevel = num_mip_levels - 1;
 
 			IMAGE_BARRIER(cmd_buf,
 				.image = tex_images[i],
 				.subresourceRange = subresource_range,
 				.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
 				.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-				.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 				.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
 				);
-
-			wd = nwd;
-			ht = nht;
 		}
 
-		subresource_range.baseMipLevel = num_mip_levels - 1;
-
-		IMAGE_BARRIER(cmd_buf,
-			.image = tex_images[i],
-			.subresourceRange = subresource_range,
-			.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
-			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-			.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-			);
-
 		img_view_info.image = tex_images[i];
 		img_view_info.subresourceRange.levelCount = num_mip_levels;
-		img_view_info.format = q_img->is_srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+		img_view_info.format = get_image_format(q_img);
 		_VK(vkCreateImageView(qvk.device, &img_view_info, NULL, tex_image_views + i));
 		ATTACH_LABEL_VARIABLE(tex_image_views[i], IMAGE_VIEW);
 
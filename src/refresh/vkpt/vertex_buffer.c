@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "shader/vertex_buffer.h"
 #include "material.h"
+#include "system/system.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -116,42 +117,385 @@ vkpt_vertex_buffer_upload_bsp_mesh_to_staging(bsp_mesh_t *bsp_mesh)
 
 	memcpy(vbo->sky_visibility, bsp_mesh->sky_visibility, (num_clusters + 7) / 8);
 
+	// light trees only change with the map, keep them out of the light buffer
+	// that is uploaded every frame
+	if (bsp_mesh->light_tree_roots)
+		memcpy(vbo->light_tree_roots, bsp_mesh->light_tree_roots, num_clusters * sizeof(uint32_t));
+	else
+		memset(vbo->light_tree_roots, 0xff, num_clusters * sizeof(uint32_t));
+
+	int num_tree_nodes = bsp_mesh->num_light_tree_nodes;
+	if (num_tree_nodes > MAX_LIGHT_TREE_NODES)
+	{
+		assert(!"Light tree buffer overflow");
+		num_tree_nodes = MAX_LIGHT_TREE_NODES;
+	}
+
+	memcpy(vbo->light_tree_nodes, bsp_mesh->light_tree_nodes, num_tree_nodes * sizeof(light_tree_node_t));
+
 	buffer_unmap(&qvk.buf_vertex_staging);
 	vbo = NULL;
 
 	return VK_SUCCESS;
 }
 
-static int local_light_counts[MAX_MAP_LEAFS];
-static int cluster_light_counts[MAX_MAP_LEAFS];
-static int light_list_tails[MAX_MAP_LEAFS];
-static int max_cluster_model_lights[MAX_MAP_LEAFS];
-static int max_model_lights;
+/*
+  Light lists of the world clusters with model lights injected.
+
+  The lists are kept in a CPU copy laid out like the light buffer: each
+  cluster has its static lights followed by room for the largest number
+  of model lights it has seen since the map was loaded. The static parts
+  are only written when that layout changes. The model light overlay of
+  a cluster is rebuilt when a light visible from it appears, disappears
+  or changes its index, and the staging buffers only receive the
+  overlays that changed since they were last written.
+*/
+
+#define LIGHT_LIST_WORDS (MAX_LIGHT_LISTS / PVS_WORD_CLUSTERS)
+
+typedef struct {
+	unsigned    layout;
+	unsigned    update;
+} light_list_staging_t;
+
+static struct {
+	qboolean    valid;
+	const int*  static_lights;          // identifies the map the lists belong to
+	int         num_clusters;
+	int         model_light_offset;
+	int         num_nodes;
+
+	unsigned    layout;                 // bumped when the static parts move
+	unsigned    update;                 // bumped when some overlay changes
+
+	uint32_t    offsets[MAX_LIGHT_LISTS];
+	uint32_t    lights[MAX_LIGHT_LIST_NODES];
+	int         model_start[MAX_LIGHT_LISTS];
+	int         model_capacity[MAX_LIGHT_LISTS];    // most model lights seen at once
+	int         model_slots[MAX_LIGHT_LISTS];       // capacity clamped to the buffer size
+	int         model_counts[MAX_LIGHT_LISTS];
+	unsigned    changed[MAX_LIGHT_LISTS];
+
+	// model light clusters of the last update, indexed by light
+	int         num_model_lights;
+	int         model_light_clusters[MAX_LIGHT_POLYS];
+
+	int         source_counts[MAX_LIGHT_LISTS];
+	uint64_t    dirty_sources[LIGHT_LIST_WORDS];
+	uint64_t    dirty[LIGHT_LIST_WORDS];
+	int         dirty_words[LIGHT_LIST_WORDS];
+	int         num_dirty_words;
+} light_lists;
+
+static light_list_staging_t light_list_staging[MAX_FRAMES_IN_FLIGHT];
 
 void vkpt_light_buffer_reset_counts()
 {
-	memset(max_cluster_model_lights, 0, sizeof(max_cluster_model_lights));
-	max_model_lights = 0;
+	light_lists.valid = qfalse;
 }
 
-void
-inject_model_lights(bsp_mesh_t* bsp_mesh, bsp_t* bsp, int num_model_lights, light_poly_t* transformed_model_lights, int model_light_offset, uint32_t* dst_list_offsets, uint32_t* dst_lists)
+static void
+reset_light_lists(bsp_mesh_t* bsp_mesh, int model_light_offset)
+{
+	light_lists.valid = qtrue;
+	light_lists.static_lights = bsp_mesh->cluster_lights;
+	light_lists.num_clusters = bsp_mesh->num_clusters;
+	light_lists.model_light_offset = model_light_offset;
+	light_lists.num_model_lights = 0;
+
+	memset(light_lists.model_capacity, 0, sizeof(light_lists.model_capacity));
+	memset(light_lists.model_slots, 0, sizeof(light_lists.model_slots));
+	memset(light_lists.model_counts, 0, sizeof(light_lists.model_counts));
+}
+
+// lays out the static lists followed by the model light slots
+static void
+build_light_list_layout(bsp_mesh_t* bsp_mesh)
 {
-	memset(local_light_counts, 0, bsp_mesh->num_clusters * sizeof(int));
-	memset(cluster_light_counts, 0, bsp_mesh->num_clusters * sizeof(int));
+	int tail = 0;
+
+	for (int c = 0; c < bsp_mesh->num_clusters; c++)
+	{
+		int original_size = bsp_mesh->cluster_light_offsets[c + 1] - bsp_mesh->cluster_light_offsets[c];
+
+		light_lists.offsets[c] = tail;
+		memcpy(light_lists.lights + tail, bsp_mesh->cluster_lights + bsp_mesh->cluster_light_offsets[c], sizeof(uint32_t) * original_size);
+		tail += original_size;
+
+		// Leave room for the static lists of the following clusters
+		int room = MAX_LIGHT_LIST_NODES - tail - (bsp_mesh->num_cluster_lights - bsp_mesh->cluster_light_offsets[c + 1]);
+
+		light_lists.model_start[c] = tail;
+		light_lists.model_slots[c] = max(0, min(light_lists.model_capacity[c], room));
+		tail += light_lists.model_slots[c];
+	}
+	light_lists.offsets[bsp_mesh->num_clusters] = tail;
+	light_lists.num_nodes = tail;
+
+	light_lists.layout++;
+}
+
+static void
+mark_source_cluster(int cluster)
+{
+	light_lists.dirty_sources[cluster >> 6] |= 1ull << (cluster & 63);
+}
+
+// collects the indices of the non-empty words of the dirty set, dropping
+// bits past the last cluster that may come from the row padding
+static void
+find_dirty_words(int num_clusters)
+{
+	int num_words = (num_clusters + PVS_WORD_CLUSTERS - 1) / PVS_WORD_CLUSTERS;
+
+	if (num_clusters & 63)
+		light_lists.dirty[num_words - 1] &= (1ull << (num_clusters & 63)) - 1;
+
+	light_lists.num_dirty_words = 0;
+
+	for (int w = 0; w < num_words; w++)
+	{
+		if (light_lists.dirty[w])
+			light_lists.dirty_words[light_lists.num_dirty_words++] = w;
+	}
+}
+
+static void
+clear_dirty_counts(void)
+{
+	for (int i = 0; i < light_lists.num_dirty_words; i++)
+	{
+		int w = light_lists.dirty_words[i];
+
+		for (uint64_t word = light_lists.dirty[w]; word; word &= word - 1)
+			light_lists.model_counts[(w << 6) + ctz64(word)] = 0;
+	}
+}
+
+// counts model lights visible from the dirty clusters, returns qtrue if
+// some of them don't fit into their slots
+static qboolean
+count_model_lights(bsp_t* bsp)
+{
+	qboolean grow = qfalse;
+
+	clear_dirty_counts();
+
+	for (int c = 0; c < light_lists.num_clusters; c++)
+	{
+		if (!light_lists.source_counts[c])
+			continue;
+
+		const char* mask = BSP_GetPvs(bsp, c);
+
+		for (int i = 0; i < light_lists.num_dirty_words; i++)
+		{
+			int w = light_lists.dirty_words[i];
+			uint64_t word = load_pvs_word(mask, w << 3, bsp->visrowsize) & light_lists.dirty[w];
+
+			for (; word; word &= word - 1)
+				light_lists.model_counts[(w << 6) + ctz64(word)] += light_lists.source_counts[c];
+		}
+	}
+
+	for (int i = 0; i < light_lists.num_dirty_words; i++)
+	{
+		int w = light_lists.dirty_words[i];
+
+		for (uint64_t word = light_lists.dirty[w]; word; word &= word - 1)
+		{
+			int c = (w << 6) + ctz64(word);
+			if (light_lists.model_counts[c] > light_lists.model_capacity[c])
+			{
+				light_lists.model_capacity[c] = light_lists.model_counts[c];
+				grow = qtrue;
+			}
+		}
+	}
+
+	return grow;
+}
+
+static void
+update_model_light_lists(bsp_mesh_t* bsp_mesh, bsp_t* bsp, int num_model_lights, light_poly_t* transformed_model_lights, int model_light_offset)
+{
+	int num_words = (bsp_mesh->num_clusters + PVS_WORD_CLUSTERS - 1) / PVS_WORD_CLUSTERS;
+	qboolean relayout = qfalse;
+	qboolean any_dirty = qfalse;
+
+	num_model_lights = min(num_model_lights, MAX_LIGHT_POLYS);
+
+	if (!light_lists.valid ||
+		light_lists.static_lights != bsp_mesh->cluster_lights ||
+		light_lists.num_clusters != bsp_mesh->num_clusters ||
+		light_lists.model_light_offset != model_light_offset)
+	{
+		reset_light_lists(bsp_mesh, model_light_offset);
+		relayout = qtrue;
+	}
+
+	int num_lights = max(num_model_lights, light_lists.num_model_lights);
+
+	// Find the clusters that gained or lost a model light index
+
+	memset(light_lists.dirty_sources, 0, num_words * sizeof(uint64_t));
+
+	for (int nlight = 0; nlight < num_lights; nlight++)
+	{
+		int old_cluster = nlight < light_lists.num_model_lights ? light_lists.model_light_clusters[nlight] : -1;
+		int new_cluster = nlight < num_model_lights ? transformed_model_lights[nlight].cluster : -1;
+
+		if (old_cluster == new_cluster)
+			continue;
+
+		if (old_cluster >= 0)
+			mark_source_cluster(old_cluster);
+		if (new_cluster >= 0)
+			mark_source_cluster(new_cluster);
+
+		light_lists.model_light_clusters[nlight] = new_cluster;
+		any_dirty = qtrue;
+	}
+
+	light_lists.num_model_lights = num_model_lights;
+
+	if (!any_dirty && !relayout)
+		return;
+
+	// Lists of the clusters that see any of these need to be rebuilt
+
+	memset(light_lists.dirty, 0, num_words * sizeof(uint64_t));
+
+	for (int w = 0; w < num_words; w++)
+	{
+		for (uint64_t word = light_lists.dirty_sources[w]; word; word &= word - 1)
+		{
+			const char* mask = BSP_GetPvs(bsp, (w << 6) + ctz64(word));
+
+			for (int j = 0; j < num_words; j++)
+				light_lists.dirty[j] |= load_pvs_word(mask, j << 3, bsp->visrowsize);
+		}
+	}
+
+	memset(light_lists.source_counts, 0, bsp_mesh->num_clusters * sizeof(int));
+
+	for (int nlight = 0; nlight < num_model_lights; nlight++)
+	{
+		light_lists.source_counts[transformed_model_lights[nlight].cluster]++;
+	}
+
+	find_dirty_words(bsp_mesh->num_clusters);
+
+	if (count_model_lights(bsp))
+		relayout = qtrue;
+
+	if (relayout)
+	{
+		// All slots moved, so every overlay is written again
+		memset(light_lists.dirty, 0xff, num_words * sizeof(uint64_t));
+		find_dirty_words(bsp_mesh->num_clusters);
+
+		count_model_lights(bsp);
+		build_light_list_layout(bsp_mesh);
+	}
+
+	light_lists.update++;
+
+	// Write the model light indices into the dirty lists, in light order
+
+	clear_dirty_counts();
+
+	for (int nlight = 0; nlight < num_model_lights; nlight++)
+	{
+		const char* mask = BSP_GetPvs(bsp, transformed_model_lights[nlight].cluster);
+
+		for (int i = 0; i < light_lists.num_dirty_words; i++)
+		{
+			int w = light_lists.dirty_words[i];
+			uint64_t word = load_pvs_word(mask, w << 3, bsp->visrowsize) & light_lists.dirty[w];
+
+			for (; word; word &= word - 1)
+			{
+				int other_cluster = (w << 6) + ctz64(word);
+				int* count = light_lists.model_counts + other_cluster;
+				if (*count < light_lists.model_slots[other_cluster])
+				{
+					light_lists.lights[light_lists.model_start[other_cluster] + *count] = model_light_offset + nlight;
+					(*count)++;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < light_lists.num_dirty_words; i++)
+	{
+		int w = light_lists.dirty_words[i];
+
+		for (uint64_t word = light_lists.dirty[w]; word; word &= word - 1)
+		{
+			int c = (w << 6) + ctz64(word);
+			int used = light_lists.model_counts[c];
+
+			memset(light_lists.lights + light_lists.model_start[c] + used, 0xff,
+				sizeof(uint32_t) * (light_lists.model_slots[c] - used));
+			light_lists.changed[c] = light_lists.update;
+		}
+	}
+}
+
+// copies the parts of the lists that changed since this staging buffer
+// was written last
+static void
+write_light_lists(light_list_staging_t* staging, uint32_t* dst_list_offsets, uint32_t* dst_lists)
+{
+	if (staging->layout != light_lists.layout)
+	{
+		memcpy(dst_list_offsets, light_lists.offsets, (light_lists.num_clusters + 1) * sizeof(uint32_t));
+		memcpy(dst_lists, light_lists.lights, light_lists.num_nodes * sizeof(uint32_t));
+	}
+	else if (staging->update != light_lists.update)
+	{
+		for (int c = 0; c < light_lists.num_clusters; c++)
+		{
+			if (light_lists.changed[c] > staging->update)
+			{
+				int start = light_lists.model_start[c];
+				memcpy(dst_lists + start, light_lists.lights + start, light_lists.model_slots[c] * sizeof(uint32_t));
+			}
+		}
+	}
+
+	staging->layout = light_lists.layout;
+	staging->update = light_lists.update;
+}
+
+#if USE_TESTS
+
+// the previous version that rebuilt all lists every frame, for reference
+
+static int ref_local_light_counts[MAX_MAP_LEAFS];
+static int ref_cluster_light_counts[MAX_MAP_LEAFS];
+static int ref_light_list_tails[MAX_MAP_LEAFS];
+static int ref_max_cluster_model_lights[MAX_MAP_LEAFS];
+
+static void
+inject_model_lights_ref(bsp_mesh_t* bsp_mesh, bsp_t* bsp, int num_model_lights, light_poly_t* transformed_model_lights, int model_light_offset, uint32_t* dst_list_offsets, uint32_t* dst_lists)
+{
+	memset(ref_local_light_counts, 0, bsp_mesh->num_clusters * sizeof(int));
+	memset(ref_cluster_light_counts, 0, bsp_mesh->num_clusters * sizeof(int));
 
 	// Count the number of model lights per cluster
 
 	for (int nlight = 0; nlight < num_model_lights; nlight++)
 	{
-		local_light_counts[transformed_model_lights[nlight].cluster]++;
+		ref_local_light_counts[transformed_model_lights[nlight].cluster]++;
 	}
 
 	// Count the number of model lights visible from each cluster, using the PVS
 
 	for (int c = 0; c < bsp_mesh->num_clusters; c++)
 	{
-		if (local_light_counts[c])
+		if (ref_local_light_counts[c])
 		{
 			const char* mask = BSP_GetPvs(bsp, c);
 
@@ -159,7 +503,7 @@ inject_model_lights(bsp_mesh_t* bsp_mesh, bsp_t* bsp, int num_model_lights, ligh
 				if (mask[j]) {
 					for (int k = 0; k < 8; ++k) {
 						if (mask[j] & (1 << k))
-							cluster_light_counts[j * 8 + k] += local_light_counts[c];
+							ref_cluster_light_counts[j * 8 + k] += ref_local_light_counts[c];
 					}
 				}
 			}
@@ -170,7 +514,7 @@ inject_model_lights(bsp_mesh_t* bsp_mesh, bsp_t* bsp, int num_model_lights, ligh
 
 	for (int c = 0; c < bsp_mesh->num_clusters; c++)
 	{
-		max_cluster_model_lights[c] = max(max_cluster_model_lights[c], cluster_light_counts[c]);
+		ref_max_cluster_model_lights[c] = max(ref_max_cluster_model_lights[c], ref_cluster_light_counts[c]);
 	}
 
 	// Copy the static light lists, and make room in these lists to inject the model lights
@@ -183,11 +527,11 @@ inject_model_lights(bsp_mesh_t* bsp_mesh, bsp_t* bsp, int num_model_lights, ligh
 		dst_list_offsets[c] = tail;
 		memcpy(dst_lists + tail, bsp_mesh->cluster_lights + bsp_mesh->cluster_light_offsets[c], sizeof(uint32_t) * original_size);
 		tail += original_size;
-		if (max_cluster_model_lights[c] > 0) {
-			memset(dst_lists + tail, 0xff, sizeof(uint32_t) * max_cluster_model_lights[c]);
+		if (ref_max_cluster_model_lights[c] > 0) {
+			memset(dst_lists + tail, 0xff, sizeof(uint32_t) * ref_max_cluster_model_lights[c]);
 		}
-		light_list_tails[c] = tail;
-		tail += max_cluster_model_lights[c];
+		ref_light_list_tails[c] = tail;
+		tail += ref_max_cluster_model_lights[c];
 	}
 	dst_list_offsets[bsp_mesh->num_clusters] = tail;
 
@@ -203,7 +547,7 @@ inject_model_lights(bsp_mesh_t* bsp_mesh, bsp_t* bsp, int num_model_lights, ligh
 					if (mask[j] & (1 << k))
 					{
 						int other_cluster = j * 8 + k;
-						dst_lists[light_list_tails[other_cluster]++] = model_light_offset + nlight;
+						dst_lists[ref_light_list_tails[other_cluster]++] = model_light_offset + nlight;
 					}
 				}
 			}
@@ -211,6 +555,102 @@ inject_model_lights(bsp_mesh_t* bsp_mesh, bsp_t* bsp, int num_model_lights, ligh
 	}
 }
 
+/*
+  Moves synthetic model lights around the loaded map and checks that the
+  incremental light lists match the ones rebuilt from scratch every frame.
+  Doesn't touch the GPU buffers.
+*/
+void
+vkpt_light_buffer_test(bsp_mesh_t* bsp_mesh, bsp_t* bsp)
+{
+	enum { NUM_FRAMES = 2000, MAX_TEST_LIGHTS = 256 };
+	light_list_staging_t staging[MAX_FRAMES_IN_FLIGHT];
+	uint32_t* offsets[MAX_FRAMES_IN_FLIGHT];
+	uint32_t* lists[MAX_FRAMES_IN_FLIGHT];
+	unsigned start, ref_msec = 0, msec = 0;
+	int frame, errors = 0, num_lights = MAX_TEST_LIGHTS / 2;
+
+	if (!bsp || !bsp->vis || !bsp_mesh->num_clusters)
+	{
+		Com_Printf("No map loaded.\n");
+		return;
+	}
+
+	light_poly_t* lights = Z_Mallocz(MAX_TEST_LIGHTS * sizeof(light_poly_t));
+	uint32_t* ref_offsets = Z_Malloc(MAX_LIGHT_LISTS * sizeof(uint32_t));
+	uint32_t* ref_lists = Z_Malloc(MAX_LIGHT_LIST_NODES * sizeof(uint32_t));
+
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		offsets[i] = Z_Malloc(MAX_LIGHT_LISTS * sizeof(uint32_t));
+		lists[i] = Z_Malloc(MAX_LIGHT_LIST_NODES * sizeof(uint32_t));
+	}
+
+	for (int i = 0; i < MAX_TEST_LIGHTS; i++)
+		lights[i].cluster = rand() % bsp_mesh->num_clusters;
+
+	memset(staging, 0, sizeof(staging));
+	memset(ref_max_cluster_model_lights, 0, sizeof(ref_max_cluster_model_lights));
+	vkpt_light_buffer_reset_counts();
+
+	for (frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		int index = frame % MAX_FRAMES_IN_FLIGHT;
+
+		// Most lights stay where they are, a few move, appear or go away
+		for (int i = 0; i < 4; i++)
+			lights[rand() % MAX_TEST_LIGHTS].cluster = rand() % bsp_mesh->num_clusters;
+		if ((frame & 15) == 0)
+			num_lights = max(0, min(MAX_TEST_LIGHTS, num_lights + rand() % 9 - 4));
+
+		start = Sys_Milliseconds();
+		update_model_light_lists(bsp_mesh, bsp, num_lights, lights, bsp_mesh->num_light_polys);
+		write_light_lists(staging + index, offsets[index], lists[index]);
+		msec += Sys_Milliseconds() - start;
+
+		// The reference doesn't check the buffer size
+		int total = bsp_mesh->num_cluster_lights;
+		for (int c = 0; c < bsp_mesh->num_clusters; c++)
+			total += max(ref_max_cluster_model_lights[c], light_lists.model_capacity[c]);
+		if (total > MAX_LIGHT_LIST_NODES)
+		{
+			Com_Printf("Light lists overflow at frame %d\n", frame);
+			break;
+		}
+
+		start = Sys_Milliseconds();
+		inject_model_lights_ref(bsp_mesh, bsp, num_lights, lights, bsp_mesh->num_light_polys, ref_offsets, ref_lists);
+		ref_msec += Sys_Milliseconds() - start;
+
+		int num_nodes = ref_offsets[bsp_mesh->num_clusters];
+		if (memcmp(ref_offsets, offsets[index], (bsp_mesh->num_clusters + 1) * sizeof(uint32_t)) ||
+			memcmp(ref_lists, lists[index], num_nodes * sizeof(uint32_t)))
+		{
+			Com_Printf("Light lists differ at frame %d\n", frame);
+			errors++;
+			break;
+		}
+	}
+
+	Com_Printf("%d frames, %d model lights: %u msec reference, %u msec incremental\n",
+		frame, num_lights, ref_msec, msec);
+	Com_Printf("%d failures\n", errors);
+
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		Z_Free(offsets[i]);
+		Z_Free(lists[i]);
+	}
+	Z_Free(lights);
+	Z_Free(ref_offsets);
+	Z_Free(ref_lists);
+
+	// Lay the lists out for the real model lights again
+	vkpt_light_buffer_reset_counts();
+}
+
+#endif // USE_TESTS
+
 static inline void
 copy_light(const light_poly_t* light, float* vblight, const float* sky_radiance)
 {
@@ -324,20 +764,14 @@ vkpt_light_buffer_upload_to_staging(qboolean render_world, bsp_mesh_t *bsp_mesh,
 		assert(bsp_mesh->num_light_polys + num_model_lights < MAX_LIGHT_POLYS);
 
 		int model_light_offset = bsp_mesh->num_light_polys;
-		max_model_lights = max(max_model_lights, num_model_lights);
 
-		if(max_model_lights > 0)
-		{
-			// If any of the BSP models contain lights, inject these lights right into the visibility lists.
-			// The shader doesn't know that these lights are dynamic.
+		// If any of the BSP models contain lights, inject these lights right into the visibility lists.
+		// The shader doesn't know that these lights are dynamic.
 
-			inject_model_lights(bsp_mesh, bsp, num_model_lights, transformed_model_lights, model_light_offset, lbo->light_list_offsets, lbo->light_list_lights);
-		}
-		else
-		{
-			memcpy(lbo->light_list_offsets, bsp_mesh->cluster_light_offsets, (bsp_mesh->num_clusters + 1) * sizeof(uint32_t));
-			memcpy(lbo->light_list_lights, bsp_mesh->cluster_lights, bsp_mesh->num_cluster_lights * sizeof(uint32_t));
-		}
+		update_model_light_lists(bsp_mesh, bsp, num_model_lights, transformed_model_lights, model_light_offset);
+
+		light_list_staging_t* list_staging = light_list_staging + qvk.current_frame_index;
+		write_light_lists(list_staging, lbo->light_list_offsets, lbo->light_list_lights);
 
 		for (int nlight = 0; nlight < bsp_mesh->num_light_polys; nlight++)
 		{
@@ -357,6 +791,9 @@ vkpt_light_buffer_upload_to_staging(qboolean render_world, bsp_mesh_t *bsp_mesh,
 	{
 		lbo->light_list_offsets[0] = 0;
 		lbo->light_list_offsets[1] = 0;
+
+		// The lists in this buffer need to be written again
+		light_list_staging[qvk.current_frame_index].layout = 0;
 	}
 
 	/* effects.c declares this - hence the assert below:
@@ -416,11 +853,17 @@ vkpt_vertex_buffer_upload_models_to_staging()
 
 	int idx_offset = 0;
 	int vertex_offset = 0;
-	for(int i = 0; i < MAX_MODELS; i++) {
+	for(int i = 0; i < r_numModels; i++) {
 		if(!r_models[i].meshes) {
 			continue;
 		}
 
+		// models kept in the cache for later maps take no buffer space
+		// until they are registered again
+		if(r_models[i].registration_sequence != registration_sequence) {
+			continue;
+		}
+
 		for (int nmesh = 0; nmesh < r_models[i].nummeshes; nmesh++)
 		{
 			maliasmesh_t *m = r_models[i].meshes + nmesh;
@@ -432,6 +875,11 @@ vkpt_vertex_buffer_upload_models_to_staging()
 
 			int num_verts = r_models[i].numframes * m->numverts;
 			assert(num_verts > 0);
+
+			if (vertex_offset + num_verts > MAX_VERT_MODEL || idx_offset + m->numindices > MAX_IDX_MODEL) {
+				buffer_unmap(&qvk.buf_vertex_staging);
+				Com_Error(ERR_DROP, "%s: too many model vertices, %s doesn't fit", __func__, r_models[i].name);
+			}
 #if 0
 			for (int j = 0; j < num_verts; j++)
 				Com_Printf("%f %f %f\n",
@@ -474,9 +922,6 @@ vkpt_vertex_buffer_upload_models_to_staging()
 
 			vertex_offset += num_verts;
 			idx_offset += m->numtris * 3;
-
-			assert(vertex_offset < MAX_VERT_MODEL);
-			assert(idx_offset < MAX_IDX_MODEL);
 		}
 	}
 
@@ -564,6 +1009,7 @@ vkpt_vertex_buffer_create()
 			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 	}
+	memset(light_list_staging, 0, sizeof(light_list_staging));
 
 	buffer_create(&qvk.buf_readback, sizeof(ReadbackBuffer),
 		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
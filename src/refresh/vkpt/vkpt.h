@@ -21,6 +21,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define  __VKPT_H__
 
 #include <vulkan/vulkan.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #define HAVE_M_PI
 #include <SDL.h>
 #include <SDL_vulkan.h>
@@ -176,6 +179,7 @@ typedef struct QVK_s {
 	int32_t                     queue_idx_graphics;
 	int32_t                     queue_idx_compute;
 	int32_t                     queue_idx_transfer;
+	qboolean                    supports_bc; // block compressed textures
 	VkSurfaceKHR                surface;
 	VkSwapchainKHR              swap_chain;
 	VkSurfaceFormatKHR          surf_format;
@@ -340,6 +344,18 @@ typedef struct aabb_s {
 	vec3_t maxs;
 } aabb_t;
 
+// matches the layout of light_tree_nodes in the vertex buffer
+typedef struct light_tree_node_s {
+	vec3_t center;
+	float radius;
+	vec3_t axis;        // cone of the emission directions
+	float cone_angle;
+	float power;
+	uint32_t children;  // first of two adjacent children, 0 for leaves
+	uint32_t first;     // lights of the node in the cluster light list
+	uint32_t count;
+} light_tree_node_t;
+
 typedef struct bsp_mesh_s {
 	uint32_t world_idx_count;
 	bsp_model_t *models;
@@ -362,6 +378,7 @@ typedef struct bsp_mesh_s {
 	float *texel_density;
 	int num_indices;
 	int num_vertices;
+	int allocated_vertices;
 
 	int num_clusters;
 	int *clusters;
@@ -370,6 +387,10 @@ typedef struct bsp_mesh_s {
 	int *cluster_light_offsets;
 	int *cluster_lights;
 
+	int num_light_tree_nodes;
+	light_tree_node_t *light_tree_nodes;
+	uint32_t *light_tree_roots;     // per cluster, ~0u for clusters without a tree
+
 	int num_light_polys;
 	int allocated_light_polys;
 	light_poly_t *light_polys;
@@ -386,9 +407,38 @@ typedef struct bsp_mesh_s {
 	aabb_t* cluster_aabbs;
 } bsp_mesh_t;
 
+// PVS rows are processed 64 clusters at a time, see BSP_LoadVisWord.
+
+#define PVS_WORD_CLUSTERS 64
+
+static inline int
+ctz64(uint64_t x)
+{
+	return BSP_FirstVisBit(x);
+}
+
+// returns 64 bits of the row starting at byte offset ofs, bit N of the
+// word is cluster ofs * 8 + N
+static inline uint64_t
+load_pvs_word(const char* row, int ofs, int rowsize)
+{
+	return BSP_LoadVisWord((const byte*)row, ofs, rowsize);
+}
+
 void bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name);
 void bsp_mesh_destroy(bsp_mesh_t *wm);
 void bsp_mesh_register_textures(bsp_t *bsp);
+#if USE_TESTS
+void bsp_mesh_test_cache(bsp_t *bsp);
+void bsp_mesh_test_pvs(bsp_mesh_t *wm, bsp_t *world);
+void bsp_mesh_test_polys(void);
+#endif
+
+void vkpt_light_trees_create(bsp_mesh_t *wm);
+void vkpt_light_trees_destroy(bsp_mesh_t *wm);
+#if USE_TESTS
+void vkpt_light_trees_test(bsp_mesh_t *wm);
+#endif
 
 typedef struct vkpt_refdef_s {
 	QVKUniformBuffer_t uniform_buffer;
@@ -581,6 +631,9 @@ VkResult vkpt_vertex_buffer_create_instance(VkCommandBuffer cmd_buf, uint32_t nu
 VkResult vkpt_vertex_buffer_upload_models_to_staging();
 VkResult vkpt_vertex_buffer_upload_staging();
 void vkpt_light_buffer_reset_counts();
+#if USE_TESTS
+void vkpt_light_buffer_test(bsp_mesh_t* bsp_mesh, bsp_t* bsp);
+#endif
 VkResult vkpt_light_buffer_upload_to_staging(qboolean render_world, bsp_mesh_t *bsp_mesh, bsp_t* bsp, int num_model_lights, light_poly_t* transformed_model_lights, const float* sky_radiance);
 VkResult vkpt_light_buffer_upload_staging(VkCommandBuffer cmd_buf);
 VkResult vkpt_light_stats_create(bsp_mesh_t *bsp_mesh);
@@ -639,7 +692,7 @@ VkResult vkpt_shadow_map_render(VkCommandBuffer cmd_buf, float* view_projection_
 VkImageView vkpt_shadow_map_get_view();
 void vkpt_shadow_map_setup(const sun_light_t* light, const float* bbox_min, const float* bbox_max, float* VP, float* depth_scale, qboolean random_sampling);
 
-qerror_t load_img(const char *name, image_t *image);
+qerror_t load_img(const char *name, imagetype_t type, image_t *image);
 // Transparency module API
 
 qboolean initialize_transparency();
@@ -759,6 +812,7 @@ int R_DrawString_RTX(int x, int y, int flags, size_t maxlen, const char *s, qhan
 qboolean R_InterceptKey_RTX(unsigned key, qboolean down);
 
 void IMG_Load_RTX(image_t *image, byte *pic);
+qboolean IMG_SupportsCompressed_RTX(void);
 void IMG_Unload_RTX(image_t *image);
 byte *IMG_ReadPixels_RTX(int *width, int *height, int *rowbytes);
 
@@ -1596,5 +1596,9 @@ void SV_InitOperatorCommands(void)
 
     if (COM_DEDICATED)
         Cmd_AddCommand("say", SV_ConSay_f);
+
+#if USE_TESTS
+    SV_InitGameTests();
+#endif
 }
 
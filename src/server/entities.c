@@ -392,8 +392,8 @@ void SV_BuildClientFrame(client_t *client)
 	int         l;
     int         clientarea, clientcluster;
     mleaf_t     *leaf;
-    byte        clientphs[VIS_MAX_BYTES];
-    byte        clientpvs[VIS_MAX_BYTES];
+    byte        fatpvs[VIS_MAX_BYTES];
+    const byte  *clientphs, *clientpvs;
     qboolean    ent_visible;
     int cull_nonvisible_entities = Cvar_Get("sv_cull_nonvisible_entities", "1", CVAR_CHEAT)->integer;
 
@@ -436,15 +436,15 @@ void SV_BuildClientFrame(client_t *client)
 
 	if (clientcluster >= 0)
 	{
-		CM_FatPVS(client->cm, clientpvs, org, DVIS_PVS2);
+		clientpvs = CM_FatPVS(client->cm, fatpvs, org, DVIS_PVS2);
 		client->last_valid_cluster = clientcluster;
 	}
 	else
 	{
-		BSP_ClusterVis(client->cm->cache, clientpvs, client->last_valid_cluster, DVIS_PVS2);
+		clientpvs = BSP_GetVisRow(client->cm->cache, client->last_valid_cluster, DVIS_PVS2);
 	}
 
-    BSP_ClusterVis(client->cm->cache, clientphs, clientcluster, DVIS_PHS);
+    clientphs = BSP_GetVisRow(client->cm->cache, clientcluster, DVIS_PHS);
 
     // build up the list of visible entities
     frame->num_entities = 0;
@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // sv_game.c -- interface to the game dll
 
 #include "server.h"
+#include "system/hunk.h"
 
 game_export_t    *ge;
 
@@ -427,7 +428,7 @@ static void PF_WriteFloat(float f)
 static qboolean PF_inVIS(vec3_t p1, vec3_t p2, int vis)
 {
     mleaf_t *leaf1, *leaf2;
-    byte mask[VIS_MAX_BYTES];
+    const byte *mask;
     bsp_t *bsp = sv.cm.cache;
 
     if (!bsp) {
@@ -435,7 +436,7 @@ static qboolean PF_inVIS(vec3_t p1, vec3_t p2, int vis)
     }
 
     leaf1 = BSP_PointLeaf(bsp->nodes, p1);
-    BSP_ClusterVis(bsp, mask, leaf1->cluster, vis);
+    mask = BSP_GetVisRow(bsp, leaf1->cluster, vis);
 
     leaf2 = BSP_PointLeaf(bsp->nodes, p2);
     if (leaf2->cluster == -1)
@@ -517,7 +518,7 @@ static void PF_StartSound(edict_t *edict, int channel,
     int         ent;
     vec3_t      origin;
     client_t    *client;
-    byte        mask[VIS_MAX_BYTES];
+    const byte  *mask;
     mleaf_t     *leaf;
     int         area;
     player_state_t      *ps;
@@ -573,7 +574,7 @@ static void PF_StartSound(edict_t *edict, int channel,
                     continue;        // blocked by a door
                 }
             }
-            BSP_ClusterVis(sv.cm.cache, mask, leaf->cluster, DVIS_PHS);
+            mask = BSP_GetVisRow(sv.cm.cache, leaf->cluster, DVIS_PHS);
             if (!SV_EdictIsVisible(&sv.cm, edict, mask)) {
                 continue; // not in PHS
             }
@@ -764,6 +765,40 @@ static void PF_FreeTags(unsigned tag)
     Z_FreeTags(tag + TAG_MAX);
 }
 
+/*
+================
+PF_LevelAlloc
+
+Level strings and similar small objects that all die together are bump
+allocated from a single hunk. Freeing the level just rewinds the hunk,
+pages stay committed for the next map.
+================
+*/
+#define LEVEL_HUNK_SIZE     0x4000000
+
+static memhunk_t    sv_levelhunk;
+
+static void *SV_LevelAlloc(memhunk_t *hunk, size_t size)
+{
+    if (!size) {
+        return NULL;
+    }
+    if (!hunk->base) {
+        Hunk_Begin(hunk, LEVEL_HUNK_SIZE);
+    }
+    return memset(Hunk_Alloc(hunk, size), 0, size);
+}
+
+static void *PF_LevelAlloc(size_t size)
+{
+    return SV_LevelAlloc(&sv_levelhunk, size);
+}
+
+static void PF_LevelFree(void)
+{
+    sv_levelhunk.cursize = 0;
+}
+
 static void PF_DebugGraph(float value, int color)
 {
 #if (defined _DEBUG) && USE_CLIENT
@@ -771,6 +806,133 @@ static void PF_DebugGraph(float value, int color)
 #endif
 }
 
+#if USE_TESTS
+
+// TAG_LEVEL in baseq2, only safe to use with no game loaded
+#define TEST_TAG_LEVEL  766
+
+// copy every entity string token the way ED_NewString does on spawn,
+// either into zone tagged memory or into the given level hunk
+static size_t SV_LevelTestSpawn(const char *entstring, memhunk_t *hunk)
+{
+    const char *data = entstring;
+    char *token;
+    size_t len, total = 0;
+
+    while (1) {
+        token = COM_Parse(&data);
+        if (!data) {
+            break;
+        }
+        if (!strcmp(token, "{") || !strcmp(token, "}")) {
+            continue;
+        }
+        len = strlen(token) + 1;
+        if (hunk) {
+            memcpy(SV_LevelAlloc(hunk, len), token, len);
+        } else {
+            memcpy(PF_TagMalloc(len, TEST_TAG_LEVEL), token, len);
+        }
+        total += len;
+    }
+
+    return total;
+}
+
+/*
+================
+SV_LevelTest_f
+
+Spawn/free benchmark for level allocations. Runs the entity string of
+each map through zone tags and through a private level hunk. Game tags
+share one namespace, so this refuses to run while a game is loaded.
+================
+*/
+static void SV_LevelTest_f(void)
+{
+    void **list = NULL;
+    char buffer[MAX_QPATH];
+    char *name;
+    int i, j, count, iterations;
+    bsp_t *bsp;
+    qerror_t ret;
+    memhunk_t hunk;
+    size_t bytes;
+    unsigned start, zone_msec, hunk_msec;
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <iterations> [map ...]\n", Cmd_Argv(0));
+        return;
+    }
+
+    if (ge) {
+        Com_Printf("Can't run while a game is loaded, use killserver first.\n");
+        return;
+    }
+
+    iterations = atoi(Cmd_Argv(1));
+    clamp(iterations, 1, 100000);
+
+    if (Cmd_Argc() > 2) {
+        count = Cmd_Argc() - 2;
+    } else {
+        list = FS_ListFiles("maps", ".bsp", FS_SEARCH_SAVEPATH, &count);
+        if (!list) {
+            Com_Printf("No maps found\n");
+            return;
+        }
+    }
+
+    memset(&hunk, 0, sizeof(hunk));
+
+    for (i = 0; i < count; i++) {
+        if (list) {
+            name = list[i];
+        } else {
+            Q_concat(buffer, sizeof(buffer), "maps/", Cmd_Argv(i + 2), ".bsp", NULL);
+            name = buffer;
+        }
+
+        ret = BSP_Load(name, &bsp);
+        if (!bsp) {
+            Com_EPrintf("%s: %s\n", name, Q_ErrorString(ret));
+            continue;
+        }
+
+        bytes = 0;
+        start = Sys_Milliseconds();
+        for (j = 0; j < iterations; j++) {
+            bytes = SV_LevelTestSpawn(bsp->entitystring, NULL);
+            PF_FreeTags(TEST_TAG_LEVEL);
+        }
+        zone_msec = Sys_Milliseconds() - start;
+
+        start = Sys_Milliseconds();
+        for (j = 0; j < iterations; j++) {
+            SV_LevelTestSpawn(bsp->entitystring, &hunk);
+            hunk.cursize = 0;
+        }
+        hunk_msec = Sys_Milliseconds() - start;
+
+        Com_Printf("%s: %"PRIz" bytes, zone %u msec, hunk %u msec\n",
+                   name, bytes, zone_msec, hunk_msec);
+        BSP_Free(bsp);
+    }
+
+    Hunk_Free(&hunk);
+
+    if (list) {
+        FS_FreeList(list);
+    }
+}
+
+void SV_InitGameTests(void)
+{
+    Cmd_AddCommand("leveltest", SV_LevelTest_f);
+}
+
+#endif // USE_TESTS
+
 //==============================================
 
 static void *game_library;
@@ -793,6 +955,7 @@ void SV_ShutdownGameProgs(void)
         Sys_FreeLibrary(game_library);
         game_library = NULL;
     }
+    Hunk_Free(&sv_levelhunk);
     Cvar_Set("g_features", "0");
 }
 
@@ -920,6 +1083,9 @@ void SV_InitGameProgs(void)
     import.AddCommandString = PF_AddCommandString;
 
     import.DebugGraph = PF_DebugGraph;
+
+    import.LevelAlloc = PF_LevelAlloc;
+    import.LevelFree = PF_LevelFree;
     import.SetAreaPortalState = PF_SetAreaPortalState;
     import.AreasConnected = PF_AreasConnected;
 
@@ -928,7 +1094,8 @@ void SV_InitGameProgs(void)
         Com_Error(ERR_DROP, "Game DLL returned NULL exports");
     }
 
-    if (ge->apiversion != GAME_API_VERSION) {
+    if (ge->apiversion != GAME_API_VERSION &&
+        ge->apiversion != GAME_API_VERSION_OLD) {
         Com_Error(ERR_DROP, "Game DLL is version %d, expected %d",
                   ge->apiversion, GAME_API_VERSION);
     }
@@ -153,7 +153,7 @@ static void MVD_ParseMulticast(mvd_t *mvd, mvd_ops_t op, int extrabits)
 {
     mvd_client_t    *client;
     client_t    *cl;
-    byte        mask[VIS_MAX_BYTES];
+    const byte  *mask = NULL;
     mleaf_t     *leaf1, *leaf2;
     vec3_t      org;
     qboolean    reliable = qfalse;
@@ -181,7 +181,7 @@ static void MVD_ParseMulticast(mvd_t *mvd, mvd_ops_t op, int extrabits)
             break;
         }
         leaf1 = CM_LeafNum(&mvd->cm, leafnum);
-        BSP_ClusterVis(mvd->cm.cache, mask, leaf1->cluster, DVIS_PHS);
+        mask = BSP_GetVisRow(mvd->cm.cache, leaf1->cluster, DVIS_PHS);
         break;
     case mvd_multicast_pvs_r:
         reliable = qtrue;
@@ -193,7 +193,7 @@ static void MVD_ParseMulticast(mvd_t *mvd, mvd_ops_t op, int extrabits)
             break;
         }
         leaf1 = CM_LeafNum(&mvd->cm, leafnum);
-        BSP_ClusterVis(mvd->cm.cache, mask, leaf1->cluster, DVIS_PVS);
+        mask = BSP_GetVisRow(mvd->cm.cache, leaf1->cluster, DVIS_PVS);
         break;
     default:
         MVD_Destroyf(mvd, "bad op");
@@ -492,7 +492,7 @@ static void MVD_ParseSound(mvd_t *mvd, int extrabits)
     vec3_t      origin;
     mvd_client_t        *client;
     client_t    *cl;
-    byte        mask[VIS_MAX_BYTES];
+    const byte  *mask;
     mleaf_t     *leaf;
     int         area;
     player_state_t      *ps;
@@ -549,7 +549,7 @@ static void MVD_ParseSound(mvd_t *mvd, int extrabits)
                     continue;        // blocked by a door
                 }
             }
-            BSP_ClusterVis(mvd->cm.cache, mask, leaf->cluster, DVIS_PHS);
+            mask = BSP_GetVisRow(mvd->cm.cache, leaf->cluster, DVIS_PHS);
             if (!SV_EdictIsVisible(&mvd->cm, entity, mask)) {
                 continue; // not in PHS
             }
@@ -255,7 +255,7 @@ MULTICAST_PHS    send to clients potentially hearable from org
 void SV_Multicast(vec3_t origin, multicast_t to)
 {
     client_t    *client;
-    byte        mask[VIS_MAX_BYTES];
+    const byte  *mask;
     mleaf_t     *leaf1, *leaf2;
     int         leafnum q_unused;
     int         flags;
@@ -274,6 +274,7 @@ void SV_Multicast(vec3_t origin, multicast_t to)
     case MULTICAST_ALL:
         leaf1 = NULL;
         leafnum = 0;
+        mask = NULL;
         break;
     case MULTICAST_PHS_R:
         flags |= MSG_RELIABLE;
@@ -281,7 +282,7 @@ void SV_Multicast(vec3_t origin, multicast_t to)
     case MULTICAST_PHS:
         leaf1 = CM_PointLeaf(&sv.cm, origin);
         leafnum = leaf1 - sv.cm.cache->leafs;
-        BSP_ClusterVis(sv.cm.cache, mask, leaf1->cluster, DVIS_PHS);
+        mask = BSP_GetVisRow(sv.cm.cache, leaf1->cluster, DVIS_PHS);
         break;
     case MULTICAST_PVS_R:
         flags |= MSG_RELIABLE;
@@ -289,7 +290,7 @@ void SV_Multicast(vec3_t origin, multicast_t to)
     case MULTICAST_PVS:
         leaf1 = CM_PointLeaf(&sv.cm, origin);
         leafnum = leaf1 - sv.cm.cache->leafs;
-        BSP_ClusterVis(sv.cm.cache, mask, leaf1->cluster, DVIS_PVS2);
+        mask = BSP_GetVisRow(sv.cm.cache, leaf1->cluster, DVIS_PVS2);
         break;
     default:
         Com_Error(ERR_DROP, "SV_Multicast: bad to: %i", to);
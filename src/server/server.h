@@ -732,6 +732,10 @@ void SV_InitGameProgs(void);
 void SV_ShutdownGameProgs(void);
 void SV_InitEdict(edict_t *e);
 
+#if USE_TESTS
+void SV_InitGameTests(void);
+#endif
+
 void PF_Pmove(pmove_t *pm);
 
 //
@@ -772,7 +776,7 @@ int SV_AreaEdicts(vec3_t mins, vec3_t maxs, edict_t **list, int maxcount, int ar
 // returns the number of pointers filled in
 // ??? does this always return the world?
 
-qboolean SV_EdictIsVisible(cm_t *cm, edict_t *ent, byte *mask);
+qboolean SV_EdictIsVisible(cm_t *cm, edict_t *ent, const byte *mask);
 
 //===================================================================
 
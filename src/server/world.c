@@ -126,7 +126,7 @@ SV_EdictIsVisible
 Checks if edict is potentially visible from the given PVS row.
 ===============
 */
-qboolean SV_EdictIsVisible(cm_t *cm, edict_t *ent, byte *mask)
+qboolean SV_EdictIsVisible(cm_t *cm, edict_t *ent, const byte *mask)
 {
     int i;
 
@@ -0,0 +1,365 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// texbake.c -- offline texture compressor
+//
+// Converts TGA, PNG and JPG textures into block compressed DDS files with
+// full mip chains, written next to the source files. The renderer prefers
+// these over the source art when 'd' is in r_texture_formats.
+//
+// Format and color space are picked from the file name by default:
+// normal maps (*_n) are linear BC7 with normals renormalized like the
+// renderer does on load, everything else is sRGB, BC1 if fully opaque
+// and BC7 otherwise, since diffuse alpha holds material roughness.
+//
+
+#include "shared/shared.h"
+#include "refresh/bc.h"
+#include "format/dds.h"
+
+#include <sys/stat.h>
+#include <errno.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_TGA
+#define STBI_ONLY_PNG
+#define STBI_ONLY_JPEG
+#include "stb_image.h"
+
+static bcformat_t   opt_format = BC_NONE;   // BC_NONE = pick automatically
+static int          opt_srgb = -1;          // -1 = pick automatically
+static qboolean     opt_force;
+static qboolean     opt_verbose;
+
+static float        srgb_to_linear[256];
+
+static void init_srgb_table(void)
+{
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        float x = i / 255.f;
+
+        if (x < 0.04045f)
+            srgb_to_linear[i] = x / 12.92f;
+        else
+            srgb_to_linear[i] = powf((x + 0.055f) / 1.055f, 2.4f);
+    }
+}
+
+static byte linear_to_srgb(float x)
+{
+    if (x <= 0.0031308f)
+        x *= 12.92f;
+    else
+        x = 1.055f * powf(x, 1.f / 2.4f) - 0.055f;
+
+    clamp(x, 0.f, 1.f);
+    return (byte)(x * 255.f + 0.5f);
+}
+
+// 2x2 box filter, sRGB color channels are averaged in linear space
+// to match the GPU blits used for uncompressed textures
+static void downsample(byte *out, const byte *in, int w, int h, qboolean srgb)
+{
+    int     nw = max(w >> 1, 1), nh = max(h >> 1, 1);
+    int     x, y, c, x0, x1, y0, y1;
+    const byte *p[4];
+    float   sum;
+
+    for (y = 0; y < nh; y++) {
+        y0 = min(y * 2, h - 1);
+        y1 = min(y * 2 + 1, h - 1);
+        for (x = 0; x < nw; x++, out += 4) {
+            x0 = min(x * 2, w - 1);
+            x1 = min(x * 2 + 1, w - 1);
+            p[0] = in + (y0 * w + x0) * 4;
+            p[1] = in + (y0 * w + x1) * 4;
+            p[2] = in + (y1 * w + x0) * 4;
+            p[3] = in + (y1 * w + x1) * 4;
+            for (c = 0; c < 4; c++) {
+                if (srgb && c < 3) {
+                    sum = srgb_to_linear[p[0][c]] + srgb_to_linear[p[1][c]] +
+                          srgb_to_linear[p[2][c]] + srgb_to_linear[p[3][c]];
+                    out[c] = linear_to_srgb(sum * 0.25f);
+                } else {
+                    out[c] = (p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) >> 2;
+                }
+            }
+        }
+    }
+}
+
+// same as vkpt_normalize_normal_map
+static void normalize_normals(byte *pic, int count)
+{
+    float   v[3], len;
+    int     i;
+
+    for (i = 0; i < count; i++, pic += 4) {
+        v[0] = pic[0] / 255.f * 2.f - 1.f;
+        v[1] = pic[1] / 255.f * 2.f - 1.f;
+        v[2] = pic[2] / 255.f;
+
+        len = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        if (len == 0) {
+            v[0] = v[1] = 0;
+            v[2] = 1;
+        } else {
+            v[0] /= len;
+            v[1] /= len;
+            v[2] /= len;
+        }
+
+        pic[0] = (byte)(v[0] * 127.5f + 128.f);
+        pic[1] = (byte)(v[1] * 127.5f + 128.f);
+        pic[2] = (byte)(v[2] * 255.f + 0.5f);
+    }
+}
+
+static qboolean is_opaque(const byte *pic, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        if (pic[i * 4 + 3] != 255)
+            return qfalse;
+
+    return qtrue;
+}
+
+static DXGI_FORMAT dxgi_format(bcformat_t fmt, qboolean srgb)
+{
+    switch (fmt) {
+    case BC_1: return srgb ? DXGI_FORMAT_BC1_UNORM_SRGB : DXGI_FORMAT_BC1_UNORM;
+    case BC_3: return srgb ? DXGI_FORMAT_BC3_UNORM_SRGB : DXGI_FORMAT_BC3_UNORM;
+    case BC_4: return DXGI_FORMAT_BC4_UNORM;
+    case BC_5: return DXGI_FORMAT_BC5_UNORM;
+    case BC_7: return srgb ? DXGI_FORMAT_BC7_UNORM_SRGB : DXGI_FORMAT_BC7_UNORM;
+    default:   return DXGI_FORMAT_UNKNOWN;
+    }
+}
+
+static void put_le32(uint32_t *p, uint32_t v)
+{
+    byte *b = (byte *)p;
+
+    b[0] = v & 255;
+    b[1] = (v >> 8) & 255;
+    b[2] = (v >> 16) & 255;
+    b[3] = v >> 24;
+}
+
+static qboolean write_dds(const char *path, bcformat_t fmt, qboolean srgb,
+                          int w, int h, int levels, const byte *data, size_t size)
+{
+    DDS_HEADER          dds;
+    DDS_HEADER_DXT10    dxt10;
+    FILE                *fp;
+    qboolean            ret;
+
+    memset(&dds, 0, sizeof(dds));
+    put_le32(&dds.magic, DDS_MAGIC);
+    put_le32(&dds.size, sizeof(dds) - 4);
+    put_le32(&dds.flags, DDS_HEADER_FLAGS_TEXTURE | DDS_HEADER_FLAGS_MIPMAP | DDS_HEADER_FLAGS_LINEARSIZE);
+    put_le32(&dds.height, h);
+    put_le32(&dds.width, w);
+    put_le32(&dds.pitchOrLinearSize, BC_LevelSize(fmt, w, h));
+    put_le32(&dds.mipMapCount, levels);
+    put_le32(&dds.ddspf.size, sizeof(dds.ddspf));
+    put_le32(&dds.ddspf.flags, DDS_FOURCC);
+    put_le32(&dds.ddspf.fourCC, MAKEFOURCC('D', 'X', '1', '0'));
+    put_le32(&dds.caps, DDS_SURFACE_FLAGS_TEXTURE | DDS_SURFACE_FLAGS_MIPMAP);
+
+    memset(&dxt10, 0, sizeof(dxt10));
+    put_le32((uint32_t *)&dxt10.dxgiFormat, dxgi_format(fmt, srgb));
+    put_le32(&dxt10.resourceDimension, DDS_DIMENSION_TEXTURE2D);
+    put_le32(&dxt10.arraySize, 1);
+
+    fp = fopen(path, "wb");
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return qfalse;
+    }
+
+    ret = fwrite(&dds, sizeof(dds), 1, fp) == 1 &&
+          fwrite(&dxt10, sizeof(dxt10), 1, fp) == 1 &&
+          fwrite(data, size, 1, fp) == 1;
+
+    if (fclose(fp))
+        ret = qfalse;
+
+    if (!ret) {
+        fprintf(stderr, "%s: write error\n", path);
+        remove(path);
+    }
+
+    return ret;
+}
+
+static qboolean is_up_to_date(const char *src, const char *dst)
+{
+    struct stat s, d;
+
+    if (stat(src, &s) || stat(dst, &d))
+        return qfalse;
+
+    return d.st_mtime >= s.st_mtime;
+}
+
+static qboolean bake(const char *path)
+{
+    char        out[MAX_OSPATH], *ext;
+    const char  *base;
+    byte        *pic, *level, *next, *data;
+    size_t      size, ofs;
+    int         w, h, lw, lh, levels, n;
+    qboolean    normals, srgb, ret;
+    bcformat_t  fmt;
+
+    if (strlen(path) >= sizeof(out)) {
+        fprintf(stderr, "%s: path too long\n", path);
+        return qfalse;
+    }
+
+    strcpy(out, path);
+    base = strrchr(out, '/');
+    base = base ? base + 1 : out;
+    ext = strrchr(base, '.');
+    if (!ext || strlen(ext) != 4) {
+        fprintf(stderr, "%s: no extension\n", path);
+        return qfalse;
+    }
+    strcpy(ext, ".dds");
+
+    if (!opt_force && is_up_to_date(path, out)) {
+        if (opt_verbose)
+            printf("%s: up to date\n", out);
+        return qtrue;
+    }
+
+    pic = stbi_load(path, &w, &h, &n, 4);
+    if (!pic) {
+        fprintf(stderr, "%s: %s\n", path, stbi_failure_reason());
+        return qfalse;
+    }
+
+    *ext = 0;
+    n = strlen(base);
+    normals = n > 2 && !strcmp(base + n - 2, "_n");
+    *ext = '.';
+
+    srgb = opt_srgb >= 0 ? opt_srgb : !normals;
+
+    fmt = opt_format;
+    if (fmt == BC_NONE)
+        fmt = (normals || !is_opaque(pic, w * h)) ? BC_7 : BC_1;
+
+    if (normals)
+        normalize_normals(pic, w * h);
+
+    for (levels = 1; (w | h) >> levels; levels++)
+        ;
+
+    size = BC_ChainSize(fmt, w, h, levels);
+    data = malloc(size);
+    next = malloc((size_t)max(w >> 1, 1) * max(h >> 1, 1) * 4);
+    if (!data || !next) {
+        fprintf(stderr, "%s: out of memory\n", path);
+        exit(1);
+    }
+
+    // compress each level, then downsample it in place for the next one
+    level = pic;
+    lw = w;
+    lh = h;
+    for (n = 0, ofs = 0; n < levels; n++) {
+        BC_Encode(fmt, data + ofs, level, lw, lh);
+        ofs += BC_LevelSize(fmt, lw, lh);
+        if (n == levels - 1)
+            break;
+        downsample(next, level, lw, lh, srgb);
+        lw = max(lw >> 1, 1);
+        lh = max(lh >> 1, 1);
+        memcpy(level, next, (size_t)lw * lh * 4);
+    }
+
+    ret = write_dds(out, fmt, srgb, w, h, levels, data, size);
+    if (ret && opt_verbose)
+        printf("%s: %dx%d %s%s, %d levels, %zu bytes\n", out, w, h,
+               BC_FormatName(fmt), srgb ? " sRGB" : "", levels, size);
+
+    free(next);
+    free(data);
+    stbi_image_free(pic);
+    return ret;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: texbake [options] <image> [...]\n"
+            "Options:\n"
+            "  -f <format>  bc1, bc3, bc4, bc5 or bc7 (default: pick by name)\n"
+            "  -linear      treat color as linear\n"
+            "  -srgb        treat color as sRGB\n"
+            "  -force       rebuild up to date files\n"
+            "  -v           verbose output\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int i, errors = 0;
+    bcformat_t fmt;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            i++;
+            for (fmt = BC_1; fmt < BC_MAX; fmt++)
+                if (tolower(argv[i][0]) == 'b' && tolower(argv[i][1]) == 'c' &&
+                    !strcmp(argv[i] + 2, BC_FormatName(fmt) + 2))
+                    break;
+            if (fmt == BC_MAX)
+                usage();
+            opt_format = fmt;
+        } else if (!strcmp(argv[i], "-linear")) {
+            opt_srgb = 0;
+        } else if (!strcmp(argv[i], "-srgb")) {
+            opt_srgb = 1;
+        } else if (!strcmp(argv[i], "-force")) {
+            opt_force = qtrue;
+        } else if (!strcmp(argv[i], "-v")) {
+            opt_verbose = qtrue;
+        } else {
+            usage();
+        }
+    }
+
+    if (i == argc)
+        usage();
+
+    init_srgb_table();
+
+    for (; i < argc; i++)
+        if (!bake(argv[i]))
+            errors++;
+
+    return errors ? 1 : 0;
+}
@@ -17,29 +17,138 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "shared/shared.h"
+#include "common/cvar.h"
 #include "system/hunk.h"
+#include "system/system.h"
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <errno.h>
 
+#define HUGE_PAGE_SIZE  0x200000
+
+static cvar_t   *sys_hugepages;
+
+void Hunk_Init(void)
+{
+    // 0 - regular pages faulted in as the hunk grows
+    // 1 - transparent huge pages, prefault expected size
+    // 2 - like 1, but try explicit hugetlbfs pages first
+    sys_hugepages = Cvar_Get("sys_hugepages", "0", CVAR_NOSET);
+}
+
+static int hugepages_mode(void)
+{
+    return sys_hugepages ? sys_hugepages->integer : 0;
+}
+
+static unsigned page_faults(void)
+{
+    struct rusage ru;
+
+#ifdef RUSAGE_THREAD
+    if (getrusage(RUSAGE_THREAD, &ru))
+#else
+    if (getrusage(RUSAGE_SELF, &ru))
+#endif
+        return 0;
+
+    return ru.ru_minflt + ru.ru_majflt;
+}
+
 void Hunk_Begin(memhunk_t *hunk, size_t maxsize)
 {
     void *buf;
+    size_t slop = 0;
 
-    if (maxsize > SIZE_MAX - 4095)
+    if (maxsize > SIZE_MAX - HUGE_PAGE_SIZE)
         Com_Error(ERR_FATAL, "%s: size > SIZE_MAX", __func__);
 
-    // reserve a huge chunk of memory, but don't commit any yet
     hunk->cursize = 0;
     hunk->maxsize = (maxsize + 4095) & ~4095;
-    buf = mmap(NULL, hunk->maxsize, PROT_READ | PROT_WRITE,
+    hunk->pagesize = 4096;
+    hunk->faults = page_faults();
+    hunk->msec = Sys_Milliseconds();
+
+    // big hunks are aligned to huge page boundary so that
+    // transparent huge pages can back them entirely
+    if (hugepages_mode() && hunk->maxsize >= HUGE_PAGE_SIZE)
+        slop = HUGE_PAGE_SIZE - 4096;
+
+    // reserve a huge chunk of memory, but don't commit any yet
+    buf = mmap(NULL, hunk->maxsize + slop, PROT_READ | PROT_WRITE,
                MAP_PRIVATE | MAP_ANON, -1, 0);
     if (buf == NULL || buf == (void *)-1)
         Com_Error(ERR_FATAL, "%s: unable to reserve %"PRIz" bytes: %s",
                   __func__, hunk->maxsize, strerror(errno));
+
+    if (slop) {
+        byte *base = (byte *)(((uintptr_t)buf + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+        size_t head = base - (byte *)buf;
+
+        if (head)
+            munmap(buf, head);
+        if (slop > head)
+            munmap(base + hunk->maxsize, slop - head);
+        buf = base;
+    }
+
     hunk->base = buf;
     hunk->mapped = hunk->maxsize;
 }
 
+void Hunk_Prefault(memhunk_t *hunk, size_t size)
+{
+    int mode = hugepages_mode();
+    size_t start, end, ofs;
+
+    if (!mode)
+        return;
+
+    if (hunk->cursize > hunk->maxsize)
+        Com_Error(ERR_FATAL, "%s: cursize > maxsize", __func__);
+
+#ifdef MAP_HUGETLB
+    // explicit huge pages have to be requested at mapping time, replace
+    // the reservation while nothing has been allocated from it yet. if
+    // hugetlbfs pool is exhausted, fall back to transparent huge pages.
+    if (mode > 1 && !hunk->cursize && hunk->pagesize != HUGE_PAGE_SIZE &&
+        size >= HUGE_PAGE_SIZE) {
+        size_t len = (hunk->maxsize + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        void *buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+        if (buf != NULL && buf != (void *)-1) {
+            munmap(hunk->base, hunk->mapped);
+            hunk->base = buf;
+            hunk->maxsize = hunk->mapped = len;
+            hunk->pagesize = HUGE_PAGE_SIZE;
+        }
+    }
+#endif
+
+    if (size > hunk->maxsize - hunk->cursize)
+        size = hunk->maxsize - hunk->cursize;
+
+    start = (hunk->cursize + 4095) & ~4095;
+    end = (hunk->cursize + size + 4095) & ~4095;
+    if (start >= end)
+        return;
+
+#ifdef MADV_HUGEPAGE
+    if (hunk->pagesize != HUGE_PAGE_SIZE)
+        madvise((byte *)hunk->base + start, end - start, MADV_HUGEPAGE);
+#endif
+
+#ifdef MADV_POPULATE_WRITE
+    if (!madvise((byte *)hunk->base + start, end - start, MADV_POPULATE_WRITE))
+        return;
+#endif
+
+    // older kernels, touch every page. memory past cursize is not
+    // allocated yet, so it can be safely overwritten.
+    for (ofs = start; ofs < end; ofs += 4096)
+        ((volatile byte *)hunk->base)[ofs] = 0;
+}
+
 void *Hunk_Alloc(memhunk_t *hunk, size_t size)
 {
     void *buf;
@@ -68,22 +177,29 @@ void Hunk_End(memhunk_t *hunk)
     if (hunk->cursize > hunk->maxsize)
         Com_Error(ERR_FATAL, "%s: cursize > maxsize", __func__);
 
-    newsize = (hunk->cursize + 4095) & ~4095;
+    // hugetlbfs mappings can only be trimmed at huge page boundary
+    newsize = (hunk->cursize + hunk->pagesize - 1) & ~(hunk->pagesize - 1);
 
     if (newsize < hunk->maxsize) {
+        void *buf;
 #if (defined __linux__) && (defined _GNU_SOURCE)
-        void *buf = mremap(hunk->base, hunk->maxsize, newsize, 0);
-#else
-        void *unmap_base = (byte *)hunk->base + newsize;
-        size_t unmap_len = hunk->maxsize - newsize;
-        void *buf = munmap(unmap_base, unmap_len) + (byte *)hunk->base;
+        if (hunk->pagesize == 4096)
+            buf = mremap(hunk->base, hunk->maxsize, newsize, 0);
+        else
 #endif
+        {
+            void *unmap_base = (byte *)hunk->base + newsize;
+            size_t unmap_len = hunk->maxsize - newsize;
+            buf = munmap(unmap_base, unmap_len) + (byte *)hunk->base;
+        }
         if (buf != hunk->base)
             Com_Error(ERR_FATAL, "%s: could not remap virtual block: %s",
                       __func__, strerror(errno));
     }
 
     hunk->mapped = newsize;
+    hunk->faults = page_faults() - hunk->faults;
+    hunk->msec = Sys_Milliseconds() - hunk->msec;
 }
 
 void Hunk_Free(memhunk_t *hunk)
@@ -94,4 +210,3 @@ void Hunk_Free(memhunk_t *hunk)
 
     memset(hunk, 0, sizeof(*hunk));
 }
-
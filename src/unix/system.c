@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #if USE_REF
 #include "client/video.h"
 #endif
+#include "system/hunk.h"
 #include "system/system.h"
 #include "tty.h"
 
@@ -249,6 +250,8 @@ void Sys_Init(void)
     sys_libdir = Cvar_Get("libdir", baseDirectory, CVAR_NOSET);
     sys_forcegamelib = Cvar_Get("sys_forcegamelib", "", CVAR_NOSET);
 
+    Hunk_Init();
+
     if (tty_init_input()) {
         signal(SIGHUP, term_handler);
     } else if (COM_DEDICATED) {
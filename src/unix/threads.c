@@ -0,0 +1,150 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "shared/shared.h"
+#include "system/threads.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+
+struct qthread_s {
+    pthread_t       handle;
+    threadfunc_t    func;
+    void            *arg;
+};
+
+struct qmutex_s {
+    pthread_mutex_t handle;
+};
+
+struct qcond_s {
+    pthread_cond_t  handle;
+};
+
+// these are allocated with malloc() rather than Z_Malloc(),
+// since zone allocator itself depends on them
+static void *thread_alloc(size_t size, const char *func)
+{
+    void *ptr = malloc(size);
+
+    if (!ptr)
+        Com_Error(ERR_FATAL, "%s: out of memory", func);
+
+    return ptr;
+}
+
+static void *thread_main(void *arg)
+{
+    qthread_t *thread = arg;
+
+    thread->func(thread->arg);
+    return NULL;
+}
+
+qthread_t *Sys_CreateThread(threadfunc_t func, void *arg)
+{
+    qthread_t *thread = thread_alloc(sizeof(*thread), __func__);
+    int ret;
+
+    thread->func = func;
+    thread->arg = arg;
+
+    ret = pthread_create(&thread->handle, NULL, thread_main, thread);
+    if (ret) {
+        Com_EPrintf("%s: %s\n", __func__, strerror(ret));
+        free(thread);
+        return NULL;
+    }
+
+    return thread;
+}
+
+void Sys_JoinThread(qthread_t *thread)
+{
+    if (!thread)
+        return;
+
+    pthread_join(thread->handle, NULL);
+    free(thread);
+}
+
+qmutex_t *Sys_CreateMutex(void)
+{
+    qmutex_t *mutex = thread_alloc(sizeof(*mutex), __func__);
+
+    pthread_mutex_init(&mutex->handle, NULL);
+    return mutex;
+}
+
+void Sys_DestroyMutex(qmutex_t *mutex)
+{
+    if (!mutex)
+        return;
+
+    pthread_mutex_destroy(&mutex->handle);
+    free(mutex);
+}
+
+void Sys_LockMutex(qmutex_t *mutex)
+{
+    pthread_mutex_lock(&mutex->handle);
+}
+
+void Sys_UnlockMutex(qmutex_t *mutex)
+{
+    pthread_mutex_unlock(&mutex->handle);
+}
+
+qcond_t *Sys_CreateCond(void)
+{
+    qcond_t *cond = thread_alloc(sizeof(*cond), __func__);
+
+    pthread_cond_init(&cond->handle, NULL);
+    return cond;
+}
+
+void Sys_DestroyCond(qcond_t *cond)
+{
+    if (!cond)
+        return;
+
+    pthread_cond_destroy(&cond->handle);
+    free(cond);
+}
+
+void Sys_WaitCond(qcond_t *cond, qmutex_t *mutex)
+{
+    pthread_cond_wait(&cond->handle, &mutex->handle);
+}
+
+void Sys_SignalCond(qcond_t *cond)
+{
+    pthread_cond_signal(&cond->handle);
+}
+
+void Sys_BroadcastCond(qcond_t *cond)
+{
+    pthread_cond_broadcast(&cond->handle);
+}
+
+int Sys_NumProcessors(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return count > 0 ? (int)count : 1;
+}
@@ -17,9 +17,20 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "shared/shared.h"
+#include "common/cvar.h"
 #include "system/hunk.h"
+#include "system/system.h"
 #include <windows.h>
 
+static cvar_t   *sys_hugepages;
+
+void Hunk_Init(void)
+{
+    // large pages need SeLockMemoryPrivilege and can't be committed
+    // lazily, so on Windows this only enables prefaulting
+    sys_hugepages = Cvar_Get("sys_hugepages", "0", CVAR_NOSET);
+}
+
 void Hunk_Begin(memhunk_t *hunk, size_t maxsize)
 {
     if (maxsize > SIZE_MAX - 4095)
@@ -28,6 +39,9 @@ void Hunk_Begin(memhunk_t *hunk, size_t maxsize)
     // reserve a huge chunk of memory, but don't commit any yet
     hunk->cursize = 0;
     hunk->maxsize = (maxsize + 4095) & ~4095;
+    hunk->pagesize = 4096;
+    hunk->faults = 0;
+    hunk->msec = Sys_Milliseconds();
     hunk->base = VirtualAlloc(NULL, hunk->maxsize, MEM_RESERVE, PAGE_NOACCESS);
     if (!hunk->base)
         Com_Error(ERR_FATAL,
@@ -35,6 +49,32 @@ void Hunk_Begin(memhunk_t *hunk, size_t maxsize)
                   hunk->maxsize, GetLastError());
 }
 
+void Hunk_Prefault(memhunk_t *hunk, size_t size)
+{
+    size_t start, end, ofs;
+
+    if (!sys_hugepages || !sys_hugepages->integer)
+        return;
+
+    if (hunk->cursize > hunk->maxsize)
+        Com_Error(ERR_FATAL, "%s: cursize > maxsize", __func__);
+
+    if (size > hunk->maxsize - hunk->cursize)
+        size = hunk->maxsize - hunk->cursize;
+
+    start = (hunk->cursize + 4095) & ~4095;
+    end = (hunk->cursize + size + 4095) & ~4095;
+    if (start >= end)
+        return;
+
+    if (!VirtualAlloc((byte *)hunk->base + start, end - start, MEM_COMMIT, PAGE_READWRITE))
+        return;
+
+    // memory past cursize is not allocated yet, so it can be safely overwritten
+    for (ofs = start; ofs < end; ofs += 4096)
+        ((volatile byte *)hunk->base)[ofs] = 0;
+}
+
 void *Hunk_Alloc(memhunk_t *hunk, size_t size)
 {
     void *buf;
@@ -70,6 +110,7 @@ void Hunk_End(memhunk_t *hunk)
 
     // for statistics
     hunk->mapped = (hunk->cursize + 4095) & ~4095;
+    hunk->msec = Sys_Milliseconds() - hunk->msec;
 }
 
 void Hunk_Free(memhunk_t *hunk)
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/cvar.h"
 #include "common/field.h"
 #include "common/prompt.h"
+#include "system/hunk.h"
 #include <mmsystem.h>
 #if USE_WINSVC
 #include <winsvc.h>
@@ -729,6 +730,8 @@ void Sys_Init(void)
 
     sys_forcegamelib = Cvar_Get("sys_forcegamelib", "", CVAR_NOSET);
 
+    Hunk_Init();
+
 #if USE_WINSVC
     Cmd_AddCommand("installservice", Sys_InstallService_f);
     Cmd_AddCommand("deleteservice", Sys_DeleteService_f);
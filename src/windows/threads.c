@@ -0,0 +1,146 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "shared/shared.h"
+#include "system/threads.h"
+#include <windows.h>
+#include <process.h>
+
+struct qthread_s {
+    HANDLE              handle;
+    threadfunc_t        func;
+    void                *arg;
+};
+
+struct qmutex_s {
+    CRITICAL_SECTION    handle;
+};
+
+struct qcond_s {
+    CONDITION_VARIABLE  handle;
+};
+
+// these are allocated with malloc() rather than Z_Malloc(),
+// since zone allocator itself depends on them
+static void *thread_alloc(size_t size, const char *func)
+{
+    void *ptr = malloc(size);
+
+    if (!ptr)
+        Com_Error(ERR_FATAL, "%s: out of memory", func);
+
+    return ptr;
+}
+
+static unsigned __stdcall thread_main(void *arg)
+{
+    qthread_t *thread = arg;
+
+    thread->func(thread->arg);
+    return 0;
+}
+
+qthread_t *Sys_CreateThread(threadfunc_t func, void *arg)
+{
+    qthread_t *thread = thread_alloc(sizeof(*thread), __func__);
+
+    thread->func = func;
+    thread->arg = arg;
+
+    thread->handle = (HANDLE)_beginthreadex(NULL, 0, thread_main, thread, 0, NULL);
+    if (!thread->handle) {
+        Com_EPrintf("%s: couldn't create thread\n", __func__);
+        free(thread);
+        return NULL;
+    }
+
+    return thread;
+}
+
+void Sys_JoinThread(qthread_t *thread)
+{
+    if (!thread)
+        return;
+
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    free(thread);
+}
+
+qmutex_t *Sys_CreateMutex(void)
+{
+    qmutex_t *mutex = thread_alloc(sizeof(*mutex), __func__);
+
+    InitializeCriticalSection(&mutex->handle);
+    return mutex;
+}
+
+void Sys_DestroyMutex(qmutex_t *mutex)
+{
+    if (!mutex)
+        return;
+
+    DeleteCriticalSection(&mutex->handle);
+    free(mutex);
+}
+
+void Sys_LockMutex(qmutex_t *mutex)
+{
+    EnterCriticalSection(&mutex->handle);
+}
+
+void Sys_UnlockMutex(qmutex_t *mutex)
+{
+    LeaveCriticalSection(&mutex->handle);
+}
+
+qcond_t *Sys_CreateCond(void)
+{
+    qcond_t *cond = thread_alloc(sizeof(*cond), __func__);
+
+    InitializeConditionVariable(&cond->handle);
+    return cond;
+}
+
+void Sys_DestroyCond(qcond_t *cond)
+{
+    free(cond);
+}
+
+void Sys_WaitCond(qcond_t *cond, qmutex_t *mutex)
+{
+    SleepConditionVariableCS(&cond->handle, &mutex->handle, INFINITE);
+}
+
+void Sys_SignalCond(qcond_t *cond)
+{
+    WakeConditionVariable(&cond->handle);
+}
+
+void Sys_BroadcastCond(qcond_t *cond)
+{
+    WakeAllConditionVariable(&cond->handle);
+}
+
+int Sys_NumProcessors(void)
+{
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}